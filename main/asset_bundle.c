@@ -0,0 +1,211 @@
+/**
+ * @file asset_bundle.c
+ * @brief Read-only frontend assets, memory-mapped from the www partition
+ *
+ * The bundle is built from the frontend directory by tools/pack_frontend.py and flashed to the www partition. At
+ * startup it is validated and mapped into the address space with esp_partition_mmap, after which assets are looked
+ * up in its hash table and served directly from flash, without copying them into RAM first.
+ */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "asset_bundle.h"
+
+static const char *TAG = "asset_bundle";    // Tag used for logging
+
+static const uint8_t *bundle = NULL;                // Start of the mapped bundle, NULL if not mounted
+static const asset_bundle_header_t *header;
+static const uint16_t *table;                       // Hash table with entry indices
+static const asset_bundle_entry_t *entries;
+static esp_partition_mmap_handle_t mmap_handle;
+
+// Function prototypes
+static esp_err_t validate(const uint8_t *data, size_t size);
+static bool is_in_bundle(uint32_t offset, uint32_t len, size_t size);
+static uint32_t hash_path(const char *path, size_t len);
+
+
+/**
+ * @brief Map the asset bundle
+ *
+ * @param[in] partition_label The label of the partition that contains the bundle
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the partition doesn't exist,
+ *         ESP_ERR_INVALID_VERSION if it doesn't contain a valid bundle
+ */
+esp_err_t asset_bundle_init(const char *partition_label) {
+    const esp_partition_t *partition;
+    asset_bundle_header_t partition_header;
+    const void *data;
+    esp_err_t err;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "Partition %s not found", partition_label);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Only map the part of the partition that is used by the bundle
+    err = esp_partition_read(partition, 0, &partition_header, sizeof(partition_header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (partition_header.magic != ASSET_BUNDLE_MAGIC || partition_header.version != ASSET_BUNDLE_VERSION
+        || partition_header.size < sizeof(asset_bundle_header_t) || partition_header.size > partition->size) {
+        ESP_LOGE(TAG, "No valid asset bundle in partition %s, was the frontend flashed?", partition_label);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    err = esp_partition_mmap(partition, 0, partition_header.size, ESP_PARTITION_MMAP_DATA, &data, &mmap_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map partition %s (%s)", partition_label, esp_err_to_name(err));
+        return err;
+    }
+
+    err = validate(data, partition_header.size);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Asset bundle in partition %s is corrupt", partition_label);
+        esp_partition_munmap(mmap_handle);
+        return err;
+    }
+
+    header = data;
+    table = (const uint16_t *)(header + 1);
+    entries = (const asset_bundle_entry_t *)(table + header->table_size);
+    bundle = data;
+
+    ESP_LOGI(TAG, "Mapped %u assets (%lu bytes)", header->entry_count, header->size);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Check if the asset bundle is mapped
+ *
+ * @return True if assets can be looked up
+ */
+bool asset_bundle_is_mounted(void) {
+    return bundle != NULL;
+}
+
+/**
+ * @brief Find an asset by its path
+ *
+ * @param[in] path The path of the asset, relative to the frontend root and starting with '/' (e.g. "/index.html")
+ * @param[in] path_len The length of the path, the path doesn't have to be zero terminated
+ * @param[out] asset The asset, its data points into the mapped bundle and stays valid
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the bundle doesn't contain the path
+ */
+esp_err_t asset_bundle_find(const char *path, size_t path_len, asset_bundle_asset_t *asset) {
+    uint32_t hash;
+    uint16_t slot;
+    const asset_bundle_entry_t *entry;
+    const char *entry_path;
+
+    if (bundle == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    hash = hash_path(path, path_len);
+
+    // Linear probing, the table is never full so an empty slot ends the search
+    for (uint16_t i = 0; i < header->table_size; i++) {
+        slot = table[(hash + i) & (header->table_size - 1)];
+        if (slot == ASSET_BUNDLE_EMPTY_SLOT) {
+            break;
+        }
+
+        entry = &entries[slot];
+        entry_path = (const char *)bundle + entry->path_offset;
+        if (entry->path_hash != hash || strncmp(entry_path, path, path_len) != 0 || entry_path[path_len] != '\0') {
+            continue;
+        }
+
+        asset->identity.data = bundle + entry->data_offset;
+        asset->identity.size = entry->data_size;
+        asset->identity.crc = entry->data_crc;
+        asset->gzip.data = entry->gzip_size > 0 ? bundle + entry->gzip_offset : NULL;
+        asset->gzip.size = entry->gzip_size;
+        asset->gzip.crc = entry->gzip_crc;
+        return ESP_OK;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * @brief Validate the structure of a bundle
+ *
+ * All offsets are checked once here, so lookups don't have to.
+ *
+ * @param[in] data The mapped bundle
+ * @param[in] size The size of the bundle
+ * @return ESP_OK if the bundle is valid, ESP_ERR_INVALID_SIZE otherwise
+ */
+static esp_err_t validate(const uint8_t *data, size_t size) {
+    const asset_bundle_header_t *bundle_header = (const asset_bundle_header_t *)data;
+    const uint16_t *bundle_table = (const uint16_t *)(bundle_header + 1);
+    const asset_bundle_entry_t *bundle_entries;
+    const asset_bundle_entry_t *entry;
+    uint32_t entries_offset;
+
+    // The table size must be a power of two, with at least one empty slot
+    if (bundle_header->table_size < 2 || (bundle_header->table_size & (bundle_header->table_size - 1)) != 0
+        || bundle_header->entry_count >= bundle_header->table_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    entries_offset = sizeof(asset_bundle_header_t) + bundle_header->table_size * sizeof(uint16_t);
+    if (!is_in_bundle(entries_offset, bundle_header->entry_count * sizeof(asset_bundle_entry_t), size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    bundle_entries = (const asset_bundle_entry_t *)(data + entries_offset);
+
+    for (uint16_t i = 0; i < bundle_header->table_size; i++) {
+        if (bundle_table[i] != ASSET_BUNDLE_EMPTY_SLOT && bundle_table[i] >= bundle_header->entry_count) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    for (uint16_t i = 0; i < bundle_header->entry_count; i++) {
+        entry = &bundle_entries[i];
+        if (!is_in_bundle(entry->path_offset, 1, size)
+            || memchr(data + entry->path_offset, '\0', size - entry->path_offset) == NULL
+            || !is_in_bundle(entry->data_offset, entry->data_size, size)
+            || (entry->gzip_size > 0 && !is_in_bundle(entry->gzip_offset, entry->gzip_size, size))) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Check if a range lies within the bundle
+ *
+ * @param[in] offset The start of the range
+ * @param[in] len The length of the range
+ * @param[in] size The size of the bundle
+ * @return True if the range lies within the bundle
+ */
+static bool is_in_bundle(uint32_t offset, uint32_t len, size_t size) {
+    return offset <= size && len <= size - offset;
+}
+
+/**
+ * @brief Compute the 32-bit FNV-1a hash of a path, the same hash is used by tools/pack_frontend.py
+ *
+ * @param[in] path The path
+ * @param[in] len The length of the path
+ * @return The hash
+ */
+static uint32_t hash_path(const char *path, size_t len) {
+    uint32_t hash = 0x811C9DC5;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)path[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
@@ -0,0 +1,163 @@
+/**
+ * @file async_worker.c
+ * @brief Worker pool for slow API handlers
+ *
+ * httpd handles all requests in a single task, so a slow handler (e.g. rendering the history) would delay every other
+ * request, including the frontend files. Requests for the endpoints registered with async_worker_handler() are
+ * detached from the httpd task with the async request API and handled by one of ASYNC_WORKER_COUNT worker tasks
+ * instead. At most ASYNC_WORKER_QUEUE_SIZE requests wait for a worker; when the queue is full, requests are answered
+ * with 503 Service Unavailable so clients back off instead of piling up.
+ *
+ * For every endpoint, the number of requests and the time they waited in the queue are kept, see
+ * async_worker_endpoint_t.
+ */
+
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "request_arena.h"
+#include "http_stats.h"
+#include "http_sessions.h"
+#include "async_worker.h"
+
+typedef struct {
+    httpd_req_t *req;                           // The detached request
+    async_worker_endpoint_t *endpoint;          // The endpoint of the request
+    http_stats_endpoint_t *stats_endpoint;      // The instrumented endpoint the request was measured for, or NULL
+    int64_t queued_time;                        // Time at which the request was queued, in microseconds since boot
+} async_worker_job_t;
+
+static const char *TAG = "async_worker";        // Tag used for logging
+static QueueHandle_t job_queue = NULL;          // Requests waiting for a worker
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;  // Protects the statistics of the endpoints
+
+// Function prototypes
+_Noreturn static void async_worker_task(void *pvParameters);
+
+
+/**
+ * @brief Create the job queue and start the worker tasks
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t async_worker_init(void) {
+    char name[configMAX_TASK_NAME_LEN];
+
+    job_queue = xQueueCreate(ASYNC_WORKER_QUEUE_SIZE, sizeof(async_worker_job_t));
+    if (job_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create job queue");
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < ASYNC_WORKER_COUNT; i++) {
+        snprintf(name, sizeof(name), "async_worker_%d", i);
+        if (xTaskCreatePinnedToCore(async_worker_task, name, ASYNC_WORKER_TASK_STACK_SIZE, NULL,
+                                    ASYNC_WORKER_TASK_PRIORITY, NULL, ASYNC_WORKER_TASK_CORE) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create worker task %d", i);
+            return ESP_FAIL;
+        }
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief URI handler that passes the request to the worker pool
+ *
+ * Register this function as the handler and an async_worker_endpoint_t as user_ctx:
+ * .handler = async_worker_handler, .user_ctx = &endpoint
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+esp_err_t async_worker_handler(httpd_req_t *req) {
+    async_worker_endpoint_t *endpoint = (async_worker_endpoint_t *)req->user_ctx;
+    async_worker_job_t job = {
+            .endpoint = endpoint,
+            .queued_time = esp_timer_get_time()
+    };
+
+    // Only the httpd task adds jobs, so there is still room after this check
+    if (uxQueueSpacesAvailable(job_queue) == 0) {
+        taskENTER_CRITICAL(&stats_lock);
+        endpoint->stats.rejected_count++;
+        taskEXIT_CRITICAL(&stats_lock);
+        ESP_LOGW(TAG, "Queue full, rejecting request for %s", endpoint->name);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", ASYNC_WORKER_RETRY_AFTER_S);
+        return httpd_resp_sendstr(req, "Server busy");
+    }
+
+    // Detach the request from the httpd task
+    if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to detach request");
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to queue request");
+    }
+
+    // The worker measures the request from here on
+    job.stats_endpoint = http_stats_detach();
+    http_sessions_async_begin(job.req);
+
+    if (xQueueSend(job_queue, &job, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to queue request");
+        httpd_resp_send_err(job.req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to queue request");
+        http_sessions_async_end(job.req);
+        httpd_req_async_handler_complete(job.req);
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the number of requests waiting for a worker
+ *
+ * @return The queue length
+ */
+uint32_t async_worker_get_queue_length(void) {
+    return job_queue != NULL ? uxQueueMessagesWaiting(job_queue) : 0;
+}
+
+/**
+ * @brief Get a consistent copy of the statistics of an endpoint
+ *
+ * @param[in] endpoint The endpoint
+ * @param[out] stats The statistics
+ */
+void async_worker_get_stats(const async_worker_endpoint_t *endpoint, async_worker_stats_t *stats) {
+    taskENTER_CRITICAL(&stats_lock);
+    *stats = endpoint->stats;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief Worker task, handles the queued requests one at a time
+ *
+ * @param[in] pvParameters Unused
+ */
+_Noreturn static void async_worker_task(void *pvParameters) {
+    async_worker_job_t job;
+    uint32_t wait_time;
+
+    while (1) {
+        xQueueReceive(job_queue, &job, portMAX_DELAY);
+
+        wait_time = (uint32_t)(esp_timer_get_time() - job.queued_time);
+        taskENTER_CRITICAL(&stats_lock);
+        job.endpoint->stats.request_count++;
+        job.endpoint->stats.total_wait_time_us += wait_time;
+        if (wait_time > job.endpoint->stats.max_wait_time_us) {
+            job.endpoint->stats.max_wait_time_us = wait_time;
+        }
+        taskEXIT_CRITICAL(&stats_lock);
+        ESP_LOGD(TAG, "Handling %s after %lu us in the queue", job.req->uri, wait_time);
+
+        http_stats_begin(job.stats_endpoint);
+        http_stats_end(request_arena_call(job.endpoint->handler, job.req));
+
+        http_sessions_async_end(job.req);
+        httpd_req_async_handler_complete(job.req);
+    }
+}
@@ -0,0 +1,293 @@
+/**
+ * @file chunk_writer.c
+ * @brief Buffered writer with a fixed size buffer and a pluggable flush function
+ *
+ * Used to stream responses straight into the socket (or into a shared buffer) without building them in memory first.
+ * Numbers are formatted with integer arithmetic only, using a fixed number of decimals.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+#include "chunk_writer.h"
+
+static const char *TAG = "chunk_writer";    // Tag used for logging
+
+static const uint32_t pow10_table[CHUNK_WRITER_MAX_DECIMALS + 1] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+// Function prototypes
+static esp_err_t httpd_flush(chunk_writer_t *w, const char *data, size_t len, bool final);
+static esp_err_t shared_buffer_flush(chunk_writer_t *w, const char *data, size_t len, bool final);
+static void write_uint(chunk_writer_t *w, uint64_t value, uint8_t min_digits);
+
+
+/**
+ * @brief Initialize a chunk writer
+ *
+ * @param[out] w The writer to initialize
+ * @param[in] flush_fn The function that is called to flush the buffer
+ * @param[in] flush_ctx Context for the flush function, stored in w->flush_ctx
+ */
+void chunk_writer_init(chunk_writer_t *w, chunk_writer_flush_fn_t flush_fn, void *flush_ctx) {
+    w->len = 0;
+    w->bytes_flushed = 0;
+    w->flush_fn = flush_fn;
+    w->flush_ctx = flush_ctx;
+    w->close_fn = NULL;
+    w->err = ESP_OK;
+}
+
+/**
+ * @brief Initialize a chunk writer that sends its data as the response to an HTTP request
+ *
+ * If the complete response fits in the buffer, it is sent in one go with a Content-Length header.
+ * Otherwise, the response is sent using chunked transfer encoding.
+ *
+ * @param[out] w The writer to initialize
+ * @param[in] req The request to respond to
+ */
+void chunk_writer_init_httpd(chunk_writer_t *w, httpd_req_t *req) {
+    chunk_writer_init(w, httpd_flush, req);
+}
+
+/**
+ * @brief Initialize a chunk writer that appends its data to a shared buffer
+ *
+ * @note Writing more data than the capacity of the buffer results in ESP_ERR_INVALID_SIZE
+ *
+ * @param[out] w The writer to initialize
+ * @param[in] buf The buffer to append to
+ */
+void chunk_writer_init_shared_buffer(chunk_writer_t *w, shared_buffer_t *buf) {
+    chunk_writer_init(w, shared_buffer_flush, buf);
+}
+
+/**
+ * @brief Write data to the writer, flushing the buffer when it is full
+ *
+ * @param[in] w The writer
+ * @param[in] data The data to write
+ * @param[in] len The number of bytes to write
+ */
+void chunk_writer_write(chunk_writer_t *w, const char *data, size_t len) {
+    size_t n;
+
+    while (len > 0 && w->err == ESP_OK) {
+        if (w->len == CHUNK_WRITER_BUFFER_SIZE) {
+            chunk_writer_flush(w);
+            continue;
+        }
+
+        n = CHUNK_WRITER_BUFFER_SIZE - w->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(w->buf + w->len, data, n);
+        w->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Write a null terminated string to the writer
+ *
+ * @param[in] w The writer
+ * @param[in] str The string to write
+ */
+void chunk_writer_write_str(chunk_writer_t *w, const char *str) {
+    chunk_writer_write(w, str, strlen(str));
+}
+
+/**
+ * @brief Write a single character to the writer
+ *
+ * @param[in] w The writer
+ * @param[in] c The character to write
+ */
+void chunk_writer_write_char(chunk_writer_t *w, char c) {
+    if (w->len == CHUNK_WRITER_BUFFER_SIZE) {
+        chunk_writer_flush(w);
+    }
+    if (w->err == ESP_OK) {
+        w->buf[w->len++] = c;
+    }
+}
+
+/**
+ * @brief Write a signed integer in decimal notation
+ *
+ * @param[in] w The writer
+ * @param[in] value The value to write
+ */
+void chunk_writer_write_int(chunk_writer_t *w, int64_t value) {
+    if (value < 0) {
+        chunk_writer_write_char(w, '-');
+        write_uint(w, (uint64_t)0 - (uint64_t)value, 1);
+    }
+    else {
+        write_uint(w, (uint64_t)value, 1);
+    }
+}
+
+/**
+ * @brief Write a number with a fixed number of decimals
+ *
+ * The value is rounded to the requested number of decimals and printed using integer arithmetic.
+ * NaN and infinity are written as "NaN", "+Inf" and "-Inf".
+ *
+ * @param[in] w The writer
+ * @param[in] value The value to write
+ * @param[in] decimals The number of decimals, at most CHUNK_WRITER_MAX_DECIMALS
+ */
+void chunk_writer_write_fixed(chunk_writer_t *w, double value, uint8_t decimals) {
+    uint64_t scaled;
+    uint32_t scale;
+
+    if (isnan(value)) {
+        chunk_writer_write_str(w, "NaN");
+        return;
+    }
+    if (isinf(value)) {
+        chunk_writer_write_str(w, value > 0 ? "+Inf" : "-Inf");
+        return;
+    }
+
+    if (decimals > CHUNK_WRITER_MAX_DECIMALS) {
+        decimals = CHUNK_WRITER_MAX_DECIMALS;
+    }
+    scale = pow10_table[decimals];
+
+    // Values this large don't have meaningful decimals in a float, print them as integers
+    if (fabs(value) >= 1e12) {
+        chunk_writer_write_int(w, llround(value));
+        return;
+    }
+
+    scaled = (uint64_t)llround(fabs(value) * scale);
+    if (value < 0 && scaled != 0) {
+        chunk_writer_write_char(w, '-');
+    }
+    write_uint(w, scaled / scale, 1);
+    if (decimals > 0) {
+        chunk_writer_write_char(w, '.');
+        write_uint(w, scaled % scale, decimals);
+    }
+}
+
+/**
+ * @brief Flush the buffered data
+ *
+ * @param[in] w The writer
+ * @return ESP_OK on success, or the first error that occurred
+ */
+esp_err_t chunk_writer_flush(chunk_writer_t *w) {
+    if (w->err == ESP_OK && w->len > 0) {
+        w->err = w->flush_fn(w, w->buf, w->len, false);
+        if (w->err != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to flush %d bytes (%s)", w->len, esp_err_to_name(w->err));
+        }
+        w->bytes_flushed += w->len;
+        w->len = 0;
+    }
+
+    return w->err;
+}
+
+/**
+ * @brief Flush the remaining data and signal the end of the data to the flush function
+ *
+ * The close function, if any, is called afterwards, also if an error occurred. Every initialized writer must be
+ * finished exactly once.
+ *
+ * @param[in] w The writer
+ * @return ESP_OK on success, or the first error that occurred
+ */
+esp_err_t chunk_writer_finish(chunk_writer_t *w) {
+    if (w->err == ESP_OK) {
+        w->err = w->flush_fn(w, w->buf, w->len, true);
+        w->bytes_flushed += w->len;
+        w->len = 0;
+    }
+
+    if (w->close_fn != NULL) {
+        w->close_fn(w);
+        w->close_fn = NULL;
+    }
+
+    return w->err;
+}
+
+/**
+ * @brief Write an unsigned integer in decimal notation
+ *
+ * @param[in] w The writer
+ * @param[in] value The value to write
+ * @param[in] min_digits The minimum number of digits, the number is padded with leading zeros
+ */
+static void write_uint(chunk_writer_t *w, uint64_t value, uint8_t min_digits) {
+    char digits[20];
+    size_t i = sizeof(digits);
+
+    do {
+        digits[--i] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0 || sizeof(digits) - i < min_digits);
+
+    chunk_writer_write(w, digits + i, sizeof(digits) - i);
+}
+
+/**
+ * @brief Flush function that sends the data as (part of) an HTTP response
+ *
+ * @param[in] w The writer, flush_ctx is the httpd request
+ * @param[in] data The data to send
+ * @param[in] len The number of bytes to send
+ * @param[in] final True if this is the last data of the response
+ * @return ESP_OK on success
+ */
+static esp_err_t httpd_flush(chunk_writer_t *w, const char *data, size_t len, bool final) {
+    httpd_req_t *req = (httpd_req_t *)w->flush_ctx;
+    esp_err_t err;
+
+    // The complete response fits in the buffer, send it with a Content-Length header
+    if (final && w->bytes_flushed == 0) {
+        return httpd_resp_send(req, data, (ssize_t)len);
+    }
+
+    if (len > 0) {
+        err = httpd_resp_send_chunk(req, data, (ssize_t)len);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    // End the response by sending an empty chunk
+    if (final) {
+        return httpd_resp_send_chunk(req, NULL, 0);
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Flush function that appends the data to a shared buffer
+ *
+ * @param[in] w The writer, flush_ctx is the shared buffer
+ * @param[in] data The data to append
+ * @param[in] len The number of bytes to append
+ * @param[in] final Unused
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the data doesn't fit in the buffer
+ */
+static esp_err_t shared_buffer_flush(chunk_writer_t *w, const char *data, size_t len, bool final) {
+    shared_buffer_t *buf = (shared_buffer_t *)w->flush_ctx;
+
+    if (buf->len + len > buf->capacity) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+
+    return ESP_OK;
+}
@@ -16,6 +16,7 @@
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "emucs_p1.h"
 
 #define P1_DATA_PIN 5
@@ -31,6 +32,14 @@ static uint8_t uart_buffer[TELEGRAM_BUFFER_SIZE];   // Buffer for storing uart d
 emucs_p1_data_t p1_telegram;                        // Struct for storing the parsed telegram
 SemaphoreHandle_t p1_telegram_mutex;                // Mutex for accessing the telegram struct
 EventGroupHandle_t p1_event_group;                  // Event group for signaling when a new telegram is available
+static volatile uint32_t p1_telegram_sequence = 0;  // Incremented every time a new telegram is published
+static emucs_p1_stats_t p1_stats;                   // Health counters, only written by the emucs_p1_task
+static portMUX_TYPE p1_stats_lock = portMUX_INITIALIZER_UNLOCKED;   // Makes reading the counters consistent
+#if EMUCS_P1_RAW_TELEGRAM
+static shared_buffer_t *p1_raw_telegram = NULL;     // Last CRC-valid telegram as received, NULL if none yet
+static uint32_t p1_raw_telegram_sequence = 0;       // Sequence number of the raw telegram
+static portMUX_TYPE p1_raw_telegram_lock = portMUX_INITIALIZER_UNLOCKED;    // Protects the raw telegram
+#endif
 
 // Function prototypes
 static void process_p1_data(size_t size);
@@ -95,12 +104,21 @@ _Noreturn void emucs_p1_task(void *pvParameters) {
                     break;
                 case UART_BUFFER_FULL:
                     ESP_LOGW(TAG, "UART buffer full");
+                    taskENTER_CRITICAL(&p1_stats_lock);
+                    p1_stats.uart_buffer_full_count++;
+                    taskEXIT_CRITICAL(&p1_stats_lock);
                     break;
                 case UART_FIFO_OVF:
                     ESP_LOGW(TAG, "UART FIFO overflow");
+                    taskENTER_CRITICAL(&p1_stats_lock);
+                    p1_stats.uart_fifo_overflow_count++;
+                    taskEXIT_CRITICAL(&p1_stats_lock);
                     break;
                 case UART_FRAME_ERR:
                     ESP_LOGW(TAG, "UART frame error");
+                    taskENTER_CRITICAL(&p1_stats_lock);
+                    p1_stats.uart_frame_error_count++;
+                    taskEXIT_CRITICAL(&p1_stats_lock);
                     break;
 
                 default:
@@ -139,6 +157,52 @@ EventGroupHandle_t emucs_p1_get_event_group_handle(void) {
     return p1_event_group;
 }
 
+/**
+ * @brief Get the sequence number of the current telegram
+ *
+ * The sequence number is incremented every time a new telegram is parsed, 0 means no telegram is available yet.
+ * It can be read without holding the telegram mutex, e.g. to check whether derived data is stale.
+ *
+ * @return The telegram sequence number
+ */
+uint32_t emucs_p1_get_telegram_sequence(void) {
+    return p1_telegram_sequence;
+}
+
+/**
+ * @brief Get a consistent copy of the health counters of the P1 reader
+ *
+ * @param[out] stats The counters
+ */
+void emucs_p1_get_stats(emucs_p1_stats_t *stats) {
+    taskENTER_CRITICAL(&p1_stats_lock);
+    *stats = p1_stats;
+    taskEXIT_CRITICAL(&p1_stats_lock);
+}
+
+#if EMUCS_P1_RAW_TELEGRAM
+/**
+ * @brief Get the last CRC-valid telegram as it was received, from '/' up to and including the final "\r\n"
+ *
+ * The buffer is shared by all readers, it must not be modified and must be released with shared_buffer_release().
+ *
+ * @param[out] sequence The sequence number of the telegram, may be NULL
+ * @return The raw telegram, or NULL if no telegram is available yet
+ */
+shared_buffer_t * emucs_p1_get_raw_telegram(uint32_t *sequence) {
+    shared_buffer_t *raw;
+
+    taskENTER_CRITICAL(&p1_raw_telegram_lock);
+    raw = shared_buffer_acquire(p1_raw_telegram);
+    if (sequence != NULL) {
+        *sequence = p1_raw_telegram_sequence;
+    }
+    taskEXIT_CRITICAL(&p1_raw_telegram_lock);
+
+    return raw;
+}
+#endif
+
 /**
  * @brief Read size bytes from the UART and process them.
  *
@@ -160,6 +224,9 @@ static void process_p1_data(size_t size) {
     // Check if there is enough space in the buffer
     if (uart_buffer_index + size > uart_buffer + TELEGRAM_BUFFER_SIZE) {
         ESP_LOGE(TAG, "Not enough space in the uart buffer. Resetting state");
+        taskENTER_CRITICAL(&p1_stats_lock);
+        p1_stats.buffer_overflow_count++;
+        taskEXIT_CRITICAL(&p1_stats_lock);
         // TODO: In some cases it might be possible to recover from this error, but for now we just reset the state
         //  and hope that the next telegram will be received correctly
         state = P1_STATE_IDLE;
@@ -249,12 +316,32 @@ static void process_p1_data(size_t size) {
  * @param[in] size The size of the telegram
  */
 static void parse_telegram(uint8_t * telegram, size_t size) {
+    int64_t start_time = esp_timer_get_time();
+    uint32_t parse_time;
+#if EMUCS_P1_RAW_TELEGRAM
+    shared_buffer_t *raw;
+    shared_buffer_t *old_raw;
+#endif
+
     // Check if the telegram CRC16 is correct
     if (!check_telegram_crc(telegram, size)) {
         ESP_LOGW(TAG, "Telegram CRC16 is incorrect");
+        taskENTER_CRITICAL(&p1_stats_lock);
+        p1_stats.crc_error_count++;
+        taskEXIT_CRITICAL(&p1_stats_lock);
         return;
     }
 
+#if EMUCS_P1_RAW_TELEGRAM
+    // Keep a copy of the telegram as received for the raw consumers, strtok() modifies it while parsing
+    raw = shared_buffer_create(size);
+    if (raw != NULL) {
+        memcpy(raw->data, telegram, size);
+        raw->data[size - 1] = '\n';  // The last '\n' was replaced by the terminator
+        raw->len = size;
+    }
+#endif
+
     // Get the telegram semaphore
     xSemaphoreTake(p1_telegram_mutex, portMAX_DELAY);
 
@@ -429,11 +516,31 @@ static void parse_telegram(uint8_t * telegram, size_t size) {
         line = strtok(NULL, "\r\n");
     }
 
+    // Publish the new telegram
+    p1_telegram_sequence++;
+#if EMUCS_P1_RAW_TELEGRAM
+    taskENTER_CRITICAL(&p1_raw_telegram_lock);
+    old_raw = p1_raw_telegram;
+    p1_raw_telegram = raw;
+    p1_raw_telegram_sequence = p1_telegram_sequence;
+    taskEXIT_CRITICAL(&p1_raw_telegram_lock);
+    shared_buffer_release(old_raw);
+#endif
+
     // Release the semaphore
     xSemaphoreGive(p1_telegram_mutex);
 
-    // Set the telegram available bit in the event group
-    xEventGroupSetBits(p1_event_group, EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_BIT);
+    parse_time = (uint32_t)(esp_timer_get_time() - start_time);
+    taskENTER_CRITICAL(&p1_stats_lock);
+    p1_stats.telegram_count++;
+    p1_stats.last_parse_time_us = parse_time;
+    if (parse_time > p1_stats.max_parse_time_us) {
+        p1_stats.max_parse_time_us = parse_time;
+    }
+    taskEXIT_CRITICAL(&p1_stats_lock);
+
+    // Set the telegram available bits in the event group
+    xEventGroupSetBits(p1_event_group, EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_ALL_BITS);
 }
 
 /**
@@ -0,0 +1,381 @@
+/**
+ * @file event_stream.c
+ * @brief Server-Sent Events stream of the meter data
+ *
+ * Clients connect to the stream endpoint and keep the connection open. Every time a new telegram or prediction is
+ * available, an event with the meter data is pushed to all clients. Each client can select the fields it wants to
+ * receive with the 'fields' query parameter; the event is rendered once for every distinct selection.
+ *
+ * Events are sent with non-blocking sends from the event stream task. A client that can't keep up has at most one
+ * event in progress and one waiting; when a newer event arrives, the waiting one is dropped.
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "emucs_p1.h"
+#include "predict_peak.h"
+#include "meter_data.h"
+#include "json_writer.h"
+#include "shared_buffer.h"
+#include "web_server.h"
+#include "event_stream.h"
+
+#define EVENT_STREAM_HTTP_HEADERS "HTTP/1.1 200 OK\r\n" \
+                                  "Content-Type: text/event-stream\r\n" \
+                                  "Cache-Control: no-cache\r\n" \
+                                  "Connection: keep-alive\r\n" \
+                                  "\r\n"
+#define EVENT_STREAM_KEEP_ALIVE_COMMENT ": keep-alive\n\n"
+
+typedef struct {
+    bool in_use;                    // Slot is used by a connected client
+    bool closing;                   // Sending failed, the session is being closed
+    int fd;                         // Socket of the client
+    uint64_t field_mask;            // Fields selected by the client
+    shared_buffer_t *sending;       // Event that is being sent, NULL if idle
+    size_t sending_offset;          // Number of bytes of the event that are already sent
+    shared_buffer_t *next;          // Newest event waiting to be sent, NULL if none
+    uint32_t events_sent;           // Number of events sent completely
+    uint32_t events_dropped;        // Number of events dropped because the client was too slow
+} event_stream_client_t;
+
+static const char *TAG = "event_stream";                        // Tag used for logging
+static httpd_handle_t server_handle;                            // The httpd server the clients are connected to
+static SemaphoreHandle_t clients_mutex;                         // Mutex protecting the clients array
+static event_stream_client_t clients[EVENT_STREAM_MAX_CLIENTS]; // Connected clients
+static shared_buffer_t *keep_alive_event;                       // Comment sent to idle clients
+
+// Function prototypes
+_Noreturn static void event_stream_task(void *pvParameters);
+static void publish_meter_data(const meter_data_t *data);
+static shared_buffer_t * render_event(const meter_data_t *data, uint64_t field_mask);
+static void queue_event(event_stream_client_t *client, shared_buffer_t *event);
+static bool flush_client(event_stream_client_t *client);
+static void client_session_closed(void *ctx);
+
+
+/**
+ * @brief Initialize the event stream and start the event stream task
+ *
+ * @param[in] server The httpd server the stream endpoint is registered on
+ * @return ESP_OK on success
+ */
+esp_err_t event_stream_init(httpd_handle_t server) {
+    server_handle = server;
+
+    clients_mutex = xSemaphoreCreateMutex();
+    if (clients_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create clients mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    keep_alive_event = shared_buffer_create(sizeof(EVENT_STREAM_KEEP_ALIVE_COMMENT) - 1);
+    if (keep_alive_event == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate keep-alive event");
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(keep_alive_event->data, EVENT_STREAM_KEEP_ALIVE_COMMENT, keep_alive_event->capacity);
+    keep_alive_event->len = keep_alive_event->capacity;
+
+    if (xTaskCreate(event_stream_task, "event_stream_task", EVENT_STREAM_TASK_STACK_SIZE, NULL, EVENT_STREAM_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create event stream task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler for the stream endpoint
+ *
+ * Sends the event stream headers, registers the client and sends the current meter data as the first event.
+ * The connection is kept open after the handler returns; events are sent by the event stream task.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+esp_err_t event_stream_get_handler(httpd_req_t *req) {
+    char query[WEB_SERVER_MAX_QUERY_LEN];
+    char fields[WEB_SERVER_MAX_QUERY_LEN];
+    uint64_t field_mask = METER_DATA_FIELDS_BASIC;
+    event_stream_client_t *client = NULL;
+    shared_buffer_t *event = NULL;
+    meter_data_t data;
+
+    // Parse the selected fields
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+        && httpd_query_key_value(query, "fields", fields, sizeof(fields)) == ESP_OK) {
+        if (meter_data_parse_field_mask(fields, &field_mask) != ESP_OK || field_mask == 0) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid fields");
+        }
+    }
+
+    // Render the first event before taking the clients mutex
+    if (meter_data_copy(&data, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) == ESP_OK) {
+        event = render_event(&data, field_mask);
+    }
+
+    xSemaphoreTake(clients_mutex, portMAX_DELAY);
+
+    // Find a free slot
+    for (size_t i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++) {
+        if (!clients[i].in_use) {
+            client = &clients[i];
+            break;
+        }
+    }
+    if (client == NULL) {
+        xSemaphoreGive(clients_mutex);
+        shared_buffer_release(event);
+        ESP_LOGW(TAG, "Max number of event stream clients reached");
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Max number of event stream clients reached");
+    }
+
+    // Send the headers, the body is sent without chunked encoding and ends when the connection is closed
+    if (httpd_send(req, EVENT_STREAM_HTTP_HEADERS, sizeof(EVENT_STREAM_HTTP_HEADERS) - 1) < 0) {
+        xSemaphoreGive(clients_mutex);
+        shared_buffer_release(event);
+        return ESP_FAIL;
+    }
+
+    // Register the client, it is removed when the session is closed
+    memset(client, 0, sizeof(event_stream_client_t));
+    client->in_use = true;
+    client->fd = httpd_req_to_sockfd(req);
+    client->field_mask = field_mask;
+    req->sess_ctx = client;
+    req->free_ctx = client_session_closed;
+
+    if (event != NULL) {
+        queue_event(client, event);
+        flush_client(client);
+    }
+
+    xSemaphoreGive(clients_mutex);
+    shared_buffer_release(event);
+
+    ESP_LOGI(TAG, "Event stream client connected (socket %d)", client->fd);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Event stream task
+ *
+ * Waits for new telegrams and predictions and pushes them to the clients.
+ * Clients that couldn't receive all data at once are retried every EVENT_STREAM_FLUSH_INTERVAL_MS.
+ *
+ * @param pvParameters
+ */
+_Noreturn static void event_stream_task(void *pvParameters) {
+    EventGroupHandle_t event_group = emucs_p1_get_event_group_handle();
+    TickType_t last_event_time = xTaskGetTickCount();
+    bool pending = false;
+    EventBits_t bits;
+    meter_data_t data;
+
+    for (;;) {
+        // Wait for new data, or until it's time to retry sending or send a keep-alive
+        bits = xEventGroupWaitBits(event_group,
+                                   EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_STREAM_BIT | PREDICT_PEAK_EVENT_AVAILABLE_STREAM_BIT,
+                                   pdTRUE, pdFALSE,
+                                   pdMS_TO_TICKS(pending ? EVENT_STREAM_FLUSH_INTERVAL_MS : EVENT_STREAM_KEEP_ALIVE_INTERVAL_MS));
+
+        bool has_data = bits != 0 && meter_data_copy(&data, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) == ESP_OK;
+        bool keep_alive = !has_data && xTaskGetTickCount() - last_event_time >= pdMS_TO_TICKS(EVENT_STREAM_KEEP_ALIVE_INTERVAL_MS);
+
+        xSemaphoreTake(clients_mutex, portMAX_DELAY);
+
+        if (has_data) {
+            publish_meter_data(&data);
+        }
+        if (has_data || keep_alive) {
+            last_event_time = xTaskGetTickCount();
+        }
+
+        // Send as much as possible to every client
+        pending = false;
+        for (size_t i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++) {
+            event_stream_client_t *client = &clients[i];
+            if (!client->in_use || client->closing) {
+                continue;
+            }
+            if (keep_alive && client->sending == NULL && client->next == NULL) {
+                queue_event(client, keep_alive_event);
+            }
+            pending |= flush_client(client);
+        }
+
+        xSemaphoreGive(clients_mutex);
+    }
+}
+
+/**
+ * @brief Queue an event with the meter data for every client
+ *
+ * The event is rendered once for every distinct field selection.
+ *
+ * @note The clients mutex must be taken before calling this function
+ *
+ * @param[in] data The meter data
+ */
+static void publish_meter_data(const meter_data_t *data) {
+    struct {
+        uint64_t field_mask;
+        shared_buffer_t *event;
+    } rendered[EVENT_STREAM_MAX_CLIENTS];
+    size_t rendered_count = 0;
+    size_t j;
+
+    for (size_t i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++) {
+        event_stream_client_t *client = &clients[i];
+        if (!client->in_use || client->closing) {
+            continue;
+        }
+
+        // Reuse the event if it was already rendered for the same fields
+        for (j = 0; j < rendered_count; j++) {
+            if (rendered[j].field_mask == client->field_mask) {
+                break;
+            }
+        }
+        if (j == rendered_count) {
+            rendered[j].field_mask = client->field_mask;
+            rendered[j].event = render_event(data, client->field_mask);
+            rendered_count++;
+        }
+
+        if (rendered[j].event != NULL) {
+            queue_event(client, rendered[j].event);
+        }
+    }
+
+    // Release the references held by this function, the clients hold their own
+    for (j = 0; j < rendered_count; j++) {
+        shared_buffer_release(rendered[j].event);
+    }
+}
+
+/**
+ * @brief Render a meter data event
+ *
+ * @param[in] data The meter data
+ * @param[in] field_mask The fields to include
+ * @return The rendered event, or NULL on failure
+ */
+static shared_buffer_t * render_event(const meter_data_t *data, uint64_t field_mask) {
+    shared_buffer_t *event = shared_buffer_create(EVENT_STREAM_FRAME_BUFFER_SIZE);
+    json_writer_t json;
+
+    if (event == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for an event");
+        return NULL;
+    }
+
+    json_writer_init_shared_buffer(&json, event);
+    chunk_writer_write_str(&json.out, "id: ");
+    chunk_writer_write_int(&json.out, data->telegram_sequence);
+    chunk_writer_write_str(&json.out, "\nevent: meter-data\ndata: ");
+    json_writer_begin_object(&json, NULL);
+    meter_data_write_json_fields(&json, data, field_mask);
+    json_writer_end_object(&json);
+    chunk_writer_write_str(&json.out, "\n\n");
+
+    if (json_writer_finish(&json) != ESP_OK) {
+        ESP_LOGE(TAG, "Event doesn't fit in %d bytes", EVENT_STREAM_FRAME_BUFFER_SIZE);
+        shared_buffer_release(event);
+        return NULL;
+    }
+
+    return event;
+}
+
+/**
+ * @brief Queue an event for a client
+ *
+ * If an older event is still waiting, it is dropped in favour of the new one.
+ *
+ * @note The clients mutex must be taken before calling this function
+ *
+ * @param[in] client The client
+ * @param[in] event The event, the client acquires its own reference
+ */
+static void queue_event(event_stream_client_t *client, shared_buffer_t *event) {
+    if (client->next != NULL) {
+        shared_buffer_release(client->next);
+        client->events_dropped++;
+    }
+    client->next = shared_buffer_acquire(event);
+}
+
+/**
+ * @brief Send as much of the queued events to a client as possible without blocking
+ *
+ * If sending fails, the session of the client is closed.
+ *
+ * @note The clients mutex must be taken before calling this function
+ *
+ * @param[in] client The client
+ * @return True if there is still data waiting to be sent
+ */
+static bool flush_client(event_stream_client_t *client) {
+    int ret;
+
+    for (;;) {
+        // Start sending the next event
+        if (client->sending == NULL) {
+            if (client->next == NULL) {
+                return false;
+            }
+            client->sending = client->next;
+            client->sending_offset = 0;
+            client->next = NULL;
+        }
+
+        ret = httpd_socket_send(server_handle, client->fd, client->sending->data + client->sending_offset,
+                                client->sending->len - client->sending_offset, MSG_DONTWAIT);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            // The socket buffer is full, retry later
+            return true;
+        }
+        if (ret < 0) {
+            ESP_LOGI(TAG, "Failed to send to event stream client (socket %d), closing", client->fd);
+            client->closing = true;
+            httpd_sess_trigger_close(server_handle, client->fd);
+            return false;
+        }
+
+        client->sending_offset += ret;
+        if (client->sending_offset == client->sending->len) {
+            shared_buffer_release(client->sending);
+            client->sending = NULL;
+            client->events_sent++;
+        }
+    }
+}
+
+/**
+ * @brief Called by httpd when the session of a client is closed
+ *
+ * @param[in] ctx The client
+ */
+static void client_session_closed(void *ctx) {
+    event_stream_client_t *client = (event_stream_client_t *)ctx;
+
+    xSemaphoreTake(clients_mutex, portMAX_DELAY);
+
+    ESP_LOGI(TAG, "Event stream client disconnected (socket %d, %lu events sent, %lu dropped)",
+             client->fd, client->events_sent, client->events_dropped);
+
+    shared_buffer_release(client->sending);
+    shared_buffer_release(client->next);
+    memset(client, 0, sizeof(event_stream_client_t));
+
+    xSemaphoreGive(clients_mutex);
+}
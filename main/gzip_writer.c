@@ -0,0 +1,322 @@
+/**
+ * @file gzip_writer.c
+ * @brief Chunk writer that gzip compresses an HTTP response while it is streamed
+ *
+ * The data is compressed with the deflate compressor (tdefl) in ROM. Its state, including the 32 KB window, is
+ * allocated in PSRAM for the duration of the response; at most GZIP_WRITER_MAX_STREAMS responses are compressed at the
+ * same time, so the memory use is bounded. GZIP_WRITER_LEVEL sets the trade-off between CPU time and response size.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "rom/miniz.h"
+#include "gzip_writer.h"
+
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+
+static const char *TAG = "gzip_writer";    // Tag used for logging
+
+// Number of hash probes per compression level, as used by miniz
+static const uint16_t level_probes[] = {0, 1, 6, 32, 16, 32, 128, 256, 512, 768, 1500};
+
+/**
+ * State of a compressed response, allocated in PSRAM
+ */
+typedef struct {
+    tdefl_compressor compressor;
+    httpd_req_t *req;
+    uint32_t crc;                                   // CRC32 of the uncompressed data
+    size_t in_len;                                  // Number of uncompressed bytes
+    size_t out_len;                                 // Number of compressed bytes, including the gzip header and trailer
+    int64_t compress_time;                          // Time spent compressing, in microseconds
+    esp_err_t send_err;                             // First error while sending the compressed data
+    size_t buf_len;                                 // Number of bytes in buf
+    char buf[GZIP_WRITER_OUT_BUFFER_SIZE];          // Compressed data that hasn't been sent yet
+} gzip_ctx_t;
+
+static SemaphoreHandle_t streams_semaphore = NULL;  // Counts the free compressors
+
+// Function prototypes
+static esp_err_t gzip_flush(chunk_writer_t *w, const char *data, size_t len, bool final);
+static void gzip_close(chunk_writer_t *w);
+static mz_bool put_compressed(const void *data, int len, void *user);
+static void append_output(gzip_ctx_t *ctx, const void *data, size_t len);
+static esp_err_t send_output(gzip_ctx_t *ctx);
+static bool parse_coding(char *element, const char **coding);
+
+
+/**
+ * @brief Initialize the gzip writer
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the semaphore can't be created
+ */
+esp_err_t gzip_writer_init(void) {
+    streams_semaphore = xSemaphoreCreateCounting(GZIP_WRITER_MAX_STREAMS, GZIP_WRITER_MAX_STREAMS);
+    if (streams_semaphore == NULL) {
+        ESP_LOGE(TAG, "Failed to create semaphore");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Check if the client accepts gzip encoded responses
+ *
+ * The Accept-Encoding header is a comma separated list of codings with an optional weight, e.g. "gzip;q=0, br".
+ * A coding with q=0 is refused. "*" stands for every coding that isn't listed.
+ *
+ * @param[in] req The request handle
+ * @return True if gzip, or "*" without gzip, is listed with a non-zero weight
+ */
+bool gzip_writer_is_accepted(httpd_req_t *req) {
+    char accept_encoding[GZIP_WRITER_MAX_ACCEPT_ENCODING_LEN];
+    const char *coding;
+    char *element;
+    char *save_ptr;
+    bool accepted;
+    int gzip = -1;      // 1 if gzip is accepted, 0 if refused, -1 if not listed
+    int any = -1;       // The same for "*"
+
+    if (httpd_req_get_hdr_value_str(req, "Accept-Encoding", accept_encoding, sizeof(accept_encoding)) != ESP_OK) {
+        return false;
+    }
+
+    element = strtok_r(accept_encoding, ",", &save_ptr);
+    for (; element != NULL; element = strtok_r(NULL, ",", &save_ptr)) {
+        accepted = parse_coding(element, &coding);
+        if (strcasecmp(coding, "gzip") == 0) {
+            gzip = accepted;
+        } else if (strcmp(coding, "*") == 0) {
+            any = accepted;
+        }
+    }
+
+    return gzip != -1 ? gzip == 1 : any == 1;
+}
+
+/**
+ * @brief Initialize a chunk writer that sends its data gzip compressed as the response to an HTTP request
+ *
+ * The Content-Encoding header is set and the response is sent using chunked transfer encoding.
+ * The writer must be finished with chunk_writer_finish(), which releases the compressor.
+ *
+ * @param[out] w The writer to initialize
+ * @param[in] req The request to respond to
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT if no compressor is free, ESP_ERR_NO_MEM if it can't be allocated.
+ *         The writer is not initialized on failure, so the caller can fall back to an uncompressed response.
+ */
+esp_err_t gzip_writer_init_httpd(chunk_writer_t *w, httpd_req_t *req) {
+    static const uint8_t gzip_header[GZIP_HEADER_SIZE] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+    int level = GZIP_WRITER_LEVEL;
+    int flags;
+    gzip_ctx_t *ctx;
+
+    if (streams_semaphore == NULL
+        || xSemaphoreTake(streams_semaphore, pdMS_TO_TICKS(GZIP_WRITER_MAX_WAIT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "No compressor available, sending uncompressed");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    ctx = heap_caps_malloc(sizeof(gzip_ctx_t), MALLOC_CAP_SPIRAM);
+    if (ctx == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate compressor");
+        xSemaphoreGive(streams_semaphore);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (level < 0 || level >= (int)(sizeof(level_probes) / sizeof(level_probes[0]))) {
+        level = 1;
+    }
+    flags = level_probes[level];
+    if (level <= 3) {
+        flags |= TDEFL_GREEDY_PARSING_FLAG;
+    }
+    if (level == 0) {
+        flags |= TDEFL_FORCE_ALL_RAW_BLOCKS;
+    }
+    tdefl_init(&ctx->compressor, put_compressed, ctx, flags);
+
+    ctx->req = req;
+    ctx->crc = 0;
+    ctx->in_len = 0;
+    ctx->out_len = 0;
+    ctx->compress_time = 0;
+    ctx->send_err = ESP_OK;
+    ctx->buf_len = 0;
+    append_output(ctx, gzip_header, sizeof(gzip_header));
+
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+    chunk_writer_init(w, gzip_flush, ctx);
+    w->close_fn = gzip_close;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Flush function that compresses the data and sends the compressed data
+ *
+ * @param[in] w The writer, flush_ctx is the gzip context
+ * @param[in] data The uncompressed data
+ * @param[in] len The number of bytes
+ * @param[in] final True if this is the last data of the response
+ * @return ESP_OK on success
+ */
+static esp_err_t gzip_flush(chunk_writer_t *w, const char *data, size_t len, bool final) {
+    gzip_ctx_t *ctx = (gzip_ctx_t *)w->flush_ctx;
+    uint8_t trailer[GZIP_TRAILER_SIZE];
+    int64_t start_time = esp_timer_get_time();
+    tdefl_status status;
+
+    ctx->crc = esp_rom_crc32_le(ctx->crc, (const uint8_t *)data, len);
+    ctx->in_len += len;
+    status = tdefl_compress_buffer(&ctx->compressor, data, len, final ? TDEFL_FINISH : TDEFL_NO_FLUSH);
+    ctx->compress_time += esp_timer_get_time() - start_time;
+
+    if (ctx->send_err != ESP_OK) {
+        return ctx->send_err;
+    }
+    if (status != (final ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY)) {
+        ESP_LOGE(TAG, "Compression failed (%d)", status);
+        return ESP_FAIL;
+    }
+    if (!final) {
+        return ESP_OK;
+    }
+
+    // The trailer contains the CRC32 and the size (modulo 2^32) of the uncompressed data, little endian
+    for (int i = 0; i < 4; i++) {
+        trailer[i] = (uint8_t)(ctx->crc >> (8 * i));
+        trailer[4 + i] = (uint8_t)(ctx->in_len >> (8 * i));
+    }
+    append_output(ctx, trailer, sizeof(trailer));
+    if (send_output(ctx) != ESP_OK) {
+        return ctx->send_err;
+    }
+
+    // End the response by sending an empty chunk
+    return httpd_resp_send_chunk(ctx->req, NULL, 0);
+}
+
+/**
+ * @brief Close function that releases the compressor
+ *
+ * @param[in] w The writer, flush_ctx is the gzip context
+ */
+static void gzip_close(chunk_writer_t *w) {
+    gzip_ctx_t *ctx = (gzip_ctx_t *)w->flush_ctx;
+
+    ESP_LOGD(TAG, "Compressed %u bytes to %u bytes in %lld us (level %d)", ctx->in_len, ctx->out_len,
+             ctx->compress_time, GZIP_WRITER_LEVEL);
+
+    heap_caps_free(ctx);
+    xSemaphoreGive(streams_semaphore);
+}
+
+/**
+ * @brief Output function of the compressor
+ *
+ * @param[in] data The compressed data
+ * @param[in] len The number of bytes
+ * @param[in] user The gzip context
+ * @return MZ_TRUE on success, MZ_FALSE if sending failed
+ */
+static mz_bool put_compressed(const void *data, int len, void *user) {
+    gzip_ctx_t *ctx = (gzip_ctx_t *)user;
+
+    append_output(ctx, data, len);
+
+    return ctx->send_err == ESP_OK ? MZ_TRUE : MZ_FALSE;
+}
+
+/**
+ * @brief Append compressed data to the output buffer, sending it as a chunk when the buffer is full
+ *
+ * @param[in] ctx The gzip context
+ * @param[in] data The data
+ * @param[in] len The number of bytes
+ */
+static void append_output(gzip_ctx_t *ctx, const void *data, size_t len) {
+    const char *src = data;
+    size_t n;
+
+    ctx->out_len += len;
+
+    while (len > 0 && ctx->send_err == ESP_OK) {
+        if (ctx->buf_len == sizeof(ctx->buf)) {
+            send_output(ctx);
+            continue;
+        }
+
+        n = MIN(sizeof(ctx->buf) - ctx->buf_len, len);
+        memcpy(ctx->buf + ctx->buf_len, src, n);
+        ctx->buf_len += n;
+        src += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Send the compressed data in the output buffer as a chunk
+ *
+ * @param[in] ctx The gzip context
+ * @return ESP_OK on success, or the first error that occurred while sending
+ */
+static esp_err_t send_output(gzip_ctx_t *ctx) {
+    if (ctx->send_err == ESP_OK && ctx->buf_len > 0) {
+        ctx->send_err = httpd_resp_send_chunk(ctx->req, ctx->buf, (ssize_t)ctx->buf_len);
+        ctx->buf_len = 0;
+    }
+
+    return ctx->send_err;
+}
+
+/**
+ * @brief Parse an element of the Accept-Encoding header
+ *
+ * @param[in,out] element The element, e.g. " gzip;q=0.5", it is modified to terminate the coding
+ * @param[out] coding The coding, without white space
+ * @return False if the weight is zero, true otherwise
+ */
+static bool parse_coding(char *element, const char **coding) {
+    char *param;
+    char *end;
+    bool zero;
+
+    element += strspn(element, " \t");
+    *coding = element;
+    end = element + strcspn(element, " \t;");
+    param = strchr(end, ';');
+    *end = '\0';
+
+    // Look for the weight, only "q=0", "q=0.", "q=0.0" ... mean "not acceptable"
+    while (param != NULL) {
+        param++;
+        param += strspn(param, " \t");
+        if ((param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+            param += 2;
+            zero = param[0] == '0';
+            if (zero && param[1] == '.') {
+                for (param += 2; *param >= '0' && *param <= '9'; param++) {
+                    zero &= *param == '0';
+                }
+            } else if (zero) {
+                param++;
+            }
+            return !(zero && (*param == '\0' || *param == ' ' || *param == '\t' || *param == ';'));
+        }
+        param = strchr(param, ';');
+    }
+
+    return true;
+}
@@ -0,0 +1,180 @@
+/**
+ * @file ha_discovery.c
+ * @brief Home Assistant MQTT discovery of the published fields
+ *
+ * Every field that the MQTT publisher publishes on its own topic is announced to Home Assistant as a sensor, with a
+ * retained config on <discovery prefix>/sensor/<device id>/<field name>/config. The configs are rendered once from the
+ * field table of the publisher, so publishing them on every connect only costs the MQTT messages. They are published
+ * again when Home Assistant comes online, in case it lost them.
+ *
+ * The sensors use the per-field topics as state topic, so at runtime only the values are published.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_heap_caps.h"
+#include "esp_app_desc.h"
+#include "json_writer.h"
+#include "shared_buffer.h"
+#include "ha_discovery.h"
+
+typedef struct {
+    char topic[HA_DISCOVERY_MAX_TOPIC_LEN];     // Discovery topic of the sensor
+    shared_buffer_t *config;                    // Rendered config of the sensor
+} sensor_config_t;
+
+static const char *TAG = "ha_discovery";        // Tag used for logging
+
+static sensor_config_t *sensor_configs = NULL;
+static size_t sensor_count = 0;
+
+// Function prototypes
+static esp_err_t render_config(sensor_config_t *sensor, const mqtt_publisher_field_t *field, const char *device_id);
+static void publish_configs(esp_mqtt_client_handle_t client);
+
+
+/**
+ * @brief Render the discovery configs of the fields
+ *
+ * @param[in] fields The fields published on their own topic
+ * @param[in] field_count The number of fields
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if a config can't be allocated
+ */
+esp_err_t ha_discovery_init(const mqtt_publisher_field_t *fields, size_t field_count) {
+    char device_id[32];
+    uint8_t mac[6];
+
+    // The MAC address identifies the device, so it stays the same when the broker or the topic prefix changes
+    ESP_ERROR_CHECK(esp_read_mac(mac, ESP_MAC_WIFI_STA));
+    snprintf(device_id, sizeof(device_id), "kwartiwi_%02x%02x%02x%02x%02x%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    sensor_configs = heap_caps_calloc(field_count, sizeof(sensor_config_t), MALLOC_CAP_SPIRAM);
+    if (sensor_configs == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the sensor configs");
+        return ESP_ERR_NO_MEM;
+    }
+    sensor_count = field_count;
+
+    for (size_t i = 0; i < field_count; i++) {
+        if (render_config(&sensor_configs[i], &fields[i], device_id) != ESP_OK) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    ESP_LOGI(TAG, "Rendered %u sensor configs for device %s", sensor_count, device_id);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Publish the configs and follow the status of Home Assistant, call when connected to the broker
+ *
+ * @param[in] client The MQTT client
+ */
+void ha_discovery_connected(esp_mqtt_client_handle_t client) {
+    if (esp_mqtt_client_subscribe(client, HA_DISCOVERY_STATUS_TOPIC, 1) < 0) {
+        ESP_LOGW(TAG, "Failed to subscribe to %s", HA_DISCOVERY_STATUS_TOPIC);
+    }
+
+    publish_configs(client);
+}
+
+/**
+ * @brief Handle a received message, publishes the configs again when Home Assistant comes online
+ *
+ * @param[in] client The MQTT client
+ * @param[in] event The MQTT_EVENT_DATA event
+ */
+void ha_discovery_data(esp_mqtt_client_handle_t client, esp_mqtt_event_handle_t event) {
+    if (event->topic_len == sizeof(HA_DISCOVERY_STATUS_TOPIC) - 1
+        && memcmp(event->topic, HA_DISCOVERY_STATUS_TOPIC, event->topic_len) == 0
+        && event->data_len == sizeof("online") - 1
+        && memcmp(event->data, "online", event->data_len) == 0) {
+        ESP_LOGI(TAG, "Home Assistant came online");
+        publish_configs(client);
+    }
+}
+
+/**
+ * @brief Render the discovery topic and config of a field
+ *
+ * @param[out] sensor The sensor config
+ * @param[in] field The field
+ * @param[in] device_id The unique id of the device
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the config can't be allocated or doesn't fit
+ */
+static esp_err_t render_config(sensor_config_t *sensor, const mqtt_publisher_field_t *field, const char *device_id) {
+    const meter_data_field_t *meter_field = meter_data_get_field(field->id);
+    char value[HA_DISCOVERY_MAX_TOPIC_LEN];
+    json_writer_t json;
+
+    snprintf(sensor->topic, sizeof(sensor->topic), "%s/sensor/%s/%s/config", HA_DISCOVERY_PREFIX, device_id,
+             meter_field->name);
+
+    sensor->config = shared_buffer_create(HA_DISCOVERY_MAX_CONFIG_SIZE);
+    if (sensor->config == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the config of %s", meter_field->name);
+        return ESP_ERR_NO_MEM;
+    }
+
+    json_writer_init_shared_buffer(&json, sensor->config);
+    json_writer_begin_object(&json, NULL);
+    json_writer_add_string(&json, "name", field->name);
+    snprintf(value, sizeof(value), "%s_%s", device_id, meter_field->name);
+    json_writer_add_string(&json, "unique_id", value);
+    snprintf(value, sizeof(value), "%s/%s", CONFIG_MQTT_PUBLISHER_TOPIC_PREFIX, meter_field->name);
+    json_writer_add_string(&json, "state_topic", value);
+    snprintf(value, sizeof(value), "%s/%s", CONFIG_MQTT_PUBLISHER_TOPIC_PREFIX, MQTT_PUBLISHER_STATUS_TOPIC);
+    json_writer_add_string(&json, "availability_topic", value);
+    if (field->unit != NULL) {
+        json_writer_add_string(&json, "unit_of_measurement", field->unit);
+        json_writer_add_int(&json, "suggested_display_precision", meter_field->decimals);
+    }
+    if (field->device_class != NULL) {
+        json_writer_add_string(&json, "device_class", field->device_class);
+    }
+    if (field->state_class != NULL) {
+        json_writer_add_string(&json, "state_class", field->state_class);
+    }
+    json_writer_begin_object(&json, "device");
+    json_writer_begin_array(&json, "identifiers");
+    json_writer_add_string(&json, NULL, device_id);
+    json_writer_end_array(&json);
+    json_writer_add_string(&json, "name", HA_DISCOVERY_DEVICE_NAME);
+    json_writer_add_string(&json, "model", HA_DISCOVERY_DEVICE_MODEL);
+    json_writer_add_string(&json, "sw_version", esp_app_get_description()->version);
+    json_writer_end_object(&json);
+    json_writer_end_object(&json);
+
+    if (json_writer_finish(&json) != ESP_OK) {
+        ESP_LOGE(TAG, "Config of %s doesn't fit in %d bytes", meter_field->name, HA_DISCOVERY_MAX_CONFIG_SIZE);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Publish the configs of all sensors, retained
+ *
+ * @param[in] client The MQTT client
+ */
+static void publish_configs(esp_mqtt_client_handle_t client) {
+    size_t failed = 0;
+
+    for (size_t i = 0; i < sensor_count; i++) {
+        if (esp_mqtt_client_publish(client, sensor_configs[i].topic, sensor_configs[i].config->data,
+                                    (int)sensor_configs[i].config->len, 1, 1) < 0) {
+            failed++;
+        }
+    }
+
+    if (failed > 0) {
+        ESP_LOGW(TAG, "Failed to publish %u of %u sensor configs", failed, sensor_count);
+    } else {
+        ESP_LOGI(TAG, "Published %u sensor configs", sensor_count);
+    }
+}
@@ -0,0 +1,376 @@
+/**
+ * @file history.c
+ * @brief Incremental and downsampled queries on the logs
+ *
+ * A query starts at an absolute log index and returns at most 'limit' points of 'resolution' seconds, aligned to
+ * multiples of the resolution. Points of the short term log contain the average, and with a resolution of more than
+ * a second also the minimum and maximum, of the entries in the bucket. Queries with a resolution of a quarter-hour or
+ * more, or that start before the short term log, use the quarter-hour rollups of the long term log instead; their
+ * points contain the meter readings at the end of the bucket.
+ *
+ * Instead of a resolution, a client can ask for a number of points, from which the resolution is derived, so the
+ * response size stays bounded whatever the queried range.
+ *
+ * Only complete buckets are returned; the cursor of the next query points to the first entry that was not returned
+ * yet, so a client that keeps passing the cursor gets every point exactly once, and the work per query only depends
+ * on the number of new entries.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "emucs_p1.h"
+#include "request_arena.h"
+#include "http_stats.h"
+#include "history.h"
+
+typedef struct {
+    time_t start;               // Start of the bucket
+    uint32_t first_index;       // Absolute log index of the first entry in the bucket
+    uint32_t count;             // Number of entries in the bucket
+    union {
+        struct {
+            double avg_demand_sum;      // Sum of the average demand of the entries
+            float avg_demand_max;       // Max average demand
+            double power_usage_sum;     // Sum of the power usage of the entries
+            float power_usage_min;      // Min power usage
+            float power_usage_max;      // Max power usage
+        } short_term;
+        log_entry_long_term_p1_data_t long_term;    // Last entry of the bucket
+    };
+} bucket_t;
+
+static const char *TAG = "history";     // Tag used for logging
+
+// Function prototypes
+static SemaphoreHandle_t get_log_mutex(history_log_t log);
+static size_t read_log_items(const history_query_t *query, uint32_t *index, void *batch, time_t *timestamps);
+static void add_to_bucket(const history_query_t *query, bucket_t *bucket, const void *batch, size_t i);
+static void write_bucket(json_writer_t *json, const history_query_t *query, const bucket_t *bucket);
+
+
+/**
+ * @brief Choose the log, resolution and start index of a query
+ *
+ * The long term log is used if the resolution is at least a quarter-hour, or if 'since' is before the oldest entry
+ * of the short term log. On the long term log, the resolution is rounded up to a multiple of a quarter-hour.
+ *
+ * @param[in,out] query The query, resolution 0 if it has to be derived from 'points'
+ * @param[in] since Start of the query, 0 to start at the oldest entry of the short term log
+ * @param[in] points Number of points to divide the range into if no resolution is given, 0 for the raw entries
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT if a log mutex couldn't be taken
+ */
+esp_err_t history_prepare_query(history_query_t *query, time_t since, uint32_t points) {
+    SemaphoreHandle_t short_term_mutex = logger_get_short_term_log_mutex_handle();
+    SemaphoreHandle_t mutex;
+    log_entry_short_term_p1_data_t short_term_entry;
+    log_entry_long_term_p1_data_t long_term_entry;
+    time_t oldest = 0;
+    time_t newest = 0;
+    uint32_t index;
+    uint32_t period;
+
+    if (short_term_mutex == NULL
+        || http_stats_take(short_term_mutex, pdMS_TO_TICKS(HISTORY_MAX_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get short term log mutex within %d ms", HISTORY_MAX_TIMEOUT_MS);
+        return ESP_ERR_TIMEOUT;
+    }
+    index = logger_get_short_term_log_first_index();
+    if (logger_read_short_term_log_items(&index, &short_term_entry, 1) == 1) {
+        oldest = short_term_entry.timestamp;
+    }
+    xSemaphoreGive(short_term_mutex);
+
+    query->log = (query->resolution >= HISTORY_LONG_TERM_PERIOD_S || (since != 0 && since < oldest))
+            ? HISTORY_LOG_LONG_TERM : HISTORY_LOG_SHORT_TERM;
+    period = query->log == HISTORY_LOG_LONG_TERM ? HISTORY_LONG_TERM_PERIOD_S : 1;
+    mutex = get_log_mutex(query->log);
+
+    if (mutex == NULL || http_stats_take(mutex, pdMS_TO_TICKS(HISTORY_MAX_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get log mutex within %d ms", HISTORY_MAX_TIMEOUT_MS);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // Derive the resolution from the range between the start and the newest entry
+    if (query->resolution == 0 && points > 0) {
+        if (query->log == HISTORY_LOG_LONG_TERM) {
+            index = logger_get_long_term_log_end_index() - 1;
+            if (logger_read_long_term_log_items(&index, &long_term_entry, 1) == 1) {
+                newest = long_term_entry.timestamp;
+            }
+            index = logger_get_long_term_log_first_index();
+            if (since == 0 && logger_read_long_term_log_items(&index, &long_term_entry, 1) == 1) {
+                since = long_term_entry.timestamp;
+            }
+        }
+        else {
+            index = logger_get_short_term_log_end_index() - 1;
+            if (logger_read_short_term_log_items(&index, &short_term_entry, 1) == 1) {
+                newest = short_term_entry.timestamp;
+            }
+            if (since < oldest) {
+                since = oldest;
+            }
+        }
+        if (newest > since) {
+            query->resolution = (newest - since + period + points - 1) / points;
+        }
+    }
+
+    // Round the resolution up to a multiple of the log period
+    if (query->resolution < period) {
+        query->resolution = period;
+    }
+    query->resolution = (query->resolution + period - 1) / period * period;
+    if (query->resolution > HISTORY_MAX_RESOLUTION_S) {
+        query->resolution = HISTORY_MAX_RESOLUTION_S;
+    }
+
+    // Start at the beginning of the bucket containing 'since', so the first bucket is complete
+    since -= since % query->resolution;
+    if (query->log == HISTORY_LOG_LONG_TERM) {
+        query->index = logger_find_long_term_log_index(since);
+    }
+    else {
+        query->index = logger_find_short_term_log_index(since);
+    }
+
+    xSemaphoreGive(mutex);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Parse a cursor returned by an earlier query
+ *
+ * The cursor contains the log, the index and the resolution, so a client only has to pass the cursor to continue.
+ *
+ * @param[in] cursor The cursor
+ * @param[out] query The query to continue, the limit is not changed
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the cursor is invalid
+ */
+esp_err_t history_parse_cursor(const char *cursor, history_query_t *query) {
+    char *end;
+    unsigned long index;
+    unsigned long resolution;
+
+    if (cursor[0] != HISTORY_LOG_SHORT_TERM && cursor[0] != HISTORY_LOG_LONG_TERM) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    index = strtoul(cursor + 1, &end, 10);
+    if (end == cursor + 1 || *end != '.' || index > UINT32_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    resolution = strtoul(end + 1, &end, 10);
+    if (*end != '\0' || resolution == 0 || resolution > HISTORY_MAX_RESOLUTION_S
+        || (cursor[0] == HISTORY_LOG_LONG_TERM && resolution % HISTORY_LONG_TERM_PERIOD_S != 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    query->log = (history_log_t)cursor[0];
+    query->index = index;
+    query->resolution = resolution;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Format the cursor at which the next query continues
+ *
+ * @param[in] query The query
+ * @param[in] next_index The index returned by history_write_points()
+ * @param[out] cursor The buffer for the cursor
+ * @param[in] len The size of the buffer, at least HISTORY_CURSOR_MAX_LEN
+ */
+void history_format_cursor(const history_query_t *query, uint32_t next_index, char *cursor, size_t len) {
+    snprintf(cursor, len, "%c%lu.%lu", query->log, next_index, query->resolution);
+}
+
+/**
+ * @brief Write the points of a query as JSON array elements
+ *
+ * The log is read in batches of HISTORY_BATCH_SIZE entries; the log mutex is only held while copying a batch.
+ * The batch buffer is allocated from the request arena, so this must be called from a handler wrapped by
+ * request_arena_handler().
+ *
+ * @param[in] json The JSON writer, positioned inside an array
+ * @param[in] query The query
+ * @param[out] next_index The absolute log index at which the next query has to continue
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT if the log mutex couldn't be taken,
+ *         ESP_ERR_NO_MEM if the batch buffer couldn't be allocated
+ */
+esp_err_t history_write_points(json_writer_t *json, const history_query_t *query, uint32_t *next_index) {
+    union {
+        log_entry_short_term_p1_data_t short_term[HISTORY_BATCH_SIZE];
+        log_entry_long_term_p1_data_t long_term[HISTORY_BATCH_SIZE];
+    } *batch = request_arena_alloc(sizeof(*batch));
+    time_t *timestamps = request_arena_alloc(HISTORY_BATCH_SIZE * sizeof(time_t));
+    time_t period = query->log == HISTORY_LOG_LONG_TERM ? HISTORY_LONG_TERM_PERIOD_S : 1;
+    bucket_t bucket = {0};
+    uint32_t index = query->index;
+    uint32_t consumed_index = query->index;     // Index after the last entry that was consumed
+    uint32_t points = 0;
+    size_t item_count;
+
+    if (batch == NULL || timestamps == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    while (points < query->limit && json->out.err == ESP_OK) {
+        item_count = read_log_items(query, &index, batch, timestamps);
+        if (item_count == (size_t)-1) {
+            return ESP_ERR_TIMEOUT;
+        }
+        if (item_count == 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < item_count && points < query->limit; i++) {
+            uint32_t entry_index = index - item_count + i;
+            time_t start = timestamps[i] - timestamps[i] % query->resolution;
+
+            // An entry of a later bucket completes the current one (entries may be missing)
+            if (bucket.count > 0 && start != bucket.start) {
+                write_bucket(json, query, &bucket);
+                bucket.count = 0;
+                if (++points == query->limit) {
+                    consumed_index = entry_index;
+                    break;
+                }
+            }
+
+            if (bucket.count == 0) {
+                bucket.start = start;
+                bucket.first_index = entry_index;
+            }
+            add_to_bucket(query, &bucket, batch, i);
+            consumed_index = entry_index + 1;
+
+            // The last entry period of the bucket completes it
+            if (timestamps[i] >= bucket.start + (time_t)query->resolution - period) {
+                write_bucket(json, query, &bucket);
+                bucket.count = 0;
+                points++;
+            }
+        }
+    }
+
+    // An incomplete bucket is returned by the next query
+    *next_index = bucket.count > 0 ? bucket.first_index : consumed_index;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the mutex of a log
+ *
+ * @param[in] log The log
+ * @return The mutex handle, NULL if the logger hasn't started yet
+ */
+static SemaphoreHandle_t get_log_mutex(history_log_t log) {
+    return log == HISTORY_LOG_LONG_TERM ? logger_get_long_term_log_mutex_handle() : logger_get_short_term_log_mutex_handle();
+}
+
+/**
+ * @brief Read a batch of entries of the queried log
+ *
+ * @param[in] query The query
+ * @param[in,out] index The absolute index of the first entry to read, updated to the index after the last entry read
+ * @param[out] batch The buffer for HISTORY_BATCH_SIZE entries of the log
+ * @param[out] timestamps The timestamps of the entries
+ * @return The number of entries read, or (size_t)-1 if the log mutex couldn't be taken
+ */
+static size_t read_log_items(const history_query_t *query, uint32_t *index, void *batch, time_t *timestamps) {
+    SemaphoreHandle_t mutex = get_log_mutex(query->log);
+    size_t item_count;
+
+    if (mutex == NULL || http_stats_take(mutex, pdMS_TO_TICKS(HISTORY_MAX_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get log mutex within %d ms", HISTORY_MAX_TIMEOUT_MS);
+        return (size_t)-1;
+    }
+    if (query->log == HISTORY_LOG_LONG_TERM) {
+        item_count = logger_read_long_term_log_items(index, batch, HISTORY_BATCH_SIZE);
+    }
+    else {
+        item_count = logger_read_short_term_log_items(index, batch, HISTORY_BATCH_SIZE);
+    }
+    xSemaphoreGive(mutex);
+
+    for (size_t i = 0; i < item_count; i++) {
+        timestamps[i] = query->log == HISTORY_LOG_LONG_TERM
+                ? ((const log_entry_long_term_p1_data_t *)batch)[i].timestamp
+                : ((const log_entry_short_term_p1_data_t *)batch)[i].timestamp;
+    }
+
+    return item_count;
+}
+
+/**
+ * @brief Add an entry to a bucket
+ *
+ * @param[in] query The query
+ * @param[in,out] bucket The bucket
+ * @param[in] batch The batch of entries
+ * @param[in] i The index of the entry in the batch
+ */
+static void add_to_bucket(const history_query_t *query, bucket_t *bucket, const void *batch, size_t i) {
+    if (query->log == HISTORY_LOG_LONG_TERM) {
+        // The readings are cumulative, the last one of the bucket is kept
+        bucket->long_term = ((const log_entry_long_term_p1_data_t *)batch)[i];
+    }
+    else {
+        const log_entry_short_term_p1_data_t *entry = &((const log_entry_short_term_p1_data_t *)batch)[i];
+        if (bucket->count == 0) {
+            bucket->short_term.avg_demand_sum = 0;
+            bucket->short_term.avg_demand_max = -FLT_MAX;
+            bucket->short_term.power_usage_sum = 0;
+            bucket->short_term.power_usage_min = FLT_MAX;
+            bucket->short_term.power_usage_max = -FLT_MAX;
+        }
+        bucket->short_term.avg_demand_sum += entry->current_avg_demand;
+        bucket->short_term.power_usage_sum += entry->current_power_usage;
+        if (entry->current_avg_demand > bucket->short_term.avg_demand_max) {
+            bucket->short_term.avg_demand_max = entry->current_avg_demand;
+        }
+        if (entry->current_power_usage < bucket->short_term.power_usage_min) {
+            bucket->short_term.power_usage_min = entry->current_power_usage;
+        }
+        if (entry->current_power_usage > bucket->short_term.power_usage_max) {
+            bucket->short_term.power_usage_max = entry->current_power_usage;
+        }
+    }
+    bucket->count++;
+}
+
+/**
+ * @brief Write a bucket as a JSON object
+ *
+ * @param[in] json The JSON writer
+ * @param[in] query The query
+ * @param[in] bucket The bucket
+ */
+static void write_bucket(json_writer_t *json, const history_query_t *query, const bucket_t *bucket) {
+    json_writer_begin_object(json, NULL);
+    json_writer_add_int(json, "timestamp", bucket->start);
+    if (query->log == HISTORY_LOG_LONG_TERM) {
+        json_writer_add_int(json, "electricityDeliveredTariff1", bucket->long_term.electricity_delivered_tariff1);
+        json_writer_add_int(json, "electricityDeliveredTariff2", bucket->long_term.electricity_delivered_tariff2);
+        json_writer_add_int(json, "electricityReturnedTariff1", bucket->long_term.electricity_returned_tariff1);
+        json_writer_add_int(json, "electricityReturnedTariff2", bucket->long_term.electricity_returned_tariff2);
+    }
+    else {
+        json_writer_add_fixed(json, "avgDemand", bucket->short_term.avg_demand_sum / bucket->count, EMUCS_P1_DECIMALS_POWER);
+        json_writer_add_fixed(json, "powerUsage", bucket->short_term.power_usage_sum / bucket->count, EMUCS_P1_DECIMALS_POWER);
+        if (query->resolution > 1) {
+            json_writer_add_fixed(json, "avgDemandMax", bucket->short_term.avg_demand_max, EMUCS_P1_DECIMALS_POWER);
+            json_writer_add_fixed(json, "powerUsageMin", bucket->short_term.power_usage_min, EMUCS_P1_DECIMALS_POWER);
+            json_writer_add_fixed(json, "powerUsageMax", bucket->short_term.power_usage_max, EMUCS_P1_DECIMALS_POWER);
+        }
+    }
+    json_writer_end_object(json);
+}
@@ -0,0 +1,237 @@
+/**
+ * @file http_cache.c
+ * @brief ETag and conditional GET support for the web server
+ *
+ * Dynamic responses get an ETag derived from the sequence numbers of the data they are rendered from, prefixed with
+ * a random boot id because the sequence numbers restart at every boot. Responses that only change with the firmware
+ * use the ELF hash of the application. Static files use a CRC32 of their content, which is computed on the first
+ * request and remembered (the www partition is read-only at runtime).
+ *
+ * Handlers check If-None-Match before touching any data, so a redundant poll only costs the header parsing.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_app_desc.h"
+#include "esp_rom_crc.h"
+#include "web_server.h"
+#include "http_cache.h"
+
+typedef struct {
+    char path[WEB_SERVER_MAX_FILE_PATH_LEN];    // Path of the file, empty if the slot is free
+    char etag[HTTP_CACHE_ETAG_MAX_LEN];         // ETag of the file
+} file_etag_t;
+
+static const char *TAG = "http_cache";              // Tag used for logging
+static uint32_t boot_id;                            // Random id, different at every boot
+static SemaphoreHandle_t file_etags_mutex;          // Mutex protecting the file ETags
+static file_etag_t file_etags[HTTP_CACHE_MAX_FILES];// Remembered ETags of static files
+
+// Function prototypes
+static esp_err_t compute_file_etag(const char *path, char *etag, size_t len);
+static bool etag_list_contains(char *list, const char *etag);
+
+
+/**
+ * @brief Initialize the HTTP cache support
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t http_cache_init(void) {
+    boot_id = esp_random();
+
+    file_etags_mutex = xSemaphoreCreateMutex();
+    if (file_etags_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create file ETags mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Make an ETag for a response rendered from data identified by (up to) two sequence numbers
+ *
+ * @param[out] etag The buffer for the ETag
+ * @param[in] len The size of the buffer, at least HTTP_CACHE_ETAG_MAX_LEN
+ * @param[in] kind A character identifying the kind of response, so ETags of different endpoints never match
+ * @param[in] a The first sequence number
+ * @param[in] b The second sequence number
+ * @param[in] variant Identifies the representation if the same data can be rendered in different ways, e.g. a hash
+ *                    of the field selection
+ */
+void http_cache_make_sequence_etag(char *etag, size_t len, char kind, uint32_t a, uint32_t b, uint32_t variant) {
+    snprintf(etag, len, "\"%c%08lx-%lx-%lx-%lx\"", kind, boot_id, a, b, variant);
+}
+
+/**
+ * @brief Make an ETag for a response that only changes with the firmware
+ *
+ * @param[out] etag The buffer for the ETag
+ * @param[in] len The size of the buffer, at least HTTP_CACHE_ETAG_MAX_LEN
+ */
+void http_cache_make_firmware_etag(char *etag, size_t len) {
+    char sha[17];
+
+    esp_app_get_elf_sha256(sha, sizeof(sha));
+    snprintf(etag, len, "\"fw-%s\"", sha);
+}
+
+/**
+ * @brief Get the ETag of a static file
+ *
+ * The ETag is computed from the file content on the first call and remembered for later calls.
+ *
+ * @param[in] path The path of the file
+ * @param[out] etag The buffer for the ETag
+ * @param[in] len The size of the buffer, at least HTTP_CACHE_ETAG_MAX_LEN
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the file can't be read
+ */
+esp_err_t http_cache_get_file_etag(const char *path, char *etag, size_t len) {
+    file_etag_t *free_slot = NULL;
+    esp_err_t err;
+
+    xSemaphoreTake(file_etags_mutex, portMAX_DELAY);
+
+    for (size_t i = 0; i < HTTP_CACHE_MAX_FILES; i++) {
+        if (file_etags[i].path[0] == '\0') {
+            if (free_slot == NULL) {
+                free_slot = &file_etags[i];
+            }
+        }
+        else if (strcmp(file_etags[i].path, path) == 0) {
+            strlcpy(etag, file_etags[i].etag, len);
+            xSemaphoreGive(file_etags_mutex);
+            return ESP_OK;
+        }
+    }
+
+    err = compute_file_etag(path, etag, len);
+
+    // Remember the ETag, if there is room left
+    if (err == ESP_OK && free_slot != NULL && strlen(path) < sizeof(free_slot->path)) {
+        strlcpy(free_slot->path, path, sizeof(free_slot->path));
+        strlcpy(free_slot->etag, etag, sizeof(free_slot->etag));
+    }
+
+    xSemaphoreGive(file_etags_mutex);
+
+    return err;
+}
+
+/**
+ * @brief Set the ETag and Cache-Control headers of a response
+ *
+ * @note The header values are not copied, so they must stay valid until the response is sent
+ *
+ * @param[in] req The request handle
+ * @param[in] etag The ETag
+ * @param[in] cache_control The Cache-Control header value
+ * @return ESP_OK on success
+ */
+esp_err_t http_cache_set_validators(httpd_req_t *req, const char *etag, const char *cache_control) {
+    if (httpd_resp_set_hdr(req, "ETag", etag) != ESP_OK
+        || httpd_resp_set_hdr(req, "Cache-Control", cache_control) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set cache headers");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Check if the client already has the current version of a response
+ *
+ * @param[in] req The request handle
+ * @param[in] etag The ETag of the current version
+ * @return True if the If-None-Match header of the request matches the ETag
+ */
+bool http_cache_is_not_modified(httpd_req_t *req, const char *etag) {
+    char if_none_match[HTTP_CACHE_IF_NONE_MATCH_MAX_LEN];
+    size_t len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+
+    if (len == 0 || len >= sizeof(if_none_match)) {
+        return false;
+    }
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) != ESP_OK) {
+        return false;
+    }
+
+    return etag_list_contains(if_none_match, etag);
+}
+
+/**
+ * @brief Send a 304 Not Modified response
+ *
+ * The validators must be set with http_cache_set_validators() first.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+esp_err_t http_cache_send_not_modified(httpd_req_t *req) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/**
+ * @brief Compute the ETag of a file from its size and the CRC32 of its content
+ *
+ * @param[in] path The path of the file
+ * @param[out] etag The buffer for the ETag
+ * @param[in] len The size of the buffer
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the file can't be read
+ */
+static esp_err_t compute_file_etag(const char *path, char *etag, size_t len) {
+    uint8_t buf[HTTP_CACHE_FILE_READ_BUFFER_SIZE];
+    uint32_t crc = 0;
+    size_t size = 0;
+    size_t read;
+    FILE *fp = fopen(path, "rb");
+
+    if (fp == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    while ((read = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        crc = esp_rom_crc32_le(crc, buf, read);
+        size += read;
+    }
+    if (ferror(fp)) {
+        fclose(fp);
+        return ESP_ERR_NOT_FOUND;
+    }
+    fclose(fp);
+
+    snprintf(etag, len, "\"%x-%08lx\"", size, crc);
+    ESP_LOGD(TAG, "ETag of %s: %s", path, etag);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Check if a comma separated list of ETags (an If-None-Match header value) contains an ETag
+ *
+ * Weak ETags (W/ prefix) match their strong counterpart, "*" matches anything.
+ *
+ * @param[in] list The list, modified while parsing
+ * @param[in] etag The ETag to look for
+ * @return True if the list contains the ETag
+ */
+static bool etag_list_contains(char *list, const char *etag) {
+    char *save_ptr;
+
+    for (char *token = strtok_r(list, ", ", &save_ptr); token != NULL; token = strtok_r(NULL, ", ", &save_ptr)) {
+        if (strncmp(token, "W/", 2) == 0) {
+            token += 2;
+        }
+        if (strcmp(token, "*") == 0 || strcmp(token, etag) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,398 @@
+/**
+ * @file http_sessions.c
+ * @brief Connection management of the web server
+ *
+ * httpd has a fixed pool of sockets. When all of them are in use, it stops accepting connections, so new clients wait
+ * until they time out without any trace on the device. Instead, one socket is always kept free: when a new session
+ * fills the pool, the session that has been inactive the longest is closed (LRU eviction), or, with LRU eviction
+ * disabled, the new session is closed right away. Sessions without activity for longer than the idle timeout are
+ * closed as well, so forgotten keep-alive connections don't hold a socket. All of this is counted, see
+ * http_sessions_stats_t.
+ *
+ * A session with a detached request (a parked long-poll, a job queued for a worker) sends nothing until the request is
+ * answered, but it isn't idle. Closing it would let the answer go to whichever client gets the socket next, so these
+ * sessions are never evicted or closed for being idle. long_poll and async_worker report them with
+ * http_sessions_async_begin() and http_sessions_async_end().
+ *
+ * Activity is anything received or sent, so streaming clients (event stream, WebSocket) stay active as long as they
+ * get data. It is tracked by the receive and send functions installed on every session, which also report the send
+ * time to http_stats. The HTTPS listener needs these functions for TLS, so there activity isn't tracked: the web
+ * server disables LRU eviction (a new session is closed when the pool is full) and the idle timeout isn't applied.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "http_stats.h"
+#include "http_sessions.h"
+
+typedef struct {
+    int fd;                                 // Socket of the session, -1 if the slot is free
+    int64_t last_activity;                  // Time of the last receive or send, in microseconds since boot
+    bool closing;                           // The session is being closed by this module
+    uint8_t async_count;                    // Number of detached requests of the session that aren't answered yet
+} session_t;
+
+static const char *TAG = "http_sessions";   // Tag used for logging
+
+static session_t *sessions = NULL;
+static size_t session_count = 0;
+static bool lru_eviction_enabled;
+static int64_t idle_timeout_us;             // 0 if disabled
+static http_sessions_stats_t stats;
+static portMUX_TYPE sessions_lock = portMUX_INITIALIZER_UNLOCKED;   // Protects the sessions and the statistics
+static httpd_handle_t server_handle = NULL;
+static esp_timer_handle_t sweep_timer = NULL;
+
+// Function prototypes
+static int http_sessions_recv(httpd_handle_t hd, int sockfd, char *buf, size_t buf_len, int flags);
+static int http_sessions_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags);
+static session_t *get_session(int fd);
+static void touch(int fd);
+static void sweep_timer_callback(void *arg);
+static void close_idle_sessions(void *arg);
+
+
+/**
+ * @brief Allocate the session table
+ *
+ * @param[in] max_sessions The max number of open sessions, must be the max_open_sockets of the httpd server
+ * @param[in] lru_eviction True to evict the least recently active session when the pool is full, false to close the
+ *                         new session instead
+ * @param[in] idle_timeout_s Time without activity after which a session is closed, 0 to keep idle sessions open
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the table can't be allocated
+ */
+esp_err_t http_sessions_init(size_t max_sessions, bool lru_eviction, uint32_t idle_timeout_s) {
+    sessions = calloc(max_sessions, sizeof(session_t));
+    if (sessions == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the session table");
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < max_sessions; i++) {
+        sessions[i].fd = -1;
+    }
+    session_count = max_sessions;
+    lru_eviction_enabled = lru_eviction;
+#if CONFIG_WEB_SERVER_HTTPS
+    idle_timeout_us = 0;
+    (void)idle_timeout_s;
+#else
+    idle_timeout_us = (int64_t)idle_timeout_s * 1000000;
+#endif
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Start closing the idle sessions of the server
+ *
+ * @param[in] server The httpd server handle
+ * @return ESP_OK on success
+ */
+esp_err_t http_sessions_start(httpd_handle_t server) {
+    esp_timer_create_args_t timer_args = {
+            .callback = sweep_timer_callback,
+            .name = "http_sessions"
+    };
+
+    server_handle = server;
+    if (idle_timeout_us == 0) {
+        return ESP_OK;
+    }
+
+    if (esp_timer_create(&timer_args, &sweep_timer) != ESP_OK
+        || esp_timer_start_periodic(sweep_timer, (uint64_t)HTTP_SESSIONS_SWEEP_INTERVAL_S * 1000000) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the sweep timer");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Session open callback, set as config.open_fn of the httpd server
+ *
+ * Installs the receive and send functions and keeps one socket free, see the file description.
+ *
+ * A rejected session is closed with httpd_sess_trigger_close() instead of by returning an error: esp_https_server
+ * calls this function from its own open function and ignores the result, so the socket would stay open over HTTPS.
+ *
+ * @param[in] hd The httpd server handle
+ * @param[in] sockfd The socket of the new session
+ * @return ESP_OK on success, ESP_FAIL if the receive and send functions can't be installed
+ */
+esp_err_t http_sessions_open(httpd_handle_t hd, int sockfd) {
+    session_t *session;
+    session_t *victim = NULL;
+    int victim_fd = -1;
+    bool full;
+
+    taskENTER_CRITICAL(&sessions_lock);
+    stats.accepted_count++;
+    session = get_session(-1);
+    if (session != NULL) {
+        session->fd = sockfd;
+        session->last_activity = esp_timer_get_time();
+        session->closing = false;
+        session->async_count = 0;
+        stats.open_count++;
+        if (stats.open_count > stats.peak_open_count) {
+            stats.peak_open_count = stats.open_count;
+        }
+    }
+    full = stats.open_count >= session_count;
+
+    // Find the least recently active session without detached requests
+    if (full && lru_eviction_enabled) {
+        for (size_t i = 0; i < session_count; i++) {
+            if (sessions[i].fd >= 0 && sessions[i].fd != sockfd && !sessions[i].closing && sessions[i].async_count == 0
+                && (victim == NULL || sessions[i].last_activity < victim->last_activity)) {
+                victim = &sessions[i];
+            }
+        }
+        if (victim != NULL) {
+            victim->closing = true;
+            victim_fd = victim->fd;
+            stats.evicted_count++;
+        }
+    }
+    if (session == NULL || (full && victim == NULL)) {
+        if (session != NULL) {
+            session->closing = true;
+        }
+        stats.rejected_count++;
+    }
+    taskEXIT_CRITICAL(&sessions_lock);
+
+    if (session == NULL || (full && victim == NULL)) {
+        ESP_LOGW(TAG, "Session pool full, rejecting socket %d", sockfd);
+        httpd_sess_trigger_close(hd, sockfd);
+        return ESP_OK;
+    }
+    if (victim_fd >= 0) {
+        ESP_LOGI(TAG, "Session pool full, evicting socket %d", victim_fd);
+        httpd_sess_trigger_close(hd, victim_fd);
+    }
+
+    // The HTTPS listener sends and receives through TLS, which can't be replaced. There activity isn't tracked and the
+    // send phase isn't measured by http_stats.
+#if !CONFIG_WEB_SERVER_HTTPS
+    if (httpd_sess_set_recv_override(hd, sockfd, http_sessions_recv) != ESP_OK
+        || httpd_sess_set_send_override(hd, sockfd, http_sessions_send) != ESP_OK) {
+        return ESP_FAIL;
+    }
+#endif
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Session close callback, set as config.close_fn of the httpd server
+ *
+ * @param[in] hd The httpd server handle
+ * @param[in] sockfd The socket of the session
+ */
+void http_sessions_close(httpd_handle_t hd, int sockfd) {
+    session_t *session;
+
+    taskENTER_CRITICAL(&sessions_lock);
+    session = get_session(sockfd);
+    if (session != NULL) {
+        session->fd = -1;
+        stats.open_count--;
+    }
+    taskEXIT_CRITICAL(&sessions_lock);
+
+    // httpd leaves closing the socket to the close callback
+    close(sockfd);
+}
+
+/**
+ * @brief Mark a session busy with a detached request, so it isn't evicted or closed for being idle
+ *
+ * @note Call from the handler, before or right after detaching the request with httpd_req_async_handler_begin()
+ *
+ * @param[in] req The request
+ */
+void http_sessions_async_begin(httpd_req_t *req) {
+    int fd = httpd_req_to_sockfd(req);
+    session_t *session;
+
+    taskENTER_CRITICAL(&sessions_lock);
+    session = get_session(fd);
+    if (session != NULL) {
+        session->async_count++;
+    }
+    taskEXIT_CRITICAL(&sessions_lock);
+}
+
+/**
+ * @brief Mark a detached request of a session answered, counts as activity
+ *
+ * @note Call before httpd_req_async_handler_complete(), the request is freed by it
+ *
+ * @param[in] req The detached request
+ */
+void http_sessions_async_end(httpd_req_t *req) {
+    int fd = httpd_req_to_sockfd(req);
+    session_t *session;
+
+    taskENTER_CRITICAL(&sessions_lock);
+    session = get_session(fd);
+    if (session != NULL && session->async_count > 0) {
+        session->async_count--;
+        session->last_activity = esp_timer_get_time();
+    }
+    taskEXIT_CRITICAL(&sessions_lock);
+}
+
+/**
+ * @brief Get a consistent copy of the connection counters
+ *
+ * @param[out] stats_out The counters
+ */
+void http_sessions_get_stats(http_sessions_stats_t *stats_out) {
+    taskENTER_CRITICAL(&sessions_lock);
+    *stats_out = stats;
+    taskEXIT_CRITICAL(&sessions_lock);
+}
+
+/**
+ * @brief Receive function of the sessions, same as the default one of httpd but tracks the activity
+ *
+ * @param[in] hd The httpd server handle
+ * @param[in] sockfd The socket
+ * @param[out] buf The buffer for the received data
+ * @param[in] buf_len The size of the buffer
+ * @param[in] flags Flags for recv()
+ * @return The number of bytes received, or a HTTPD_SOCK_ERR_* code
+ */
+static int http_sessions_recv(httpd_handle_t hd, int sockfd, char *buf, size_t buf_len, int flags) {
+    int ret;
+
+    (void)hd;
+    if (buf == NULL) {
+        return HTTPD_SOCK_ERR_INVALID;
+    }
+
+    ret = recv(sockfd, buf, buf_len, flags);
+    if (ret < 0) {
+        ESP_LOGD(TAG, "Error in recv: %d", errno);
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+
+    if (ret > 0) {
+        touch(sockfd);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Send function of the sessions, same as the default one of httpd but tracks the activity and the send time
+ *
+ * @param[in] hd The httpd server handle
+ * @param[in] sockfd The socket
+ * @param[in] buf The data to send
+ * @param[in] buf_len The length of the data
+ * @param[in] flags Flags for send()
+ * @return The number of bytes sent, or a HTTPD_SOCK_ERR_* code
+ */
+static int http_sessions_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags) {
+    int64_t start_time = esp_timer_get_time();
+    int ret;
+
+    (void)hd;
+    if (buf == NULL) {
+        return HTTPD_SOCK_ERR_INVALID;
+    }
+
+    ret = send(sockfd, buf, buf_len, flags);
+    if (ret < 0) {
+        ESP_LOGD(TAG, "Error in send: %d", errno);
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+
+    http_stats_add_send(ret, (uint32_t)(esp_timer_get_time() - start_time));
+    touch(sockfd);
+
+    return ret;
+}
+
+/**
+ * @brief Find the session of a socket
+ *
+ * @note Must be called with sessions_lock held
+ *
+ * @param[in] fd The socket, or -1 to find a free slot
+ * @return The session, or NULL if there is none
+ */
+static session_t *get_session(int fd) {
+    for (size_t i = 0; i < session_count; i++) {
+        if (sessions[i].fd == fd) {
+            return &sessions[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Record activity on a session
+ *
+ * @param[in] fd The socket of the session
+ */
+static void touch(int fd) {
+    session_t *session;
+
+    taskENTER_CRITICAL(&sessions_lock);
+    session = get_session(fd);
+    if (session != NULL) {
+        session->last_activity = esp_timer_get_time();
+    }
+    taskEXIT_CRITICAL(&sessions_lock);
+}
+
+/**
+ * @brief Sweep timer callback, looks for idle sessions in the httpd task
+ *
+ * @param[in] arg Unused
+ */
+static void sweep_timer_callback(void *arg) {
+    if (httpd_queue_work(server_handle, close_idle_sessions, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to queue the idle session sweep");
+    }
+}
+
+/**
+ * @brief Close the sessions that have been idle for longer than the idle timeout, runs in the httpd task
+ *
+ * @param[in] arg Unused
+ */
+static void close_idle_sessions(void *arg) {
+    int64_t now = esp_timer_get_time();
+    bool idle;
+    int fd;
+
+    // Sessions are only opened and closed in the httpd task, so the sockets don't change during the sweep
+    for (size_t i = 0; i < session_count; i++) {
+        taskENTER_CRITICAL(&sessions_lock);
+        fd = sessions[i].fd;
+        idle = fd >= 0 && !sessions[i].closing && sessions[i].async_count == 0
+               && now - sessions[i].last_activity > idle_timeout_us;
+        if (idle) {
+            sessions[i].closing = true;
+            stats.idle_closed_count++;
+        }
+        taskEXIT_CRITICAL(&sessions_lock);
+
+        if (idle) {
+            ESP_LOGD(TAG, "Closing idle socket %d", fd);
+            httpd_sess_trigger_close(server_handle, fd);
+        }
+    }
+}
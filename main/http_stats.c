@@ -0,0 +1,354 @@
+/**
+ * @file http_stats.c
+ * @brief Per-endpoint latency and throughput statistics of the web server
+ *
+ * URI handlers registered with http_stats_register_uri_handler() are wrapped by a handler that measures every request.
+ * The time of a request is split into phases, so slow responses can be blamed on the right cause:
+ *  - lock wait: waiting for the mutexes taken with http_stats_take() (the P1 telegram, the logs, ...)
+ *  - send: writing to the socket, reported by the send function of the sessions with http_stats_add_send()
+ *  - render: everything else, mainly building the response
+ * The bytes written to the socket are counted with the send time. The HTTPS listener needs its own send function for
+ * TLS, so there the send time is counted as render time and the bytes aren't counted, see http_sessions.c.
+ *
+ * A task handles one request at a time, so the request being measured is looked up by the current task. Requests
+ * handed to an async worker are detached with http_stats_detach() and measured again in the worker, see
+ * async_worker.c. Requests that are parked and answered later from another task (long-poll, event stream) are only
+ * measured until their handler returns.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "http_stats.h"
+
+typedef struct {
+    TaskHandle_t task;                      // Task handling the request, NULL if the slot is free
+    http_stats_endpoint_t *endpoint;        // Endpoint of the request
+    int64_t start_time;                     // Time at which the request started, in microseconds since boot
+    uint32_t lock_wait_us;                  // Time spent waiting for mutexes so far
+    uint32_t send_us;                       // Time spent writing to the socket so far
+    uint32_t bytes_sent;                    // Number of bytes written to the socket so far
+} active_request_t;
+
+static const char *TAG = "http_stats";      // Tag used for logging
+static const uint32_t bucket_limits_us[HTTP_STATS_BUCKET_COUNT - 1] = HTTP_STATS_BUCKET_LIMITS_US;
+
+static http_stats_endpoint_t *endpoints = NULL; // Registered endpoints, in PSRAM
+static size_t endpoint_count = 0;
+static size_t endpoint_capacity = 0;
+static active_request_t active_requests[HTTP_STATS_MAX_ACTIVE];
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;  // Protects the statistics and the active requests
+static esp_timer_handle_t log_timer = NULL;
+
+// Function prototypes
+static esp_err_t http_stats_handler(httpd_req_t *req);
+static active_request_t *get_active_request(TaskHandle_t task);
+static void add_to_histogram(http_stats_histogram_t *histogram, uint32_t latency_us);
+static void log_stats(void *arg);
+
+
+/**
+ * @brief Allocate the endpoint table and start logging the statistics every HTTP_STATS_LOG_INTERVAL_S seconds
+ *
+ * @param[in] max_endpoints The max number of URI handlers that will be registered
+ * @return ESP_OK on success
+ */
+esp_err_t http_stats_init(size_t max_endpoints) {
+    esp_timer_create_args_t timer_args = {
+            .callback = log_stats,
+            .name = "http_stats_log"
+    };
+
+    endpoints = heap_caps_calloc(max_endpoints, sizeof(http_stats_endpoint_t), MALLOC_CAP_SPIRAM);
+    if (endpoints == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the endpoint table");
+        return ESP_ERR_NO_MEM;
+    }
+    endpoint_capacity = max_endpoints;
+
+    if (esp_timer_create(&timer_args, &log_timer) != ESP_OK
+        || esp_timer_start_periodic(log_timer, (uint64_t)HTTP_STATS_LOG_INTERVAL_S * 1000000) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the log timer");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Register an instrumented URI handler, drop-in replacement for httpd_register_uri_handler()
+ *
+ * The actual handler still gets uri->user_ctx as req->user_ctx.
+ *
+ * @note uri->uri must stay valid, it is used as the name of the endpoint
+ *
+ * @param[in] server The httpd server handle
+ * @param[in] uri The URI handler
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the endpoint table is full, or the result of
+ *         httpd_register_uri_handler()
+ */
+esp_err_t http_stats_register_uri_handler(httpd_handle_t server, const httpd_uri_t *uri) {
+    http_stats_endpoint_t *endpoint;
+    httpd_uri_t wrapped_uri;
+    esp_err_t err;
+
+    if (endpoint_count >= endpoint_capacity) {
+        ESP_LOGE(TAG, "Endpoint table full, can't register %s", uri->uri);
+        return ESP_ERR_NO_MEM;
+    }
+
+    endpoint = &endpoints[endpoint_count];
+    endpoint->uri = *uri;
+    wrapped_uri = *uri;
+    wrapped_uri.handler = http_stats_handler;
+    wrapped_uri.user_ctx = endpoint;
+
+    err = httpd_register_uri_handler(server, &wrapped_uri);
+    if (err == ESP_OK) {
+        endpoint_count++;
+    }
+
+    return err;
+}
+
+/**
+ * @brief Start measuring a request in the current task
+ *
+ * @note The request is not measured if every slot is in use
+ *
+ * @param[in] endpoint The endpoint of the request, nothing is measured if NULL
+ */
+void http_stats_begin(http_stats_endpoint_t *endpoint) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    active_request_t *request;
+
+    if (endpoint == NULL) {
+        return;
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    request = get_active_request(NULL);
+    if (request != NULL) {
+        request->task = task;
+        request->endpoint = endpoint;
+        request->start_time = esp_timer_get_time();
+        request->lock_wait_us = 0;
+        request->send_us = 0;
+        request->bytes_sent = 0;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    if (request == NULL) {
+        ESP_LOGW(TAG, "No free slot to measure a request for %s", endpoint->uri.uri);
+    }
+}
+
+/**
+ * @brief Stop measuring the request of the current task and add it to the statistics of its endpoint
+ *
+ * @param[in] err The result of the handler
+ */
+void http_stats_end(esp_err_t err) {
+    active_request_t *request = get_active_request(xTaskGetCurrentTaskHandle());
+    uint32_t total_us;
+    uint32_t render_us;
+    http_stats_t *stats;
+
+    if (request == NULL) {
+        return;
+    }
+
+    total_us = (uint32_t)(esp_timer_get_time() - request->start_time);
+    render_us = total_us > request->lock_wait_us + request->send_us
+            ? total_us - request->lock_wait_us - request->send_us : 0;
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats = &request->endpoint->stats;
+    stats->request_count++;
+    if (err != ESP_OK) {
+        stats->error_count++;
+    }
+    stats->bytes_sent += request->bytes_sent;
+    add_to_histogram(&stats->total, total_us);
+    add_to_histogram(&stats->phases[HTTP_STATS_PHASE_LOCK_WAIT], request->lock_wait_us);
+    add_to_histogram(&stats->phases[HTTP_STATS_PHASE_RENDER], render_us);
+    add_to_histogram(&stats->phases[HTTP_STATS_PHASE_SEND], request->send_us);
+    request->task = NULL;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief Stop measuring the request of the current task without adding it to the statistics
+ *
+ * Used when the request is handed to another task, which measures it with http_stats_begin() and http_stats_end().
+ *
+ * @return The endpoint of the request, or NULL if it wasn't measured
+ */
+http_stats_endpoint_t *http_stats_detach(void) {
+    active_request_t *request = get_active_request(xTaskGetCurrentTaskHandle());
+    http_stats_endpoint_t *endpoint;
+
+    if (request == NULL) {
+        return NULL;
+    }
+
+    endpoint = request->endpoint;
+    taskENTER_CRITICAL(&stats_lock);
+    request->task = NULL;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    return endpoint;
+}
+
+/**
+ * @brief Take a mutex, the time spent waiting counts as lock wait of the request of the current task
+ *
+ * Same as xSemaphoreTake() when the current task isn't handling a request.
+ *
+ * @param[in] mutex The mutex
+ * @param[in] timeout The max time to wait
+ * @return pdTRUE if the mutex was taken
+ */
+BaseType_t http_stats_take(SemaphoreHandle_t mutex, TickType_t timeout) {
+    active_request_t *request = get_active_request(xTaskGetCurrentTaskHandle());
+    int64_t start_time;
+    BaseType_t ret;
+
+    if (request == NULL) {
+        return xSemaphoreTake(mutex, timeout);
+    }
+
+    start_time = esp_timer_get_time();
+    ret = xSemaphoreTake(mutex, timeout);
+    request->lock_wait_us += (uint32_t)(esp_timer_get_time() - start_time);
+
+    return ret;
+}
+
+/**
+ * @brief Add data written to the socket to the request of the current task
+ *
+ * Called by the send function of the sessions. Data sent outside of a request (e.g. events pushed to the stream
+ * clients) isn't counted.
+ *
+ * @param[in] bytes The number of bytes written
+ * @param[in] send_us The time it took to write them
+ */
+void http_stats_add_send(size_t bytes, uint32_t send_us) {
+    active_request_t *request = get_active_request(xTaskGetCurrentTaskHandle());
+
+    if (request != NULL) {
+        request->send_us += send_us;
+        request->bytes_sent += bytes;
+    }
+}
+
+/**
+ * @brief Get the number of registered endpoints
+ *
+ * @return The number of endpoints
+ */
+size_t http_stats_get_endpoint_count(void) {
+    return endpoint_count;
+}
+
+/**
+ * @brief Get an endpoint and a consistent copy of its statistics
+ *
+ * @param[in] index The index of the endpoint, in order of registration
+ * @param[out] stats The statistics
+ * @return The endpoint, or NULL if the index is out of range
+ */
+const http_stats_endpoint_t *http_stats_get(size_t index, http_stats_t *stats) {
+    if (index >= endpoint_count) {
+        return NULL;
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    *stats = endpoints[index].stats;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    return &endpoints[index];
+}
+
+/**
+ * @brief URI handler that measures the actual handler of the endpoint passed as user_ctx
+ *
+ * @param[in] req The request handle
+ * @return The result of the actual handler
+ */
+static esp_err_t http_stats_handler(httpd_req_t *req) {
+    http_stats_endpoint_t *endpoint = (http_stats_endpoint_t *)req->user_ctx;
+    esp_err_t err;
+
+    req->user_ctx = endpoint->uri.user_ctx;
+    http_stats_begin(endpoint);
+    err = endpoint->uri.handler(req);
+    http_stats_end(err);
+
+    return err;
+}
+
+/**
+ * @brief Find the request handled by a task
+ *
+ * @note Only the task itself claims or frees its slot, so a task can look up its own request without the lock
+ *
+ * @param[in] task The task, or NULL to find a free slot
+ * @return The request, or NULL if there is none
+ */
+static active_request_t *get_active_request(TaskHandle_t task) {
+    for (size_t i = 0; i < HTTP_STATS_MAX_ACTIVE; i++) {
+        if (active_requests[i].task == task) {
+            return &active_requests[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Add a latency to a histogram
+ *
+ * @param[in,out] histogram The histogram
+ * @param[in] latency_us The latency in microseconds
+ */
+static void add_to_histogram(http_stats_histogram_t *histogram, uint32_t latency_us) {
+    size_t bucket = 0;
+
+    while (bucket < HTTP_STATS_BUCKET_COUNT - 1 && latency_us > bucket_limits_us[bucket]) {
+        bucket++;
+    }
+    histogram->buckets[bucket]++;
+    histogram->total_us += latency_us;
+    if (latency_us > histogram->max_us) {
+        histogram->max_us = latency_us;
+    }
+}
+
+/**
+ * @brief Log the statistics of every endpoint that handled a request, called by the log timer
+ *
+ * @param[in] arg Unused
+ */
+static void log_stats(void *arg) {
+    http_stats_t stats;
+    const http_stats_endpoint_t *endpoint;
+    uint32_t avg_us[HTTP_STATS_PHASE_COUNT];
+
+    for (size_t i = 0; (endpoint = http_stats_get(i, &stats)) != NULL; i++) {
+        if (stats.request_count == 0) {
+            continue;
+        }
+        for (size_t phase = 0; phase < HTTP_STATS_PHASE_COUNT; phase++) {
+            avg_us[phase] = (uint32_t)(stats.phases[phase].total_us / stats.request_count);
+        }
+        ESP_LOGI(TAG, "%s %s: %lu requests (%lu errors), %llu bytes, avg %lu us (lock %lu, render %lu, send %lu), "
+                      "max %lu us", http_method_str(endpoint->uri.method), endpoint->uri.uri, stats.request_count,
+                 stats.error_count, stats.bytes_sent, (uint32_t)(stats.total.total_us / stats.request_count),
+                 avg_us[HTTP_STATS_PHASE_LOCK_WAIT], avg_us[HTTP_STATS_PHASE_RENDER], avg_us[HTTP_STATS_PHASE_SEND],
+                 stats.total.max_us);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define ASSET_BUNDLE_MAGIC 0x4241574B           // "KWAB"
+#define ASSET_BUNDLE_VERSION 1
+#define ASSET_BUNDLE_EMPTY_SLOT 0xFFFF          // Value of an unused hash table slot
+
+/**
+ * @brief Layout of the asset bundle, as written by tools/pack_frontend.py
+ *
+ * The bundle starts with the header, followed by the hash table (table_size slots of uint16_t, each holding an
+ * entry index or ASSET_BUNDLE_EMPTY_SLOT) and entry_count entries. Paths are zero terminated strings, offsets are
+ * relative to the start of the bundle. All integers are little endian.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_count;
+    uint16_t table_size;                        // Number of hash table slots, a power of two
+    uint16_t reserved;
+    uint32_t size;                              // Size of the whole bundle
+} asset_bundle_header_t;
+
+typedef struct {
+    uint32_t path_hash;                         // FNV-1a hash of the path
+    uint32_t path_offset;
+    uint32_t data_offset;
+    uint32_t data_size;
+    uint32_t data_crc;
+    uint32_t gzip_offset;
+    uint32_t gzip_size;                         // 0 if there is no gzip variant
+    uint32_t gzip_crc;
+} asset_bundle_entry_t;
+
+typedef struct {
+    const uint8_t *data;                        // Points into the memory-mapped partition
+    size_t size;
+    uint32_t crc;                               // CRC32 of the data, used for the ETag
+} asset_bundle_blob_t;
+
+typedef struct {
+    asset_bundle_blob_t identity;
+    asset_bundle_blob_t gzip;                   // data is NULL if there is no gzip variant
+} asset_bundle_asset_t;
+
+// Function prototypes
+esp_err_t asset_bundle_init(const char *partition_label);
+bool asset_bundle_is_mounted(void);
+esp_err_t asset_bundle_find(const char *path, size_t path_len, asset_bundle_asset_t *asset);
+
+#endif //ASSET_BUNDLE_H
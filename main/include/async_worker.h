@@ -0,0 +1,46 @@
+#ifndef ASYNC_WORKER_H
+#define ASYNC_WORKER_H
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "emucs_p1.h"
+
+#define ASYNC_WORKER_COUNT 2                    // Number of worker tasks
+#define ASYNC_WORKER_QUEUE_SIZE 4               // Max number of requests waiting for a worker, more are answered with 503
+#define ASYNC_WORKER_TASK_STACK_SIZE 6144
+#define ASYNC_WORKER_TASK_PRIORITY 5
+#define ASYNC_WORKER_RETRY_AFTER_S "1"          // Retry-After header value of a 503 response
+#ifdef CONFIG_FREERTOS_UNICORE
+#define ASYNC_WORKER_TASK_CORE tskNO_AFFINITY
+#else
+#define ASYNC_WORKER_TASK_CORE (1 - EMUCS_P1_TASK_CORE) // Keep the workers off the core that reads the P1 port
+#endif
+
+/**
+ * Statistics of an endpoint handled by the worker pool
+ */
+typedef struct {
+    uint32_t request_count;                     // Number of requests handled
+    uint32_t rejected_count;                    // Number of requests answered with 503 because the queue was full
+    uint64_t total_wait_time_us;                // Sum of the time requests waited in the queue
+    uint32_t max_wait_time_us;                  // Max time a request waited in the queue
+} async_worker_stats_t;
+
+/**
+ * An endpoint whose requests are handled by the worker pool, passed as user_ctx of the URI handler
+ */
+typedef struct {
+    const char *name;                           // Name of the endpoint in the statistics, e.g. its URI
+    esp_err_t (*handler)(httpd_req_t *req);     // The actual handler, runs in a worker task with a request arena
+    async_worker_stats_t stats;                 // Updated by the pool, read with async_worker_get_stats()
+} async_worker_endpoint_t;
+
+// Function prototypes
+esp_err_t async_worker_init(void);
+esp_err_t async_worker_handler(httpd_req_t *req);
+uint32_t async_worker_get_queue_length(void);
+void async_worker_get_stats(const async_worker_endpoint_t *endpoint, async_worker_stats_t *stats);
+
+#endif //ASYNC_WORKER_H
@@ -0,0 +1,54 @@
+#ifndef CHUNK_WRITER_H
+#define CHUNK_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "shared_buffer.h"
+
+#define CHUNK_WRITER_BUFFER_SIZE 256    // Size of the buffer that is filled before it is flushed
+#define CHUNK_WRITER_MAX_DECIMALS 6     // Max number of decimals supported by chunk_writer_write_fixed()
+
+typedef struct chunk_writer_s chunk_writer_t;
+
+/**
+ * Flush function of a chunk writer.
+ * Called with the buffered data when the buffer is full, and with final set to true when the writer is finished.
+ */
+typedef esp_err_t (*chunk_writer_flush_fn_t)(chunk_writer_t *w, const char *data, size_t len, bool final);
+
+/**
+ * Close function of a chunk writer.
+ * Called by chunk_writer_finish(), also after an error, to release the resources held by the flush context.
+ */
+typedef void (*chunk_writer_close_fn_t)(chunk_writer_t *w);
+
+/**
+ * Buffered writer that flushes its contents in fixed size chunks.
+ * Errors are sticky: after the first failed flush all writes are ignored and chunk_writer_finish() returns the error.
+ */
+struct chunk_writer_s {
+    char buf[CHUNK_WRITER_BUFFER_SIZE];     // Data that hasn't been flushed yet
+    size_t len;                             // Number of bytes in buf
+    size_t bytes_flushed;                   // Number of bytes flushed so far
+    chunk_writer_flush_fn_t flush_fn;       // Function called to flush the buffer
+    void *flush_ctx;                        // Context for the flush function (e.g. the httpd request)
+    chunk_writer_close_fn_t close_fn;       // Function called when the writer is finished, NULL if not needed
+    esp_err_t err;                          // First error that occurred, ESP_OK if none
+};
+
+// Function prototypes
+void chunk_writer_init(chunk_writer_t *w, chunk_writer_flush_fn_t flush_fn, void *flush_ctx);
+void chunk_writer_init_httpd(chunk_writer_t *w, httpd_req_t *req);
+void chunk_writer_init_shared_buffer(chunk_writer_t *w, shared_buffer_t *buf);
+void chunk_writer_write(chunk_writer_t *w, const char *data, size_t len);
+void chunk_writer_write_str(chunk_writer_t *w, const char *str);
+void chunk_writer_write_char(chunk_writer_t *w, char c);
+void chunk_writer_write_int(chunk_writer_t *w, int64_t value);
+void chunk_writer_write_fixed(chunk_writer_t *w, double value, uint8_t decimals);
+esp_err_t chunk_writer_flush(chunk_writer_t *w);
+esp_err_t chunk_writer_finish(chunk_writer_t *w);
+
+#endif //CHUNK_WRITER_H
@@ -7,9 +7,40 @@
 #include "freertos/event_groups.h"
 #include "esp_system.h"
 #include "driver/uart.h"
+#include "shared_buffer.h"
 
 #define EMUCS_P1_TELEGRAM_INTERVAL_MS 1000  // Interval between P1 telegrams in ms
-#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_BIT BIT0
+#ifdef CONFIG_FREERTOS_UNICORE
+#define EMUCS_P1_TASK_CORE 0
+#else
+#define EMUCS_P1_TASK_CORE 1                // Core the P1 reader task is pinned to, away from the Wi-Fi and lwIP tasks
+#endif
+// Event bits, every consumer of new telegrams has its own bit, so it can clear it independently of the others
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_BIT BIT0          // Consumed by the logger task
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_STREAM_BIT BIT1   // Consumed by the event stream task
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_WS_BIT BIT2       // Consumed by the WebSocket telemetry task
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_LONG_POLL_BIT BIT3 // Consumed by the long-poll task
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_MQTT_BIT BIT4      // Consumed by the MQTT publisher task
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_UDP_BIT BIT5       // Consumed by the UDP multicast task
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_PASSTHROUGH_BIT BIT6 // Consumed by the P1 passthrough task
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_MODBUS_BIT BIT7    // Consumed by the Modbus TCP task
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_ALL_BITS (EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_BIT \
+                                                    | EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_STREAM_BIT \
+                                                    | EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_WS_BIT \
+                                                    | EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_LONG_POLL_BIT \
+                                                    | EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_MQTT_BIT \
+                                                    | EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_UDP_BIT \
+                                                    | EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_PASSTHROUGH_BIT \
+                                                    | EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_MODBUS_BIT)
+#define EMUCS_P1_MAX_DEMAND_YEAR_MONTHS 13  // Number of months in the max demand history
+// A copy of every telegram as received is only kept for the services that send it on as is
+#define EMUCS_P1_RAW_TELEGRAM (CONFIG_UDP_MULTICAST || CONFIG_P1_PASSTHROUGH)
+
+// Number of decimals the meter reports values with (DSMR 5.0 resolution)
+#define EMUCS_P1_DECIMALS_ENERGY 3  // kWh
+#define EMUCS_P1_DECIMALS_POWER 3   // kW
+#define EMUCS_P1_DECIMALS_VOLTAGE 1 // V
+#define EMUCS_P1_DECIMALS_CURRENT 2 // A
 
 typedef enum emucs_p1_breaker_state_e {
     EMUCS_P1_BREAKER_STATE_DISCONNECTED = 0,
@@ -28,14 +59,14 @@ typedef struct {
     float electricity_returned_tariff2;     //  1-0:2.8.2   kWh     Meter reading electricity delivered by client (Tariff 2)
     uint16_t tariff_indicator;              //  0-0:96.14.0 -       Tariff indicator electricity (1=High, 2=Low)
     float current_avg_demand;               //  1-0:1.4.0   kW      Current average demand - Active energy import
-    struct {                                //  1-0:1.6.0   -      Maximum demand - Active energy import of the running month
+    struct emucs_p1_max_demand_month_s {    //  1-0:1.6.0   -      Maximum demand - Active energy import of the running month
         time_t timestamp;
         float max_demand;   // kW
     } max_demand_month;
-    struct {                                //  0-0:89.1.0   kW      Maximum demand - Active energy import of the last 13 months
+    struct emucs_p1_max_demand_s {          //  0-0:89.1.0   kW      Maximum demand - Active energy import of the last 13 months
         time_t timestamp_appearance;
         float max_demand;   // kW
-    } max_demand_year[13];
+    } max_demand_year[EMUCS_P1_MAX_DEMAND_YEAR_MONTHS];
     float current_power_usage;              //  1-0:1.7.0   kW      Actual electricity power delivered to client from the grid (+P)
     float current_power_return;             //  1-0:2.7.0   kW      Actual electricity power injected by client in the grid (-P)
     float current_power_usage_l1;           //  1-0:21.7.0  kW      Instantaneous active power L1 (+P)
@@ -56,12 +87,31 @@ typedef struct {
     // char text_message[1024+1];           //  0-0:96.13.0 -       Text message (max 1024 characters) (not implemented)
 } emucs_p1_data_t;
 
+/**
+ * Health counters of the P1 reader, since boot
+ */
+typedef struct {
+    uint32_t telegram_count;                // Number of telegrams parsed
+    uint32_t crc_error_count;               // Number of telegrams dropped because of a CRC mismatch
+    uint32_t uart_buffer_full_count;        // Number of times the UART ring buffer was full
+    uint32_t uart_fifo_overflow_count;      // Number of times the UART hardware FIFO overflowed
+    uint32_t uart_frame_error_count;        // Number of UART frame errors
+    uint32_t buffer_overflow_count;         // Number of times a telegram didn't fit in the telegram buffer
+    uint32_t last_parse_time_us;            // Time it took to check and parse the last telegram
+    uint32_t max_parse_time_us;             // Max time it took to check and parse a telegram
+} emucs_p1_stats_t;
+
 
 // Function prototypes
 _Noreturn void emucs_p1_task(void *pvParameters);
 emucs_p1_data_t * emucs_p1_get_telegram(void);
 SemaphoreHandle_t emucs_p1_get_telegram_mutex_handle(void);
 EventGroupHandle_t emucs_p1_get_event_group_handle(void);
+uint32_t emucs_p1_get_telegram_sequence(void);
+void emucs_p1_get_stats(emucs_p1_stats_t *stats);
+#if EMUCS_P1_RAW_TELEGRAM
+shared_buffer_t * emucs_p1_get_raw_telegram(uint32_t *sequence);
+#endif
 
 
 #endif // EMUCS_P1_H
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef EVENT_STREAM_H
+#define EVENT_STREAM_H
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define EVENT_STREAM_MAX_CLIENTS 8                  // Max number of simultaneously connected clients
+#define EVENT_STREAM_FRAME_BUFFER_SIZE 3072         // Max size of a single event (all fields)
+#define EVENT_STREAM_FLUSH_INTERVAL_MS 50           // Interval at which sending is retried for clients with pending data
+#define EVENT_STREAM_KEEP_ALIVE_INTERVAL_MS 15000   // Max time without sending anything to a client
+#define EVENT_STREAM_TASK_STACK_SIZE 4096
+#define EVENT_STREAM_TASK_PRIORITY 5
+
+// Function prototypes
+esp_err_t event_stream_init(httpd_handle_t server);
+esp_err_t event_stream_get_handler(httpd_req_t *req);
+
+#endif //EVENT_STREAM_H
@@ -0,0 +1,20 @@
+#ifndef GZIP_WRITER_H
+#define GZIP_WRITER_H
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "chunk_writer.h"
+
+#define GZIP_WRITER_LEVEL 1                 // Compression level, 1 (fastest) to 10 (smallest), 0 stores the data
+#define GZIP_WRITER_MAX_STREAMS 2           // Max number of responses compressed at the same time
+#define GZIP_WRITER_MAX_WAIT_MS 1000        // Max time to wait for a free compressor, the response is sent uncompressed otherwise
+#define GZIP_WRITER_OUT_BUFFER_SIZE 1024    // Compressed data is sent in chunks of this size
+#define GZIP_WRITER_MAX_ACCEPT_ENCODING_LEN 128
+
+// Function prototypes
+esp_err_t gzip_writer_init(void);
+bool gzip_writer_is_accepted(httpd_req_t *req);
+esp_err_t gzip_writer_init_httpd(chunk_writer_t *w, httpd_req_t *req);
+
+#endif //GZIP_WRITER_H
@@ -0,0 +1,21 @@
+#ifndef HA_DISCOVERY_H
+#define HA_DISCOVERY_H
+
+#include <stddef.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+#include "mqtt_publisher.h"
+
+#define HA_DISCOVERY_PREFIX "homeassistant"                         // Discovery prefix configured in Home Assistant
+#define HA_DISCOVERY_STATUS_TOPIC HA_DISCOVERY_PREFIX "/status"     // Home Assistant publishes "online" here when it starts
+#define HA_DISCOVERY_MAX_TOPIC_LEN 128
+#define HA_DISCOVERY_MAX_CONFIG_SIZE 768                            // Max size of the config of one sensor
+#define HA_DISCOVERY_DEVICE_NAME "Kwartiwi"
+#define HA_DISCOVERY_DEVICE_MODEL "P1 reader"
+
+// Function prototypes
+esp_err_t ha_discovery_init(const mqtt_publisher_field_t *fields, size_t field_count);
+void ha_discovery_connected(esp_mqtt_client_handle_t client);
+void ha_discovery_data(esp_mqtt_client_handle_t client, esp_mqtt_event_handle_t event);
+
+#endif //HA_DISCOVERY_H
@@ -0,0 +1,38 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+#include "json_writer.h"
+#include "logger.h"
+
+#define HISTORY_MAX_LIMIT LOGGER_SHORT_TERM_LOG_SIZE            // Max number of points in one response
+#define HISTORY_MAX_RESOLUTION_S (24 * 60 * 60)                 // Max width of a point
+#define HISTORY_LONG_TERM_PERIOD_S (15 * 60)                    // Time covered by a long term log entry
+#define HISTORY_BATCH_SIZE 32                                   // Number of log entries copied at once
+#define HISTORY_MAX_TIMEOUT_MS 1000                             // Max time to wait for the log mutexes
+#define HISTORY_CURSOR_MAX_LEN 24                               // Max length of a cursor, including null terminator
+
+typedef enum {
+    HISTORY_LOG_SHORT_TERM = 's',   // Entry every telegram, averaged per bucket
+    HISTORY_LOG_LONG_TERM = 'l',    // Entry every quarter-hour (rollup), last reading per bucket
+} history_log_t;
+
+/**
+ * Query on one of the logs.
+ */
+typedef struct {
+    history_log_t log;      // The log to query
+    uint32_t index;         // Absolute log index of the first entry to include (see logger.h)
+    uint32_t limit;         // Max number of points to return
+    uint32_t resolution;    // Width of a point in seconds
+} history_query_t;
+
+// Function prototypes
+esp_err_t history_prepare_query(history_query_t *query, time_t since, uint32_t points);
+esp_err_t history_parse_cursor(const char *cursor, history_query_t *query);
+void history_format_cursor(const history_query_t *query, uint32_t next_index, char *cursor, size_t len);
+esp_err_t history_write_points(json_writer_t *json, const history_query_t *query, uint32_t *next_index);
+
+#endif //HISTORY_H
@@ -0,0 +1,25 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define HTTP_CACHE_ETAG_MAX_LEN 48                  // Max length of an ETag, including the quotes and null terminator
+#define HTTP_CACHE_IF_NONE_MATCH_MAX_LEN 256        // Longer If-None-Match headers are treated as not matching
+#define HTTP_CACHE_MAX_FILES 16                     // Max number of static files of which the ETag is remembered
+#define HTTP_CACHE_FILE_READ_BUFFER_SIZE 512
+#define HTTP_CACHE_CONTROL_REVALIDATE "no-cache"                    // API responses and html pages: always revalidate
+#define HTTP_CACHE_CONTROL_STATIC "public, max-age=604800"          // Other static files: cache for a week
+
+// Function prototypes
+esp_err_t http_cache_init(void);
+void http_cache_make_sequence_etag(char *etag, size_t len, char kind, uint32_t a, uint32_t b, uint32_t variant);
+void http_cache_make_firmware_etag(char *etag, size_t len);
+esp_err_t http_cache_get_file_etag(const char *path, char *etag, size_t len);
+esp_err_t http_cache_set_validators(httpd_req_t *req, const char *etag, const char *cache_control);
+bool http_cache_is_not_modified(httpd_req_t *req, const char *etag);
+esp_err_t http_cache_send_not_modified(httpd_req_t *req);
+
+#endif //HTTP_CACHE_H
@@ -0,0 +1,33 @@
+#ifndef HTTP_SESSIONS_H
+#define HTTP_SESSIONS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define HTTP_SESSIONS_SWEEP_INTERVAL_S 10       // Interval at which idle sessions are looked for
+
+/**
+ * Connection counters of the web server
+ */
+typedef struct {
+    uint32_t accepted_count;                    // Number of connections accepted
+    uint32_t rejected_count;                    // Number of connections closed right away because the pool was full
+    uint32_t evicted_count;                     // Number of sessions closed to make room for a new connection
+    uint32_t idle_closed_count;                 // Number of sessions closed because they were idle for too long
+    uint32_t open_count;                        // Number of sessions that are open
+    uint32_t peak_open_count;                   // Max number of sessions that were open at the same time
+} http_sessions_stats_t;
+
+// Function prototypes
+esp_err_t http_sessions_init(size_t max_sessions, bool lru_eviction, uint32_t idle_timeout_s);
+esp_err_t http_sessions_start(httpd_handle_t server);
+esp_err_t http_sessions_open(httpd_handle_t hd, int sockfd);
+void http_sessions_close(httpd_handle_t hd, int sockfd);
+void http_sessions_async_begin(httpd_req_t *req);
+void http_sessions_async_end(httpd_req_t *req);
+void http_sessions_get_stats(http_sessions_stats_t *stats);
+
+#endif //HTTP_SESSIONS_H
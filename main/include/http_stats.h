@@ -0,0 +1,66 @@
+#ifndef HTTP_STATS_H
+#define HTTP_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "async_worker.h"
+
+#define HTTP_STATS_BUCKET_COUNT 8                   // Number of buckets of a latency histogram
+#define HTTP_STATS_BUCKET_LIMITS_US {1000, 5000, 10000, 50000, 100000, 500000, 1000000} // Upper limits, the last bucket has none
+#define HTTP_STATS_MAX_ACTIVE (1 + ASYNC_WORKER_COUNT)  // One request in the httpd task and one per async worker
+#define HTTP_STATS_LOG_INTERVAL_S 300               // Interval at which the statistics are logged
+
+/**
+ * Phases of a request
+ */
+typedef enum {
+    HTTP_STATS_PHASE_LOCK_WAIT,                     // Waiting for a mutex taken with http_stats_take()
+    HTTP_STATS_PHASE_RENDER,                        // Everything else: parsing, building the response, ...
+    HTTP_STATS_PHASE_SEND,                          // Writing to the socket
+    HTTP_STATS_PHASE_COUNT
+} http_stats_phase_t;
+
+/**
+ * Latency histogram
+ */
+typedef struct {
+    uint32_t buckets[HTTP_STATS_BUCKET_COUNT];      // Number of requests per bucket, see HTTP_STATS_BUCKET_LIMITS_US
+    uint64_t total_us;                              // Sum of the latencies
+    uint32_t max_us;                                // Max latency
+} http_stats_histogram_t;
+
+/**
+ * Statistics of an endpoint
+ */
+typedef struct {
+    uint32_t request_count;                         // Number of requests handled
+    uint32_t error_count;                           // Number of requests for which the handler returned an error
+    uint64_t bytes_sent;                            // Number of bytes written to the socket, headers included
+    http_stats_histogram_t total;                   // Latency of the whole request
+    http_stats_histogram_t phases[HTTP_STATS_PHASE_COUNT];  // Time spent per phase
+} http_stats_t;
+
+/**
+ * An instrumented URI handler, passed as user_ctx of the registered handler
+ */
+typedef struct {
+    httpd_uri_t uri;                                // The registered URI, with the actual handler and user_ctx
+    http_stats_t stats;                             // Updated per request, read with http_stats_get()
+} http_stats_endpoint_t;
+
+// Function prototypes
+esp_err_t http_stats_init(size_t max_endpoints);
+esp_err_t http_stats_register_uri_handler(httpd_handle_t server, const httpd_uri_t *uri);
+void http_stats_begin(http_stats_endpoint_t *endpoint);
+void http_stats_end(esp_err_t err);
+http_stats_endpoint_t *http_stats_detach(void);
+BaseType_t http_stats_take(SemaphoreHandle_t mutex, TickType_t timeout);
+void http_stats_add_send(size_t bytes, uint32_t send_us);
+size_t http_stats_get_endpoint_count(void);
+const http_stats_endpoint_t *http_stats_get(size_t index, http_stats_t *stats);
+
+#endif //HTTP_STATS_H
@@ -0,0 +1,36 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "chunk_writer.h"
+
+#define JSON_WRITER_MAX_DEPTH 16    // Max nesting depth of objects and arrays
+
+/**
+ * Streaming JSON writer.
+ * Writes compact JSON directly into a chunk writer, without building a document tree first.
+ * Keys are passed to every add/begin function; pass NULL for array elements and for the root value.
+ */
+typedef struct {
+    chunk_writer_t out;         // Writer the JSON is written to
+    uint8_t depth;              // Current nesting depth
+    uint32_t has_members;       // Bit n is set if a value has already been written at depth n (a comma is needed)
+} json_writer_t;
+
+// Function prototypes
+void json_writer_init_httpd(json_writer_t *w, httpd_req_t *req);
+void json_writer_init_shared_buffer(json_writer_t *w, shared_buffer_t *buf);
+void json_writer_begin_object(json_writer_t *w, const char *key);
+void json_writer_end_object(json_writer_t *w);
+void json_writer_begin_array(json_writer_t *w, const char *key);
+void json_writer_end_array(json_writer_t *w);
+void json_writer_add_string(json_writer_t *w, const char *key, const char *value);
+void json_writer_add_int(json_writer_t *w, const char *key, int64_t value);
+void json_writer_add_fixed(json_writer_t *w, const char *key, double value, uint8_t decimals);
+void json_writer_add_bool(json_writer_t *w, const char *key, bool value);
+esp_err_t json_writer_finish(json_writer_t *w);
+
+#endif //JSON_WRITER_H
@@ -29,6 +29,14 @@ typedef struct {
 _Noreturn void logger_task(void *pvParameters);
 size_t logger_get_short_term_log_items(log_entry_short_term_p1_data_t *log, size_t max_items);
 size_t logger_get_long_term_log_items(log_entry_long_term_p1_data_t *log, size_t max_items);
+uint32_t logger_get_short_term_log_first_index(void);
+uint32_t logger_get_short_term_log_end_index(void);
+uint32_t logger_find_short_term_log_index(time_t timestamp);
+size_t logger_read_short_term_log_items(uint32_t *index, log_entry_short_term_p1_data_t *log, size_t max_items);
+uint32_t logger_get_long_term_log_first_index(void);
+uint32_t logger_get_long_term_log_end_index(void);
+uint32_t logger_find_long_term_log_index(time_t timestamp);
+size_t logger_read_long_term_log_items(uint32_t *index, log_entry_long_term_p1_data_t *log, size_t max_items);
 SemaphoreHandle_t logger_get_short_term_log_mutex_handle(void);
 SemaphoreHandle_t logger_get_long_term_log_mutex_handle(void);
 
@@ -0,0 +1,19 @@
+#ifndef LONG_POLL_H
+#define LONG_POLL_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define LONG_POLL_MAX_PARKED 8                  // Max number of requests waiting for a telegram at the same time
+#define LONG_POLL_DEFAULT_TIMEOUT_S 25          // Time a request waits for a newer telegram, if not given by the client
+#define LONG_POLL_MAX_TIMEOUT_S 60              // Max time a request can wait for a newer telegram
+#define LONG_POLL_CHECK_INTERVAL_MS 1000        // Interval at which expired requests are answered
+#define LONG_POLL_TASK_STACK_SIZE 4096
+#define LONG_POLL_TASK_PRIORITY 5
+
+// Function prototypes
+esp_err_t long_poll_init(void);
+esp_err_t long_poll_handle_request(httpd_req_t *req, uint32_t after, uint32_t timeout_s, uint64_t field_mask);
+
+#endif //LONG_POLL_H
@@ -0,0 +1,102 @@
+#ifndef METER_DATA_H
+#define METER_DATA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "emucs_p1.h"
+#include "predict_peak.h"
+#include "json_writer.h"
+
+/**
+ * Consistent copy of the telegram and the predicted peak.
+ */
+typedef struct {
+    emucs_p1_data_t p1;                         // The parsed telegram
+    struct predicted_peak_s predicted_peak;     // The predicted peak
+    uint32_t telegram_sequence;                 // Sequence number of the telegram
+    uint32_t predicted_peak_sequence;           // Sequence number of the predicted peak
+} meter_data_t;
+
+typedef enum {
+    METER_DATA_FIELD_TYPE_FLOAT,            // float
+    METER_DATA_FIELD_TYPE_TIMESTAMP,        // time_t
+    METER_DATA_FIELD_TYPE_MAX_DEMAND,       // Maximum demand (timestamp and demand)
+    METER_DATA_FIELD_TYPE_MAX_DEMAND_YEAR,  // Maximum demand of the last months (array of timestamp and demand)
+    METER_DATA_FIELD_TYPE_UINT32,           // uint32_t
+    METER_DATA_FIELD_TYPE_UINT16,           // uint16_t
+    METER_DATA_FIELD_TYPE_ENUM,             // enum (int)
+    METER_DATA_FIELD_TYPE_STRING,           // Null terminated char array
+} meter_data_field_type_t;
+
+/**
+ * Fields of meter_data_t that can be exposed through the API.
+ * The order determines the order in the JSON output.
+ */
+typedef enum {
+    METER_DATA_FIELD_VERSION_INFO = 0,
+    METER_DATA_FIELD_EQUIPMENT_ID,
+    METER_DATA_FIELD_TIMESTAMP,
+    METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF1,
+    METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF2,
+    METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF1,
+    METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF2,
+    METER_DATA_FIELD_TARIFF_INDICATOR,
+    METER_DATA_FIELD_CURRENT_AVG_DEMAND,
+    METER_DATA_FIELD_CURRENT_POWER_USAGE,
+    METER_DATA_FIELD_CURRENT_POWER_RETURN,
+    METER_DATA_FIELD_CURRENT_POWER_USAGE_L1,
+    METER_DATA_FIELD_CURRENT_POWER_USAGE_L2,
+    METER_DATA_FIELD_CURRENT_POWER_USAGE_L3,
+    METER_DATA_FIELD_CURRENT_POWER_RETURN_L1,
+    METER_DATA_FIELD_CURRENT_POWER_RETURN_L2,
+    METER_DATA_FIELD_CURRENT_POWER_RETURN_L3,
+    METER_DATA_FIELD_VOLTAGE_L1,
+    METER_DATA_FIELD_VOLTAGE_L2,
+    METER_DATA_FIELD_VOLTAGE_L3,
+    METER_DATA_FIELD_CURRENT_L1,
+    METER_DATA_FIELD_CURRENT_L2,
+    METER_DATA_FIELD_CURRENT_L3,
+    METER_DATA_FIELD_BREAKER_STATE,
+    METER_DATA_FIELD_LIMITER_THRESHOLD,
+    METER_DATA_FIELD_FUSE_SUPERVISION_THRESHOLD,
+    METER_DATA_FIELD_MAX_DEMAND_MONTH,
+    METER_DATA_FIELD_MAX_DEMAND_YEAR,
+    METER_DATA_FIELD_PREDICTED_PEAK,
+    METER_DATA_FIELD_PREDICTED_PEAK_TIME,
+    METER_DATA_FIELD_TELEGRAM_SEQUENCE,
+    METER_DATA_FIELD_COUNT
+} meter_data_field_id_t;
+
+typedef struct {
+    const char *name;                   // Name of the field in the API (JSON key)
+    meter_data_field_type_t type;       // Type of the field
+    size_t offset;                      // Offset of the field in meter_data_t
+    uint8_t decimals;                   // Number of decimals (only for floats)
+} meter_data_field_t;
+
+#define METER_DATA_FIELD_BIT(id) (1ULL << (id))
+#define METER_DATA_FIELDS_ALL (METER_DATA_FIELD_BIT(METER_DATA_FIELD_COUNT) - 1)
+#define METER_DATA_FIELDS_BASIC (METER_DATA_FIELD_BIT(METER_DATA_FIELD_TIMESTAMP) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF1) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF2) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF1) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF2) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_CURRENT_AVG_DEMAND) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_CURRENT_POWER_USAGE) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_CURRENT_POWER_RETURN) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_MAX_DEMAND_MONTH) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_PREDICTED_PEAK) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_PREDICTED_PEAK_TIME) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_TELEGRAM_SEQUENCE))     // Fields returned by /api/meter-data
+#define METER_DATA_FIELDS_COMPLETE METER_DATA_FIELDS_ALL             // Fields returned by /api/p1/data/complete
+#define METER_DATA_FIELD_LIST_SEPARATOR ','
+
+// Function prototypes
+esp_err_t meter_data_copy(meter_data_t *data, TickType_t timeout);
+const meter_data_field_t * meter_data_get_field(meter_data_field_id_t id);
+esp_err_t meter_data_parse_field_mask(const char *list, uint64_t *mask);
+void meter_data_write_json_fields(json_writer_t *json, const meter_data_t *data, uint64_t field_mask);
+
+#endif //METER_DATA_H
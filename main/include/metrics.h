@@ -0,0 +1,13 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"  // Prometheus text exposition format
+#define METRICS_MAX_TIMEOUT_MS 100      // Max time to wait for the meter data, the meter metrics are skipped otherwise
+
+// Function prototypes
+esp_err_t metrics_get_handler(httpd_req_t *req);
+
+#endif //METRICS_H
@@ -0,0 +1,82 @@
+#ifndef MODBUS_TCP_H
+#define MODBUS_TCP_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define MODBUS_TCP_TASK_STACK_SIZE 3072
+#define MODBUS_TCP_TASK_PRIORITY 5
+#define MODBUS_TCP_LISTEN_BACKLOG 2
+#define MODBUS_TCP_MAX_TIMEOUT_MS 1000
+#define MODBUS_TCP_SELECT_TIMEOUT_MS 100        // Max time a new telegram waits before the registers are refreshed
+#define MODBUS_TCP_MBAP_HEADER_SIZE 7
+#define MODBUS_TCP_MAX_ADU_SIZE 260             // MBAP header and the largest PDU
+#define MODBUS_TCP_MAX_READ_COUNT 125           // Max number of registers in one read request
+#define MODBUS_TCP_REGISTER_COUNT 54
+#if CONFIG_MODBUS_TCP
+#define MODBUS_TCP_SOCKET_COUNT (CONFIG_MODBUS_TCP_MAX_CLIENTS + 1)            // Clients and the listening socket
+#else
+#define MODBUS_TCP_SOCKET_COUNT 0
+#endif
+
+// Function codes
+#define MODBUS_TCP_FC_READ_HOLDING_REGISTERS 0x03
+#define MODBUS_TCP_FC_READ_INPUT_REGISTERS 0x04
+
+// Exception codes
+#define MODBUS_TCP_EX_ILLEGAL_FUNCTION 0x01
+#define MODBUS_TCP_EX_ILLEGAL_DATA_ADDRESS 0x02
+#define MODBUS_TCP_EX_ILLEGAL_DATA_VALUE 0x03
+
+/*
+ * Register map. The same read-only registers are served as input registers (function 0x04) and as holding registers
+ * (function 0x03), write requests are answered with an illegal function exception. The unit identifier is ignored.
+ * Values are big-endian, 32-bit values take two registers with the high word first. float32 is IEEE 754.
+ *
+ *  Address  Type     Unit  Field
+ *  0        uint32   -     telegramSequence            0 until the first telegram is received
+ *  2        uint32   s     timestamp                   Unix time of the telegram
+ *  4        float32  A     currentL1
+ *  6        float32  A     currentL2
+ *  8        float32  A     currentL3
+ *  10       float32  V     voltageL1
+ *  12       float32  V     voltageL2
+ *  14       float32  V     voltageL3
+ *  16       float32  kW    currentPowerUsage
+ *  18       float32  kW    currentPowerReturn
+ *  20       float32  kW    currentPowerUsageL1
+ *  22       float32  kW    currentPowerUsageL2
+ *  24       float32  kW    currentPowerUsageL3
+ *  26       float32  kW    currentPowerReturnL1
+ *  28       float32  kW    currentPowerReturnL2
+ *  30       float32  kW    currentPowerReturnL3
+ *  32       float32  kW    currentAvgDemand
+ *  34       float32  kW    predictedPeak               Updated with every prediction (PREDICT_PEAK_TASK_INTERVAL_MS)
+ *  36       uint32   s     predictedPeakTime           Unix time
+ *  38       float32  kW    maxDemandMonth
+ *  40       float32  kWh   electricityDeliveredTariff1
+ *  42       float32  kWh   electricityDeliveredTariff2
+ *  44       float32  kWh   electricityReturnedTariff1
+ *  46       float32  kWh   electricityReturnedTariff2
+ *  48       uint16   -     tariffIndicator             1 = high, 2 = low
+ *  49       uint16   -     breakerState                0 = disconnected, 1 = connected, 2 = ready for connection
+ *  50       float32  kW    limiterThreshold
+ *  52       float32  A     fuseSupervisionThreshold
+ */
+
+/**
+ * Counters of the Modbus TCP server, since boot
+ */
+typedef struct {
+    uint32_t client_count;                      // Number of connected clients
+    uint32_t accepted_count;                    // Number of connections accepted
+    uint32_t rejected_count;                    // Number of connections closed right away because all slots were in use
+    uint32_t request_count;                     // Number of requests answered
+    uint32_t exception_count;                   // Number of requests answered with an exception
+} modbus_tcp_stats_t;
+
+// Function prototypes
+esp_err_t modbus_tcp_init(void);
+void modbus_tcp_get_stats(modbus_tcp_stats_t *stats);
+
+#endif //MODBUS_TCP_H
@@ -0,0 +1,60 @@
+#ifndef MQTT_PUBLISHER_H
+#define MQTT_PUBLISHER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "meter_data.h"
+
+#define MQTT_PUBLISHER_TASK_STACK_SIZE 4096
+#define MQTT_PUBLISHER_TASK_PRIORITY 4
+#define MQTT_PUBLISHER_MAX_TOPIC_LEN 96
+#define MQTT_PUBLISHER_MAX_TIMEOUT_MS 1000
+#define MQTT_PUBLISHER_MESSAGE_MAX_SIZE 1536                // Max size of the batched message of a telegram
+#define MQTT_PUBLISHER_OFFLINE_BUFFER_SIZE (256 * 1024)     // Size of the PSRAM buffer used while the broker is unreachable
+#define MQTT_PUBLISHER_REPLAY_BATCH_SIZE 16                 // Max number of buffered messages replayed per telegram
+#define MQTT_PUBLISHER_TELEGRAM_TOPIC "telegram"            // Topic of the batched messages, below the topic prefix
+#define MQTT_PUBLISHER_STATUS_TOPIC "status"                // Retained "online" or "offline" (last will)
+#define MQTT_PUBLISHER_TELEGRAM_QOS 1
+#define MQTT_PUBLISHER_FIELD_QOS 0
+#if CONFIG_MQTT_PUBLISHER
+#define MQTT_PUBLISHER_SOCKET_COUNT 1                       // Connection to the broker
+#else
+#define MQTT_PUBLISHER_SOCKET_COUNT 0
+#endif
+#define MQTT_PUBLISHER_TELEGRAM_FIELDS (METER_DATA_FIELDS_ALL \
+    & ~(METER_DATA_FIELD_BIT(METER_DATA_FIELD_VERSION_INFO) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_EQUIPMENT_ID) \
+    | METER_DATA_FIELD_BIT(METER_DATA_FIELD_MAX_DEMAND_YEAR)))    // Fields of a JSON batched message, without the static ones
+
+/**
+ * A field published on its own topic, <prefix>/<field name>
+ */
+typedef struct {
+    meter_data_field_id_t id;                               // The field, must be a number
+    float deadband;                                         // Min change before the field is published again
+    const char *name;                                       // Name shown in Home Assistant
+    const char *unit;                                       // Unit of measurement, NULL if none
+    const char *device_class;                               // Home Assistant device class, NULL if none
+    const char *state_class;                                // Home Assistant state class, NULL if none
+} mqtt_publisher_field_t;
+
+/**
+ * Counters of the MQTT publisher, since boot
+ */
+typedef struct {
+    bool connected;                                         // Connected to the broker
+    uint32_t telegram_count;                                // Number of batched messages published, replays included
+    uint32_t field_update_count;                            // Number of per-field values published
+    uint32_t field_suppressed_count;                        // Number of per-field values within the deadband
+    uint32_t field_error_count;                             // Number of per-field values the client failed to publish
+    uint32_t buffered_count;                                // Number of messages waiting in the offline buffer
+    uint32_t replayed_count;                                // Number of buffered messages published after a reconnect
+    uint32_t dropped_count;                                 // Number of buffered messages dropped because it was full
+} mqtt_publisher_stats_t;
+
+// Function prototypes
+esp_err_t mqtt_publisher_init(void);
+void mqtt_publisher_get_stats(mqtt_publisher_stats_t *stats);
+
+#endif //MQTT_PUBLISHER_H
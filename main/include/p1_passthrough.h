@@ -0,0 +1,49 @@
+#ifndef P1_PASSTHROUGH_H
+#define P1_PASSTHROUGH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define P1_PASSTHROUGH_TASK_STACK_SIZE 3072
+#define P1_PASSTHROUGH_TASK_PRIORITY 5
+#define P1_PASSTHROUGH_LISTEN_BACKLOG 4
+#define P1_PASSTHROUGH_FLUSH_INTERVAL_MS 20     // Interval at which sending is retried for clients with pending data
+#define P1_PASSTHROUGH_POLL_INTERVAL_MS 250     // Interval at which new connections and disconnects are checked
+#define P1_PASSTHROUGH_STALL_TIMEOUT_S 30       // Time a client can take to receive a telegram before it is closed
+#if CONFIG_P1_PASSTHROUGH
+#define P1_PASSTHROUGH_SOCKET_COUNT (CONFIG_P1_PASSTHROUGH_MAX_CLIENTS + 1)    // Clients and the listening socket
+#else
+#define P1_PASSTHROUGH_SOCKET_COUNT 0
+#endif
+
+/**
+ * Statistics of a connected client
+ */
+typedef struct {
+    char address[16];                           // IPv4 address of the client
+    uint16_t port;                              // Port of the client
+    int64_t connected_since_us;                 // Time the client connected, in microseconds since boot
+    uint32_t telegrams_sent;                    // Number of telegrams sent
+    uint32_t telegrams_dropped;                 // Number of telegrams skipped because the previous one was still being sent
+    uint64_t bytes_sent;                        // Number of bytes sent
+} p1_passthrough_client_stats_t;
+
+/**
+ * Counters of the passthrough server, since boot
+ */
+typedef struct {
+    uint32_t client_count;                      // Number of connected clients
+    uint32_t accepted_count;                    // Number of connections accepted
+    uint32_t rejected_count;                    // Number of connections closed right away because all slots were in use
+    uint32_t telegrams_sent;                    // Number of telegrams sent, summed over all clients
+    uint32_t telegrams_dropped;                 // Number of telegrams skipped, summed over all clients
+} p1_passthrough_stats_t;
+
+// Function prototypes
+esp_err_t p1_passthrough_init(void);
+bool p1_passthrough_get_client(size_t index, p1_passthrough_client_stats_t *stats);
+void p1_passthrough_get_stats(p1_passthrough_stats_t *stats);
+
+#endif //P1_PASSTHROUGH_H
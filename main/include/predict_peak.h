@@ -8,6 +8,15 @@
 #define PREDICT_PEAK_NVS_KEY_METHOD "method"    // Predict peak method (enum predict_peak_method_e)
 #define PREDICT_PEAK_TASK_INTERVAL_MS 5000
 
+// Event bits set in the emucs_p1 event group when a new prediction is available,
+// so consumers can wait for new telegrams and new predictions at the same time
+#define PREDICT_PEAK_EVENT_AVAILABLE_STREAM_BIT BIT16   // Consumed by the event stream task
+#define PREDICT_PEAK_EVENT_AVAILABLE_WS_BIT BIT17       // Consumed by the WebSocket telemetry task
+#define PREDICT_PEAK_EVENT_AVAILABLE_MODBUS_BIT BIT18   // Consumed by the Modbus TCP task
+#define PREDICT_PEAK_EVENT_AVAILABLE_ALL_BITS (PREDICT_PEAK_EVENT_AVAILABLE_STREAM_BIT \
+                                               | PREDICT_PEAK_EVENT_AVAILABLE_WS_BIT \
+                                               | PREDICT_PEAK_EVENT_AVAILABLE_MODBUS_BIT)
+
 enum predict_peak_method_e {
     PREDICT_PEAK_METHOD_LINEAR_REGRESSION = 0,
     PREDICT_PEAK_METHOD_WEIGHTED_AVERAGE = 1
@@ -23,5 +32,6 @@ struct predicted_peak_s {
 _Noreturn void predict_peak_task(void *pvParameters);
 SemaphoreHandle_t predict_peak_get_predicted_peak_mutex_handle(void);
 struct predicted_peak_s predict_peak_get_predicted_peak(void);
+uint32_t predict_peak_get_sequence(void);
 
 #endif //PREDICT_PEAK_H
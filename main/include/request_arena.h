@@ -0,0 +1,20 @@
+#ifndef REQUEST_ARENA_H
+#define REQUEST_ARENA_H
+
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "async_worker.h"
+
+#define REQUEST_ARENA_SIZE (16 * 1024)      // PSRAM available to the allocations of one request
+#define REQUEST_ARENA_ALIGNMENT 8           // Alignment of every allocation
+#define REQUEST_ARENA_COUNT (1 + ASYNC_WORKER_COUNT)    // One for the httpd task and one per async worker
+
+// Function prototypes
+esp_err_t request_arena_init(void);
+esp_err_t request_arena_handler(httpd_req_t *req);
+esp_err_t request_arena_call(esp_err_t (*handler)(httpd_req_t *req), httpd_req_t *req);
+void *request_arena_alloc(size_t size);
+size_t request_arena_get_peak_usage(void);
+
+#endif //REQUEST_ARENA_H
@@ -0,0 +1,25 @@
+#ifndef SHARED_BUFFER_H
+#define SHARED_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/**
+ * Reference-counted, immutable-once-published byte buffer.
+ * The producer fills data/len after creating the buffer, afterwards any number of readers can hold a reference.
+ * The buffer is freed when the last reference is released.
+ */
+typedef struct {
+    atomic_uint_fast32_t ref_count;     // Number of references held to this buffer
+    size_t capacity;                    // Size of the data array
+    size_t len;                         // Number of valid bytes in the data array
+    char data[];                        // Buffer contents
+} shared_buffer_t;
+
+// Function prototypes
+shared_buffer_t * shared_buffer_create(size_t capacity);
+shared_buffer_t * shared_buffer_acquire(shared_buffer_t *buf);
+void shared_buffer_release(shared_buffer_t *buf);
+
+#endif //SHARED_BUFFER_H
@@ -0,0 +1,17 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "shared_buffer.h"
+#include "meter_data.h"
+
+#define SNAPSHOT_METER_DATA_BUFFER_SIZE 3072    // Max size of the rendered meter data JSON (all fields)
+#define SNAPSHOT_MAX_TIMEOUT_MS 1000            // Max time to wait for the telegram and predicted peak mutexes
+#define SNAPSHOT_CACHED_FIELD_MASKS {METER_DATA_FIELDS_BASIC, METER_DATA_FIELDS_COMPLETE}   // Selections that are cached
+
+// Function prototypes
+esp_err_t snapshot_init(void);
+shared_buffer_t * snapshot_get_meter_data(uint64_t field_mask, uint32_t *telegram_sequence, uint32_t *predicted_peak_sequence);
+
+#endif //SNAPSHOT_H
@@ -0,0 +1,13 @@
+#ifndef STATIC_FILES_H
+#define STATIC_FILES_H
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define STATIC_FILES_GZIP_SUFFIX ".gz"                  // Suffix of the precompressed sibling of a file
+#define STATIC_FILES_MAX_HEADERS_LEN 512                // Max length of the response headers
+
+// Function prototypes
+esp_err_t static_files_get_handler(httpd_req_t *req);
+
+#endif //STATIC_FILES_H
@@ -0,0 +1,53 @@
+#ifndef TELEMETRY_FRAME_H
+#define TELEMETRY_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "meter_data.h"
+#include "shared_buffer.h"
+
+#define TELEMETRY_FRAME_SCHEMA_VERSION 1
+#define TELEMETRY_FRAME_TYPE_METER_DATA 1
+#define TELEMETRY_FRAME_HEADER_SIZE 4       // Schema version (u8), frame type (u8), frame size (u16)
+#define TELEMETRY_FRAME_MAX_SIZE 128
+#define TELEMETRY_FRAME_DESCRIPTOR_MAX_SIZE 2048
+
+/*
+ * Binary meter data frame, schema version 1. All values are little-endian, floats are IEEE 754 single precision.
+ *
+ *  Offset  Type  Field                          Unit
+ *  0       u8    schemaVersion                  -
+ *  1       u8    frameType (1 = meter data)     -
+ *  2       u16   frameSize                      bytes
+ *  4       u32   telegramSequence               -
+ *  8       u32   predictedPeakSequence          -
+ *  12      i64   timestamp                      s (unix time)
+ *  20      f32   electricityDeliveredTariff1    kWh
+ *  24      f32   electricityDeliveredTariff2    kWh
+ *  28      f32   electricityReturnedTariff1     kWh
+ *  32      f32   electricityReturnedTariff2     kWh
+ *  36      u16   tariffIndicator                -
+ *  38      u8    breakerState                   -
+ *  39      u8    reserved                       -
+ *  40      f32   currentAvgDemand               kW
+ *  44      f32   currentPowerUsage              kW
+ *  48      f32   currentPowerReturn             kW
+ *  52      f32   currentPowerUsageL1..L3        kW (3 values)
+ *  64      f32   currentPowerReturnL1..L3       kW (3 values)
+ *  76      f32   voltageL1..L3                  V (3 values)
+ *  88      f32   currentL1..L3                  A (3 values)
+ *  100     f32   predictedPeak                  kW
+ *  104     i64   predictedPeakTime              s (unix time)
+ *  112     -     end of frame
+ *
+ * The same layout is described at runtime by the schema descriptor (JSON), see telemetry_frame_get_descriptor().
+ */
+
+// Function prototypes
+esp_err_t telemetry_frame_init(void);
+size_t telemetry_frame_encode(const meter_data_t *data, uint8_t *frame, size_t max_size);
+shared_buffer_t * telemetry_frame_encode_shared(const meter_data_t *data);
+shared_buffer_t * telemetry_frame_get_descriptor(void);
+
+#endif //TELEMETRY_FRAME_H
@@ -0,0 +1,44 @@
+#ifndef UDP_MULTICAST_H
+#define UDP_MULTICAST_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define UDP_MULTICAST_TASK_STACK_SIZE 3072
+#define UDP_MULTICAST_TASK_PRIORITY 5
+#define UDP_MULTICAST_MAX_TIMEOUT_MS 1000
+#define UDP_MULTICAST_VERSION 1
+#define UDP_MULTICAST_HEADER_SIZE 12
+#define UDP_MULTICAST_TYPE_RAW_TELEGRAM 1               // Payload is the telegram as received from the meter
+#define UDP_MULTICAST_TYPE_TELEMETRY_FRAME 2            // Payload is a binary telemetry frame, see telemetry_frame.h
+#if CONFIG_UDP_MULTICAST
+#define UDP_MULTICAST_SOCKET_COUNT 1
+#else
+#define UDP_MULTICAST_SOCKET_COUNT 0
+#endif
+
+/*
+ * Datagram header, all values are little-endian.
+ *
+ *  Offset  Type  Field
+ *  0       u8    version (1)
+ *  1       u8    payloadType (UDP_MULTICAST_TYPE_*)
+ *  2       u16   payloadSize
+ *  4       u32   datagramSequence      incremented for every datagram, a gap means datagrams were lost
+ *  8       u32   telegramSequence      sequence number of the telegram
+ *  12      -     payload
+ */
+
+/**
+ * Counters of the UDP multicast sender, since boot
+ */
+typedef struct {
+    uint32_t sent_count;                        // Number of datagrams sent
+    uint32_t error_count;                       // Number of datagrams that couldn't be sent (e.g. no network)
+} udp_multicast_stats_t;
+
+// Function prototypes
+esp_err_t udp_multicast_init(void);
+void udp_multicast_get_stats(udp_multicast_stats_t *stats);
+
+#endif //UDP_MULTICAST_H
@@ -2,14 +2,30 @@
 #define WEB_SERVER_H
 
 #define WEB_SERVER_PORT 80
+#define WEB_SERVER_HTTPS_PORT 443               // Port of the server if CONFIG_WEB_SERVER_HTTPS is enabled
+#if CONFIG_WEB_SERVER_HTTPS
+#define WEB_SERVER_MAX_OPEN_SOCKETS 4           // Max number of TLS sessions, each one has its own buffers
+#define WEB_SERVER_LRU_EVICTION false           // Activity isn't tracked over TLS, see http_sessions.c
+#else
+#define WEB_SERVER_MAX_OPEN_SOCKETS 10          // Max number of sessions, must fit in CONFIG_LWIP_MAX_SOCKETS - 3
+#define WEB_SERVER_LRU_EVICTION true            // Close the least recently active session when the pool is full
+#endif
+#define WEB_SERVER_SOCKET_COUNT (WEB_SERVER_MAX_OPEN_SOCKETS + 3)   // Sessions and the sockets httpd uses internally
+#define WEB_SERVER_IDLE_TIMEOUT_S 120           // Inactivity after which a session is closed, above the long-poll timeout
+#define WEB_SERVER_KEEP_ALIVE_IDLE_S 30         // Idle time of a connection before TCP keep-alive probes are sent
+#define WEB_SERVER_KEEP_ALIVE_INTERVAL_S 5      // Time between TCP keep-alive probes
+#define WEB_SERVER_KEEP_ALIVE_COUNT 3           // Number of unanswered probes after which the connection is closed
+#define WEB_SERVER_MAX_URI_HANDLERS 16
 #define WEB_SERVER_FS_MOUNT_POINT "/www"
-#define WEB_SERVER_SPIFFS_PARTITION_LABEL "www"
-#define WEB_SERVER_SPIFFS_MAX_OPEN_FILES 5
+#define WEB_SERVER_BUNDLE_PARTITION_LABEL "www"
 #define WEB_SERVER_MAX_FILE_PATH_LEN 128
-#define WEB_SERVER_FILE_BUFFER_SIZE 1024
+#define WEB_SERVER_FILE_BUFFER_SIZE 4096     // Block size used to read and send static files
 #define WEB_SERVER_API_ROUTES_PREFIX "/api"
 #define WEB_SERVER_MAX_TIMEOUT_MS 1000
+#define WEB_SERVER_HISTORY_BATCH_SIZE 32  // Number of log entries copied at once while streaming the history
 #define WEB_SERVER_API_VERSION "v1"
+#define WEB_SERVER_API_VERSIONED_ROUTES_PREFIX WEB_SERVER_API_ROUTES_PREFIX "/" WEB_SERVER_API_VERSION
+#define WEB_SERVER_MAX_QUERY_LEN 256
 
 // Function prototypes
 void setup_web_server(void);
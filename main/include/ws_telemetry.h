@@ -0,0 +1,21 @@
+#ifndef WS_TELEMETRY_H
+#define WS_TELEMETRY_H
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define WS_TELEMETRY_MAX_CLIENTS 8              // Max number of simultaneously connected clients
+#define WS_TELEMETRY_MAX_QUEUED_FRAMES 1        // Max number of frames queued for sending per client
+#define WS_TELEMETRY_MAX_STALLED_FRAMES 30      // Number of frames in a row a client can't take before it is closed
+#define WS_TELEMETRY_RETRY_AFTER_S "5"          // Retry-After of the response when all client slots are in use
+#define WS_TELEMETRY_MAX_RX_FRAME_LEN 32        // Max length of a message received from a client
+#define WS_TELEMETRY_SCHEMA_REQUEST "schema"    // Message a client can send to receive the schema descriptor again
+#define WS_TELEMETRY_TASK_STACK_SIZE 4096
+#define WS_TELEMETRY_TASK_PRIORITY 5
+
+// Function prototypes
+esp_err_t ws_telemetry_init(httpd_handle_t server);
+esp_err_t ws_telemetry_pre_handshake(httpd_req_t *req);
+esp_err_t ws_telemetry_handler(httpd_req_t *req);
+
+#endif //WS_TELEMETRY_H
@@ -0,0 +1,247 @@
+/**
+ * @file json_writer.c
+ * @brief Allocation-free streaming JSON writer
+ *
+ * The JSON is written straight into a chunk writer, which flushes it to the socket (or a shared buffer)
+ * whenever its fixed size buffer is full. No heap memory is used, regardless of the size of the document.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+#include "json_writer.h"
+
+static const char *TAG = "json_writer";     // Tag used for logging
+
+// Function prototypes
+static void write_separator_and_key(json_writer_t *w, const char *key);
+static void write_escaped_string(json_writer_t *w, const char *str);
+static void push(json_writer_t *w, char c);
+static void pop(json_writer_t *w, char c);
+
+
+/**
+ * @brief Initialize a JSON writer that streams the JSON as the response to an HTTP request
+ *
+ * @note The content type of the response should be set before the first data is flushed
+ *
+ * @param[out] w The writer to initialize
+ * @param[in] req The request to respond to
+ */
+void json_writer_init_httpd(json_writer_t *w, httpd_req_t *req) {
+    chunk_writer_init_httpd(&w->out, req);
+    w->depth = 0;
+    w->has_members = 0;
+}
+
+/**
+ * @brief Initialize a JSON writer that writes the JSON into a shared buffer
+ *
+ * @param[out] w The writer to initialize
+ * @param[in] buf The buffer to write to
+ */
+void json_writer_init_shared_buffer(json_writer_t *w, shared_buffer_t *buf) {
+    chunk_writer_init_shared_buffer(&w->out, buf);
+    w->depth = 0;
+    w->has_members = 0;
+}
+
+/**
+ * @brief Begin a new object
+ *
+ * @param[in] w The writer
+ * @param[in] key The key of the object in the enclosing object, or NULL
+ */
+void json_writer_begin_object(json_writer_t *w, const char *key) {
+    write_separator_and_key(w, key);
+    push(w, '{');
+}
+
+/**
+ * @brief End the current object
+ *
+ * @param[in] w The writer
+ */
+void json_writer_end_object(json_writer_t *w) {
+    pop(w, '}');
+}
+
+/**
+ * @brief Begin a new array
+ *
+ * @param[in] w The writer
+ * @param[in] key The key of the array in the enclosing object, or NULL
+ */
+void json_writer_begin_array(json_writer_t *w, const char *key) {
+    write_separator_and_key(w, key);
+    push(w, '[');
+}
+
+/**
+ * @brief End the current array
+ *
+ * @param[in] w The writer
+ */
+void json_writer_end_array(json_writer_t *w) {
+    pop(w, ']');
+}
+
+/**
+ * @brief Add a string value
+ *
+ * @param[in] w The writer
+ * @param[in] key The key in the enclosing object, or NULL
+ * @param[in] value The string, special characters are escaped
+ */
+void json_writer_add_string(json_writer_t *w, const char *key, const char *value) {
+    write_separator_and_key(w, key);
+    write_escaped_string(w, value);
+}
+
+/**
+ * @brief Add an integer value
+ *
+ * @param[in] w The writer
+ * @param[in] key The key in the enclosing object, or NULL
+ * @param[in] value The value
+ */
+void json_writer_add_int(json_writer_t *w, const char *key, int64_t value) {
+    write_separator_and_key(w, key);
+    chunk_writer_write_int(&w->out, value);
+}
+
+/**
+ * @brief Add a number with a fixed number of decimals
+ *
+ * @note NaN and infinity can't be represented in JSON and are written as null
+ *
+ * @param[in] w The writer
+ * @param[in] key The key in the enclosing object, or NULL
+ * @param[in] value The value
+ * @param[in] decimals The number of decimals
+ */
+void json_writer_add_fixed(json_writer_t *w, const char *key, double value, uint8_t decimals) {
+    write_separator_and_key(w, key);
+    if (isfinite(value)) {
+        chunk_writer_write_fixed(&w->out, value, decimals);
+    }
+    else {
+        chunk_writer_write_str(&w->out, "null");
+    }
+}
+
+/**
+ * @brief Add a boolean value
+ *
+ * @param[in] w The writer
+ * @param[in] key The key in the enclosing object, or NULL
+ * @param[in] value The value
+ */
+void json_writer_add_bool(json_writer_t *w, const char *key, bool value) {
+    write_separator_and_key(w, key);
+    chunk_writer_write_str(&w->out, value ? "true" : "false");
+}
+
+/**
+ * @brief Finish the JSON document and flush the remaining data
+ *
+ * The underlying writer is always finished, so its resources are released also when the document is incomplete. An
+ * incomplete document without an earlier error is an error, the remaining data isn't flushed then.
+ *
+ * @param[in] w The writer
+ * @return ESP_OK on success, or the first error that occurred
+ */
+esp_err_t json_writer_finish(json_writer_t *w) {
+    if (w->depth != 0 && w->out.err == ESP_OK) {
+        ESP_LOGE(TAG, "JSON document finished at depth %d", w->depth);
+        w->out.err = ESP_ERR_INVALID_STATE;
+    }
+
+    return chunk_writer_finish(&w->out);
+}
+
+/**
+ * @brief Write the comma before a value (if needed) and the key
+ *
+ * @param[in] w The writer
+ * @param[in] key The key, or NULL
+ */
+static void write_separator_and_key(json_writer_t *w, const char *key) {
+    uint32_t bit = 1UL << w->depth;
+
+    if (w->has_members & bit) {
+        chunk_writer_write_char(&w->out, ',');
+    }
+    w->has_members |= bit;
+
+    if (key != NULL) {
+        write_escaped_string(w, key);
+        chunk_writer_write_char(&w->out, ':');
+    }
+}
+
+/**
+ * @brief Write a quoted and escaped string
+ *
+ * @param[in] w The writer
+ * @param[in] str The string
+ */
+static void write_escaped_string(json_writer_t *w, const char *str) {
+    static const char hex[] = "0123456789abcdef";
+    const char *start = str;
+
+    chunk_writer_write_char(&w->out, '"');
+    for (; *str != '\0'; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        // Write the part that doesn't need escaping, followed by the escaped character
+        chunk_writer_write(&w->out, start, str - start);
+        start = str + 1;
+        if (c == '"' || c == '\\') {
+            chunk_writer_write_char(&w->out, '\\');
+            chunk_writer_write_char(&w->out, (char)c);
+        }
+        else {
+            char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            chunk_writer_write(&w->out, escaped, sizeof(escaped));
+        }
+    }
+    chunk_writer_write(&w->out, start, str - start);
+    chunk_writer_write_char(&w->out, '"');
+}
+
+/**
+ * @brief Open an object or array
+ *
+ * @param[in] w The writer
+ * @param[in] c The opening character
+ */
+static void push(json_writer_t *w, char c) {
+    chunk_writer_write_char(&w->out, c);
+    if (w->depth + 1 >= JSON_WRITER_MAX_DEPTH) {
+        ESP_LOGE(TAG, "Max JSON nesting depth exceeded");
+        w->out.err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    w->depth++;
+    w->has_members &= ~(1UL << w->depth);
+}
+
+/**
+ * @brief Close an object or array
+ *
+ * @param[in] w The writer
+ * @param[in] c The closing character
+ */
+static void pop(json_writer_t *w, char c) {
+    chunk_writer_write_char(&w->out, c);
+    if (w->depth == 0) {
+        ESP_LOGE(TAG, "Unbalanced JSON object or array");
+        w->out.err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    w->depth--;
+}
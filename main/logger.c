@@ -31,11 +31,13 @@
 static log_entry_short_term_p1_data_t short_term_log[LOGGER_SHORT_TERM_LOG_SIZE];
 static size_t short_term_log_head_index = 0;  // The index of the next entry to be written
 static size_t short_term_log_item_count = 0;  // The number of items in the log
+static uint32_t short_term_log_total_count = 0; // The number of items ever written, i.e. the index after the newest entry
 static SemaphoreHandle_t short_term_log_mutex;
 
 static log_entry_long_term_p1_data_t long_term_log[LOGGER_LONG_TERM_LOG_BUF_SIZE];
 static size_t long_term_log_head_index = 0;   // The index of the next entry to be written
-static size_t long_term_log_item_count = 0;   // The number of items in the log
+static size_t long_term_log_item_count = 0;   // The number of completed quarter-hours in the log
+static uint32_t long_term_log_total_count = 0; // The number of completed quarter-hours, i.e. the index after the newest entry
 static SemaphoreHandle_t long_term_log_mutex;
 
 static const char *TAG = "logger";
@@ -121,6 +123,7 @@ static void add_short_term_log_entry(log_entry_short_term_p1_data_t *entry) {
     if (short_term_log_item_count < LOGGER_SHORT_TERM_LOG_SIZE) {
         short_term_log_item_count++;
     }
+    short_term_log_total_count++;
 
     // Return the semaphore
     xSemaphoreGive(short_term_log_mutex);
@@ -140,10 +143,11 @@ static void add_long_term_log_entry(log_entry_long_term_p1_data_t *entry) {
         // Move the head index to the next entry
         long_term_log_head_index = (long_term_log_head_index + 1) % LOGGER_LONG_TERM_LOG_BUF_SIZE;
 
-        // Increment the item count
-        if (long_term_log_item_count < LOGGER_LONG_TERM_LOG_BUF_SIZE) {
+        // Increment the item count, one slot is always taken by the quarter-hour in progress
+        if (long_term_log_item_count < LOGGER_LONG_TERM_LOG_BUF_SIZE - 1) {
             long_term_log_item_count++;
         }
+        long_term_log_total_count++;
     }
 
     // Add the entry to the log
@@ -224,6 +228,167 @@ size_t logger_get_long_term_log_items(log_entry_long_term_p1_data_t *log, size_t
     return max_items;
 }
 
+/**
+ * @brief Get the absolute index of the oldest entry in the short term log
+ *
+ * Entries are identified by an absolute index that keeps increasing when new entries are added,
+ * so a reader can continue where it left off even if the ring buffer wrapped in between.
+ *
+ * @note The short term log mutex must be taken before calling this function
+ *
+ * @return The index of the oldest entry
+ */
+uint32_t logger_get_short_term_log_first_index(void) {
+    return short_term_log_total_count - short_term_log_item_count;
+}
+
+/**
+ * @brief Get the absolute index after the newest entry in the short term log
+ *
+ * @note The short term log mutex must be taken before calling this function
+ *
+ * @return The index after the newest entry (equal to the first index if the log is empty)
+ */
+uint32_t logger_get_short_term_log_end_index(void) {
+    return short_term_log_total_count;
+}
+
+/**
+ * @brief Find the first entry in the short term log with a timestamp at or after the given timestamp
+ *
+ * The entries are sorted on timestamp, so a binary search is used.
+ *
+ * @note The short term log mutex must be taken before calling this function
+ *
+ * @param timestamp The timestamp to search for
+ * @return The absolute index of the entry, or the end index if there is no such entry
+ */
+uint32_t logger_find_short_term_log_index(time_t timestamp) {
+    uint32_t low = logger_get_short_term_log_first_index();
+    uint32_t high = short_term_log_total_count;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (short_term_log[mid % LOGGER_SHORT_TERM_LOG_SIZE].timestamp < timestamp) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * @brief Read short term log items in chronological order, starting at an absolute index
+ *
+ * If the entry at the index has already been overwritten, or the index is after the newest entry, reading starts at the
+ * oldest entry that is still available.
+ *
+ * @note The short term log mutex must be taken before calling this function
+ *
+ * @param index The absolute index of the first entry to read, updated to the index after the last entry read
+ * @param log The buffer to copy the items to, must be at least max_items in size
+ * @param max_items The maximum number of items to copy
+ * @return The number of items copied
+ */
+size_t logger_read_short_term_log_items(uint32_t *index, log_entry_short_term_p1_data_t *log, size_t max_items) {
+    uint32_t first_index = logger_get_short_term_log_first_index();
+    size_t count = 0;
+
+    // Skip the entries that have already been overwritten, an index after the newest entry (e.g. from before a
+    // restart) is invalid, so reading starts at the oldest entry as well
+    if ((int32_t)(*index - first_index) < 0 || (int32_t)(*index - short_term_log_total_count) > 0) {
+        *index = first_index;
+    }
+
+    while (count < max_items && *index != short_term_log_total_count) {
+        log[count++] = short_term_log[*index % LOGGER_SHORT_TERM_LOG_SIZE];
+        (*index)++;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Get the absolute index of the oldest completed quarter-hour in the long term log
+ *
+ * @note The long term log mutex must be taken before calling this function
+ *
+ * @return The index of the oldest entry
+ */
+uint32_t logger_get_long_term_log_first_index(void) {
+    return long_term_log_total_count - long_term_log_item_count;
+}
+
+/**
+ * @brief Get the absolute index after the newest completed quarter-hour in the long term log
+ *
+ * @note The long term log mutex must be taken before calling this function
+ *
+ * @return The index after the newest entry (equal to the first index if the log is empty)
+ */
+uint32_t logger_get_long_term_log_end_index(void) {
+    return long_term_log_total_count;
+}
+
+/**
+ * @brief Find the first entry in the long term log with a timestamp at or after the given timestamp
+ *
+ * @note The long term log mutex must be taken before calling this function
+ *
+ * @param timestamp The timestamp to search for
+ * @return The absolute index of the entry, or the end index if there is no such entry
+ */
+uint32_t logger_find_long_term_log_index(time_t timestamp) {
+    uint32_t low = logger_get_long_term_log_first_index();
+    uint32_t high = long_term_log_total_count;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (long_term_log[mid % LOGGER_LONG_TERM_LOG_BUF_SIZE].timestamp < timestamp) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * @brief Read completed long term log items in chronological order, starting at an absolute index
+ *
+ * If the entry at the index has already been overwritten, or the index is after the newest entry, reading starts at the
+ * oldest entry that is still available.
+ *
+ * @note The long term log mutex must be taken before calling this function
+ *
+ * @param index The absolute index of the first entry to read, updated to the index after the last entry read
+ * @param log The buffer to copy the items to, must be at least max_items in size
+ * @param max_items The maximum number of items to copy
+ * @return The number of items copied
+ */
+size_t logger_read_long_term_log_items(uint32_t *index, log_entry_long_term_p1_data_t *log, size_t max_items) {
+    uint32_t first_index = logger_get_long_term_log_first_index();
+    size_t count = 0;
+
+    // Skip the entries that have already been overwritten, an index after the newest entry (e.g. from before a
+    // restart) is invalid, so reading starts at the oldest entry as well
+    if ((int32_t)(*index - first_index) < 0 || (int32_t)(*index - long_term_log_total_count) > 0) {
+        *index = first_index;
+    }
+
+    while (count < max_items && *index != long_term_log_total_count) {
+        log[count++] = long_term_log[*index % LOGGER_LONG_TERM_LOG_BUF_SIZE];
+        (*index)++;
+    }
+
+    return count;
+}
+
 /**
  * @brief Get the short term log mutex handle
  *
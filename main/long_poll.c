@@ -0,0 +1,232 @@
+/**
+ * @file long_poll.c
+ * @brief Long-poll requests for the meter data
+ *
+ * A request for /api/meter-data?after=<seq> is answered as soon as a telegram newer than <seq> is available.
+ * Until then, the request is detached from the httpd task with the async request API and parked here, so it doesn't
+ * block the server. The long-poll task answers the parked requests when a new telegram arrives, or with
+ * 204 No Content when they time out.
+ *
+ * The response contains the telegramSequence field, which the client passes as 'after' in its next request to get
+ * every telegram exactly once.
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "emucs_p1.h"
+#include "snapshot.h"
+#include "http_sessions.h"
+#include "long_poll.h"
+
+typedef struct {
+    httpd_req_t *req;           // The detached request, NULL if the slot is free
+    uint32_t after;             // The request is answered when a telegram newer than this sequence number is available
+    uint64_t field_mask;        // Fields selected by the client
+    TickType_t deadline;        // Tick count at which the request times out
+} parked_request_t;
+
+static const char *TAG = "long_poll";                       // Tag used for logging
+static SemaphoreHandle_t parked_mutex;                      // Mutex protecting the parked requests
+static parked_request_t parked[LONG_POLL_MAX_PARKED];       // Requests waiting for a telegram
+
+// Function prototypes
+_Noreturn static void long_poll_task(void *pvParameters);
+static bool is_newer(uint32_t sequence, uint32_t after);
+static esp_err_t send_meter_data(httpd_req_t *req, uint64_t field_mask);
+static esp_err_t send_no_content(httpd_req_t *req);
+
+
+/**
+ * @brief Initialize the long-poll support and start the long-poll task
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t long_poll_init(void) {
+    parked_mutex = xSemaphoreCreateMutex();
+    if (parked_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create parked requests mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(long_poll_task, "long_poll_task", LONG_POLL_TASK_STACK_SIZE, NULL, LONG_POLL_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create long-poll task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Handle a long-poll request for the meter data
+ *
+ * If a telegram newer than 'after' is already available, the meter data is sent immediately.
+ * Otherwise the request is parked until a newer telegram arrives or the timeout expires.
+ *
+ * @param[in] req The request handle
+ * @param[in] after The sequence number of the last telegram the client received
+ * @param[in] timeout_s The max time to wait, limited to LONG_POLL_MAX_TIMEOUT_S
+ * @param[in] field_mask The fields to include in the response (see METER_DATA_FIELD_BIT)
+ * @return ESP_OK on success
+ */
+esp_err_t long_poll_handle_request(httpd_req_t *req, uint32_t after, uint32_t timeout_s, uint64_t field_mask) {
+    parked_request_t *slot = NULL;
+    httpd_req_t *async_req;
+
+    if (timeout_s > LONG_POLL_MAX_TIMEOUT_S) {
+        timeout_s = LONG_POLL_MAX_TIMEOUT_S;
+    }
+
+    xSemaphoreTake(parked_mutex, portMAX_DELAY);
+
+    // Checked while holding the mutex, so a telegram that arrives now is either seen here or by the long-poll task
+    if (is_newer(emucs_p1_get_telegram_sequence(), after)) {
+        xSemaphoreGive(parked_mutex);
+        return send_meter_data(req, field_mask);
+    }
+
+    // Find a free slot
+    for (size_t i = 0; i < LONG_POLL_MAX_PARKED; i++) {
+        if (parked[i].req == NULL) {
+            slot = &parked[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        xSemaphoreGive(parked_mutex);
+        ESP_LOGW(TAG, "Max number of parked requests reached");
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        return httpd_resp_sendstr(req, "Max number of long-poll requests reached");
+    }
+
+    // Detach the request from the httpd task
+    if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK) {
+        xSemaphoreGive(parked_mutex);
+        ESP_LOGE(TAG, "Failed to detach request");
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to park request");
+    }
+    http_sessions_async_begin(async_req);
+    slot->req = async_req;
+    slot->after = after;
+    slot->field_mask = field_mask;
+    slot->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_s * 1000);
+
+    xSemaphoreGive(parked_mutex);
+
+    ESP_LOGD(TAG, "Parked request after sequence %lu for %lu s", after, timeout_s);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Long-poll task
+ *
+ * Answers the parked requests when a newer telegram is available, or when they time out.
+ * The requests are answered outside of the mutex, so new requests can be parked while sending.
+ *
+ * @param pvParameters
+ */
+_Noreturn static void long_poll_task(void *pvParameters) {
+    EventGroupHandle_t event_group = emucs_p1_get_event_group_handle();
+    parked_request_t ready[LONG_POLL_MAX_PARKED];
+    httpd_req_t *expired[LONG_POLL_MAX_PARKED];
+    size_t ready_count;
+    size_t expired_count;
+    uint32_t sequence;
+    TickType_t now;
+
+    for (;;) {
+        xEventGroupWaitBits(event_group, EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_LONG_POLL_BIT, pdTRUE, pdFALSE,
+                            pdMS_TO_TICKS(LONG_POLL_CHECK_INTERVAL_MS));
+
+        ready_count = 0;
+        expired_count = 0;
+
+        xSemaphoreTake(parked_mutex, portMAX_DELAY);
+        sequence = emucs_p1_get_telegram_sequence();
+        now = xTaskGetTickCount();
+        for (size_t i = 0; i < LONG_POLL_MAX_PARKED; i++) {
+            if (parked[i].req == NULL) {
+                continue;
+            }
+            if (is_newer(sequence, parked[i].after)) {
+                ready[ready_count++] = parked[i];
+            }
+            else if ((int32_t)(now - parked[i].deadline) >= 0) {
+                expired[expired_count++] = parked[i].req;
+            }
+            else {
+                continue;
+            }
+            parked[i].req = NULL;
+        }
+        xSemaphoreGive(parked_mutex);
+
+        for (size_t i = 0; i < ready_count; i++) {
+            send_meter_data(ready[i].req, ready[i].field_mask);
+            http_sessions_async_end(ready[i].req);
+            httpd_req_async_handler_complete(ready[i].req);
+        }
+        for (size_t i = 0; i < expired_count; i++) {
+            send_no_content(expired[i]);
+            http_sessions_async_end(expired[i]);
+            httpd_req_async_handler_complete(expired[i]);
+        }
+    }
+}
+
+/**
+ * @brief Check if a sequence number is newer than another one, taking wrap-around into account
+ *
+ * @param[in] sequence The sequence number to check
+ * @param[in] after The reference sequence number
+ * @return True if sequence is newer than after
+ */
+static bool is_newer(uint32_t sequence, uint32_t after) {
+    return (int32_t)(sequence - after) > 0;
+}
+
+/**
+ * @brief Send the meter data snapshot
+ *
+ * @param[in] req The request handle
+ * @param[in] field_mask The fields to include
+ * @return ESP_OK on success
+ */
+static esp_err_t send_meter_data(httpd_req_t *req, uint64_t field_mask) {
+    esp_err_t err;
+    shared_buffer_t *snapshot = snapshot_get_meter_data(field_mask, NULL, NULL);
+
+    if (snapshot == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Meter data not available");
+    }
+
+    if (httpd_resp_set_type(req, "application/json") != ESP_OK
+        || httpd_resp_set_hdr(req, "Cache-Control", "no-store") != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set response headers");
+        err = ESP_FAIL;
+    }
+    else {
+        err = httpd_resp_send(req, snapshot->data, (ssize_t)snapshot->len);
+    }
+
+    shared_buffer_release(snapshot);
+
+    return err;
+}
+
+/**
+ * @brief Send a 204 No Content response, used when no newer telegram arrived in time
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+static esp_err_t send_no_content(httpd_req_t *req) {
+    httpd_resp_set_status(req, "204 No Content");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, NULL, 0);
+}
@@ -7,21 +7,28 @@
 #include "nvs_flash.h"
 #include "esp_system.h"
 #include "esp_event.h"
-#include "cJSON.h"
 #include "emucs_p1.h"
 #include "networking.h"
 #include "logger.h"
 #include "web_server.h"
 #include "predict_peak.h"
+#include "mqtt_publisher.h"
+#include "udp_multicast.h"
+#include "p1_passthrough.h"
+#include "modbus_tcp.h"
 
-static void * CJSON_CDECL cjson_malloc(size_t size)
-{
-    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
-}
+#define MAIN_SPARE_SOCKET_COUNT 2   // Sockets left for short-lived users, e.g. DNS lookups
+
+// A service that can't get a socket fails at runtime (accept() fails with ENFILE and starves the web server), so the
+// configured clients of all services must fit in the socket limit of lwIP
+_Static_assert(WEB_SERVER_SOCKET_COUNT + MQTT_PUBLISHER_SOCKET_COUNT + UDP_MULTICAST_SOCKET_COUNT
+               + P1_PASSTHROUGH_SOCKET_COUNT + MODBUS_TCP_SOCKET_COUNT + MAIN_SPARE_SOCKET_COUNT
+               <= CONFIG_LWIP_MAX_SOCKETS,
+               "The services need more sockets than CONFIG_LWIP_MAX_SOCKETS, lower their max number of clients");
 
 void app_main(void) {
     //esp_log_level_set("emucs_p1", ESP_LOG_DEBUG);
-    xTaskCreate(emucs_p1_task, "emucs_p1_task", 4096, NULL, 5, NULL);
+    xTaskCreatePinnedToCore(emucs_p1_task, "emucs_p1_task", 4096, NULL, 5, NULL, EMUCS_P1_TASK_CORE);
 
     //Initialize NVS
     esp_err_t err = nvs_flash_init();
@@ -36,13 +43,6 @@ void app_main(void) {
     // Initialize the event loop
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-    // Initialize the CJson library to use the psram
-    static cJSON_Hooks hooks = {
-            .malloc_fn = cjson_malloc,
-            .free_fn = heap_caps_free,
-    };
-    cJSON_InitHooks(&hooks);
-
     // Initialize networking
 //    esp_log_level_set("networking", ESP_LOG_DEBUG);
     setup_networking();
@@ -51,6 +51,26 @@ void app_main(void) {
     esp_log_level_set("web_server", ESP_LOG_DEBUG);
     setup_web_server();
 
+#if CONFIG_MQTT_PUBLISHER
+    // Publish the meter data to the MQTT broker
+    ESP_ERROR_CHECK(mqtt_publisher_init());
+#endif
+
+#if CONFIG_UDP_MULTICAST
+    // Send the telegrams to the multicast group
+    ESP_ERROR_CHECK(udp_multicast_init());
+#endif
+
+#if CONFIG_P1_PASSTHROUGH
+    // Pass the raw telegrams through to TCP clients
+    ESP_ERROR_CHECK(p1_passthrough_init());
+#endif
+
+#if CONFIG_MODBUS_TCP
+    // Serve the meter registers to Modbus TCP clients
+    ESP_ERROR_CHECK(modbus_tcp_init());
+#endif
+
     // Run the logger task
     esp_log_level_set("logger", ESP_LOG_DEBUG);
     xTaskCreate(logger_task, "logger_task", 4096, NULL, 6, NULL);
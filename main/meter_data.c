@@ -0,0 +1,214 @@
+/**
+ * @file meter_data.c
+ * @brief Field descriptions and serialization of the meter data
+ *
+ * The meter data is the combination of the last telegram and the predicted peak.
+ * Every field that is exposed through the API is described in a static table, so clients can select the fields
+ * they are interested in by name, and serializers can iterate over the selected fields.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "http_stats.h"
+#include "meter_data.h"
+
+static const char *TAG = "meter_data";  // Tag used for logging
+
+static const meter_data_field_t fields[METER_DATA_FIELD_COUNT] = {
+    [METER_DATA_FIELD_VERSION_INFO] = {"versionInfo", METER_DATA_FIELD_TYPE_STRING, offsetof(meter_data_t, p1.version_info), 0},
+    [METER_DATA_FIELD_EQUIPMENT_ID] = {"equipmentId", METER_DATA_FIELD_TYPE_STRING, offsetof(meter_data_t, p1.equipment_id), 0},
+    [METER_DATA_FIELD_TIMESTAMP] = {"timestamp", METER_DATA_FIELD_TYPE_TIMESTAMP, offsetof(meter_data_t, p1.msg_timestamp), 0},
+    [METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF1] = {"electricityDeliveredTariff1", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.electricity_delivered_tariff1), EMUCS_P1_DECIMALS_ENERGY},
+    [METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF2] = {"electricityDeliveredTariff2", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.electricity_delivered_tariff2), EMUCS_P1_DECIMALS_ENERGY},
+    [METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF1] = {"electricityReturnedTariff1", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.electricity_returned_tariff1), EMUCS_P1_DECIMALS_ENERGY},
+    [METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF2] = {"electricityReturnedTariff2", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.electricity_returned_tariff2), EMUCS_P1_DECIMALS_ENERGY},
+    [METER_DATA_FIELD_TARIFF_INDICATOR] = {"tariffIndicator", METER_DATA_FIELD_TYPE_UINT16, offsetof(meter_data_t, p1.tariff_indicator), 0},
+    [METER_DATA_FIELD_CURRENT_AVG_DEMAND] = {"currentAvgDemand", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_avg_demand), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_CURRENT_POWER_USAGE] = {"currentPowerUsage", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_power_usage), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_CURRENT_POWER_RETURN] = {"currentPowerReturn", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_power_return), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_CURRENT_POWER_USAGE_L1] = {"currentPowerUsageL1", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_power_usage_l1), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_CURRENT_POWER_USAGE_L2] = {"currentPowerUsageL2", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_power_usage_l2), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_CURRENT_POWER_USAGE_L3] = {"currentPowerUsageL3", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_power_usage_l3), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_CURRENT_POWER_RETURN_L1] = {"currentPowerReturnL1", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_power_return_l1), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_CURRENT_POWER_RETURN_L2] = {"currentPowerReturnL2", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_power_return_l2), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_CURRENT_POWER_RETURN_L3] = {"currentPowerReturnL3", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_power_return_l3), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_VOLTAGE_L1] = {"voltageL1", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.voltage_l1), EMUCS_P1_DECIMALS_VOLTAGE},
+    [METER_DATA_FIELD_VOLTAGE_L2] = {"voltageL2", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.voltage_l2), EMUCS_P1_DECIMALS_VOLTAGE},
+    [METER_DATA_FIELD_VOLTAGE_L3] = {"voltageL3", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.voltage_l3), EMUCS_P1_DECIMALS_VOLTAGE},
+    [METER_DATA_FIELD_CURRENT_L1] = {"currentL1", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_l1), EMUCS_P1_DECIMALS_CURRENT},
+    [METER_DATA_FIELD_CURRENT_L2] = {"currentL2", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_l2), EMUCS_P1_DECIMALS_CURRENT},
+    [METER_DATA_FIELD_CURRENT_L3] = {"currentL3", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.current_l3), EMUCS_P1_DECIMALS_CURRENT},
+    [METER_DATA_FIELD_BREAKER_STATE] = {"breakerState", METER_DATA_FIELD_TYPE_ENUM, offsetof(meter_data_t, p1.breaker_state), 0},
+    [METER_DATA_FIELD_LIMITER_THRESHOLD] = {"limiterThreshold", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.limiter_threshold), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_FUSE_SUPERVISION_THRESHOLD] = {"fuseSupervisionThreshold", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, p1.fuse_supervision_threshold), EMUCS_P1_DECIMALS_CURRENT},
+    [METER_DATA_FIELD_MAX_DEMAND_MONTH] = {"maxDemandMonth", METER_DATA_FIELD_TYPE_MAX_DEMAND, offsetof(meter_data_t, p1.max_demand_month), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_MAX_DEMAND_YEAR] = {"maxDemandYear", METER_DATA_FIELD_TYPE_MAX_DEMAND_YEAR, offsetof(meter_data_t, p1.max_demand_year), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_PREDICTED_PEAK] = {"predictedPeak", METER_DATA_FIELD_TYPE_FLOAT, offsetof(meter_data_t, predicted_peak.value), EMUCS_P1_DECIMALS_POWER},
+    [METER_DATA_FIELD_PREDICTED_PEAK_TIME] = {"predictedPeakTime", METER_DATA_FIELD_TYPE_TIMESTAMP, offsetof(meter_data_t, predicted_peak.timestamp), 0},
+    [METER_DATA_FIELD_TELEGRAM_SEQUENCE] = {"telegramSequence", METER_DATA_FIELD_TYPE_UINT32, offsetof(meter_data_t, telegram_sequence), 0},
+};
+
+
+/**
+ * @brief Copy the current telegram and predicted peak
+ *
+ * Each mutex is only held while copying the data it protects.
+ *
+ * @param[out] data The copy of the meter data
+ * @param[in] timeout The max time to wait for each mutex
+ * @return
+ *   - ESP_OK on success
+ *   - ESP_ERR_INVALID_STATE if the data is not available yet
+ *   - ESP_ERR_TIMEOUT if a mutex couldn't be taken in time
+ */
+esp_err_t meter_data_copy(meter_data_t *data, TickType_t timeout) {
+    SemaphoreHandle_t telegram_mutex = emucs_p1_get_telegram_mutex_handle();
+    SemaphoreHandle_t predicted_peak_mutex = predict_peak_get_predicted_peak_mutex_handle();
+
+    if (telegram_mutex == NULL || predicted_peak_mutex == NULL) {
+        ESP_LOGW(TAG, "Meter data not available yet");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Copy the telegram
+    if (http_stats_take(telegram_mutex, timeout) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get P1 data semaphore");
+        return ESP_ERR_TIMEOUT;
+    }
+    data->p1 = *emucs_p1_get_telegram();
+    data->telegram_sequence = emucs_p1_get_telegram_sequence();
+    xSemaphoreGive(telegram_mutex);
+
+    // Copy the predicted peak
+    if (http_stats_take(predicted_peak_mutex, timeout) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get predicted peak mutex");
+        return ESP_ERR_TIMEOUT;
+    }
+    data->predicted_peak = predict_peak_get_predicted_peak();
+    data->predicted_peak_sequence = predict_peak_get_sequence();
+    xSemaphoreGive(predicted_peak_mutex);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the description of a field
+ *
+ * @param[in] id The field
+ * @return The field description, or NULL if the id is invalid
+ */
+const meter_data_field_t * meter_data_get_field(meter_data_field_id_t id) {
+    if (id >= METER_DATA_FIELD_COUNT) {
+        return NULL;
+    }
+
+    return &fields[id];
+}
+
+/**
+ * @brief Parse a comma separated list of field names into a field mask
+ *
+ * @param[in] list The list of field names, e.g. "timestamp,currentPowerUsage"
+ * @param[out] mask The mask with a bit set for every field in the list (see METER_DATA_FIELD_BIT)
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the list contains an unknown field name
+ */
+esp_err_t meter_data_parse_field_mask(const char *list, uint64_t *mask) {
+    const char *name = list;
+    const char *end;
+    size_t len;
+    meter_data_field_id_t id;
+
+    *mask = 0;
+    while (*name != '\0') {
+        end = strchr(name, METER_DATA_FIELD_LIST_SEPARATOR);
+        len = end != NULL ? (size_t)(end - name) : strlen(name);
+
+        // Find the field with this name, empty names are ignored
+        if (len > 0) {
+            for (id = 0; id < METER_DATA_FIELD_COUNT; id++) {
+                if (strncmp(fields[id].name, name, len) == 0 && fields[id].name[len] == '\0') {
+                    break;
+                }
+            }
+            if (id == METER_DATA_FIELD_COUNT) {
+                ESP_LOGD(TAG, "Unknown field: %.*s", len, name);
+                return ESP_ERR_NOT_FOUND;
+            }
+            *mask |= METER_DATA_FIELD_BIT(id);
+        }
+
+        name += len;
+        if (*name == METER_DATA_FIELD_LIST_SEPARATOR) {
+            name++;
+        }
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Write the selected fields to a JSON object
+ *
+ * @note The enclosing JSON object must be opened and closed by the caller
+ *
+ * @param[in] json The JSON writer
+ * @param[in] data The meter data
+ * @param[in] field_mask The fields to write (see METER_DATA_FIELD_BIT)
+ */
+void meter_data_write_json_fields(json_writer_t *json, const meter_data_t *data, uint64_t field_mask) {
+    const uint8_t *base = (const uint8_t *)data;
+
+    for (meter_data_field_id_t id = 0; id < METER_DATA_FIELD_COUNT; id++) {
+        const meter_data_field_t *field = &fields[id];
+        const void *value = base + field->offset;
+
+        if (!(field_mask & METER_DATA_FIELD_BIT(id))) {
+            continue;
+        }
+
+        switch (field->type) {
+            case METER_DATA_FIELD_TYPE_FLOAT:
+                json_writer_add_fixed(json, field->name, *(const float *)value, field->decimals);
+                break;
+            case METER_DATA_FIELD_TYPE_TIMESTAMP:
+                json_writer_add_int(json, field->name, *(const time_t *)value);
+                break;
+            case METER_DATA_FIELD_TYPE_MAX_DEMAND: {
+                const struct emucs_p1_max_demand_month_s *max_demand = value;
+                json_writer_begin_object(json, field->name);
+                json_writer_add_int(json, "timestamp", max_demand->timestamp);
+                json_writer_add_fixed(json, "demand", max_demand->max_demand, field->decimals);
+                json_writer_end_object(json);
+                break;
+            }
+            case METER_DATA_FIELD_TYPE_MAX_DEMAND_YEAR: {
+                const struct emucs_p1_max_demand_s *max_demand = value;
+                json_writer_begin_array(json, field->name);
+                // Months without a maximum demand yet are not included
+                for (size_t i = 0; i < EMUCS_P1_MAX_DEMAND_YEAR_MONTHS && max_demand[i].timestamp_appearance != 0; i++) {
+                    json_writer_begin_object(json, NULL);
+                    json_writer_add_int(json, "timestamp", max_demand[i].timestamp_appearance);
+                    json_writer_add_fixed(json, "demand", max_demand[i].max_demand, field->decimals);
+                    json_writer_end_object(json);
+                }
+                json_writer_end_array(json);
+                break;
+            }
+            case METER_DATA_FIELD_TYPE_UINT32:
+                json_writer_add_int(json, field->name, *(const uint32_t *)value);
+                break;
+            case METER_DATA_FIELD_TYPE_UINT16:
+                json_writer_add_int(json, field->name, *(const uint16_t *)value);
+                break;
+            case METER_DATA_FIELD_TYPE_ENUM:
+                json_writer_add_int(json, field->name, *(const int *)value);
+                break;
+            case METER_DATA_FIELD_TYPE_STRING:
+                json_writer_add_string(json, field->name, (const char *)value);
+                break;
+        }
+    }
+}
@@ -0,0 +1,413 @@
+/**
+ * @file metrics.c
+ * @brief Prometheus metrics
+ *
+ * The metrics are written in the Prometheus text exposition format, straight into the socket with a chunk writer.
+ * Nothing is allocated from the heap: the meter data is copied into the request arena, everything else lives on the
+ * stack or in the tables below.
+ *
+ * The meter readings come from the last telegram and the predicted peak; the health metrics from the counters of the
+ * P1 reader, the heap and the stack high-water marks of the tasks.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "chunk_writer.h"
+#include "meter_data.h"
+#include "request_arena.h"
+#include "http_sessions.h"
+#include "mqtt_publisher.h"
+#include "udp_multicast.h"
+#include "p1_passthrough.h"
+#include "modbus_tcp.h"
+#include "metrics.h"
+
+typedef enum {
+    METRIC_VALUE_FLOAT,                 // float
+    METRIC_VALUE_TIMESTAMP,             // time_t, exposed in seconds
+    METRIC_VALUE_UINT16,                // uint16_t
+    METRIC_VALUE_ENUM,                  // enum (int)
+} metric_value_type_t;
+
+/**
+ * A metric with its value in meter_data_t.
+ * Samples of the same metric with different labels must be consecutive, the HELP and TYPE lines are written once.
+ */
+typedef struct {
+    const char *name;
+    const char *type;                   // "gauge" or "counter"
+    const char *help;
+    const char *labels;                 // Labels of the sample without braces, NULL if none
+    metric_value_type_t value_type;
+    size_t offset;                      // Offset of the value in meter_data_t
+    uint8_t decimals;                   // Number of decimals (only for floats)
+} meter_metric_t;
+
+#define METER_METRIC(name, type, help, labels, value_type, member, decimals) \
+    {name, type, help, labels, value_type, offsetof(meter_data_t, member), decimals}
+
+static const char *TAG = "metrics";     // Tag used for logging
+
+static const meter_metric_t meter_metrics[] = {
+    METER_METRIC("p1_electricity_delivered_kwh_total", "counter", "Meter reading of the electricity delivered to the client",
+                 "tariff=\"1\"", METRIC_VALUE_FLOAT, p1.electricity_delivered_tariff1, EMUCS_P1_DECIMALS_ENERGY),
+    METER_METRIC("p1_electricity_delivered_kwh_total", "counter", NULL,
+                 "tariff=\"2\"", METRIC_VALUE_FLOAT, p1.electricity_delivered_tariff2, EMUCS_P1_DECIMALS_ENERGY),
+    METER_METRIC("p1_electricity_returned_kwh_total", "counter", "Meter reading of the electricity delivered by the client",
+                 "tariff=\"1\"", METRIC_VALUE_FLOAT, p1.electricity_returned_tariff1, EMUCS_P1_DECIMALS_ENERGY),
+    METER_METRIC("p1_electricity_returned_kwh_total", "counter", NULL,
+                 "tariff=\"2\"", METRIC_VALUE_FLOAT, p1.electricity_returned_tariff2, EMUCS_P1_DECIMALS_ENERGY),
+    METER_METRIC("p1_tariff_indicator", "gauge", "Current tariff (1 = high, 2 = low)",
+                 NULL, METRIC_VALUE_UINT16, p1.tariff_indicator, 0),
+    METER_METRIC("p1_average_demand_kw", "gauge", "Current average demand (quarter-hour)",
+                 NULL, METRIC_VALUE_FLOAT, p1.current_avg_demand, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_power_usage_kw", "gauge", "Power delivered to the client",
+                 NULL, METRIC_VALUE_FLOAT, p1.current_power_usage, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_power_return_kw", "gauge", "Power delivered by the client",
+                 NULL, METRIC_VALUE_FLOAT, p1.current_power_return, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_phase_power_usage_kw", "gauge", "Power delivered to the client per phase",
+                 "phase=\"l1\"", METRIC_VALUE_FLOAT, p1.current_power_usage_l1, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_phase_power_usage_kw", "gauge", NULL,
+                 "phase=\"l2\"", METRIC_VALUE_FLOAT, p1.current_power_usage_l2, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_phase_power_usage_kw", "gauge", NULL,
+                 "phase=\"l3\"", METRIC_VALUE_FLOAT, p1.current_power_usage_l3, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_phase_power_return_kw", "gauge", "Power delivered by the client per phase",
+                 "phase=\"l1\"", METRIC_VALUE_FLOAT, p1.current_power_return_l1, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_phase_power_return_kw", "gauge", NULL,
+                 "phase=\"l2\"", METRIC_VALUE_FLOAT, p1.current_power_return_l2, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_phase_power_return_kw", "gauge", NULL,
+                 "phase=\"l3\"", METRIC_VALUE_FLOAT, p1.current_power_return_l3, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_voltage_volts", "gauge", "Voltage per phase",
+                 "phase=\"l1\"", METRIC_VALUE_FLOAT, p1.voltage_l1, EMUCS_P1_DECIMALS_VOLTAGE),
+    METER_METRIC("p1_voltage_volts", "gauge", NULL,
+                 "phase=\"l2\"", METRIC_VALUE_FLOAT, p1.voltage_l2, EMUCS_P1_DECIMALS_VOLTAGE),
+    METER_METRIC("p1_voltage_volts", "gauge", NULL,
+                 "phase=\"l3\"", METRIC_VALUE_FLOAT, p1.voltage_l3, EMUCS_P1_DECIMALS_VOLTAGE),
+    METER_METRIC("p1_current_amperes", "gauge", "Current per phase",
+                 "phase=\"l1\"", METRIC_VALUE_FLOAT, p1.current_l1, EMUCS_P1_DECIMALS_CURRENT),
+    METER_METRIC("p1_current_amperes", "gauge", NULL,
+                 "phase=\"l2\"", METRIC_VALUE_FLOAT, p1.current_l2, EMUCS_P1_DECIMALS_CURRENT),
+    METER_METRIC("p1_current_amperes", "gauge", NULL,
+                 "phase=\"l3\"", METRIC_VALUE_FLOAT, p1.current_l3, EMUCS_P1_DECIMALS_CURRENT),
+    METER_METRIC("p1_breaker_state", "gauge", "Breaker state (0 = disconnected, 1 = connected, 2 = ready for connection)",
+                 NULL, METRIC_VALUE_ENUM, p1.breaker_state, 0),
+    METER_METRIC("p1_limiter_threshold_kw", "gauge", "Limiter threshold (999 = deactivated)",
+                 NULL, METRIC_VALUE_FLOAT, p1.limiter_threshold, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_fuse_supervision_threshold_amperes", "gauge", "Fuse supervision threshold (999 = deactivated)",
+                 NULL, METRIC_VALUE_FLOAT, p1.fuse_supervision_threshold, EMUCS_P1_DECIMALS_CURRENT),
+    METER_METRIC("p1_max_demand_month_kw", "gauge", "Maximum demand of the running month",
+                 NULL, METRIC_VALUE_FLOAT, p1.max_demand_month.max_demand, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_max_demand_month_timestamp_seconds", "gauge", "Time of the maximum demand of the running month",
+                 NULL, METRIC_VALUE_TIMESTAMP, p1.max_demand_month.timestamp, 0),
+    METER_METRIC("p1_telegram_timestamp_seconds", "gauge", "Time stamp of the last telegram",
+                 NULL, METRIC_VALUE_TIMESTAMP, p1.msg_timestamp, 0),
+    METER_METRIC("p1_predicted_peak_kw", "gauge", "Predicted average demand at the end of the quarter-hour",
+                 NULL, METRIC_VALUE_FLOAT, predicted_peak.value, EMUCS_P1_DECIMALS_POWER),
+    METER_METRIC("p1_predicted_peak_timestamp_seconds", "gauge", "End of the quarter-hour of the predicted peak",
+                 NULL, METRIC_VALUE_TIMESTAMP, predicted_peak.timestamp, 0),
+};
+
+// Tasks of which the stack high-water mark is exposed, tasks that don't exist are skipped
+static const char *stack_tasks[] = {
+    "emucs_p1_task", "logger_task", "predict_peak_task", "httpd", "event_stream_task", "ws_telemetry_task",
+    "long_poll_task", "async_worker_0", "async_worker_1", "mqtt_task", "mqtt_publisher",
+    "udp_multicast", "p1_passthrough", "modbus_tcp",
+};
+
+static uint32_t last_render_time_us = 0;    // Time it took to render the previous scrape
+
+// Function prototypes
+static void write_meter_metrics(chunk_writer_t *w, const meter_data_t *data);
+static void write_health_metrics(chunk_writer_t *w);
+static void write_heap_metric(chunk_writer_t *w, const char *name, const char *help, size_t (*get_size)(uint32_t caps));
+static void write_header(chunk_writer_t *w, const char *name, const char *type, const char *help);
+static void write_sample_name(chunk_writer_t *w, const char *name, const char *labels);
+static void write_uint_metric(chunk_writer_t *w, const char *name, const char *type, const char *help, uint64_t value);
+
+
+/**
+ * @brief Handler for the /metrics endpoint
+ *
+ * Must be registered through request_arena_handler(), the meter data is copied into the request arena.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+esp_err_t metrics_get_handler(httpd_req_t *req) {
+    int64_t start_time = esp_timer_get_time();
+    meter_data_t *data = request_arena_alloc(sizeof(meter_data_t));
+    chunk_writer_t w;
+    esp_err_t err;
+
+    if (httpd_resp_set_type(req, METRICS_CONTENT_TYPE) != ESP_OK
+        || httpd_resp_set_hdr(req, "Cache-Control", "no-store") != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    chunk_writer_init_httpd(&w, req);
+
+    // The meter metrics are left out until the first telegram is received, or if the data is busy for too long
+    if (data != NULL && meter_data_copy(data, pdMS_TO_TICKS(METRICS_MAX_TIMEOUT_MS)) == ESP_OK
+        && data->telegram_sequence != 0) {
+        write_meter_metrics(&w, data);
+    }
+    write_health_metrics(&w);
+
+    err = chunk_writer_finish(&w);
+
+    last_render_time_us = (uint32_t)(esp_timer_get_time() - start_time);
+    ESP_LOGD(TAG, "Rendered %u bytes in %lu us", w.bytes_flushed, last_render_time_us);
+
+    return err;
+}
+
+/**
+ * @brief Write the metrics of the meter data
+ *
+ * @param[in] w The writer
+ * @param[in] data The meter data
+ */
+static void write_meter_metrics(chunk_writer_t *w, const meter_data_t *data) {
+    const char *previous_name = NULL;
+
+    for (size_t i = 0; i < sizeof(meter_metrics) / sizeof(meter_metrics[0]); i++) {
+        const meter_metric_t *metric = &meter_metrics[i];
+        const void *value = (const uint8_t *)data + metric->offset;
+
+        if (previous_name == NULL || strcmp(metric->name, previous_name) != 0) {
+            write_header(w, metric->name, metric->type, metric->help);
+            previous_name = metric->name;
+        }
+        write_sample_name(w, metric->name, metric->labels);
+
+        switch (metric->value_type) {
+            case METRIC_VALUE_FLOAT:
+                chunk_writer_write_fixed(w, *(const float *)value, metric->decimals);
+                break;
+            case METRIC_VALUE_TIMESTAMP:
+                chunk_writer_write_int(w, *(const time_t *)value);
+                break;
+            case METRIC_VALUE_UINT16:
+                chunk_writer_write_int(w, *(const uint16_t *)value);
+                break;
+            case METRIC_VALUE_ENUM:
+                chunk_writer_write_int(w, *(const int *)value);
+                break;
+        }
+        chunk_writer_write_char(w, '\n');
+    }
+}
+
+/**
+ * @brief Write the health metrics of the P1 reader and the system
+ *
+ * @param[in] w The writer
+ */
+static void write_health_metrics(chunk_writer_t *w) {
+    emucs_p1_stats_t stats;
+    http_sessions_stats_t sessions;
+#if CONFIG_MQTT_PUBLISHER
+    mqtt_publisher_stats_t mqtt;
+#endif
+#if CONFIG_UDP_MULTICAST
+    udp_multicast_stats_t udp;
+#endif
+#if CONFIG_P1_PASSTHROUGH
+    p1_passthrough_stats_t passthrough;
+#endif
+#if CONFIG_MODBUS_TCP
+    modbus_tcp_stats_t modbus;
+#endif
+    TaskHandle_t task;
+
+    emucs_p1_get_stats(&stats);
+    write_uint_metric(w, "p1_telegrams_total", "counter", "Number of telegrams parsed", stats.telegram_count);
+    write_uint_metric(w, "p1_crc_errors_total", "counter", "Number of telegrams dropped because of a CRC mismatch",
+                      stats.crc_error_count);
+    write_uint_metric(w, "p1_uart_buffer_full_total", "counter", "Number of times the UART ring buffer was full",
+                      stats.uart_buffer_full_count);
+    write_uint_metric(w, "p1_uart_fifo_overflows_total", "counter", "Number of UART FIFO overflows",
+                      stats.uart_fifo_overflow_count);
+    write_uint_metric(w, "p1_uart_frame_errors_total", "counter", "Number of UART frame errors",
+                      stats.uart_frame_error_count);
+    write_uint_metric(w, "p1_telegram_buffer_overflows_total", "counter",
+                      "Number of times a telegram didn't fit in the telegram buffer", stats.buffer_overflow_count);
+
+    write_header(w, "p1_parse_duration_seconds", "gauge", "Time it took to check and parse the last telegram");
+    write_sample_name(w, "p1_parse_duration_seconds", NULL);
+    chunk_writer_write_fixed(w, stats.last_parse_time_us / 1e6, 6);
+    chunk_writer_write_char(w, '\n');
+    write_header(w, "p1_parse_duration_max_seconds", "gauge", "Max time it took to check and parse a telegram");
+    write_sample_name(w, "p1_parse_duration_max_seconds", NULL);
+    chunk_writer_write_fixed(w, stats.max_parse_time_us / 1e6, 6);
+    chunk_writer_write_char(w, '\n');
+
+    write_uint_metric(w, "esp_uptime_seconds", "gauge", "Time since boot", esp_timer_get_time() / 1000000);
+
+    write_heap_metric(w, "esp_heap_free_bytes", "Free heap", heap_caps_get_free_size);
+    write_heap_metric(w, "esp_heap_min_free_bytes", "Minimum free heap since boot", heap_caps_get_minimum_free_size);
+    write_heap_metric(w, "esp_heap_largest_free_block_bytes", "Largest free block of the heap",
+                      heap_caps_get_largest_free_block);
+
+    write_header(w, "esp_task_stack_high_water_mark_bytes", "gauge", "Minimum free stack space of a task since it started");
+    for (size_t i = 0; i < sizeof(stack_tasks) / sizeof(stack_tasks[0]); i++) {
+        task = xTaskGetHandle(stack_tasks[i]);
+        if (task == NULL) {
+            continue;
+        }
+        chunk_writer_write_str(w, "esp_task_stack_high_water_mark_bytes{task=\"");
+        chunk_writer_write_str(w, stack_tasks[i]);
+        chunk_writer_write_str(w, "\"} ");
+        chunk_writer_write_int(w, uxTaskGetStackHighWaterMark(task));
+        chunk_writer_write_char(w, '\n');
+    }
+
+    http_sessions_get_stats(&sessions);
+    write_uint_metric(w, "http_connections_open", "gauge", "Number of open web server sessions", sessions.open_count);
+    write_uint_metric(w, "http_connections_accepted_total", "counter", "Number of accepted web server connections",
+                      sessions.accepted_count);
+    write_uint_metric(w, "http_connections_rejected_total", "counter",
+                      "Number of connections closed right away because the session pool was full",
+                      sessions.rejected_count);
+    write_uint_metric(w, "http_connections_evicted_total", "counter",
+                      "Number of sessions closed to make room for a new connection", sessions.evicted_count);
+    write_uint_metric(w, "http_connections_idle_closed_total", "counter",
+                      "Number of sessions closed because they were idle for too long", sessions.idle_closed_count);
+
+#if CONFIG_MQTT_PUBLISHER
+    mqtt_publisher_get_stats(&mqtt);
+    write_uint_metric(w, "mqtt_connected", "gauge", "1 if connected to the MQTT broker", mqtt.connected);
+    write_uint_metric(w, "mqtt_telegrams_published_total", "counter", "Number of telegrams published to the broker",
+                      mqtt.telegram_count);
+    write_uint_metric(w, "mqtt_field_updates_total", "counter", "Number of per-field values published",
+                      mqtt.field_update_count);
+    write_uint_metric(w, "mqtt_field_updates_suppressed_total", "counter",
+                      "Number of per-field values not published because they were within the deadband",
+                      mqtt.field_suppressed_count);
+    write_uint_metric(w, "mqtt_field_update_errors_total", "counter",
+                      "Number of per-field values that failed to publish, they are retried with the next telegram",
+                      mqtt.field_error_count);
+    write_uint_metric(w, "mqtt_offline_buffered_messages", "gauge",
+                      "Number of telegrams waiting in the offline buffer", mqtt.buffered_count);
+    write_uint_metric(w, "mqtt_offline_dropped_total", "counter",
+                      "Number of telegrams dropped because the offline buffer was full", mqtt.dropped_count);
+
+#endif
+#if CONFIG_UDP_MULTICAST
+    udp_multicast_get_stats(&udp);
+    write_uint_metric(w, "udp_multicast_datagrams_total", "counter", "Number of telegrams sent to the multicast group",
+                      udp.sent_count);
+    write_uint_metric(w, "udp_multicast_errors_total", "counter", "Number of telegrams that couldn't be sent",
+                      udp.error_count);
+
+#endif
+#if CONFIG_P1_PASSTHROUGH
+    p1_passthrough_get_stats(&passthrough);
+    write_uint_metric(w, "p1_passthrough_clients", "gauge", "Number of connected P1 passthrough clients",
+                      passthrough.client_count);
+    write_uint_metric(w, "p1_passthrough_rejected_total", "counter",
+                      "Number of passthrough connections closed right away because all client slots were in use",
+                      passthrough.rejected_count);
+    write_uint_metric(w, "p1_passthrough_telegrams_sent_total", "counter",
+                      "Number of telegrams sent to passthrough clients", passthrough.telegrams_sent);
+    write_uint_metric(w, "p1_passthrough_telegrams_dropped_total", "counter",
+                      "Number of telegrams skipped for passthrough clients that were still receiving the previous one",
+                      passthrough.telegrams_dropped);
+
+#endif
+#if CONFIG_MODBUS_TCP
+    modbus_tcp_get_stats(&modbus);
+    write_uint_metric(w, "modbus_tcp_clients", "gauge", "Number of connected Modbus TCP clients", modbus.client_count);
+    write_uint_metric(w, "modbus_tcp_rejected_total", "counter",
+                      "Number of Modbus TCP connections closed right away because all client slots were in use",
+                      modbus.rejected_count);
+    write_uint_metric(w, "modbus_tcp_requests_total", "counter", "Number of Modbus TCP requests answered",
+                      modbus.request_count);
+    write_uint_metric(w, "modbus_tcp_exceptions_total", "counter",
+                      "Number of Modbus TCP requests answered with an exception", modbus.exception_count);
+
+#endif
+    write_header(w, "metrics_render_duration_seconds", "gauge", "Time it took to render the previous scrape");
+    write_sample_name(w, "metrics_render_duration_seconds", NULL);
+    chunk_writer_write_fixed(w, last_render_time_us / 1e6, 6);
+    chunk_writer_write_char(w, '\n');
+}
+
+/**
+ * @brief Write a heap metric, with a sample for the internal memory and one for the PSRAM
+ *
+ * @param[in] w The writer
+ * @param[in] name The name of the metric
+ * @param[in] help The description of the metric
+ * @param[in] get_size The heap function that returns the value for the given capabilities
+ */
+static void write_heap_metric(chunk_writer_t *w, const char *name, const char *help, size_t (*get_size)(uint32_t caps)) {
+    write_header(w, name, "gauge", help);
+    write_sample_name(w, name, "type=\"internal\"");
+    chunk_writer_write_int(w, get_size(MALLOC_CAP_INTERNAL));
+    chunk_writer_write_char(w, '\n');
+    write_sample_name(w, name, "type=\"spiram\"");
+    chunk_writer_write_int(w, get_size(MALLOC_CAP_SPIRAM));
+    chunk_writer_write_char(w, '\n');
+}
+
+/**
+ * @brief Write the HELP and TYPE lines of a metric
+ *
+ * @param[in] w The writer
+ * @param[in] name The name of the metric
+ * @param[in] type The type of the metric
+ * @param[in] help The description of the metric, NULL to leave out the HELP line
+ */
+static void write_header(chunk_writer_t *w, const char *name, const char *type, const char *help) {
+    if (help != NULL) {
+        chunk_writer_write_str(w, "# HELP ");
+        chunk_writer_write_str(w, name);
+        chunk_writer_write_char(w, ' ');
+        chunk_writer_write_str(w, help);
+        chunk_writer_write_char(w, '\n');
+    }
+    chunk_writer_write_str(w, "# TYPE ");
+    chunk_writer_write_str(w, name);
+    chunk_writer_write_char(w, ' ');
+    chunk_writer_write_str(w, type);
+    chunk_writer_write_char(w, '\n');
+}
+
+/**
+ * @brief Write the name and labels of a sample, followed by the space before the value
+ *
+ * @param[in] w The writer
+ * @param[in] name The name of the metric
+ * @param[in] labels The labels without braces, NULL if none
+ */
+static void write_sample_name(chunk_writer_t *w, const char *name, const char *labels) {
+    chunk_writer_write_str(w, name);
+    if (labels != NULL) {
+        chunk_writer_write_char(w, '{');
+        chunk_writer_write_str(w, labels);
+        chunk_writer_write_char(w, '}');
+    }
+    chunk_writer_write_char(w, ' ');
+}
+
+/**
+ * @brief Write a metric with a single integer sample without labels
+ *
+ * @param[in] w The writer
+ * @param[in] name The name of the metric
+ * @param[in] type The type of the metric
+ * @param[in] help The description of the metric
+ * @param[in] value The value
+ */
+static void write_uint_metric(chunk_writer_t *w, const char *name, const char *type, const char *help, uint64_t value) {
+    write_header(w, name, type, help);
+    write_sample_name(w, name, NULL);
+    chunk_writer_write_int(w, (int64_t)value);
+    chunk_writer_write_char(w, '\n');
+}
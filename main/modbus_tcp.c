@@ -0,0 +1,419 @@
+/**
+ * @file modbus_tcp.c
+ * @brief Modbus TCP server exposing the meter data as read-only registers
+ *
+ * Lets inverters, EV chargers and other controllers that speak Modbus TCP read the phase currents, the power and the
+ * predicted peak, e.g. for dynamic load balancing. The register map is documented in modbus_tcp.h.
+ *
+ * The registers are kept as a big-endian register image, which is refreshed in place when a new telegram is parsed or
+ * a new peak prediction is available. A read request is answered by copying the requested part of the image into the
+ * response. One task refreshes the image and serves all clients, so the image doesn't need a lock. Responses are sent
+ * without blocking, a client that doesn't read them is closed so it can't delay the other clients.
+ *
+ * tools/modbus_read.py reads and decodes the registers from a host.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "emucs_p1.h"
+#include "meter_data.h"
+#include "predict_peak.h"
+#include "modbus_tcp.h"
+
+typedef struct {
+    uint16_t address;                           // Address of the first register of the field
+    meter_data_field_id_t id;                   // The field
+} modbus_tcp_register_t;
+
+typedef struct {
+    int fd;                                     // Socket of the client, -1 if the slot is free
+    size_t len;                                 // Number of bytes in buf
+    uint8_t buf[MODBUS_TCP_MAX_ADU_SIZE];       // Received bytes of the next request
+} client_t;
+
+static const char *TAG = "modbus_tcp";  // Tag used for logging
+
+// Fields in the register map, see modbus_tcp.h
+static const modbus_tcp_register_t registers[] = {
+        {0, METER_DATA_FIELD_TELEGRAM_SEQUENCE},
+        {2, METER_DATA_FIELD_TIMESTAMP},
+        {4, METER_DATA_FIELD_CURRENT_L1},
+        {6, METER_DATA_FIELD_CURRENT_L2},
+        {8, METER_DATA_FIELD_CURRENT_L3},
+        {10, METER_DATA_FIELD_VOLTAGE_L1},
+        {12, METER_DATA_FIELD_VOLTAGE_L2},
+        {14, METER_DATA_FIELD_VOLTAGE_L3},
+        {16, METER_DATA_FIELD_CURRENT_POWER_USAGE},
+        {18, METER_DATA_FIELD_CURRENT_POWER_RETURN},
+        {20, METER_DATA_FIELD_CURRENT_POWER_USAGE_L1},
+        {22, METER_DATA_FIELD_CURRENT_POWER_USAGE_L2},
+        {24, METER_DATA_FIELD_CURRENT_POWER_USAGE_L3},
+        {26, METER_DATA_FIELD_CURRENT_POWER_RETURN_L1},
+        {28, METER_DATA_FIELD_CURRENT_POWER_RETURN_L2},
+        {30, METER_DATA_FIELD_CURRENT_POWER_RETURN_L3},
+        {32, METER_DATA_FIELD_CURRENT_AVG_DEMAND},
+        {34, METER_DATA_FIELD_PREDICTED_PEAK},
+        {36, METER_DATA_FIELD_PREDICTED_PEAK_TIME},
+        {38, METER_DATA_FIELD_MAX_DEMAND_MONTH},
+        {40, METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF1},
+        {42, METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF2},
+        {44, METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF1},
+        {46, METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF2},
+        {48, METER_DATA_FIELD_TARIFF_INDICATOR},
+        {49, METER_DATA_FIELD_BREAKER_STATE},
+        {50, METER_DATA_FIELD_LIMITER_THRESHOLD},
+        {52, METER_DATA_FIELD_FUSE_SUPERVISION_THRESHOLD},
+};
+#define REGISTER_FIELD_COUNT (sizeof(registers) / sizeof(registers[0]))
+
+static int listen_sock = -1;
+static client_t clients[CONFIG_MODBUS_TCP_MAX_CLIENTS];
+static uint8_t register_image[MODBUS_TCP_REGISTER_COUNT * 2];  // Big-endian register values, only used by the task
+static modbus_tcp_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;  // Makes reading the counters consistent
+
+// Function prototypes
+_Noreturn static void modbus_tcp_task(void *pvParameters);
+static void refresh_registers(void);
+static void put_u16(uint8_t *dst, uint16_t value);
+static void put_u32(uint8_t *dst, uint32_t value);
+static void accept_client(void);
+static void read_client(client_t *client);
+static size_t handle_request(const uint8_t *request, size_t len, uint8_t *response);
+static void close_client(client_t *client);
+
+
+/**
+ * @brief Start listening and start the Modbus TCP task
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t modbus_tcp_init(void) {
+    struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(CONFIG_MODBUS_TCP_PORT),
+            .sin_addr.s_addr = htonl(INADDR_ANY)
+    };
+    int opt = 1;
+
+    for (size_t i = 0; i < CONFIG_MODBUS_TCP_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listen_sock < 0) {
+        ESP_LOGE(TAG, "Failed to create socket");
+        return ESP_FAIL;
+    }
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || listen(listen_sock, MODBUS_TCP_LISTEN_BACKLOG) < 0) {
+        ESP_LOGE(TAG, "Failed to listen on port %d: %d", CONFIG_MODBUS_TCP_PORT, errno);
+        close(listen_sock);
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(modbus_tcp_task, "modbus_tcp", MODBUS_TCP_TASK_STACK_SIZE, NULL, MODBUS_TCP_TASK_PRIORITY,
+                    NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create Modbus TCP task");
+        close(listen_sock);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Serving the meter registers on port %d", CONFIG_MODBUS_TCP_PORT);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get a consistent copy of the counters
+ *
+ * @param[out] stats_out The counters
+ */
+void modbus_tcp_get_stats(modbus_tcp_stats_t *stats_out) {
+    taskENTER_CRITICAL(&stats_lock);
+    *stats_out = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief Modbus TCP task
+ *
+ * Waits for requests and new connections, and refreshes the register image when a new telegram or a new peak
+ * prediction is available.
+ *
+ * @param pvParameters
+ */
+_Noreturn static void modbus_tcp_task(void *pvParameters) {
+    EventGroupHandle_t event_group = emucs_p1_get_event_group_handle();
+    struct timeval timeout;
+    fd_set read_fds;
+    int max_fd;
+    int ret;
+
+    for (;;) {
+        FD_ZERO(&read_fds);
+        FD_SET(listen_sock, &read_fds);
+        max_fd = listen_sock;
+        for (size_t i = 0; i < CONFIG_MODBUS_TCP_MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0) {
+                FD_SET(clients[i].fd, &read_fds);
+                max_fd = clients[i].fd > max_fd ? clients[i].fd : max_fd;
+            }
+        }
+        timeout.tv_sec = 0;
+        timeout.tv_usec = MODBUS_TCP_SELECT_TIMEOUT_MS * 1000;
+        ret = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
+
+        // Refresh before answering, so the requests get the newest values
+        if (xEventGroupWaitBits(event_group,
+                                EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_MODBUS_BIT | PREDICT_PEAK_EVENT_AVAILABLE_MODBUS_BIT,
+                                pdTRUE, pdFALSE, 0)
+            & (EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_MODBUS_BIT | PREDICT_PEAK_EVENT_AVAILABLE_MODBUS_BIT)) {
+            refresh_registers();
+        }
+
+        if (ret <= 0) {
+            continue;
+        }
+        for (size_t i = 0; i < CONFIG_MODBUS_TCP_MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0 && FD_ISSET(clients[i].fd, &read_fds)) {
+                read_client(&clients[i]);
+            }
+        }
+        if (FD_ISSET(listen_sock, &read_fds)) {
+            accept_client();
+        }
+    }
+}
+
+/**
+ * @brief Encode the newest meter data into the register image
+ */
+static void refresh_registers(void) {
+    meter_data_t data;
+
+    if (meter_data_copy(&data, pdMS_TO_TICKS(MODBUS_TCP_MAX_TIMEOUT_MS)) != ESP_OK) {
+        // Refreshed with the next telegram
+        return;
+    }
+
+    for (size_t i = 0; i < REGISTER_FIELD_COUNT; i++) {
+        const meter_data_field_t *field = meter_data_get_field(registers[i].id);
+        const void *src = (const uint8_t *)&data + field->offset;
+        uint8_t *dst = &register_image[registers[i].address * 2];
+        uint32_t bits;
+
+        switch (field->type) {
+            case METER_DATA_FIELD_TYPE_FLOAT:
+                memcpy(&bits, src, sizeof(bits));
+                put_u32(dst, bits);
+                break;
+            case METER_DATA_FIELD_TYPE_MAX_DEMAND:
+                memcpy(&bits, &((const struct emucs_p1_max_demand_month_s *)src)->max_demand, sizeof(bits));
+                put_u32(dst, bits);
+                break;
+            case METER_DATA_FIELD_TYPE_TIMESTAMP:
+                put_u32(dst, (uint32_t)*(const time_t *)src);
+                break;
+            case METER_DATA_FIELD_TYPE_UINT32:
+                put_u32(dst, *(const uint32_t *)src);
+                break;
+            case METER_DATA_FIELD_TYPE_UINT16:
+                put_u16(dst, *(const uint16_t *)src);
+                break;
+            case METER_DATA_FIELD_TYPE_ENUM:
+                put_u16(dst, (uint16_t)*(const int *)src);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Write a big-endian 16-bit value
+ *
+ * @param[out] dst The destination
+ * @param[in] value The value
+ */
+static void put_u16(uint8_t *dst, uint16_t value) {
+    dst[0] = (uint8_t)(value >> 8);
+    dst[1] = (uint8_t)value;
+}
+
+/**
+ * @brief Write a 32-bit value as two big-endian registers, high word first
+ *
+ * @param[out] dst The destination
+ * @param[in] value The value
+ */
+static void put_u32(uint8_t *dst, uint32_t value) {
+    put_u16(dst, (uint16_t)(value >> 16));
+    put_u16(dst + 2, (uint16_t)value);
+}
+
+/**
+ * @brief Accept a connection, the connection is closed right away if all client slots are in use
+ */
+static void accept_client(void) {
+    int opt = 1;
+    int fd;
+
+    fd = accept(listen_sock, NULL, NULL);
+    if (fd < 0) {
+        ESP_LOGW(TAG, "Failed to accept a connection: %d", errno);
+        return;
+    }
+
+    for (size_t i = 0; i < CONFIG_MODBUS_TCP_MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
+            clients[i].fd = fd;
+            clients[i].len = 0;
+
+            taskENTER_CRITICAL(&stats_lock);
+            stats.client_count++;
+            stats.accepted_count++;
+            taskEXIT_CRITICAL(&stats_lock);
+
+            ESP_LOGI(TAG, "Client connected (socket %d)", fd);
+            return;
+        }
+    }
+
+    ESP_LOGW(TAG, "Max number of Modbus TCP clients reached");
+    close(fd);
+    taskENTER_CRITICAL(&stats_lock);
+    stats.rejected_count++;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief Receive the available bytes of a client and answer the complete requests
+ *
+ * @param[in] client The client
+ */
+static void read_client(client_t *client) {
+    uint8_t response[MODBUS_TCP_MAX_ADU_SIZE];
+    size_t frame_len;
+    size_t response_len;
+    int ret;
+
+    ret = recv(client->fd, client->buf + client->len, sizeof(client->buf) - client->len, 0);
+    if (ret <= 0) {
+        close_client(client);
+        return;
+    }
+    client->len += ret;
+
+    while (client->len >= MODBUS_TCP_MBAP_HEADER_SIZE) {
+        // The length field counts the unit identifier and the PDU
+        frame_len = 6 + ((client->buf[4] << 8) | client->buf[5]);
+        if (client->buf[2] != 0 || client->buf[3] != 0 || frame_len < MODBUS_TCP_MBAP_HEADER_SIZE + 1
+            || frame_len > MODBUS_TCP_MAX_ADU_SIZE) {
+            ESP_LOGW(TAG, "Invalid Modbus TCP frame (socket %d)", client->fd);
+            close_client(client);
+            return;
+        }
+        if (client->len < frame_len) {
+            break;
+        }
+
+        response_len = handle_request(client->buf, frame_len, response);
+        // Responses are small and fit in the send buffer of a client that reads them, a client whose buffer is
+        // full (EAGAIN) is closed instead of blocking the task
+        if (send(client->fd, response, response_len, MSG_DONTWAIT) != (int)response_len) {
+            ESP_LOGW(TAG, "Failed to send a response, closing the client (socket %d): %d", client->fd, errno);
+            close_client(client);
+            return;
+        }
+
+        memmove(client->buf, client->buf + frame_len, client->len - frame_len);
+        client->len -= frame_len;
+    }
+}
+
+/**
+ * @brief Build the response to a request
+ *
+ * @param[in] request The request, with the MBAP header
+ * @param[in] len The length of the request
+ * @param[out] response The response, at least MODBUS_TCP_MAX_ADU_SIZE bytes
+ * @return The length of the response
+ */
+static size_t handle_request(const uint8_t *request, size_t len, uint8_t *response) {
+    const uint8_t *pdu = request + MODBUS_TCP_MBAP_HEADER_SIZE;
+    size_t pdu_len = len - MODBUS_TCP_MBAP_HEADER_SIZE;
+    uint8_t *response_pdu = response + MODBUS_TCP_MBAP_HEADER_SIZE;
+    size_t response_pdu_len;
+    uint8_t exception = 0;
+    uint16_t address;
+    uint16_t count;
+
+    if (pdu[0] != MODBUS_TCP_FC_READ_HOLDING_REGISTERS && pdu[0] != MODBUS_TCP_FC_READ_INPUT_REGISTERS) {
+        exception = MODBUS_TCP_EX_ILLEGAL_FUNCTION;
+    } else if (pdu_len != 5) {
+        exception = MODBUS_TCP_EX_ILLEGAL_DATA_VALUE;
+    } else {
+        address = (pdu[1] << 8) | pdu[2];
+        count = (pdu[3] << 8) | pdu[4];
+        if (count < 1 || count > MODBUS_TCP_MAX_READ_COUNT) {
+            exception = MODBUS_TCP_EX_ILLEGAL_DATA_VALUE;
+        } else if (address + count > MODBUS_TCP_REGISTER_COUNT) {
+            exception = MODBUS_TCP_EX_ILLEGAL_DATA_ADDRESS;
+        }
+    }
+
+    if (exception != 0) {
+        response_pdu[0] = pdu[0] | 0x80;
+        response_pdu[1] = exception;
+        response_pdu_len = 2;
+    } else {
+        response_pdu[0] = pdu[0];
+        response_pdu[1] = (uint8_t)(count * 2);
+        memcpy(&response_pdu[2], &register_image[address * 2], count * 2);
+        response_pdu_len = 2 + count * 2;
+    }
+
+    // Same transaction and unit identifier as the request
+    memcpy(response, request, 4);
+    put_u16(response + 4, (uint16_t)(response_pdu_len + 1));
+    response[6] = request[6];
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.request_count++;
+    if (exception != 0) {
+        stats.exception_count++;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    return MODBUS_TCP_MBAP_HEADER_SIZE + response_pdu_len;
+}
+
+/**
+ * @brief Close the connection of a client and free its slot
+ *
+ * @param[in] client The client
+ */
+static void close_client(client_t *client) {
+    ESP_LOGI(TAG, "Client disconnected (socket %d)", client->fd);
+
+    close(client->fd);
+    client->fd = -1;
+    client->len = 0;
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.client_count--;
+    taskEXIT_CRITICAL(&stats_lock);
+}
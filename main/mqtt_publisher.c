@@ -0,0 +1,472 @@
+/**
+ * @file mqtt_publisher.c
+ * @brief Publishes the meter data to an MQTT broker
+ *
+ * Every telegram is published once as a batched message on <prefix>/telegram, as compact JSON or as a binary
+ * telemetry frame (see telemetry_frame.h), depending on CONFIG_MQTT_PUBLISHER_FORMAT_BINARY. The fields in
+ * published_fields are also published as retained values on their own topic, <prefix>/<field name>, but only when
+ * they changed more than their deadband since the last published value, so a flat value doesn't cost a message every
+ * second.
+ *
+ * While the broker is unreachable, the batched messages are kept in a PSRAM ring buffer, the oldest messages are
+ * dropped when it is full. After a reconnect they are replayed in order, MQTT_PUBLISHER_REPLAY_BATCH_SIZE per telegram,
+ * and all per-field values are published again. <prefix>/status is "online" while connected, the broker sets it to
+ * "offline" (last will) when the connection is lost. With CONFIG_MQTT_PUBLISHER_HA_DISCOVERY, the per-field topics are
+ * announced to Home Assistant, see ha_discovery.c.
+ *
+ * To test against a local broker, run `mosquitto -v`, set CONFIG_MQTT_PUBLISHER_BROKER_URI to its address and watch
+ * the messages with `mosquitto_sub -h <broker> -t 'kwartiwi/#' -v`.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "mqtt_client.h"
+#include "emucs_p1.h"
+#include "meter_data.h"
+#include "json_writer.h"
+#include "shared_buffer.h"
+#include "telemetry_frame.h"
+#include "ha_discovery.h"
+#include "mqtt_publisher.h"
+
+static const char *TAG = "mqtt_publisher";  // Tag used for logging
+
+// Fields published on their own topic, also described to Home Assistant (see ha_discovery.c)
+static const mqtt_publisher_field_t published_fields[] = {
+    {METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF1, 0.01f, "Energy delivered tariff 1", "kWh", "energy", "total_increasing"},
+    {METER_DATA_FIELD_ELECTRICITY_DELIVERED_TARIFF2, 0.01f, "Energy delivered tariff 2", "kWh", "energy", "total_increasing"},
+    {METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF1, 0.01f, "Energy returned tariff 1", "kWh", "energy", "total_increasing"},
+    {METER_DATA_FIELD_ELECTRICITY_RETURNED_TARIFF2, 0.01f, "Energy returned tariff 2", "kWh", "energy", "total_increasing"},
+    {METER_DATA_FIELD_TARIFF_INDICATOR, 0.0f, "Tariff", NULL, NULL, NULL},
+    {METER_DATA_FIELD_CURRENT_AVG_DEMAND, 0.01f, "Average demand", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_CURRENT_POWER_USAGE, 0.005f, "Power usage", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_CURRENT_POWER_RETURN, 0.005f, "Power return", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_CURRENT_POWER_USAGE_L1, 0.005f, "Power usage L1", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_CURRENT_POWER_USAGE_L2, 0.005f, "Power usage L2", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_CURRENT_POWER_USAGE_L3, 0.005f, "Power usage L3", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_CURRENT_POWER_RETURN_L1, 0.005f, "Power return L1", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_CURRENT_POWER_RETURN_L2, 0.005f, "Power return L2", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_CURRENT_POWER_RETURN_L3, 0.005f, "Power return L3", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_VOLTAGE_L1, 1.0f, "Voltage L1", "V", "voltage", "measurement"},
+    {METER_DATA_FIELD_VOLTAGE_L2, 1.0f, "Voltage L2", "V", "voltage", "measurement"},
+    {METER_DATA_FIELD_VOLTAGE_L3, 1.0f, "Voltage L3", "V", "voltage", "measurement"},
+    {METER_DATA_FIELD_CURRENT_L1, 0.1f, "Current L1", "A", "current", "measurement"},
+    {METER_DATA_FIELD_CURRENT_L2, 0.1f, "Current L2", "A", "current", "measurement"},
+    {METER_DATA_FIELD_CURRENT_L3, 0.1f, "Current L3", "A", "current", "measurement"},
+    {METER_DATA_FIELD_BREAKER_STATE, 0.0f, "Breaker state", NULL, NULL, NULL},
+    {METER_DATA_FIELD_LIMITER_THRESHOLD, 0.0f, "Limiter threshold", "kW", "power", NULL},
+    {METER_DATA_FIELD_FUSE_SUPERVISION_THRESHOLD, 0.0f, "Fuse supervision threshold", "A", "current", NULL},
+    {METER_DATA_FIELD_MAX_DEMAND_MONTH, 0.0f, "Max demand this month", "kW", "power", "measurement"},
+    {METER_DATA_FIELD_PREDICTED_PEAK, 0.01f, "Predicted peak", "kW", "power", "measurement"},
+};
+#define PUBLISHED_FIELD_COUNT (sizeof(published_fields) / sizeof(published_fields[0]))
+
+static esp_mqtt_client_handle_t client = NULL;
+static char status_topic[MQTT_PUBLISHER_MAX_TOPIC_LEN];
+static char telegram_topic[MQTT_PUBLISHER_MAX_TOPIC_LEN];
+static shared_buffer_t *message = NULL;                 // The batched message that is being published
+static float last_values[PUBLISHED_FIELD_COUNT];        // Last published value of every field
+static bool last_value_valid[PUBLISHED_FIELD_COUNT];    // The field was published since the last connect
+static bool resync_fields = false;                      // Set on connect, all fields must be published again
+static uint8_t *offline_buffer = NULL;                  // Ring buffer of messages, each one prefixed by its length (u16)
+static size_t offline_head = 0;                         // Offset of the oldest message
+static size_t offline_used = 0;                         // Number of bytes in use
+static mqtt_publisher_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;  // Protects the statistics and resync_fields
+
+// Function prototypes
+_Noreturn static void mqtt_publisher_task(void *pvParameters);
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
+static size_t encode_telegram(const meter_data_t *data);
+static void publish_fields(const meter_data_t *data);
+static void replay_offline_messages(void);
+static void offline_push(const char *msg, size_t len);
+static size_t offline_peek(char *msg, size_t max_len);
+static void offline_pop(void);
+static void ring_write(size_t offset, const void *src, size_t len);
+static void ring_read(size_t offset, void *dst, size_t len);
+
+
+/**
+ * @brief Connect to the broker and start the MQTT publisher task
+ *
+ * @note The connection is made in the background, the client reconnects by itself when the connection is lost
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t mqtt_publisher_init(void) {
+    esp_mqtt_client_config_t config = {
+            .broker.address.uri = CONFIG_MQTT_PUBLISHER_BROKER_URI,
+            .credentials.username = strlen(CONFIG_MQTT_PUBLISHER_USERNAME) > 0 ? CONFIG_MQTT_PUBLISHER_USERNAME : NULL,
+            .credentials.authentication.password = strlen(CONFIG_MQTT_PUBLISHER_PASSWORD) > 0
+                                                   ? CONFIG_MQTT_PUBLISHER_PASSWORD : NULL,
+            .session.last_will = {
+                    .topic = status_topic,
+                    .msg = "offline",
+                    .qos = 1,
+                    .retain = 1
+            }
+    };
+
+    snprintf(status_topic, sizeof(status_topic), "%s/%s", CONFIG_MQTT_PUBLISHER_TOPIC_PREFIX, MQTT_PUBLISHER_STATUS_TOPIC);
+    snprintf(telegram_topic, sizeof(telegram_topic), "%s/%s", CONFIG_MQTT_PUBLISHER_TOPIC_PREFIX,
+             MQTT_PUBLISHER_TELEGRAM_TOPIC);
+
+    message = shared_buffer_create(MQTT_PUBLISHER_MESSAGE_MAX_SIZE);
+    if (message == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the message buffer");
+        return ESP_ERR_NO_MEM;
+    }
+
+#if CONFIG_MQTT_PUBLISHER_HA_DISCOVERY
+    if (ha_discovery_init(published_fields, PUBLISHED_FIELD_COUNT) != ESP_OK) {
+        return ESP_FAIL;
+    }
+#endif
+
+    // Without the offline buffer, messages are simply not published while the broker is unreachable
+    offline_buffer = heap_caps_malloc(MQTT_PUBLISHER_OFFLINE_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+    if (offline_buffer == NULL) {
+        ESP_LOGW(TAG, "Failed to allocate the offline buffer");
+    }
+
+    client = esp_mqtt_client_init(&config);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to create the MQTT client");
+        return ESP_FAIL;
+    }
+    if (esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL) != ESP_OK
+        || esp_mqtt_client_start(client) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the MQTT client");
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(mqtt_publisher_task, "mqtt_publisher", MQTT_PUBLISHER_TASK_STACK_SIZE, NULL,
+                    MQTT_PUBLISHER_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create MQTT publisher task");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Publishing to %s with topic prefix '%s'", CONFIG_MQTT_PUBLISHER_BROKER_URI,
+             CONFIG_MQTT_PUBLISHER_TOPIC_PREFIX);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get a consistent copy of the counters
+ *
+ * @param[out] stats_out The counters
+ */
+void mqtt_publisher_get_stats(mqtt_publisher_stats_t *stats_out) {
+    taskENTER_CRITICAL(&stats_lock);
+    *stats_out = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief MQTT publisher task
+ *
+ * Waits for new telegrams and publishes them, or buffers them while the broker is unreachable.
+ *
+ * @param pvParameters
+ */
+_Noreturn static void mqtt_publisher_task(void *pvParameters) {
+    EventGroupHandle_t event_group = emucs_p1_get_event_group_handle();
+    meter_data_t data;
+    size_t len;
+    bool connected;
+
+    for (;;) {
+        xEventGroupWaitBits(event_group, EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_MQTT_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+
+        if (meter_data_copy(&data, pdMS_TO_TICKS(MQTT_PUBLISHER_MAX_TIMEOUT_MS)) != ESP_OK) {
+            continue;
+        }
+
+        len = encode_telegram(&data);
+        if (len == 0) {
+            continue;
+        }
+
+        taskENTER_CRITICAL(&stats_lock);
+        connected = stats.connected;
+        taskEXIT_CRITICAL(&stats_lock);
+
+        // Buffered messages go first, so the messages stay in order
+        if (!connected || offline_used > 0
+            || esp_mqtt_client_publish(client, telegram_topic, message->data, (int)len,
+                                       MQTT_PUBLISHER_TELEGRAM_QOS, 0) < 0) {
+            offline_push(message->data, len);
+        } else {
+            taskENTER_CRITICAL(&stats_lock);
+            stats.telegram_count++;
+            taskEXIT_CRITICAL(&stats_lock);
+        }
+
+        if (connected) {
+            replay_offline_messages();
+            publish_fields(&data);
+        }
+    }
+}
+
+/**
+ * @brief Handle the events of the MQTT client, runs in the MQTT client task
+ *
+ * @param[in] handler_args Unused
+ * @param[in] base The event base
+ * @param[in] event_id The event
+ * @param[in] event_data The event data (esp_mqtt_event_handle_t)
+ */
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
+    uint32_t buffered_count;
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+        case MQTT_EVENT_CONNECTED:
+            esp_mqtt_client_publish(client, status_topic, "online", 0, 1, 1);
+#if CONFIG_MQTT_PUBLISHER_HA_DISCOVERY
+            ha_discovery_connected(client);
+#endif
+            taskENTER_CRITICAL(&stats_lock);
+            stats.connected = true;
+            resync_fields = true;
+            buffered_count = stats.buffered_count;
+            taskEXIT_CRITICAL(&stats_lock);
+            ESP_LOGI(TAG, "Connected to the broker, %lu messages buffered", buffered_count);
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            ESP_LOGW(TAG, "Disconnected from the broker");
+            taskENTER_CRITICAL(&stats_lock);
+            stats.connected = false;
+            taskEXIT_CRITICAL(&stats_lock);
+            break;
+#if CONFIG_MQTT_PUBLISHER_HA_DISCOVERY
+        case MQTT_EVENT_DATA:
+            ha_discovery_data(client, (esp_mqtt_event_handle_t)event_data);
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Encode the batched message of a telegram into the message buffer
+ *
+ * @param[in] data The meter data
+ * @return The length of the message, or 0 if it doesn't fit in the buffer
+ */
+static size_t encode_telegram(const meter_data_t *data) {
+#if CONFIG_MQTT_PUBLISHER_FORMAT_BINARY
+    message->len = telemetry_frame_encode(data, (uint8_t *)message->data, message->capacity);
+#else
+    json_writer_t json;
+
+    message->len = 0;
+    json_writer_init_shared_buffer(&json, message);
+    json_writer_begin_object(&json, NULL);
+    meter_data_write_json_fields(&json, data, MQTT_PUBLISHER_TELEGRAM_FIELDS);
+    json_writer_end_object(&json);
+    if (json_writer_finish(&json) != ESP_OK) {
+        ESP_LOGE(TAG, "Message doesn't fit in %d bytes", message->capacity);
+        message->len = 0;
+    }
+#endif
+
+    return message->len;
+}
+
+/**
+ * @brief Publish the fields that changed more than their deadband
+ *
+ * @param[in] data The meter data
+ */
+static void publish_fields(const meter_data_t *data) {
+    char topic[MQTT_PUBLISHER_MAX_TOPIC_LEN];
+    char payload[16];
+    uint32_t update_count = 0;
+    uint32_t suppressed_count = 0;
+    uint32_t error_count = 0;
+    bool resync;
+
+    taskENTER_CRITICAL(&stats_lock);
+    resync = resync_fields;
+    resync_fields = false;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    for (size_t i = 0; i < PUBLISHED_FIELD_COUNT; i++) {
+        const meter_data_field_t *field = meter_data_get_field(published_fields[i].id);
+        const void *src = (const uint8_t *)data + field->offset;
+        float value;
+
+        switch (field->type) {
+            case METER_DATA_FIELD_TYPE_FLOAT:
+                value = *(const float *)src;
+                break;
+            case METER_DATA_FIELD_TYPE_UINT16:
+                value = *(const uint16_t *)src;
+                break;
+            case METER_DATA_FIELD_TYPE_ENUM:
+                value = (float)*(const int *)src;
+                break;
+            case METER_DATA_FIELD_TYPE_MAX_DEMAND:
+                value = ((const struct emucs_p1_max_demand_month_s *)src)->max_demand;
+                break;
+            default:
+                continue;
+        }
+
+        if (!resync && last_value_valid[i] && fabsf(value - last_values[i]) <= published_fields[i].deadband) {
+            suppressed_count++;
+            continue;
+        }
+
+        snprintf(topic, sizeof(topic), "%s/%s", CONFIG_MQTT_PUBLISHER_TOPIC_PREFIX, field->name);
+        snprintf(payload, sizeof(payload), "%.*f", field->decimals, value);
+        if (esp_mqtt_client_publish(client, topic, payload, 0, MQTT_PUBLISHER_FIELD_QOS, 1) < 0) {
+            // The last published value is kept unknown, so the field is published again with the next telegram
+            last_value_valid[i] = false;
+            error_count++;
+            continue;
+        }
+        last_values[i] = value;
+        last_value_valid[i] = true;
+        update_count++;
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.field_update_count += update_count;
+    stats.field_suppressed_count += suppressed_count;
+    stats.field_error_count += error_count;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief Publish up to MQTT_PUBLISHER_REPLAY_BATCH_SIZE buffered messages, oldest first
+ */
+static void replay_offline_messages(void) {
+    size_t len;
+
+    // The message buffer is free again, the last telegram has been published or buffered
+    for (size_t i = 0; i < MQTT_PUBLISHER_REPLAY_BATCH_SIZE && offline_used > 0; i++) {
+        len = offline_peek(message->data, message->capacity);
+        if (esp_mqtt_client_publish(client, telegram_topic, message->data, (int)len,
+                                    MQTT_PUBLISHER_TELEGRAM_QOS, 0) < 0) {
+            return;
+        }
+        offline_pop();
+
+        taskENTER_CRITICAL(&stats_lock);
+        stats.telegram_count++;
+        stats.replayed_count++;
+        taskEXIT_CRITICAL(&stats_lock);
+    }
+}
+
+/**
+ * @brief Add a message to the offline buffer, dropping the oldest messages if it doesn't fit
+ *
+ * @param[in] msg The message
+ * @param[in] len The length of the message, at most MQTT_PUBLISHER_MESSAGE_MAX_SIZE
+ */
+static void offline_push(const char *msg, size_t len) {
+    uint16_t record_len = (uint16_t)len;
+    uint32_t dropped = 0;
+
+    if (offline_buffer == NULL) {
+        taskENTER_CRITICAL(&stats_lock);
+        stats.dropped_count++;
+        taskEXIT_CRITICAL(&stats_lock);
+        return;
+    }
+
+    while (MQTT_PUBLISHER_OFFLINE_BUFFER_SIZE - offline_used < sizeof(record_len) + len) {
+        offline_pop();
+        dropped++;
+    }
+
+    ring_write(offline_head + offline_used, &record_len, sizeof(record_len));
+    ring_write(offline_head + offline_used + sizeof(record_len), msg, len);
+    offline_used += sizeof(record_len) + len;
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.buffered_count++;
+    stats.dropped_count += dropped;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief Copy the oldest message of the offline buffer
+ *
+ * @note The offline buffer must not be empty
+ *
+ * @param[out] msg The buffer for the message
+ * @param[in] max_len The size of the buffer, at least MQTT_PUBLISHER_MESSAGE_MAX_SIZE
+ * @return The length of the message
+ */
+static size_t offline_peek(char *msg, size_t max_len) {
+    uint16_t record_len;
+
+    ring_read(offline_head, &record_len, sizeof(record_len));
+    if (record_len > max_len) {
+        record_len = max_len;
+    }
+    ring_read(offline_head + sizeof(record_len), msg, record_len);
+
+    return record_len;
+}
+
+/**
+ * @brief Remove the oldest message from the offline buffer
+ *
+ * @note The offline buffer must not be empty
+ */
+static void offline_pop(void) {
+    uint16_t record_len;
+
+    ring_read(offline_head, &record_len, sizeof(record_len));
+    offline_head = (offline_head + sizeof(record_len) + record_len) % MQTT_PUBLISHER_OFFLINE_BUFFER_SIZE;
+    offline_used -= sizeof(record_len) + record_len;
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.buffered_count--;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief Write to the offline buffer, wrapping around at the end
+ *
+ * @param[in] offset The offset to write at, may be past the end of the buffer
+ * @param[in] src The data
+ * @param[in] len The length of the data
+ */
+static void ring_write(size_t offset, const void *src, size_t len) {
+    size_t start = offset % MQTT_PUBLISHER_OFFLINE_BUFFER_SIZE;
+    size_t first = MIN(len, MQTT_PUBLISHER_OFFLINE_BUFFER_SIZE - start);
+
+    memcpy(offline_buffer + start, src, first);
+    memcpy(offline_buffer, (const uint8_t *)src + first, len - first);
+}
+
+/**
+ * @brief Read from the offline buffer, wrapping around at the end
+ *
+ * @param[in] offset The offset to read at, may be past the end of the buffer
+ * @param[out] dst The buffer for the data
+ * @param[in] len The length of the data
+ */
+static void ring_read(size_t offset, void *dst, size_t len) {
+    size_t start = offset % MQTT_PUBLISHER_OFFLINE_BUFFER_SIZE;
+    size_t first = MIN(len, MQTT_PUBLISHER_OFFLINE_BUFFER_SIZE - start);
+
+    memcpy(dst, offline_buffer + start, first);
+    memcpy((uint8_t *)dst + first, offline_buffer, len - first);
+}
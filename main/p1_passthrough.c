@@ -0,0 +1,337 @@
+/**
+ * @file p1_passthrough.c
+ * @brief TCP server that passes the raw P1 telegrams through to its clients, like ser2net
+ *
+ * Tools that read the P1 port themselves (DSMR-reader, the DSMR integration of Home Assistant, ...) can connect to
+ * CONFIG_P1_PASSTHROUGH_PORT and receive every CRC-valid telegram exactly as the meter sent it. Data sent by the
+ * clients is ignored.
+ *
+ * All clients are sent the shared raw telegram buffer of the P1 reader, so the number of clients doesn't add copies.
+ * The sockets are non-blocking: a client that is still receiving the previous telegram when a new one arrives skips
+ * the new one, so a slow client never delays the others or receives a partial telegram. A client that doesn't receive
+ * anything for P1_PASSTHROUGH_STALL_TIMEOUT_S is closed.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "emucs_p1.h"
+#include "shared_buffer.h"
+#include "p1_passthrough.h"
+
+typedef struct {
+    bool in_use;                                // Slot is used by a connected client
+    int fd;                                     // Socket of the client
+    shared_buffer_t *pending;                   // Telegram that is being sent, NULL if idle
+    size_t offset;                              // Number of bytes of the pending telegram that are sent
+    int64_t last_progress;                      // Time the pending telegram was queued or last sent to
+    p1_passthrough_client_stats_t stats;
+} client_t;
+
+static const char *TAG = "p1_passthrough";  // Tag used for logging
+
+static int listen_sock = -1;
+static client_t clients[CONFIG_P1_PASSTHROUGH_MAX_CLIENTS];
+static p1_passthrough_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;  // Protects the statistics of the server and the clients
+
+// Function prototypes
+_Noreturn static void p1_passthrough_task(void *pvParameters);
+static void accept_clients(void);
+static void check_clients(void);
+static void queue_telegram(shared_buffer_t *raw);
+static bool flush_client(client_t *client);
+static void close_client(client_t *client, const char *reason);
+
+
+/**
+ * @brief Start listening and start the passthrough task
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t p1_passthrough_init(void) {
+    struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(CONFIG_P1_PASSTHROUGH_PORT),
+            .sin_addr.s_addr = htonl(INADDR_ANY)
+    };
+    int opt = 1;
+
+    listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listen_sock < 0) {
+        ESP_LOGE(TAG, "Failed to create socket");
+        return ESP_FAIL;
+    }
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || listen(listen_sock, P1_PASSTHROUGH_LISTEN_BACKLOG) < 0
+        || fcntl(listen_sock, F_SETFL, O_NONBLOCK) < 0) {
+        ESP_LOGE(TAG, "Failed to listen on port %d: %d", CONFIG_P1_PASSTHROUGH_PORT, errno);
+        close(listen_sock);
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(p1_passthrough_task, "p1_passthrough", P1_PASSTHROUGH_TASK_STACK_SIZE, NULL,
+                    P1_PASSTHROUGH_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create P1 passthrough task");
+        close(listen_sock);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Passing telegrams through on port %d", CONFIG_P1_PASSTHROUGH_PORT);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the statistics of a client
+ *
+ * @param[in] index The index of the client slot, from 0 to CONFIG_P1_PASSTHROUGH_MAX_CLIENTS - 1
+ * @param[out] stats_out The statistics of the client
+ * @return True if a client is connected in the slot, false otherwise
+ */
+bool p1_passthrough_get_client(size_t index, p1_passthrough_client_stats_t *stats_out) {
+    bool in_use;
+
+    if (index >= CONFIG_P1_PASSTHROUGH_MAX_CLIENTS) {
+        return false;
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    in_use = clients[index].in_use;
+    *stats_out = clients[index].stats;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    return in_use;
+}
+
+/**
+ * @brief Get a consistent copy of the counters of the server
+ *
+ * @param[out] stats_out The counters
+ */
+void p1_passthrough_get_stats(p1_passthrough_stats_t *stats_out) {
+    taskENTER_CRITICAL(&stats_lock);
+    *stats_out = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief P1 passthrough task
+ *
+ * Accepts clients, waits for new telegrams and sends them to the clients.
+ * Clients that couldn't receive a telegram at once are retried every P1_PASSTHROUGH_FLUSH_INTERVAL_MS.
+ *
+ * @param pvParameters
+ */
+_Noreturn static void p1_passthrough_task(void *pvParameters) {
+    EventGroupHandle_t event_group = emucs_p1_get_event_group_handle();
+    shared_buffer_t *raw;
+    EventBits_t bits;
+    bool pending = false;
+
+    for (;;) {
+        bits = xEventGroupWaitBits(event_group, EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_PASSTHROUGH_BIT, pdTRUE, pdFALSE,
+                                   pdMS_TO_TICKS(pending ? P1_PASSTHROUGH_FLUSH_INTERVAL_MS
+                                                         : P1_PASSTHROUGH_POLL_INTERVAL_MS));
+
+        accept_clients();
+        check_clients();
+
+        if (bits & EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_PASSTHROUGH_BIT) {
+            raw = emucs_p1_get_raw_telegram(NULL);
+            if (raw != NULL) {
+                queue_telegram(raw);
+                shared_buffer_release(raw);
+            }
+        }
+
+        // Send as much as possible to every client
+        pending = false;
+        for (size_t i = 0; i < CONFIG_P1_PASSTHROUGH_MAX_CLIENTS; i++) {
+            if (clients[i].in_use) {
+                pending |= flush_client(&clients[i]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Accept the waiting connections, connections are closed right away if all client slots are in use
+ */
+static void accept_clients(void) {
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    client_t *client;
+    int opt = 1;
+    int fd;
+
+    for (;;) {
+        addr_len = sizeof(addr);
+        fd = accept(listen_sock, (struct sockaddr *)&addr, &addr_len);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ESP_LOGW(TAG, "Failed to accept a connection: %d", errno);
+            }
+            return;
+        }
+
+        // Find a free slot
+        client = NULL;
+        for (size_t i = 0; i < CONFIG_P1_PASSTHROUGH_MAX_CLIENTS; i++) {
+            if (!clients[i].in_use) {
+                client = &clients[i];
+                break;
+            }
+        }
+        if (client == NULL) {
+            ESP_LOGW(TAG, "Max number of passthrough clients reached");
+            close(fd);
+            taskENTER_CRITICAL(&stats_lock);
+            stats.rejected_count++;
+            taskEXIT_CRITICAL(&stats_lock);
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
+
+        taskENTER_CRITICAL(&stats_lock);
+        memset(client, 0, sizeof(client_t));
+        client->in_use = true;
+        client->fd = fd;
+        inet_ntoa_r(addr.sin_addr, client->stats.address, sizeof(client->stats.address));
+        client->stats.port = ntohs(addr.sin_port);
+        client->stats.connected_since_us = esp_timer_get_time();
+        stats.client_count++;
+        stats.accepted_count++;
+        taskEXIT_CRITICAL(&stats_lock);
+
+        ESP_LOGI(TAG, "Client %s:%u connected (socket %d)", client->stats.address, client->stats.port, fd);
+    }
+}
+
+/**
+ * @brief Discard the data sent by the clients and close the clients that disconnected
+ */
+static void check_clients(void) {
+    char buf[64];
+    int ret;
+
+    for (size_t i = 0; i < CONFIG_P1_PASSTHROUGH_MAX_CLIENTS; i++) {
+        if (!clients[i].in_use) {
+            continue;
+        }
+        do {
+            ret = recv(clients[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+        } while (ret > 0);
+
+        if (ret == 0) {
+            close_client(&clients[i], "disconnected");
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            close_client(&clients[i], "receive error");
+        }
+    }
+}
+
+/**
+ * @brief Queue a telegram for every client, clients that are still sending the previous telegram skip it
+ *
+ * @param[in] raw The raw telegram, every client acquires its own reference
+ */
+static void queue_telegram(shared_buffer_t *raw) {
+    int64_t now = esp_timer_get_time();
+    client_t *client;
+
+    for (size_t i = 0; i < CONFIG_P1_PASSTHROUGH_MAX_CLIENTS; i++) {
+        client = &clients[i];
+        if (!client->in_use) {
+            continue;
+        }
+        if (client->pending != NULL) {
+            taskENTER_CRITICAL(&stats_lock);
+            client->stats.telegrams_dropped++;
+            stats.telegrams_dropped++;
+            taskEXIT_CRITICAL(&stats_lock);
+            continue;
+        }
+        client->pending = shared_buffer_acquire(raw);
+        client->offset = 0;
+        client->last_progress = now;
+    }
+}
+
+/**
+ * @brief Send as much of the pending telegram as the socket accepts
+ *
+ * @param[in] client The client
+ * @return True if data is still pending, false otherwise
+ */
+static bool flush_client(client_t *client) {
+    int ret;
+
+    while (client->pending != NULL) {
+        ret = send(client->fd, client->pending->data + client->offset, client->pending->len - client->offset,
+                   MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_client(client, "send error");
+                return false;
+            }
+            if (esp_timer_get_time() - client->last_progress > (int64_t)P1_PASSTHROUGH_STALL_TIMEOUT_S * 1000000) {
+                close_client(client, "stalled");
+                return false;
+            }
+            return true;
+        }
+
+        client->offset += ret;
+        client->last_progress = esp_timer_get_time();
+        taskENTER_CRITICAL(&stats_lock);
+        client->stats.bytes_sent += ret;
+        if (client->offset == client->pending->len) {
+            client->stats.telegrams_sent++;
+            stats.telegrams_sent++;
+        }
+        taskEXIT_CRITICAL(&stats_lock);
+
+        if (client->offset == client->pending->len) {
+            shared_buffer_release(client->pending);
+            client->pending = NULL;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Close the connection of a client and free its slot
+ *
+ * @param[in] client The client
+ * @param[in] reason Reason for closing, for the log
+ */
+static void close_client(client_t *client, const char *reason) {
+    ESP_LOGI(TAG, "Client %s:%u %s (socket %d, %lu telegrams sent, %lu dropped)", client->stats.address,
+             client->stats.port, reason, client->fd, client->stats.telegrams_sent, client->stats.telegrams_dropped);
+
+    close(client->fd);
+    shared_buffer_release(client->pending);
+
+    taskENTER_CRITICAL(&stats_lock);
+    client->in_use = false;
+    client->fd = -1;
+    client->pending = NULL;
+    stats.client_count--;
+    taskEXIT_CRITICAL(&stats_lock);
+}
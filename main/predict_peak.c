@@ -12,6 +12,7 @@
 #include <string.h>
 #include <time.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
@@ -24,6 +25,7 @@
 static const char *TAG = "predict_peak";
 struct predicted_peak_s predicted_peak;
 SemaphoreHandle_t predicted_peak_mutex;
+static volatile uint32_t predicted_peak_sequence = 0;  // Incremented every time a new prediction is published
 
 // Function prototypes
 static time_t get_timestamp_at_end_of_quarter_hour(time_t timestamp);
@@ -115,8 +117,12 @@ _Noreturn void predict_peak_task(void *pvParameters) {
             // Update the global predicted peak, so that it can be read by other tasks
             xSemaphoreTake(predicted_peak_mutex, portMAX_DELAY);
             predicted_peak = predicted_peak_temp;
+            predicted_peak_sequence++;
             xSemaphoreGive(predicted_peak_mutex);
 
+            // Notify the consumers of the new prediction
+            xEventGroupSetBits(emucs_p1_get_event_group_handle(), PREDICT_PEAK_EVENT_AVAILABLE_ALL_BITS);
+
         }
 
         // Wait for the next cycle
@@ -145,6 +151,18 @@ struct predicted_peak_s predict_peak_get_predicted_peak(void) {
     return predicted_peak;
 }
 
+/**
+ * @brief Get the sequence number of the predicted peak
+ *
+ * The sequence number is incremented every time a new prediction is made, 0 means no prediction is available yet.
+ * It can be read without holding the predicted_peak_mutex.
+ *
+ * @return The predicted peak sequence number
+ */
+uint32_t predict_peak_get_sequence(void) {
+    return predicted_peak_sequence;
+}
+
 /**
  * @brief Calculate the timestamp at the end of the quarter-hour that contains the given timestamp
  *
@@ -0,0 +1,183 @@
+/**
+ * @file request_arena.c
+ * @brief Bump allocator for the buffers of an HTTP request
+ *
+ * Handlers run through request_arena_handler() or request_arena_call() can allocate their buffers with
+ * request_arena_alloc(). The memory is never freed individually: the whole arena is reset in one step when the
+ * handler returns, on every path, so handlers can't leak and the heap doesn't fragment, however many requests are
+ * served.
+ *
+ * A handler runs in a single task and a task runs one handler at a time, so each arena belongs to the task that is
+ * running a handler with it: the httpd task or one of the async workers. Allocations from any other task fail.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "request_arena.h"
+
+typedef struct {
+    uint8_t *data;                          // Memory of the arena, in PSRAM
+    size_t used;                            // Number of bytes allocated by the current request
+    TaskHandle_t owner;                     // Task running the current request, NULL if the arena is free
+} arena_t;
+
+static const char *TAG = "request_arena";   // Tag used for logging
+
+static arena_t arenas[REQUEST_ARENA_COUNT];
+static SemaphoreHandle_t arenas_mutex;      // Mutex protecting the owners of the arenas and the peak usage
+static size_t peak_usage = 0;               // Max number of bytes used by a request since boot
+
+// Function prototypes
+static arena_t *get_arena(TaskHandle_t task);
+
+
+/**
+ * @brief Allocate the arenas
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the arenas can't be allocated
+ */
+esp_err_t request_arena_init(void) {
+    arenas_mutex = xSemaphoreCreateMutex();
+    if (arenas_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create arenas mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (size_t i = 0; i < REQUEST_ARENA_COUNT; i++) {
+        arenas[i].data = heap_caps_malloc(REQUEST_ARENA_SIZE, MALLOC_CAP_SPIRAM);
+        if (arenas[i].data == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate the request arenas");
+            return ESP_ERR_NO_MEM;
+        }
+        arenas[i].used = 0;
+        arenas[i].owner = NULL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief URI handler that runs another handler with an arena available
+ *
+ * Register this function as the handler and the actual handler as user_ctx:
+ * .handler = request_arena_handler, .user_ctx = (void *)actual_handler
+ *
+ * @note The actual handler can't use user_ctx itself
+ *
+ * @param[in] req The request handle
+ * @return The result of the actual handler
+ */
+esp_err_t request_arena_handler(httpd_req_t *req) {
+    return request_arena_call((esp_err_t (*)(httpd_req_t *))req->user_ctx, req);
+}
+
+/**
+ * @brief Run a handler with an arena available, and reset the arena afterwards
+ *
+ * @note The handler must not keep arena memory after it returns (e.g. in an async request)
+ *
+ * @param[in] handler The handler
+ * @param[in] req The request handle
+ * @return The result of the handler, or of sending a 500 error if no arena was free
+ */
+esp_err_t request_arena_call(esp_err_t (*handler)(httpd_req_t *req), httpd_req_t *req) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    arena_t *arena;
+    esp_err_t err;
+    size_t used;
+    bool new_peak;
+
+    // Claim a free arena for this task
+    xSemaphoreTake(arenas_mutex, portMAX_DELAY);
+    arena = get_arena(NULL);
+    if (arena != NULL) {
+        arena->owner = task;
+        arena->used = 0;
+    }
+    xSemaphoreGive(arenas_mutex);
+    if (arena == NULL) {
+        ESP_LOGE(TAG, "No free arena for %s", req->uri);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+
+    err = handler(req);
+
+    // The httpd task and the workers finish requests concurrently
+    xSemaphoreTake(arenas_mutex, portMAX_DELAY);
+    used = arena->used;
+    new_peak = used > peak_usage;
+    if (new_peak) {
+        peak_usage = used;
+    }
+    arena->owner = NULL;
+    arena->used = 0;
+    xSemaphoreGive(arenas_mutex);
+
+    if (new_peak) {
+        ESP_LOGD(TAG, "New peak usage: %u bytes (%s)", used, req->uri);
+    }
+
+    return err;
+}
+
+/**
+ * @brief Allocate memory for the current request
+ *
+ * @param[in] size The number of bytes
+ * @return The memory, aligned to REQUEST_ARENA_ALIGNMENT, or NULL if the arena is full or not available
+ */
+void *request_arena_alloc(size_t size) {
+    size_t aligned_size = (size + REQUEST_ARENA_ALIGNMENT - 1) & ~(size_t)(REQUEST_ARENA_ALIGNMENT - 1);
+    arena_t *arena;
+    void *ptr;
+
+    // Only the owner changes the owner of its arena, so it doesn't change during the lookup
+    arena = get_arena(xTaskGetCurrentTaskHandle());
+    if (arena == NULL) {
+        ESP_LOGE(TAG, "Allocation outside of a request handler");
+        return NULL;
+    }
+    if (aligned_size > REQUEST_ARENA_SIZE - arena->used) {
+        ESP_LOGE(TAG, "Arena full, failed to allocate %u bytes (%u in use)", size, arena->used);
+        return NULL;
+    }
+
+    ptr = arena->data + arena->used;
+    arena->used += aligned_size;
+
+    return ptr;
+}
+
+/**
+ * @brief Get the max number of bytes used by a single request since boot
+ *
+ * @return The peak usage in bytes
+ */
+size_t request_arena_get_peak_usage(void) {
+    size_t peak;
+
+    xSemaphoreTake(arenas_mutex, portMAX_DELAY);
+    peak = peak_usage;
+    xSemaphoreGive(arenas_mutex);
+
+    return peak;
+}
+
+/**
+ * @brief Find the arena owned by a task
+ *
+ * @param[in] task The task, or NULL to find a free arena
+ * @return The arena, or NULL if there is none
+ */
+static arena_t *get_arena(TaskHandle_t task) {
+    for (size_t i = 0; i < REQUEST_ARENA_COUNT; i++) {
+        if (arenas[i].data != NULL && arenas[i].owner == task) {
+            return &arenas[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file shared_buffer.c
+ * @brief Reference-counted buffers that can be shared between tasks
+ *
+ * A shared buffer is rendered once by a producer and can then be handed out to any number of readers
+ * (e.g. HTTP clients) without copying. Every reader acquires a reference and releases it when it is done.
+ * The buffers are allocated in PSRAM.
+ */
+
+#include "esp_heap_caps.h"
+#include "shared_buffer.h"
+
+/**
+ * @brief Create a new shared buffer
+ *
+ * The returned buffer has a reference count of 1, which is owned by the caller.
+ *
+ * @param[in] capacity The number of bytes that can be stored in the buffer
+ * @return The buffer, or NULL if the allocation failed
+ */
+shared_buffer_t * shared_buffer_create(size_t capacity) {
+    shared_buffer_t *buf = heap_caps_malloc(sizeof(shared_buffer_t) + capacity, MALLOC_CAP_SPIRAM);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    atomic_init(&buf->ref_count, 1);
+    buf->capacity = capacity;
+    buf->len = 0;
+
+    return buf;
+}
+
+/**
+ * @brief Acquire an additional reference to a shared buffer
+ *
+ * @param[in] buf The buffer, may be NULL
+ * @return The same buffer
+ */
+shared_buffer_t * shared_buffer_acquire(shared_buffer_t *buf) {
+    if (buf != NULL) {
+        atomic_fetch_add(&buf->ref_count, 1);
+    }
+
+    return buf;
+}
+
+/**
+ * @brief Release a reference to a shared buffer
+ *
+ * The buffer is freed when the last reference is released.
+ *
+ * @param[in] buf The buffer, may be NULL
+ */
+void shared_buffer_release(shared_buffer_t *buf) {
+    if (buf != NULL && atomic_fetch_sub(&buf->ref_count, 1) == 1) {
+        heap_caps_free(buf);
+    }
+}
@@ -0,0 +1,158 @@
+/**
+ * @file snapshot.c
+ * @brief Pre-rendered snapshots of the meter data, shared between all HTTP clients
+ *
+ * The meter data JSON is rendered at most once per telegram and prediction update, into a reference-counted buffer.
+ * Requests that arrive while the snapshot is up-to-date get a reference to the same buffer, so the cost of a request
+ * doesn't depend on the number of fields in the response.
+ * A snapshot is stale when the telegram or predicted peak sequence number has changed since it was rendered.
+ *
+ * Snapshots are kept for the field selections of the API endpoints (see SNAPSHOT_CACHED_FIELD_MASKS), other selections
+ * are rendered for every request.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "emucs_p1.h"
+#include "predict_peak.h"
+#include "meter_data.h"
+#include "http_stats.h"
+#include "snapshot.h"
+
+static const char *TAG = "snapshot";        // Tag used for logging
+static SemaphoreHandle_t snapshot_mutex;    // Mutex protecting the current snapshot
+static const uint64_t cached_field_masks[] = SNAPSHOT_CACHED_FIELD_MASKS;
+static struct {
+    shared_buffer_t *buf;                   // The rendered JSON, NULL if nothing has been rendered yet
+    uint32_t telegram_sequence;             // Telegram sequence number the snapshot was rendered from
+    uint32_t predicted_peak_sequence;       // Predicted peak sequence number the snapshot was rendered from
+} meter_data_snapshots[sizeof(cached_field_masks) / sizeof(cached_field_masks[0])];
+
+// Function prototypes
+static shared_buffer_t * render_meter_data(uint64_t field_mask, uint32_t *telegram_sequence, uint32_t *predicted_peak_sequence);
+
+
+/**
+ * @brief Initialize the snapshot cache
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t snapshot_init(void) {
+    snapshot_mutex = xSemaphoreCreateMutex();
+    if (snapshot_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create snapshot mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the current meter data snapshot
+ *
+ * If the snapshot is stale, it is rendered again before it is returned.
+ *
+ * @note The caller owns a reference to the returned buffer and must release it with shared_buffer_release()
+ *
+ * @param[in] field_mask The fields to include (see METER_DATA_FIELD_BIT)
+ * @param[out] telegram_sequence_out The telegram sequence number the snapshot was rendered from, may be NULL
+ * @param[out] predicted_peak_sequence_out The predicted peak sequence number the snapshot was rendered from, may be NULL
+ * @return The rendered meter data JSON, or NULL if it could not be rendered
+ */
+shared_buffer_t * snapshot_get_meter_data(uint64_t field_mask, uint32_t *telegram_sequence_out, uint32_t *predicted_peak_sequence_out) {
+    shared_buffer_t *buf;
+    uint32_t telegram_sequence;
+    uint32_t predicted_peak_sequence;
+    size_t slot;
+
+    // Find the cache slot of the selection
+    for (slot = 0; slot < sizeof(cached_field_masks) / sizeof(cached_field_masks[0]); slot++) {
+        if (cached_field_masks[slot] == field_mask) {
+            break;
+        }
+    }
+    if (slot == sizeof(cached_field_masks) / sizeof(cached_field_masks[0])) {
+        buf = render_meter_data(field_mask, &telegram_sequence, &predicted_peak_sequence);
+        if (buf != NULL && telegram_sequence_out != NULL) {
+            *telegram_sequence_out = telegram_sequence;
+        }
+        if (buf != NULL && predicted_peak_sequence_out != NULL) {
+            *predicted_peak_sequence_out = predicted_peak_sequence;
+        }
+        return buf;
+    }
+
+    if (http_stats_take(snapshot_mutex, pdMS_TO_TICKS(SNAPSHOT_MAX_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get snapshot mutex within %d ms", SNAPSHOT_MAX_TIMEOUT_MS);
+        return NULL;
+    }
+
+    // Render a new snapshot if the data changed since the last one
+    if (meter_data_snapshots[slot].buf == NULL
+        || meter_data_snapshots[slot].telegram_sequence != emucs_p1_get_telegram_sequence()
+        || meter_data_snapshots[slot].predicted_peak_sequence != predict_peak_get_sequence()) {
+        buf = render_meter_data(field_mask, &telegram_sequence, &predicted_peak_sequence);
+        if (buf != NULL) {
+            // Replace the current snapshot, readers that still hold the old one keep it alive until they are done
+            shared_buffer_release(meter_data_snapshots[slot].buf);
+            meter_data_snapshots[slot].buf = buf;
+            meter_data_snapshots[slot].telegram_sequence = telegram_sequence;
+            meter_data_snapshots[slot].predicted_peak_sequence = predicted_peak_sequence;
+        }
+    }
+
+    buf = shared_buffer_acquire(meter_data_snapshots[slot].buf);
+    if (telegram_sequence_out != NULL) {
+        *telegram_sequence_out = meter_data_snapshots[slot].telegram_sequence;
+    }
+    if (predicted_peak_sequence_out != NULL) {
+        *predicted_peak_sequence_out = meter_data_snapshots[slot].predicted_peak_sequence;
+    }
+
+    xSemaphoreGive(snapshot_mutex);
+
+    return buf;
+}
+
+/**
+ * @brief Render the meter data JSON into a new shared buffer
+ *
+ * @param[in] field_mask The fields to include
+ * @param[out] telegram_sequence The sequence number of the telegram that was rendered
+ * @param[out] predicted_peak_sequence The sequence number of the predicted peak that was rendered
+ * @return The rendered JSON, or NULL on failure
+ */
+static shared_buffer_t * render_meter_data(uint64_t field_mask, uint32_t *telegram_sequence, uint32_t *predicted_peak_sequence) {
+    meter_data_t data;
+    shared_buffer_t *buf;
+    json_writer_t json;
+
+    // Copy the meter data, so the mutexes are only held for a short time
+    if (meter_data_copy(&data, pdMS_TO_TICKS(SNAPSHOT_MAX_TIMEOUT_MS)) != ESP_OK) {
+        return NULL;
+    }
+    *telegram_sequence = data.telegram_sequence;
+    *predicted_peak_sequence = data.predicted_peak_sequence;
+
+    buf = shared_buffer_create(SNAPSHOT_METER_DATA_BUFFER_SIZE);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for the meter data snapshot");
+        return NULL;
+    }
+
+    // Render the JSON directly into the shared buffer
+    json_writer_init_shared_buffer(&json, buf);
+    json_writer_begin_object(&json, NULL);
+    meter_data_write_json_fields(&json, &data, field_mask);
+    json_writer_end_object(&json);
+
+    if (json_writer_finish(&json) != ESP_OK) {
+        ESP_LOGE(TAG, "Meter data JSON doesn't fit in %d bytes", SNAPSHOT_METER_DATA_BUFFER_SIZE);
+        shared_buffer_release(buf);
+        return NULL;
+    }
+
+    return buf;
+}
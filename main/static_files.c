@@ -0,0 +1,327 @@
+/**
+ * @file static_files.c
+ * @brief Static file server for the frontend
+ *
+ * Files are served from the memory-mapped asset bundle (see asset_bundle.c) if it is mounted, otherwise from the file
+ * system at WEB_SERVER_FS_MOUNT_POINT (/www), which is used during development with the semihost file system. Files
+ * are sent as-is, so binary files are supported, with a Content-Length header so the connection can be kept alive.
+ *
+ * If the client accepts gzip and a precompressed variant of the file exists, that one is sent with
+ * Content-Encoding: gzip instead.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "asset_bundle.h"
+#include "http_cache.h"
+#include "gzip_writer.h"
+#include "request_arena.h"
+#include "web_server.h"
+#include "static_files.h"
+
+static const char *TAG = "static_files";    // Tag used for logging
+
+// Function prototypes
+static esp_err_t get_file_path(const char *uri, char *path, size_t len);
+static const char * get_content_type(const char *path);
+static esp_err_t send_bundle_asset(httpd_req_t *req, const char *path, bool accept_gzip, const char *content_type,
+                                   const char *cache_control);
+static esp_err_t send_file(httpd_req_t *req, const char *path, bool accept_gzip, const char *content_type,
+                           const char *cache_control);
+static esp_err_t send_headers(httpd_req_t *req, const char *content_type, size_t size, bool gzip, const char *etag,
+                              const char *cache_control);
+static esp_err_t send_all(httpd_req_t *req, const char *data, size_t len);
+
+
+/**
+ * @brief Handler for getting the frontend
+ *
+ * This handler is called when the user requests a file from the web server that is not already a registered URI.
+ * Based on the URI, the corresponding file is looked up and sent to the client. If the file is not found, a 404 error
+ * is sent. If the URI ends with '/', the file 'index.html' in that directory is sent.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+esp_err_t static_files_get_handler(httpd_req_t *req) {
+    char path[WEB_SERVER_MAX_FILE_PATH_LEN];                // Path of the requested file, relative to the frontend
+    const char *content_type;
+    const char *cache_control;
+    bool gzip = gzip_writer_is_accepted(req);
+
+    if (get_file_path(req->uri, path, sizeof(path)) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+    }
+    content_type = get_content_type(path);
+    // Pages are always revalidated, so a new frontend is picked up immediately, other files are cached for a while
+    cache_control = strcmp(content_type, "text/html") == 0 ? HTTP_CACHE_CONTROL_REVALIDATE : HTTP_CACHE_CONTROL_STATIC;
+
+    if (asset_bundle_is_mounted()) {
+        return send_bundle_asset(req, path, gzip, content_type, cache_control);
+    }
+    return send_file(req, path, gzip, content_type, cache_control);
+}
+
+/**
+ * @brief Send an asset from the memory-mapped asset bundle
+ *
+ * The data is passed from flash to the socket directly, without an intermediate buffer.
+ *
+ * @param[in] req The request handle
+ * @param[in] path The path of the asset, relative to the frontend
+ * @param[in] accept_gzip True if the client accepts gzip encoded responses
+ * @param[in] content_type The content type of the asset
+ * @param[in] cache_control The Cache-Control header value
+ * @return ESP_OK on success
+ */
+static esp_err_t send_bundle_asset(httpd_req_t *req, const char *path, bool accept_gzip, const char *content_type,
+                                   const char *cache_control) {
+    asset_bundle_asset_t asset;
+    const asset_bundle_blob_t *blob;
+    char etag[HTTP_CACHE_ETAG_MAX_LEN];
+    int64_t start_time = esp_timer_get_time();
+    esp_err_t err;
+
+    if (asset_bundle_find(path, strlen(path), &asset) != ESP_OK) {
+        ESP_LOGW(TAG, "File not found: %s", path);
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+    }
+    blob = accept_gzip && asset.gzip.data != NULL ? &asset.gzip : &asset.identity;
+
+    // Same ETag format as http_cache_get_file_etag, the CRC is computed when the bundle is packed
+    snprintf(etag, sizeof(etag), "\"%x-%08lx\"", blob->size, blob->crc);
+    if (http_cache_set_validators(req, etag, cache_control) != ESP_OK
+        || httpd_resp_set_hdr(req, "Vary", "Accept-Encoding") != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (http_cache_is_not_modified(req, etag)) {
+        return http_cache_send_not_modified(req);
+    }
+
+    err = send_headers(req, content_type, blob->size, blob == &asset.gzip, etag, cache_control);
+    if (err == ESP_OK) {
+        err = send_all(req, (const char *)blob->data, blob->size);
+    }
+
+    ESP_LOGD(TAG, "Sent %s (%u bytes%s) from the bundle in %lld us", path, blob->size,
+             blob == &asset.gzip ? ", gzip" : "", esp_timer_get_time() - start_time);
+
+    return err;
+}
+
+/**
+ * @brief Send a file from the file system
+ *
+ * The file is read in blocks of WEB_SERVER_FILE_BUFFER_SIZE bytes. If the client accepts gzip and a precompressed
+ * sibling of the file exists (e.g. index.html.gz), that one is sent instead.
+ *
+ * @param[in] req The request handle
+ * @param[in] path The path of the file, relative to WEB_SERVER_FS_MOUNT_POINT
+ * @param[in] accept_gzip True if the client accepts gzip encoded responses
+ * @param[in] content_type The content type of the file
+ * @param[in] cache_control The Cache-Control header value
+ * @return ESP_OK on success
+ */
+static esp_err_t send_file(httpd_req_t *req, const char *path, bool accept_gzip, const char *content_type,
+                           const char *cache_control) {
+    char fs_path[WEB_SERVER_MAX_FILE_PATH_LEN];             // Path of the file, including the mount point
+    char gzip_path[WEB_SERVER_MAX_FILE_PATH_LEN];           // Path of the precompressed sibling
+    char etag[HTTP_CACHE_ETAG_MAX_LEN];                     // Content hash of the file that is sent
+    const char *file_path = fs_path;                        // Path of the file that is sent
+    bool gzip = false;
+    struct stat st;
+    int64_t start_time = esp_timer_get_time();
+    uint32_t read_count = 0;
+    ssize_t read_len;
+    char *buf;
+    int fd;
+    esp_err_t err;
+
+    if (snprintf(fs_path, sizeof(fs_path), "%s%s", WEB_SERVER_FS_MOUNT_POINT, path) >= (int)sizeof(fs_path)) {
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+    }
+
+    // Prefer the precompressed sibling, if the client accepts it
+    if (accept_gzip
+        && snprintf(gzip_path, sizeof(gzip_path), "%s" STATIC_FILES_GZIP_SUFFIX, fs_path) < (int)sizeof(gzip_path)
+        && stat(gzip_path, &st) == 0) {
+        file_path = gzip_path;
+        gzip = true;
+    }
+    else if (stat(fs_path, &st) != 0) {
+        ESP_LOGW(TAG, "File not found: %s", fs_path);
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+    }
+
+    // Answer with 304 if the client already has the current version of the file
+    if (http_cache_get_file_etag(file_path, etag, sizeof(etag)) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+    }
+    if (http_cache_set_validators(req, etag, cache_control) != ESP_OK
+        || httpd_resp_set_hdr(req, "Vary", "Accept-Encoding") != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (http_cache_is_not_modified(req, etag)) {
+        return http_cache_send_not_modified(req);
+    }
+
+    fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        ESP_LOGW(TAG, "Failed to open file: %s", file_path);
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+    }
+
+    // The buffer is released together with the request
+    buf = request_arena_alloc(WEB_SERVER_FILE_BUFFER_SIZE);
+    if (buf == NULL) {
+        close(fd);
+        ESP_LOGE(TAG, "Failed to allocate file buffer");
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+
+    err = send_headers(req, content_type, st.st_size, gzip, etag, cache_control);
+
+    // Send the file in blocks
+    while (err == ESP_OK && (read_len = read(fd, buf, WEB_SERVER_FILE_BUFFER_SIZE)) > 0) {
+        read_count++;
+        err = send_all(req, buf, read_len);
+    }
+
+    close(fd);
+
+    ESP_LOGD(TAG, "Sent %s (%ld bytes%s) in %lld us using %lu reads", file_path, (long)st.st_size,
+             gzip ? ", gzip" : "", esp_timer_get_time() - start_time, read_count);
+
+    return err;
+}
+
+/**
+ * @brief Send the status line and headers of a 200 response
+ *
+ * The headers are sent directly, httpd can only send a Content-Length when the whole body is in memory.
+ *
+ * @param[in] req The request handle
+ * @param[in] content_type The content type of the body
+ * @param[in] size The length of the body
+ * @param[in] gzip True if the body is gzip encoded
+ * @param[in] etag The ETag of the body
+ * @param[in] cache_control The Cache-Control header value
+ * @return ESP_OK on success, ESP_FAIL if the headers don't fit or the connection failed
+ */
+static esp_err_t send_headers(httpd_req_t *req, const char *content_type, size_t size, bool gzip, const char *etag,
+                              const char *cache_control) {
+    char headers[STATIC_FILES_MAX_HEADERS_LEN];
+    int len;
+
+    len = snprintf(headers, sizeof(headers),
+                   "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %u\r\n"
+                   "%s"
+                   "Vary: Accept-Encoding\r\n"
+                   "ETag: %s\r\n"
+                   "Cache-Control: %s\r\n"
+                   "\r\n",
+                   content_type, size, gzip ? "Content-Encoding: gzip\r\n" : "", etag, cache_control);
+    if (len >= (int)sizeof(headers)) {
+        return ESP_FAIL;
+    }
+
+    return send_all(req, headers, len);
+}
+
+/**
+ * @brief Get the path of the file requested by a URI
+ *
+ * The query string is ignored. If the URI ends with '/', index.html in that directory is used.
+ *
+ * @param[in] uri The URI of the request
+ * @param[out] path The buffer for the path, relative to the frontend root (e.g. "/index.html")
+ * @param[in] len The size of the buffer
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the URI is too long or refers outside of the mount point
+ */
+static esp_err_t get_file_path(const char *uri, char *path, size_t len) {
+    size_t uri_len = strcspn(uri, "?#");
+    int path_len;
+
+    if (uri_len == 0 || uri[0] != '/' || strstr(uri, "..") != NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    path_len = snprintf(path, len, "%.*s%s", uri_len, uri,
+                        uri[uri_len - 1] == '/' ? "index.html" : "");
+    if (path_len >= (int)len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Determine the content type based on the file extension
+ * @details The following file extensions are supported: html, css, js, png, jpg, ico, svg, json, csv, woff, woff2,
+ *          webp and txt. If the file extension is not supported, the content type will be application/octet-stream
+ *
+ * @param[in] path The file path
+ * @return The content type
+ */
+static const char * get_content_type(const char *path) {
+    static const struct {
+        const char *ext;
+        const char *type;
+    } content_types[] = {
+        {"html", "text/html"},
+        {"css", "text/css"},
+        {"js", "application/javascript"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"ico", "image/x-icon"},
+        {"svg", "image/svg+xml"},
+        {"json", "application/json"},
+        {"csv", "text/csv"},
+        {"woff", "font/woff"},
+        {"woff2", "font/woff2"},
+        {"webp", "image/webp"},
+        {"txt", "text/plain"},
+    };
+    const char *ext = strrchr(path, '.');
+
+    if (ext != NULL && strchr(ext, '/') == NULL) {
+        for (size_t i = 0; i < sizeof(content_types) / sizeof(content_types[0]); i++) {
+            if (strcmp(ext + 1, content_types[i].ext) == 0) {
+                return content_types[i].type;
+            }
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+/**
+ * @brief Send data to the client, retrying until everything is sent
+ *
+ * @param[in] req The request handle
+ * @param[in] data The data
+ * @param[in] len The length of the data
+ * @return ESP_OK on success, ESP_FAIL if the connection failed
+ */
+static esp_err_t send_all(httpd_req_t *req, const char *data, size_t len) {
+    int ret;
+
+    while (len > 0) {
+        ret = httpd_send(req, data, len);
+        if (ret < 0) {
+            ESP_LOGD(TAG, "Failed to send (%d)", ret);
+            return ESP_FAIL;
+        }
+        data += ret;
+        len -= ret;
+    }
+
+    return ESP_OK;
+}
@@ -0,0 +1,245 @@
+/**
+ * @file telemetry_frame.c
+ * @brief Fixed-layout little-endian binary encoding of the meter data
+ *
+ * The layout is defined by a static table, which is used both to encode the frames and to generate the
+ * schema descriptor that is sent to clients, so the two can't get out of sync.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include "esp_log.h"
+#include "json_writer.h"
+#include "telemetry_frame.h"
+
+typedef enum {
+    FIELD_TYPE_U8,      // Source is an enum (int), encoded as u8
+    FIELD_TYPE_U16,     // Source is an uint16_t
+    FIELD_TYPE_U32,     // Source is an uint32_t
+    FIELD_TYPE_I64,     // Source is a time_t
+    FIELD_TYPE_F32,     // Source is a float
+    FIELD_TYPE_PADDING, // No source, encoded as a zero byte
+} field_type_t;
+
+typedef struct {
+    const char *name;       // Name in the schema descriptor
+    field_type_t type;      // Encoded type
+    size_t offset;          // Offset of the source value in meter_data_t
+    const char *unit;       // Unit in the schema descriptor, NULL if none
+} frame_field_t;
+
+static const char *TAG = "telemetry_frame";     // Tag used for logging
+static shared_buffer_t *descriptor = NULL;      // The schema descriptor, rendered by telemetry_frame_init()
+
+static const char *field_type_names[] = {
+    [FIELD_TYPE_U8] = "u8",
+    [FIELD_TYPE_U16] = "u16",
+    [FIELD_TYPE_U32] = "u32",
+    [FIELD_TYPE_I64] = "i64",
+    [FIELD_TYPE_F32] = "f32",
+    [FIELD_TYPE_PADDING] = "padding",
+};
+
+static const size_t field_type_sizes[] = {
+    [FIELD_TYPE_U8] = 1,
+    [FIELD_TYPE_U16] = 2,
+    [FIELD_TYPE_U32] = 4,
+    [FIELD_TYPE_I64] = 8,
+    [FIELD_TYPE_F32] = 4,
+    [FIELD_TYPE_PADDING] = 1,
+};
+
+// Fields following the frame header, in frame order
+static const frame_field_t frame_fields[] = {
+    {"telegramSequence", FIELD_TYPE_U32, offsetof(meter_data_t, telegram_sequence), NULL},
+    {"predictedPeakSequence", FIELD_TYPE_U32, offsetof(meter_data_t, predicted_peak_sequence), NULL},
+    {"timestamp", FIELD_TYPE_I64, offsetof(meter_data_t, p1.msg_timestamp), "s"},
+    {"electricityDeliveredTariff1", FIELD_TYPE_F32, offsetof(meter_data_t, p1.electricity_delivered_tariff1), "kWh"},
+    {"electricityDeliveredTariff2", FIELD_TYPE_F32, offsetof(meter_data_t, p1.electricity_delivered_tariff2), "kWh"},
+    {"electricityReturnedTariff1", FIELD_TYPE_F32, offsetof(meter_data_t, p1.electricity_returned_tariff1), "kWh"},
+    {"electricityReturnedTariff2", FIELD_TYPE_F32, offsetof(meter_data_t, p1.electricity_returned_tariff2), "kWh"},
+    {"tariffIndicator", FIELD_TYPE_U16, offsetof(meter_data_t, p1.tariff_indicator), NULL},
+    {"breakerState", FIELD_TYPE_U8, offsetof(meter_data_t, p1.breaker_state), NULL},
+    {"reserved", FIELD_TYPE_PADDING, 0, NULL},
+    {"currentAvgDemand", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_avg_demand), "kW"},
+    {"currentPowerUsage", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_power_usage), "kW"},
+    {"currentPowerReturn", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_power_return), "kW"},
+    {"currentPowerUsageL1", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_power_usage_l1), "kW"},
+    {"currentPowerUsageL2", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_power_usage_l2), "kW"},
+    {"currentPowerUsageL3", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_power_usage_l3), "kW"},
+    {"currentPowerReturnL1", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_power_return_l1), "kW"},
+    {"currentPowerReturnL2", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_power_return_l2), "kW"},
+    {"currentPowerReturnL3", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_power_return_l3), "kW"},
+    {"voltageL1", FIELD_TYPE_F32, offsetof(meter_data_t, p1.voltage_l1), "V"},
+    {"voltageL2", FIELD_TYPE_F32, offsetof(meter_data_t, p1.voltage_l2), "V"},
+    {"voltageL3", FIELD_TYPE_F32, offsetof(meter_data_t, p1.voltage_l3), "V"},
+    {"currentL1", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_l1), "A"},
+    {"currentL2", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_l2), "A"},
+    {"currentL3", FIELD_TYPE_F32, offsetof(meter_data_t, p1.current_l3), "A"},
+    {"predictedPeak", FIELD_TYPE_F32, offsetof(meter_data_t, predicted_peak.value), "kW"},
+    {"predictedPeakTime", FIELD_TYPE_I64, offsetof(meter_data_t, predicted_peak.timestamp), "s"},
+};
+
+// Function prototypes
+static void put_le(uint8_t *dst, uint64_t value, size_t size);
+
+
+/**
+ * @brief Encode the meter data into a binary frame
+ *
+ * @param[in] data The meter data
+ * @param[out] frame The buffer to encode the frame into
+ * @param[in] max_size The size of the buffer
+ * @return The size of the frame, or 0 if the buffer is too small
+ */
+size_t telemetry_frame_encode(const meter_data_t *data, uint8_t *frame, size_t max_size) {
+    const uint8_t *base = (const uint8_t *)data;
+    size_t offset = TELEMETRY_FRAME_HEADER_SIZE;
+
+    for (size_t i = 0; i < sizeof(frame_fields) / sizeof(frame_fields[0]); i++) {
+        const frame_field_t *field = &frame_fields[i];
+        const void *src = base + field->offset;
+        size_t size = field_type_sizes[field->type];
+        uint32_t f32;
+
+        if (offset + size > max_size) {
+            ESP_LOGE(TAG, "Frame doesn't fit in %d bytes", max_size);
+            return 0;
+        }
+
+        switch (field->type) {
+            case FIELD_TYPE_U8:
+                put_le(frame + offset, (uint8_t)*(const int *)src, size);
+                break;
+            case FIELD_TYPE_U16:
+                put_le(frame + offset, *(const uint16_t *)src, size);
+                break;
+            case FIELD_TYPE_U32:
+                put_le(frame + offset, *(const uint32_t *)src, size);
+                break;
+            case FIELD_TYPE_I64:
+                put_le(frame + offset, (uint64_t)(int64_t)*(const time_t *)src, size);
+                break;
+            case FIELD_TYPE_F32:
+                memcpy(&f32, src, sizeof(f32));
+                put_le(frame + offset, f32, size);
+                break;
+            case FIELD_TYPE_PADDING:
+                frame[offset] = 0;
+                break;
+        }
+        offset += size;
+    }
+
+    // Frame header
+    frame[0] = TELEMETRY_FRAME_SCHEMA_VERSION;
+    frame[1] = TELEMETRY_FRAME_TYPE_METER_DATA;
+    put_le(frame + 2, offset, 2);
+
+    return offset;
+}
+
+/**
+ * @brief Encode the meter data into a new shared buffer
+ *
+ * @param[in] data The meter data
+ * @return The encoded frame, or NULL on failure
+ */
+shared_buffer_t * telemetry_frame_encode_shared(const meter_data_t *data) {
+    shared_buffer_t *buf = shared_buffer_create(TELEMETRY_FRAME_MAX_SIZE);
+
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for a frame");
+        return NULL;
+    }
+
+    buf->len = telemetry_frame_encode(data, (uint8_t *)buf->data, buf->capacity);
+    if (buf->len == 0) {
+        shared_buffer_release(buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+/**
+ * @brief Render the schema descriptor of the binary frames
+ *
+ * The descriptor is a JSON document listing the name, offset, type and unit of every field. It never changes, so it
+ * is rendered once, before any client can request it.
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t telemetry_frame_init(void) {
+    shared_buffer_t *buf;
+    json_writer_t json;
+    size_t offset = TELEMETRY_FRAME_HEADER_SIZE;
+
+    if (descriptor != NULL) {
+        return ESP_OK;
+    }
+
+    buf = shared_buffer_create(TELEMETRY_FRAME_DESCRIPTOR_MAX_SIZE);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for the schema descriptor");
+        return ESP_ERR_NO_MEM;
+    }
+
+    json_writer_init_shared_buffer(&json, buf);
+    json_writer_begin_object(&json, NULL);
+    json_writer_add_string(&json, "type", "schema");
+    json_writer_add_int(&json, "schemaVersion", TELEMETRY_FRAME_SCHEMA_VERSION);
+    json_writer_add_int(&json, "frameType", TELEMETRY_FRAME_TYPE_METER_DATA);
+    json_writer_add_string(&json, "byteOrder", "little");
+    json_writer_add_int(&json, "headerSize", TELEMETRY_FRAME_HEADER_SIZE);
+    json_writer_begin_array(&json, "fields");
+    for (size_t i = 0; i < sizeof(frame_fields) / sizeof(frame_fields[0]); i++) {
+        const frame_field_t *field = &frame_fields[i];
+        json_writer_begin_object(&json, NULL);
+        json_writer_add_string(&json, "name", field->name);
+        json_writer_add_int(&json, "offset", offset);
+        json_writer_add_string(&json, "type", field_type_names[field->type]);
+        if (field->unit != NULL) {
+            json_writer_add_string(&json, "unit", field->unit);
+        }
+        json_writer_end_object(&json);
+        offset += field_type_sizes[field->type];
+    }
+    json_writer_end_array(&json);
+    json_writer_add_int(&json, "frameSize", offset);
+    json_writer_end_object(&json);
+
+    if (json_writer_finish(&json) != ESP_OK) {
+        ESP_LOGE(TAG, "Schema descriptor doesn't fit in %d bytes", TELEMETRY_FRAME_DESCRIPTOR_MAX_SIZE);
+        shared_buffer_release(buf);
+        return ESP_ERR_NO_MEM;
+    }
+
+    descriptor = buf;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the schema descriptor of the binary frames, see telemetry_frame_init()
+ *
+ * @note The caller owns a reference to the returned buffer and must release it with shared_buffer_release()
+ *
+ * @return The descriptor, or NULL if it isn't rendered
+ */
+shared_buffer_t * telemetry_frame_get_descriptor(void) {
+    return descriptor != NULL ? shared_buffer_acquire(descriptor) : NULL;
+}
+
+/**
+ * @brief Store a value in little-endian byte order
+ *
+ * @param[out] dst The destination
+ * @param[in] value The value
+ * @param[in] size The number of bytes to store
+ */
+static void put_le(uint8_t *dst, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        dst[i] = (uint8_t)(value >> (8 * i));
+    }
+}
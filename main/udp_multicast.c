@@ -0,0 +1,177 @@
+/**
+ * @file udp_multicast.c
+ * @brief Sends every telegram as a UDP datagram to a multicast group
+ *
+ * One datagram is sent per telegram, whatever the number of receivers, so LAN services can follow the meter without
+ * polling the web server. The payload is the raw telegram as received from the meter, or the binary telemetry frame,
+ * depending on CONFIG_UDP_MULTICAST_FORMAT_FRAME. Every datagram starts with a header with a sequence number, see
+ * udp_multicast.h, so receivers can detect lost datagrams. A raw telegram is sent straight from the shared buffer of
+ * the P1 reader, without copying it.
+ *
+ * tools/udp_listen.py joins the group and prints the datagrams and the number of lost ones.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "emucs_p1.h"
+#include "meter_data.h"
+#include "shared_buffer.h"
+#include "telemetry_frame.h"
+#include "udp_multicast.h"
+
+static const char *TAG = "udp_multicast";   // Tag used for logging
+
+static int sock = -1;
+static struct sockaddr_in group_addr;
+static udp_multicast_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;  // Makes reading the counters consistent
+
+// Function prototypes
+_Noreturn static void udp_multicast_task(void *pvParameters);
+static void send_datagram(uint8_t type, uint32_t telegram_sequence, const void *payload, size_t len);
+
+
+/**
+ * @brief Create the socket and start the UDP multicast task
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t udp_multicast_init(void) {
+    uint8_t ttl = CONFIG_UDP_MULTICAST_TTL;
+
+    memset(&group_addr, 0, sizeof(group_addr));
+    group_addr.sin_family = AF_INET;
+    group_addr.sin_port = htons(CONFIG_UDP_MULTICAST_PORT);
+    if (inet_aton(CONFIG_UDP_MULTICAST_GROUP, &group_addr.sin_addr) == 0
+        || !IN_MULTICAST(ntohl(group_addr.sin_addr.s_addr))) {
+        ESP_LOGE(TAG, "Invalid multicast group: %s", CONFIG_UDP_MULTICAST_GROUP);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Failed to create socket");
+        return ESP_FAIL;
+    }
+    if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+        ESP_LOGE(TAG, "Failed to set the multicast TTL");
+        close(sock);
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(udp_multicast_task, "udp_multicast", UDP_MULTICAST_TASK_STACK_SIZE, NULL,
+                    UDP_MULTICAST_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create UDP multicast task");
+        close(sock);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Sending telegrams to %s:%d", CONFIG_UDP_MULTICAST_GROUP, CONFIG_UDP_MULTICAST_PORT);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get a consistent copy of the counters
+ *
+ * @param[out] stats_out The counters
+ */
+void udp_multicast_get_stats(udp_multicast_stats_t *stats_out) {
+    taskENTER_CRITICAL(&stats_lock);
+    *stats_out = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief UDP multicast task
+ *
+ * Waits for new telegrams and sends them to the group.
+ *
+ * @param pvParameters
+ */
+_Noreturn static void udp_multicast_task(void *pvParameters) {
+    EventGroupHandle_t event_group = emucs_p1_get_event_group_handle();
+#if CONFIG_UDP_MULTICAST_FORMAT_FRAME
+    uint8_t frame[TELEMETRY_FRAME_MAX_SIZE];
+    meter_data_t data;
+    size_t len;
+#else
+    shared_buffer_t *raw;
+    uint32_t sequence;
+#endif
+
+    for (;;) {
+        xEventGroupWaitBits(event_group, EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_UDP_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+
+#if CONFIG_UDP_MULTICAST_FORMAT_FRAME
+        if (meter_data_copy(&data, pdMS_TO_TICKS(UDP_MULTICAST_MAX_TIMEOUT_MS)) != ESP_OK) {
+            continue;
+        }
+        len = telemetry_frame_encode(&data, frame, sizeof(frame));
+        if (len > 0) {
+            send_datagram(UDP_MULTICAST_TYPE_TELEMETRY_FRAME, data.telegram_sequence, frame, len);
+        }
+#else
+        raw = emucs_p1_get_raw_telegram(&sequence);
+        if (raw != NULL) {
+            send_datagram(UDP_MULTICAST_TYPE_RAW_TELEGRAM, sequence, raw->data, raw->len);
+            shared_buffer_release(raw);
+        }
+#endif
+    }
+}
+
+/**
+ * @brief Send a datagram with the header and the payload to the group
+ *
+ * @param[in] type The payload type (UDP_MULTICAST_TYPE_*)
+ * @param[in] telegram_sequence The sequence number of the telegram
+ * @param[in] payload The payload
+ * @param[in] len The length of the payload
+ */
+static void send_datagram(uint8_t type, uint32_t telegram_sequence, const void *payload, size_t len) {
+    static uint32_t datagram_sequence = 0;
+    uint8_t header[UDP_MULTICAST_HEADER_SIZE];
+    struct iovec iov[2] = {
+            {.iov_base = header, .iov_len = sizeof(header)},
+            {.iov_base = (void *)payload, .iov_len = len}
+    };
+    struct msghdr msg = {
+            .msg_name = &group_addr,
+            .msg_namelen = sizeof(group_addr),
+            .msg_iov = iov,
+            .msg_iovlen = 2
+    };
+    bool sent;
+
+    datagram_sequence++;
+    header[0] = UDP_MULTICAST_VERSION;
+    header[1] = type;
+    header[2] = (uint8_t)len;
+    header[3] = (uint8_t)(len >> 8);
+    for (size_t i = 0; i < 4; i++) {
+        header[4 + i] = (uint8_t)(datagram_sequence >> (8 * i));
+        header[8 + i] = (uint8_t)(telegram_sequence >> (8 * i));
+    }
+
+    // Fails until the network is up, the datagram is simply skipped
+    sent = sendmsg(sock, &msg, 0) >= 0;
+    if (!sent) {
+        ESP_LOGD(TAG, "Failed to send datagram %lu", datagram_sequence);
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    if (sent) {
+        stats.sent_count++;
+    } else {
+        stats.error_count++;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+}
@@ -3,46 +3,136 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/fcntl.h>
+#include <sys/param.h>
 #include "esp_chip_info.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_http_server.h"
 #include "esp_vfs.h"
-#include "esp_spiffs.h"
 #include "esp_vfs_semihost.h"
 #include "mdns.h"
-#include "cJSON.h"
+#if CONFIG_WEB_SERVER_HTTPS
+#include "esp_https_server.h"
+#endif
 #include "emucs_p1.h"
 #include "predict_peak.h"
 #include "logger.h"
+#include "json_writer.h"
+#include "snapshot.h"
+#include "event_stream.h"
+#include "ws_telemetry.h"
+#include "http_cache.h"
+#include "long_poll.h"
+#include "history.h"
+#include "asset_bundle.h"
+#include "static_files.h"
+#include "gzip_writer.h"
+#include "request_arena.h"
+#include "async_worker.h"
+#include "metrics.h"
+#include "http_stats.h"
+#include "http_sessions.h"
+#if CONFIG_P1_PASSTHROUGH
+#include "p1_passthrough.h"
+#endif
 #include "web_server.h"
 
 #define USE_SEMIHOST_FS 0
 #define MDNS_SERVICE_NAME "_kwartiwi-p1"
 
+/**
+ * Parts of the meter-data-history that are sent, as absolute log indices (see logger.h)
+ */
+typedef struct {
+    uint32_t short_term_index;              // First short term log entry to send
+    uint32_t short_term_end_index;          // Index after the last short term log entry to send
+    uint32_t long_term_index;               // First long term log entry to send
+    uint32_t long_term_end_index;           // Index after the last long term log entry to send
+} meter_data_history_range_t;
+
+/**
+ * Buffer for copying a batch of log entries
+ */
+typedef union {
+    log_entry_short_term_p1_data_t short_term[WEB_SERVER_HISTORY_BATCH_SIZE];
+    log_entry_long_term_p1_data_t long_term[WEB_SERVER_HISTORY_BATCH_SIZE];
+} meter_data_history_batch_t;
+
+/**
+ * Resources that can be included in a /api/batch response
+ */
+typedef enum {
+    BATCH_PART_VERSION = 0,
+    BATCH_PART_SYSTEM_INFO,
+    BATCH_PART_METER_DATA,
+    BATCH_PART_METER_DATA_HISTORY,
+    BATCH_PART_COUNT
+} batch_part_t;
+
+#define BATCH_PART_BIT(part) (1UL << (part))
+#define BATCH_PARTS_ALL (BATCH_PART_BIT(BATCH_PART_COUNT) - 1)
+
 static const char *TAG = "web_server";  // Tag used for logging
+#if CONFIG_WEB_SERVER_HTTPS
+// Certificate and key of the HTTPS listener, embedded by main/CMakeLists.txt
+extern const uint8_t servercert_pem_start[] asm("_binary_servercert_pem_start");
+extern const uint8_t servercert_pem_end[] asm("_binary_servercert_pem_end");
+extern const uint8_t prvtkey_pem_start[] asm("_binary_prvtkey_pem_start");
+extern const uint8_t prvtkey_pem_end[] asm("_binary_prvtkey_pem_end");
+#endif
+static const char *batch_part_names[BATCH_PART_COUNT] = {
+        [BATCH_PART_VERSION] = "version",
+        [BATCH_PART_SYSTEM_INFO] = "system-info",
+        [BATCH_PART_METER_DATA] = "meter-data",
+        [BATCH_PART_METER_DATA_HISTORY] = "meter-data-history"
+};
 
 // Function prototypes
 static esp_err_t init_fs(void);
 static esp_err_t start_web_server(void);
-static esp_err_t set_content_type_from_file_ext(httpd_req_t *req, const char *ext);
 static esp_err_t http_404_handler(httpd_req_t *req, const char *msg);
 static esp_err_t http_500_handler(httpd_req_t *req, const char *msg);
 static esp_err_t setup_fronted_routes(httpd_handle_t server);
 static esp_err_t setup_api_routes(httpd_handle_t server);
-static esp_err_t send_json_response(httpd_req_t *req, cJSON *root, uint16_t status_code);
-static esp_err_t frontend_get_handler(httpd_req_t *req);
+static esp_err_t begin_json_response(httpd_req_t *req, json_writer_t *json, bool compress, bool *compressed);
+static esp_err_t get_query_uint(const char *query, const char *key, uint32_t *value);
 static esp_err_t system_info_get_handler(httpd_req_t *req);
-static esp_err_t p1_data_basic_get_handler(httpd_req_t *req);
+static void write_system_info(json_writer_t *json);
 static esp_err_t p1_data_complete_get_handler(httpd_req_t *req);
 static esp_err_t api_version_get_handler(httpd_req_t *req);
-static esp_err_t predicted_peak_data_get_handler(httpd_req_t *req);
-static esp_err_t send_p1_data(httpd_req_t *req, bool complete);
-static esp_err_t get_p1_data_in_json(cJSON *json_obj, bool complete);
+static void write_api_version(json_writer_t *json);
 static esp_err_t meter_data_get_handler(httpd_req_t *req);
+static esp_err_t send_meter_data(httpd_req_t *req, uint64_t field_mask);
 static esp_err_t meter_data_history_get_handler(httpd_req_t *req);
+static esp_err_t meter_data_history_query_handler(httpd_req_t *req, const char *query);
+static esp_err_t get_meter_data_history_range(meter_data_history_range_t *range, time_t until);
+static void write_meter_data_history(json_writer_t *json, const struct emucs_p1_max_demand_s *max_demand_year,
+                                     const meter_data_history_range_t *range, meter_data_history_batch_t *batch);
+static esp_err_t batch_get_handler(httpd_req_t *req);
+static esp_err_t parse_batch_parts(const char *list, uint32_t *parts);
+static esp_err_t system_workers_get_handler(httpd_req_t *req);
+static esp_err_t system_http_stats_get_handler(httpd_req_t *req);
+static void add_histogram(json_writer_t *json, const char *key, const http_stats_histogram_t *histogram,
+                          uint32_t request_count);
+static esp_err_t system_connections_get_handler(httpd_req_t *req);
+#if CONFIG_P1_PASSTHROUGH
+static esp_err_t system_p1_passthrough_get_handler(httpd_req_t *req);
+#endif
+
+// Slow endpoints, handled by the worker pool so they don't block the httpd task
+static async_worker_endpoint_t history_endpoint = {
+        .name = WEB_SERVER_API_ROUTES_PREFIX "/meter-data-history",
+        .handler = meter_data_history_get_handler
+};
+static async_worker_endpoint_t batch_endpoint = {
+        .name = WEB_SERVER_API_ROUTES_PREFIX "/batch",
+        .handler = batch_get_handler
+};
+static async_worker_endpoint_t *async_endpoints[] = {&history_endpoint, &batch_endpoint};
 
 /**
  * @brief Configure and start the web server
@@ -54,51 +144,56 @@ void setup_web_server(void) {
     // Initialize the file system
     ESP_ERROR_CHECK(init_fs());
 
+    // Initialize the meter data snapshot cache
+    ESP_ERROR_CHECK(snapshot_init());
+
+    // Initialize the ETag support
+    ESP_ERROR_CHECK(http_cache_init());
+
+    // Start measuring the requests
+    ESP_ERROR_CHECK(http_stats_init(WEB_SERVER_MAX_URI_HANDLERS));
+
+    // Allocate the session table of the connection management
+    ESP_ERROR_CHECK(http_sessions_init(WEB_SERVER_MAX_OPEN_SOCKETS, WEB_SERVER_LRU_EVICTION, WEB_SERVER_IDLE_TIMEOUT_S));
+
+    // Allocate the memory for the request buffers
+    ESP_ERROR_CHECK(request_arena_init());
+
+    // Start the workers for the slow endpoints
+    ESP_ERROR_CHECK(async_worker_init());
+
+    // Initialize the response compression
+    ESP_ERROR_CHECK(gzip_writer_init());
+
+    // Start answering long-poll requests
+    ESP_ERROR_CHECK(long_poll_init());
+
     // Start the web server
     ESP_ERROR_CHECK(start_web_server());
 
     // Advertise the web server on the network using mDNS TODO: check if mdns is initialized
     ESP_LOGI(TAG, "Advertising web server using mDNS");
-    ESP_ERROR_CHECK(mdns_service_add(NULL, MDNS_SERVICE_NAME, "_tcp", 80, NULL, 0));
+#if CONFIG_WEB_SERVER_HTTPS
+    ESP_ERROR_CHECK(mdns_service_add(NULL, MDNS_SERVICE_NAME, "_tcp", WEB_SERVER_HTTPS_PORT, NULL, 0));
+#else
+    ESP_ERROR_CHECK(mdns_service_add(NULL, MDNS_SERVICE_NAME, "_tcp", WEB_SERVER_PORT, NULL, 0));
+#endif
 }
 
 /**
  * @brief Initialize file system
  *
- * Initializes the SPIFFS file system and registers it with the VFS.
- * The file system is mounted at WEB_SERVER_FS_MOUNT_POINT (/www).
+ * Maps the frontend asset bundle from the WEB_SERVER_BUNDLE_PARTITION_LABEL (www) partition.
  *
- * @note If USE_SEMIHOST_FS is defined, the semihost file system will be initialized instead
+ * @note If USE_SEMIHOST_FS is defined, the semihost file system will be mounted at WEB_SERVER_FS_MOUNT_POINT (/www)
+ *       instead, so the frontend can be changed without reflashing
  *
  * @return ESP_OK on success
  */
 static esp_err_t init_fs(void) {
 #if !USE_SEMIHOST_FS
-    ESP_LOGD(TAG, "Initializing SPIFFS file system");
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = WEB_SERVER_FS_MOUNT_POINT,
-        .partition_label = WEB_SERVER_SPIFFS_PARTITION_LABEL,
-        .max_files = WEB_SERVER_SPIFFS_MAX_OPEN_FILES,
-        .format_if_mount_failed = false
-    };
-
-    // Register SPIFFS file system
-    esp_err_t err = esp_vfs_spiffs_register(&conf);
-
-    if (err != ESP_OK) {
-        if (err == ESP_FAIL) {
-            ESP_LOGE(TAG, "Failed to mount or format filesystem");
-        }
-        else if (err == ESP_ERR_NOT_FOUND) {
-            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
-        }
-        else {
-            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(err));
-        }
-        return err;
-    }
-
-    return ESP_OK;
+    ESP_LOGD(TAG, "Mapping frontend asset bundle");
+    return asset_bundle_init(WEB_SERVER_BUNDLE_PARTITION_LABEL);
 #else // USE_SEMIHOST_FS
     ESP_LOGD(TAG, "Initializing semihost file system");
     esp_err_t ret = esp_vfs_semihost_register(WEB_SERVER_FS_MOUNT_POINT);
@@ -112,73 +207,85 @@ static esp_err_t init_fs(void) {
 #endif // USE_SEMIHOST_FS
 }
 
-/**
- * @brief Determine the content type based on the file extension and set it in the HTTP response
- * @details The following file extensions are supported: html, css, js, png, jpg, ico, svg, json and csv.
- *          If the file extension is not supported, the content type will be set to text/plain
- *
- * @param[in] req The HTTP request
- * @param[in] ext The file extension
- * @return ESP_OK on success
- */
-static esp_err_t set_content_type_from_file_ext(httpd_req_t *req, const char *ext) {
-    char *type = NULL;
-    if (strcmp(ext, "html") == 0) {
-        type = "text/html";
-    }
-    else if (strcmp(ext, "css") == 0) {
-        type = "text/css";
-    }
-    else if (strcmp(ext, "js") == 0) {
-        type = "application/javascript";
-    }
-    else if (strcmp(ext, "png") == 0) {
-        type = "image/png";
-    }
-    else if (strcmp(ext, "jpg") == 0) {
-        type = "image/jpeg";
-    }
-    else if (strcmp(ext, "ico") == 0) {
-        type = "image/x-icon";
-    }
-    else if (strcmp(ext, "svg") == 0) {
-        type = "image/svg+xml";
-    }
-    else if (strcmp(ext, "json") == 0) {
-        type = "application/json";
-    }
-    else if (strcmp(ext, "csv") == 0) {
-        type = "text/csv";
-    }
-    else {
-        type = "text/plain";
-    }
-
-    return httpd_resp_set_type(req, type);
-}
-
 /**
  * @brief Start the web server
  *
  * The httpd server will be started and the URI handlers will be registered.
  *
- * @note The web server will be started on port WEB_SERVER_PORT (80)
+ * @note The web server will be started on port WEB_SERVER_PORT (80), or with TLS on port WEB_SERVER_HTTPS_PORT (443) if
+ *       CONFIG_WEB_SERVER_HTTPS is enabled
  *
  * @return ESP_OK on success
  */
 static esp_err_t start_web_server(void) {
     httpd_handle_t server = NULL;
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.uri_match_fn = httpd_uri_match_wildcard;
-    config.server_port = WEB_SERVER_PORT;
-
-    // Start the httpd server
-    ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
-    if (httpd_start(&server, &config) != ESP_OK) {
+    esp_err_t err;
+#if CONFIG_WEB_SERVER_HTTPS
+    httpd_ssl_config_t ssl_config = HTTPD_SSL_CONFIG_DEFAULT();
+    httpd_config_t *config = &ssl_config.httpd;
+#else
+    httpd_config_t http_config = HTTPD_DEFAULT_CONFIG();
+    httpd_config_t *config = &http_config;
+#endif
+    config->uri_match_fn = httpd_uri_match_wildcard;
+    config->max_uri_handlers = WEB_SERVER_MAX_URI_HANDLERS;
+
+    // The pool is managed by http_sessions, which keeps a socket free for new clients by closing the least recently
+    // active session. httpd's own LRU purge only runs when no socket is free, so it is left disabled.
+    config->max_open_sockets = WEB_SERVER_MAX_OPEN_SOCKETS;
+    config->lru_purge_enable = false;
+    config->open_fn = http_sessions_open;
+    config->close_fn = http_sessions_close;
+
+    // Polling clients keep their connection open between requests. Probe idle connections to free the sockets of
+    // clients that disappeared.
+    config->keep_alive_enable = true;
+    config->keep_alive_idle = WEB_SERVER_KEEP_ALIVE_IDLE_S;
+    config->keep_alive_interval = WEB_SERVER_KEEP_ALIVE_INTERVAL_S;
+    config->keep_alive_count = WEB_SERVER_KEEP_ALIVE_COUNT;
+
+#if CONFIG_WEB_SERVER_HTTPS
+    ssl_config.port_secure = WEB_SERVER_HTTPS_PORT;
+    ssl_config.servercert = servercert_pem_start;
+    ssl_config.servercert_len = servercert_pem_end - servercert_pem_start;
+    ssl_config.prvtkey_pem = prvtkey_pem_start;
+    ssl_config.prvtkey_len = prvtkey_pem_end - prvtkey_pem_start;
+
+    // A returning client, e.g. one whose session was closed because the pool was full, resumes its session with a
+    // ticket, which skips the slow ECDHE and ECDSA operations
+    ssl_config.session_tickets = true;
+
+    ESP_LOGI(TAG, "Starting HTTPS server on port: '%d'", ssl_config.port_secure);
+    err = httpd_ssl_start(&server, &ssl_config);
+#else
+    config->server_port = WEB_SERVER_PORT;
+
+    ESP_LOGI(TAG, "Starting server on port: '%d'", config->server_port);
+    err = httpd_start(&server, config);
+#endif
+    if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start server!");
         return ESP_FAIL;
     }
 
+    // Start closing idle sessions
+    if (http_sessions_start(server) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the connection management");
+        return ESP_FAIL;
+    }
+
+    // Start pushing events to the stream clients
+    if (event_stream_init(server) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize the event stream");
+        return ESP_FAIL;
+    }
+
+    // Start pushing frames to the WebSocket clients
+    if (ws_telemetry_init(server) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize the WebSocket telemetry");
+        return ESP_FAIL;
+    }
+
     // Register URI handlers
     setup_api_routes(server);
     setup_fronted_routes(server);
@@ -200,10 +307,10 @@ static esp_err_t setup_fronted_routes(httpd_handle_t server) {
     httpd_uri_t index_uri = {
             .uri = "/*",
             .method = HTTP_GET,
-            .handler = frontend_get_handler,
-            .user_ctx = NULL
+            .handler = request_arena_handler,
+            .user_ctx = (void *)static_files_get_handler
     };
-    return httpd_register_uri_handler(server, &index_uri);
+    return http_stats_register_uri_handler(server, &index_uri);
 }
 
 /**
@@ -220,7 +327,7 @@ static esp_err_t setup_api_routes(httpd_handle_t server) {
             .handler = api_version_get_handler,
             .user_ctx = NULL
     };
-    if (httpd_register_uri_handler(server, &version_get_uri) != ESP_OK) {
+    if (http_stats_register_uri_handler(server, &version_get_uri) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register URI handler for version");
         return ESP_FAIL;
     }
@@ -232,11 +339,73 @@ static esp_err_t setup_api_routes(httpd_handle_t server) {
             .handler = system_info_get_handler,
             .user_ctx = NULL
     };
-    if (httpd_register_uri_handler(server, &system_info_get_uri) != ESP_OK) {
+    if (http_stats_register_uri_handler(server, &system_info_get_uri) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register URI handler for system info");
         return ESP_FAIL;
     }
 
+    // Prometheus metrics
+    httpd_uri_t metrics_get_uri = {
+            .uri = "/metrics",
+            .method = HTTP_GET,
+            .handler = request_arena_handler,
+            .user_ctx = (void *)metrics_get_handler
+    };
+    if (http_stats_register_uri_handler(server, &metrics_get_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register URI handler for the metrics");
+        return ESP_FAIL;
+    }
+
+    // Worker pool statistics
+    httpd_uri_t system_workers_get_uri = {
+            .uri = WEB_SERVER_API_ROUTES_PREFIX "/system/workers",
+            .method = HTTP_GET,
+            .handler = system_workers_get_handler,
+            .user_ctx = NULL
+    };
+    if (http_stats_register_uri_handler(server, &system_workers_get_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register URI handler for the worker statistics");
+        return ESP_FAIL;
+    }
+
+    // Per-endpoint request statistics
+    httpd_uri_t system_http_stats_get_uri = {
+            .uri = WEB_SERVER_API_ROUTES_PREFIX "/system/http-stats",
+            .method = HTTP_GET,
+            .handler = system_http_stats_get_handler,
+            .user_ctx = NULL
+    };
+    if (http_stats_register_uri_handler(server, &system_http_stats_get_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register URI handler for the request statistics");
+        return ESP_FAIL;
+    }
+
+    // Connection statistics
+    httpd_uri_t system_connections_get_uri = {
+            .uri = WEB_SERVER_API_ROUTES_PREFIX "/system/connections",
+            .method = HTTP_GET,
+            .handler = system_connections_get_handler,
+            .user_ctx = NULL
+    };
+    if (http_stats_register_uri_handler(server, &system_connections_get_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register URI handler for the connection statistics");
+        return ESP_FAIL;
+    }
+
+#if CONFIG_P1_PASSTHROUGH
+    // P1 passthrough clients
+    httpd_uri_t system_p1_passthrough_get_uri = {
+            .uri = WEB_SERVER_API_ROUTES_PREFIX "/system/p1-passthrough",
+            .method = HTTP_GET,
+            .handler = system_p1_passthrough_get_handler,
+            .user_ctx = NULL
+    };
+    if (http_stats_register_uri_handler(server, &system_p1_passthrough_get_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register URI handler for the P1 passthrough clients");
+        return ESP_FAIL;
+    }
+#endif
+
     // Meter data
     httpd_uri_t meter_data_get_uri = {
             .uri =  WEB_SERVER_API_ROUTES_PREFIX "/meter-data",
@@ -244,23 +413,73 @@ static esp_err_t setup_api_routes(httpd_handle_t server) {
             .handler = meter_data_get_handler,
             .user_ctx = NULL
     };
-    if (httpd_register_uri_handler(server, &meter_data_get_uri) != ESP_OK) {
+    if (http_stats_register_uri_handler(server, &meter_data_get_uri) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register URI handler for the meter data");
         return ESP_FAIL;
     }
 
-    // Meter data
+    // Complete P1 data
+    httpd_uri_t p1_data_complete_get_uri = {
+            .uri =  WEB_SERVER_API_ROUTES_PREFIX "/p1/data/complete",
+            .method = HTTP_GET,
+            .handler = p1_data_complete_get_handler,
+            .user_ctx = NULL
+    };
+    if (http_stats_register_uri_handler(server, &p1_data_complete_get_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register URI handler for the complete P1 data");
+        return ESP_FAIL;
+    }
+
+    // Meter data history
     httpd_uri_t meter_data_history_get_uri = {
             .uri =  WEB_SERVER_API_ROUTES_PREFIX "/meter-data-history",
             .method = HTTP_GET,
-            .handler = meter_data_history_get_handler,
-            .user_ctx = NULL
+            .handler = async_worker_handler,
+            .user_ctx = &history_endpoint
     };
-    if (httpd_register_uri_handler(server, &meter_data_history_get_uri) != ESP_OK) {
+    if (http_stats_register_uri_handler(server, &meter_data_history_get_uri) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register URI handler for the meter data history");
         return ESP_FAIL;
     }
 
+    // Batch of resources
+    httpd_uri_t batch_get_uri = {
+            .uri =  WEB_SERVER_API_ROUTES_PREFIX "/batch",
+            .method = HTTP_GET,
+            .handler = async_worker_handler,
+            .user_ctx = &batch_endpoint
+    };
+    if (http_stats_register_uri_handler(server, &batch_get_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register URI handler for the batch");
+        return ESP_FAIL;
+    }
+
+    // Meter data event stream
+    httpd_uri_t stream_get_uri = {
+            .uri =  WEB_SERVER_API_VERSIONED_ROUTES_PREFIX "/stream",
+            .method = HTTP_GET,
+            .handler = event_stream_get_handler,
+            .user_ctx = NULL
+    };
+    if (http_stats_register_uri_handler(server, &stream_get_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register URI handler for the event stream");
+        return ESP_FAIL;
+    }
+
+    // Meter data WebSocket telemetry
+    httpd_uri_t ws_telemetry_uri = {
+            .uri =  WEB_SERVER_API_VERSIONED_ROUTES_PREFIX "/ws",
+            .method = HTTP_GET,
+            .handler = ws_telemetry_handler,
+            .user_ctx = NULL,
+            .is_websocket = true,
+            .ws_pre_handshake_cb = ws_telemetry_pre_handshake
+    };
+    if (http_stats_register_uri_handler(server, &ws_telemetry_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register URI handler for the WebSocket telemetry");
+        return ESP_FAIL;
+    }
+
     return ESP_OK;
 }
 
@@ -295,149 +514,313 @@ static esp_err_t http_500_handler(httpd_req_t *req, const char *msg) {
 }
 
 /**
- * @brief Handler for getting the frontend
+ * @brief Start a JSON response
  *
- * This handler is called when the user requests a file from the web server that is not already a registered URI.
- * Based on the URI, the corresponding file is opened and sent to the client. If the file is not found, a 404 error is sent.
- * If the URI is '/', the file 'index.html' is sent.
- * Files are served from the file system at WEB_SERVER_FS_MOUNT_POINT (/www).
- *
- * @note This function will not work with binary files
- * @todo Add support for binary files
+ * This function sets the content type to application/json and initializes a JSON writer that streams the
+ * response to the client. The response is completed with json_writer_finish(), which must be called on every path
+ * once this function succeeded.
  *
  * @param[in] req The request handle
+ * @param[out] json The JSON writer to initialize
+ * @param[in] compress True to gzip compress the response, if the client accepts it (for large responses)
+ * @param[out] compressed Set to true if the response is gzip compressed, can be NULL
  * @return ESP_OK on success
  */
-static esp_err_t frontend_get_handler(httpd_req_t *req) {
-    char filepath[WEB_SERVER_MAX_FILE_PATH_LEN];    // Buffer to store the file path including the mount point
-    char buf[WEB_SERVER_FILE_BUFFER_SIZE];          // Buffer to use when reading the file
-    FILE *fp;                                       // File pointer
-    char *ext;                                      // File extension
-    esp_err_t err;
+static esp_err_t begin_json_response(httpd_req_t *req, json_writer_t *json, bool compress, bool *compressed) {
+    bool gzip = false;
+
+    // Set the content type
+    if (httpd_resp_set_type(req, "application/json") != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set json response type");
+        return ESP_FAIL;
+    }
 
-    // Set the prefix to the mount point
-    strcpy(filepath, WEB_SERVER_FS_MOUNT_POINT);
+    json_writer_init_httpd(json, req);
 
-    // Get the file path
-    if (req->uri[strlen(req->uri) - 1] == '/') {
-        // If the URI ends with a slash, use index.html
-        strlcat(filepath, "/index.html", sizeof(filepath));
+    // If no compressor is available, the response is sent uncompressed
+    if (compress && gzip_writer_is_accepted(req)) {
+        gzip = gzip_writer_init_httpd(&json->out, req) == ESP_OK;
     }
-    else {
-        // Use the URI as the file path
-        strlcat(filepath, req->uri, sizeof(filepath));
+    if (compressed != NULL) {
+        *compressed = gzip;
     }
 
-    // Open index.html file
-    fp = fopen(filepath, "r");
-    if (fp == NULL) {
-        ESP_LOGW(TAG, "Failed to open file: %s", filepath);
-        return http_404_handler(req, "File not found");
-    }
+    return ESP_OK;
+}
 
-    // Set the content type based on the file extension
-    ext = strrchr(filepath, '.');
-    if (ext != NULL) {
-        err = set_content_type_from_file_ext(req, ext + 1);
-    }
-    else {
-        err = httpd_resp_set_type(req, "text/plain");
+/**
+ * @brief Get an unsigned integer query parameter
+ *
+ * @param[in] query The query string of the request
+ * @param[in] key The name of the parameter
+ * @param[out] value The value of the parameter, unchanged if it is missing or invalid
+ * @return
+ *   - ESP_OK on success
+ *   - ESP_ERR_NOT_FOUND if the parameter is missing
+ *   - ESP_ERR_INVALID_ARG if the value is not an unsigned integer
+ */
+static esp_err_t get_query_uint(const char *query, const char *key, uint32_t *value) {
+    char str[12];
+    char *end;
+    unsigned long parsed;
+    esp_err_t err;
+
+    err = httpd_query_key_value(query, key, str, sizeof(str));
+    if (err == ESP_ERR_HTTPD_RESULT_TRUNC) {
+        return ESP_ERR_INVALID_ARG;
     }
-    // Check if the content type was set successfully
     if (err != ESP_OK) {
-        fclose(fp);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (str[0] < '0' || str[0] > '9') {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    parsed = strtoul(str, &end, 10);
+    if (*end != '\0' || parsed > UINT32_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *value = (uint32_t)parsed;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler for the /api/system_info endpoint
+ *
+ * This handler returns the system information as a JSON object.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+static esp_err_t system_info_get_handler(httpd_req_t *req) {
+    json_writer_t json;
+    char etag[HTTP_CACHE_ETAG_MAX_LEN];
+
+    // The system info only changes with the firmware
+    http_cache_make_firmware_etag(etag, sizeof(etag));
+    if (http_cache_set_validators(req, etag, HTTP_CACHE_CONTROL_REVALIDATE) != ESP_OK) {
         return ESP_FAIL;
     }
+    if (http_cache_is_not_modified(req, etag)) {
+        return http_cache_send_not_modified(req);
+    }
 
-    // Read the file and send it to the client in chunks
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-        err = httpd_resp_sendstr_chunk(req, buf);
-        if (err != ESP_OK) {
-            fclose(fp);
-            return err;
-        }
+    if (begin_json_response(req, &json, false, NULL) != ESP_OK) {
+        return ESP_FAIL;
     }
 
-    // Close the file
-    fclose(fp);
+    // Send the JSON object containing the system info
+    json_writer_begin_object(&json, NULL);
+    write_system_info(&json);
+    json_writer_end_object(&json);
 
-    // End the response by sending an empty chunk
-    err = httpd_resp_sendstr_chunk(req, NULL);
+    return json_writer_finish(&json);
+}
 
-    return err;
+/**
+ * @brief Write the members of the system info object
+ *
+ * @note The enclosing JSON object must be opened and closed by the caller
+ *
+ * @param[in] json The JSON writer
+ */
+static void write_system_info(json_writer_t *json) {
+    esp_chip_info_t chip_info;
+
+    esp_chip_info(&chip_info);
+    json_writer_add_string(json, "version", IDF_VER);
+    json_writer_add_int(json, "cores", chip_info.cores);
 }
 
 /**
- * @brief Send a JSON response
+ * @brief Handler for the /api/system/workers endpoint
  *
- * This function sets the content type to application/json and sends the JSON string to the client.
+ * Returns the state of the worker pool and, per endpoint handled by it, the number of requests and the time they
+ * waited for a worker.
  *
  * @param[in] req The request handle
- * @param[in] root The JSON object to send
- * @param[in] status_code The HTTP status code to send. If 0 or > 999, 200 is sent.
  * @return ESP_OK on success
  */
-static esp_err_t send_json_response(httpd_req_t *req, cJSON *root, uint16_t status_code) {
-    esp_err_t err = ESP_OK;
-    char status_code_str[6];
-    const char *json = cJSON_Print(root);
+static esp_err_t system_workers_get_handler(httpd_req_t *req) {
+    json_writer_t json;
+    async_worker_stats_t stats;
 
-    // Convert the status code to a string
-    if (status_code == 0 || status_code > 999) {
-        status_code = 200;
+    if (httpd_resp_set_hdr(req, "Cache-Control", "no-store") != ESP_OK
+        || begin_json_response(req, &json, false, NULL) != ESP_OK) {
+        return ESP_FAIL;
     }
-    sprintf(status_code_str, "%d", status_code);
 
-    // Set the status code
-    if (httpd_resp_set_status(req,status_code_str) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set status code");
-        err = ESP_FAIL;
+    json_writer_begin_object(&json, NULL);
+    json_writer_add_int(&json, "workers", ASYNC_WORKER_COUNT);
+    json_writer_add_int(&json, "queueSize", ASYNC_WORKER_QUEUE_SIZE);
+    json_writer_add_int(&json, "queueLength", async_worker_get_queue_length());
+    json_writer_add_int(&json, "arenaPeakUsage", request_arena_get_peak_usage());
+    json_writer_begin_array(&json, "endpoints");
+    for (size_t i = 0; i < sizeof(async_endpoints) / sizeof(async_endpoints[0]); i++) {
+        async_worker_get_stats(async_endpoints[i], &stats);
+        json_writer_begin_object(&json, NULL);
+        json_writer_add_string(&json, "endpoint", async_endpoints[i]->name);
+        json_writer_add_int(&json, "requests", stats.request_count);
+        json_writer_add_int(&json, "rejected", stats.rejected_count);
+        json_writer_add_int(&json, "avgWaitUs", stats.request_count > 0 ? stats.total_wait_time_us / stats.request_count : 0);
+        json_writer_add_int(&json, "maxWaitUs", stats.max_wait_time_us);
+        json_writer_end_object(&json);
     }
-    // Set the content type
-    else if (httpd_resp_set_type(req, "application/json") != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set json response type");
-        err = ESP_FAIL;
+    json_writer_end_array(&json);
+    json_writer_end_object(&json);
+
+    return json_writer_finish(&json);
+}
+
+/**
+ * @brief Handler for the /api/system/http-stats endpoint
+ *
+ * Returns, per registered endpoint, the number of requests, the bytes sent and the latency histograms of the whole
+ * request and of its lock wait, render and send phases. The histograms share the upper bucket limits in bucketLimitsUs,
+ * the last bucket has no limit.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+static esp_err_t system_http_stats_get_handler(httpd_req_t *req) {
+    static const uint32_t bucket_limits_us[HTTP_STATS_BUCKET_COUNT - 1] = HTTP_STATS_BUCKET_LIMITS_US;
+    json_writer_t json;
+    http_stats_t stats;
+    const http_stats_endpoint_t *endpoint;
+
+    if (httpd_resp_set_hdr(req, "Cache-Control", "no-store") != ESP_OK
+        || begin_json_response(req, &json, false, NULL) != ESP_OK) {
+        return ESP_FAIL;
     }
-    // Send the response
-    else if (httpd_resp_sendstr(req, json) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send json response");
-        err = ESP_FAIL;
+
+    json_writer_begin_object(&json, NULL);
+    json_writer_begin_array(&json, "bucketLimitsUs");
+    for (size_t i = 0; i < HTTP_STATS_BUCKET_COUNT - 1; i++) {
+        json_writer_add_int(&json, NULL, bucket_limits_us[i]);
     }
+    json_writer_end_array(&json);
+    json_writer_begin_array(&json, "endpoints");
+    for (size_t i = 0; (endpoint = http_stats_get(i, &stats)) != NULL; i++) {
+        json_writer_begin_object(&json, NULL);
+        json_writer_add_string(&json, "endpoint", endpoint->uri.uri);
+        json_writer_add_string(&json, "method", http_method_str(endpoint->uri.method));
+        json_writer_add_int(&json, "requests", stats.request_count);
+        json_writer_add_int(&json, "errors", stats.error_count);
+        json_writer_add_int(&json, "bytesSent", (int64_t)stats.bytes_sent);
+        add_histogram(&json, "total", &stats.total, stats.request_count);
+        add_histogram(&json, "lockWait", &stats.phases[HTTP_STATS_PHASE_LOCK_WAIT], stats.request_count);
+        add_histogram(&json, "render", &stats.phases[HTTP_STATS_PHASE_RENDER], stats.request_count);
+        add_histogram(&json, "send", &stats.phases[HTTP_STATS_PHASE_SEND], stats.request_count);
+        json_writer_end_object(&json);
+    }
+    json_writer_end_array(&json);
+    json_writer_end_object(&json);
 
-    // Free resources
-    free((void *)json);
+    return json_writer_finish(&json);
+}
 
-    return err;
+/**
+ * @brief Add a latency histogram as a JSON object
+ *
+ * @param[in] json The JSON writer
+ * @param[in] key The key of the object
+ * @param[in] histogram The histogram
+ * @param[in] request_count The number of requests in the histogram
+ */
+static void add_histogram(json_writer_t *json, const char *key, const http_stats_histogram_t *histogram,
+                          uint32_t request_count) {
+    json_writer_begin_object(json, key);
+    json_writer_add_int(json, "avgUs", request_count > 0 ? histogram->total_us / request_count : 0);
+    json_writer_add_int(json, "maxUs", histogram->max_us);
+    json_writer_begin_array(json, "buckets");
+    for (size_t i = 0; i < HTTP_STATS_BUCKET_COUNT; i++) {
+        json_writer_add_int(json, NULL, histogram->buckets[i]);
+    }
+    json_writer_end_array(json);
+    json_writer_end_object(json);
 }
 
 /**
- * @brief Handler for the /api/system_info endpoint
+ * @brief Handler for the /api/system/connections endpoint
  *
- * This handler returns the system information as a JSON object.
+ * Returns the size and policy of the session pool and the connection counters, see http_sessions_stats_t.
  *
  * @param[in] req The request handle
  * @return ESP_OK on success
  */
-static esp_err_t system_info_get_handler(httpd_req_t *req) {
-    esp_err_t err;
-    esp_chip_info_t chip_info;
-    cJSON *root = cJSON_CreateObject();
+static esp_err_t system_connections_get_handler(httpd_req_t *req) {
+    json_writer_t json;
+    http_sessions_stats_t stats;
 
-    // Get the system info
-    esp_chip_info(&chip_info);
+    if (httpd_resp_set_hdr(req, "Cache-Control", "no-store") != ESP_OK
+        || begin_json_response(req, &json, false, NULL) != ESP_OK) {
+        return ESP_FAIL;
+    }
 
-    // Create the JSON object containing the system info
-    cJSON_AddStringToObject(root, "version", IDF_VER);
-    cJSON_AddNumberToObject(root, "cores", chip_info.cores);
+    http_sessions_get_stats(&stats);
+    json_writer_begin_object(&json, NULL);
+    json_writer_add_int(&json, "maxSessions", WEB_SERVER_MAX_OPEN_SOCKETS);
+    json_writer_add_bool(&json, "lruEviction", WEB_SERVER_LRU_EVICTION);
+    json_writer_add_int(&json, "open", stats.open_count);
+    json_writer_add_int(&json, "peakOpen", stats.peak_open_count);
+    json_writer_add_int(&json, "accepted", stats.accepted_count);
+    json_writer_add_int(&json, "rejected", stats.rejected_count);
+    json_writer_add_int(&json, "evicted", stats.evicted_count);
+    json_writer_add_int(&json, "idleClosed", stats.idle_closed_count);
+    json_writer_end_object(&json);
+
+    return json_writer_finish(&json);
+}
 
-    // Send the JSON object
-    err = send_json_response(req, root, 200);
+#if CONFIG_P1_PASSTHROUGH
+/**
+ * @brief Handler for the /api/system/p1-passthrough endpoint
+ *
+ * Returns the counters of the P1 passthrough server and the statistics of every connected client.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+static esp_err_t system_p1_passthrough_get_handler(httpd_req_t *req) {
+    json_writer_t json;
+    p1_passthrough_stats_t stats;
+    p1_passthrough_client_stats_t client;
+    int64_t now = esp_timer_get_time();
+
+    if (httpd_resp_set_hdr(req, "Cache-Control", "no-store") != ESP_OK
+        || begin_json_response(req, &json, false, NULL) != ESP_OK) {
+        return ESP_FAIL;
+    }
 
-    // Free resources
-    cJSON_Delete(root);
+    p1_passthrough_get_stats(&stats);
+    json_writer_begin_object(&json, NULL);
+    json_writer_add_int(&json, "port", CONFIG_P1_PASSTHROUGH_PORT);
+    json_writer_add_int(&json, "maxClients", CONFIG_P1_PASSTHROUGH_MAX_CLIENTS);
+    json_writer_add_int(&json, "accepted", stats.accepted_count);
+    json_writer_add_int(&json, "rejected", stats.rejected_count);
+    json_writer_add_int(&json, "telegramsSent", stats.telegrams_sent);
+    json_writer_add_int(&json, "telegramsDropped", stats.telegrams_dropped);
+    json_writer_begin_array(&json, "clients");
+    for (size_t i = 0; i < CONFIG_P1_PASSTHROUGH_MAX_CLIENTS; i++) {
+        if (!p1_passthrough_get_client(i, &client)) {
+            continue;
+        }
+        json_writer_begin_object(&json, NULL);
+        json_writer_add_string(&json, "address", client.address);
+        json_writer_add_int(&json, "port", client.port);
+        json_writer_add_int(&json, "connectedSeconds", (now - client.connected_since_us) / 1000000);
+        json_writer_add_int(&json, "telegramsSent", client.telegrams_sent);
+        json_writer_add_int(&json, "telegramsDropped", client.telegrams_dropped);
+        json_writer_add_int(&json, "bytesSent", (int64_t)client.bytes_sent);
+        json_writer_end_object(&json);
+    }
+    json_writer_end_array(&json);
+    json_writer_end_object(&json);
 
-    return err;
+    return json_writer_finish(&json);
 }
+#endif
 
 /**
  * @brief Handler for the /api/version endpoint
@@ -448,208 +831,618 @@ static esp_err_t system_info_get_handler(httpd_req_t *req) {
  * @return ESP_OK on success
  */
 static esp_err_t api_version_get_handler(httpd_req_t *req) {
-    esp_err_t err;
+    json_writer_t json;
+    char etag[HTTP_CACHE_ETAG_MAX_LEN];
+
+    // The API version only changes with the firmware
+    http_cache_make_firmware_etag(etag, sizeof(etag));
+    if (http_cache_set_validators(req, etag, HTTP_CACHE_CONTROL_REVALIDATE) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (http_cache_is_not_modified(req, etag)) {
+        return http_cache_send_not_modified(req);
+    }
 
-    // Create the JSON object containing the api version
-    cJSON *json_obj = cJSON_CreateObject();
-    cJSON_AddStringToObject(json_obj, "version", WEB_SERVER_API_VERSION);
+    if (begin_json_response(req, &json, false, NULL) != ESP_OK) {
+        return ESP_FAIL;
+    }
 
-    // Send the JSON object
-    err = send_json_response(req, json_obj, 200);
+    // Send the JSON object containing the api version
+    json_writer_begin_object(&json, NULL);
+    write_api_version(&json);
+    json_writer_end_object(&json);
 
-    // Free resources
-    cJSON_Delete(json_obj);
+    return json_writer_finish(&json);
+}
 
-    return err;
+/**
+ * @brief Write the members of the API version object
+ *
+ * @note The enclosing JSON object must be opened and closed by the caller
+ *
+ * @param[in] json The JSON writer
+ */
+static void write_api_version(json_writer_t *json) {
+    json_writer_add_string(json, "version", WEB_SERVER_API_VERSION);
 }
 
 /**
  * @brief Handler for the meter-data
  *
+ * The 'fields' query parameter selects the fields to include, as a comma separated list of field names.
+ * Without it, the basic fields are returned (METER_DATA_FIELDS_BASIC).
+ *
+ * With the 'after' query parameter, the request is a long-poll: the response is delayed until a telegram newer than
+ * the given telegramSequence is available, or until 'timeout' seconds have passed (204 No Content).
+ *
  * @param[in] req The request handle
  * @return ESP_OK on success
  */
 static esp_err_t meter_data_get_handler(httpd_req_t *req) {
-    struct predicted_peak_s predicted_peak;
     esp_err_t err;
-    cJSON *json_obj;
-    SemaphoreHandle_t predicted_peak_mutex = predict_peak_get_predicted_peak_mutex_handle();
-    emucs_p1_data_t *p1_data;
-    cJSON *tmp_obj;
-    SemaphoreHandle_t mutex = emucs_p1_get_telegram_mutex_handle();
-
-    json_obj = cJSON_CreateObject();
+    char query[WEB_SERVER_MAX_QUERY_LEN];
+    char fields[WEB_SERVER_MAX_QUERY_LEN];
+    uint64_t field_mask = METER_DATA_FIELDS_BASIC;
+    uint32_t after;
+    uint32_t timeout_s = LONG_POLL_DEFAULT_TIMEOUT_S;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        return send_meter_data(req, field_mask);
+    }
 
-    // Get the semaphore
-    if (xSemaphoreTake(mutex, WEB_SERVER_MAX_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to get P1 data semaphore within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
-        return ESP_FAIL;
+    // Parse the selected fields once, the serializer only emits the fields in the mask
+    if (httpd_query_key_value(query, "fields", fields, sizeof(fields)) == ESP_OK) {
+        if (meter_data_parse_field_mask(fields, &field_mask) != ESP_OK || field_mask == 0) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid fields");
+        }
     }
 
-    // Get the P1 data pointer
-    p1_data = emucs_p1_get_telegram();
+    // Long-poll request
+    err = get_query_uint(query, "after", &after);
+    if (err == ESP_OK) {
+        if (get_query_uint(query, "timeout", &timeout_s) == ESP_ERR_INVALID_ARG) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid timeout");
+        }
+        return long_poll_handle_request(req, after, timeout_s, field_mask);
+    }
+    if (err == ESP_ERR_INVALID_ARG) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid after");
+    }
 
-    // Add the basic data to the root JSON object (json_obj)
-    cJSON_AddNumberToObject(json_obj, "timestamp", (double)p1_data->msg_timestamp);
-    cJSON_AddNumberToObject(json_obj, "electricityDeliveredTariff1", p1_data->electricity_delivered_tariff1);
-    cJSON_AddNumberToObject(json_obj, "electricityDeliveredTariff2", p1_data->electricity_delivered_tariff2);
-    cJSON_AddNumberToObject(json_obj, "electricityReturnedTariff1", p1_data->electricity_returned_tariff1);
-    cJSON_AddNumberToObject(json_obj, "electricityReturnedTariff2", p1_data->electricity_returned_tariff2);
-    cJSON_AddNumberToObject(json_obj, "currentAvgDemand", p1_data->current_avg_demand);
-    cJSON_AddNumberToObject(json_obj, "currentPowerUsage", p1_data->current_power_usage);
-    cJSON_AddNumberToObject(json_obj, "currentPowerReturn", p1_data->current_power_return);
-    tmp_obj = cJSON_CreateObject();
-    cJSON_AddNumberToObject(tmp_obj, "timestamp", (double) p1_data->max_demand_month.timestamp);
-    cJSON_AddNumberToObject(tmp_obj, "demand", p1_data->max_demand_month.max_demand);
-    cJSON_AddItemToObject(json_obj, "maxDemandMonth", tmp_obj);
+    return send_meter_data(req, field_mask);
+}
 
-    xSemaphoreGive(mutex);
+/**
+ * @brief Handler for the complete P1 data, i.e. every field of the telegram and the predicted peak
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+static esp_err_t p1_data_complete_get_handler(httpd_req_t *req) {
+    return send_meter_data(req, METER_DATA_FIELDS_COMPLETE);
+}
 
-    // Get the predicted peak data
-    if (xSemaphoreTake(predicted_peak_mutex, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) == pdTRUE) {
-        predicted_peak = predict_peak_get_predicted_peak();
-        xSemaphoreGive(predicted_peak_mutex);
+/**
+ * @brief Send the selected fields of the meter data
+ *
+ * The response is served from the meter data snapshot, which is only rendered again when the data changed.
+ * The ETag is derived from the telegram and predicted peak sequence numbers and the field selection, so a client
+ * that already has the current data gets a 304 response without the snapshot being touched.
+ *
+ * @param[in] req The request handle
+ * @param[in] field_mask The fields to include (see METER_DATA_FIELD_BIT)
+ * @return ESP_OK on success
+ */
+static esp_err_t send_meter_data(httpd_req_t *req, uint64_t field_mask) {
+    esp_err_t err;
+    shared_buffer_t *snapshot;
+    char etag[HTTP_CACHE_ETAG_MAX_LEN];
+    uint32_t variant = (uint32_t)(field_mask ^ (field_mask >> 32));
+    uint32_t telegram_sequence = emucs_p1_get_telegram_sequence();
+    uint32_t predicted_peak_sequence = predict_peak_get_sequence();
+
+    http_cache_make_sequence_etag(etag, sizeof(etag), 'm', telegram_sequence, predicted_peak_sequence, variant);
+    if (http_cache_is_not_modified(req, etag)) {
+        if (http_cache_set_validators(req, etag, HTTP_CACHE_CONTROL_REVALIDATE) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        return http_cache_send_not_modified(req);
     }
-    else {
-        ESP_LOGE(TAG, "Failed to get predicted peak mutex within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
-        return http_500_handler(req, "Failed to get predicted peak mutex");
+
+    snapshot = snapshot_get_meter_data(field_mask, &telegram_sequence, &predicted_peak_sequence);
+    if (snapshot == NULL) {
+        return http_500_handler(req, "Meter data not available");
     }
 
-    //  predicted peak data
-    cJSON_AddNumberToObject(json_obj, "predictedPeak", predicted_peak.value);
-    cJSON_AddNumberToObject(json_obj, "predictedPeakTime", (double)predicted_peak.timestamp);
+    // The snapshot may be newer than the sequence numbers read above, use the ones it was rendered from
+    http_cache_make_sequence_etag(etag, sizeof(etag), 'm', telegram_sequence, predicted_peak_sequence, variant);
+    if (http_cache_set_validators(req, etag, HTTP_CACHE_CONTROL_REVALIDATE) != ESP_OK) {
+        shared_buffer_release(snapshot);
+        return ESP_FAIL;
+    }
 
-    // Send the JSON object
-    err = send_json_response(req, json_obj, 200);
+    // Send the pre-rendered JSON
+    if (httpd_resp_set_type(req, "application/json") != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set json response type");
+        err = ESP_FAIL;
+    }
+    else {
+        err = httpd_resp_send(req, snapshot->data, (ssize_t)snapshot->len);
+    }
 
-    // Free resources
-    cJSON_Delete(json_obj);
+    // Release the snapshot
+    shared_buffer_release(snapshot);
 
     return err;
 }
 
 /**
- * @brief Handler for the meter-data
+ * @brief Handler for the meter-data-history
+ *
+ * The response is streamed using chunked transfer encoding, while iterating over the logs in small batches.
+ * The log mutexes are only held while copying a batch, never while sending, so the memory usage and the time to
+ * the first byte don't depend on the size of the logs.
+ * The ETag is derived from the end indices of both logs, which change every time an entry is added, and from the
+ * encoding the response is actually sent with.
  *
  * @param[in] req The request handle
  * @return ESP_OK on success
  */
 static esp_err_t meter_data_history_get_handler(httpd_req_t *req) {
-    esp_err_t err;
-    cJSON *json_obj;
+    json_writer_t json;
     emucs_p1_data_t *p1_data;
-    cJSON *tmp_obj;
-    cJSON *tmp_array;
+    struct emucs_p1_max_demand_s max_demand_year[EMUCS_P1_MAX_DEMAND_YEAR_MONTHS];
     SemaphoreHandle_t mutex = emucs_p1_get_telegram_mutex_handle();
-    log_entry_short_term_p1_data_t *short_term_log_entry;
-    log_entry_long_term_p1_data_t *long_term_log_entry;
     SemaphoreHandle_t short_term_log_mutex = logger_get_short_term_log_mutex_handle();
     SemaphoreHandle_t long_term_log_mutex = logger_get_long_term_log_mutex_handle();
-    size_t item_count;
-    struct tm * tm_ptr;
+    meter_data_history_batch_t *batch;
+    meter_data_history_range_t range;
+    uint32_t index;
+    uint32_t end_index;
+    bool compressed;
+    char etag[HTTP_CACHE_ETAG_MAX_LEN];
+    char query[WEB_SERVER_MAX_QUERY_LEN];
 
     ESP_LOGD(TAG, "meter_data_history_get_handler called");
 
-    short_term_log_entry = malloc(LOGGER_SHORT_TERM_LOG_SIZE * sizeof(log_entry_short_term_p1_data_t));
-    if (short_term_log_entry == NULL) {
-        // TODO: return 500 error instead ?
-        ESP_LOGE(TAG, "Failed to allocate memory for log_entry");
-        vTaskDelete(NULL);
-        assert(0); // Should never get here
+    // Incremental query
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        static const char *query_keys[] = {"cursor", "since", "limit", "resolution", "points"};
+        char value[2];
+        for (size_t i = 0; i < sizeof(query_keys) / sizeof(query_keys[0]); i++) {
+            if (httpd_query_key_value(query, query_keys[i], value, sizeof(value)) != ESP_ERR_NOT_FOUND) {
+                return meter_data_history_query_handler(req, query);
+            }
+        }
     }
 
-    json_obj = cJSON_CreateObject();
+    if (mutex == NULL || short_term_log_mutex == NULL || long_term_log_mutex == NULL) {
+        return http_500_handler(req, "Meter data not available");
+    }
 
-    // Get the semaphore
-    if (xSemaphoreTake(mutex, WEB_SERVER_MAX_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to get P1 data semaphore within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
-        return ESP_FAIL;
+    // The batch buffer is released together with the request
+    batch = request_arena_alloc(sizeof(*batch));
+    if (batch == NULL) {
+        return http_500_handler(req, "Out of memory");
     }
 
-    // Get the P1 data pointer
-    p1_data = emucs_p1_get_telegram();
+    // Check if the client already has the current history
+    if (http_stats_take(short_term_log_mutex, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get short term log mutex within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
+        return http_500_handler(req, "Failed to get short term log mutex");
+    }
+    index = logger_get_short_term_log_end_index();
+    xSemaphoreGive(short_term_log_mutex);
+    if (http_stats_take(long_term_log_mutex, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get long term log mutex within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
+        return http_500_handler(req, "Failed to get long term log mutex");
+    }
+    end_index = logger_get_long_term_log_end_index();
+    xSemaphoreGive(long_term_log_mutex);
 
-    // Add the basic data to the root JSON object (json_obj)
-    tmp_array = cJSON_CreateArray();
-    for (int i = 0; i < 13; i++) {
-        if (p1_data->max_demand_year[i].timestamp_appearance == 0) {
-            break;
+    // The gzip encoded response is a different representation, so it gets a different ETag. Whether the response is
+    // compressed is only known once a compressor is taken, a client holding either representation can keep using it.
+    for (uint32_t variant = 0; variant <= 1; variant++) {
+        http_cache_make_sequence_etag(etag, sizeof(etag), 'h', index, end_index, variant);
+        if (http_cache_is_not_modified(req, etag)) {
+            if (http_cache_set_validators(req, etag, HTTP_CACHE_CONTROL_REVALIDATE) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            return http_cache_send_not_modified(req);
         }
-        tmp_obj = cJSON_CreateObject();
-        cJSON_AddNumberToObject(tmp_obj, "timestamp", (double) p1_data->max_demand_year[i].timestamp_appearance);
-        cJSON_AddNumberToObject(tmp_obj, "demand", p1_data->max_demand_year[i].max_demand);
-        cJSON_AddItemToArray(tmp_array, tmp_obj);
     }
-    cJSON_AddItemToObject(json_obj, "maxDemandYear", tmp_array);
 
+    // Copy the max demand of the last 13 months, so the telegram doesn't stay locked while sending
+    if (http_stats_take(mutex, WEB_SERVER_MAX_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get P1 data semaphore within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
+        return http_500_handler(req, "Failed to get P1 data semaphore");
+    }
+    p1_data = emucs_p1_get_telegram();
+    memcpy(max_demand_year, p1_data->max_demand_year, sizeof(max_demand_year));
     xSemaphoreGive(mutex);
 
-    // Copy the short term log to a local buffer, sorted on entry timestamp
-    xSemaphoreTake(short_term_log_mutex, portMAX_DELAY);
-    item_count = logger_get_short_term_log_items(short_term_log_entry, LOGGER_SHORT_TERM_LOG_SIZE);
+    if (get_meter_data_history_range(&range, 0) != ESP_OK) {
+        return http_500_handler(req, "Failed to get log mutex");
+    }
+
+    if (begin_json_response(req, &json, true, &compressed) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    http_cache_make_sequence_etag(etag, sizeof(etag), 'h', index, end_index, compressed);
+    if (http_cache_set_validators(req, etag, HTTP_CACHE_CONTROL_REVALIDATE) != ESP_OK) {
+        json.out.err = ESP_FAIL;
+        return json_writer_finish(&json);
+    }
+    json_writer_begin_object(&json, NULL);
+    write_meter_data_history(&json, max_demand_year, &range, batch);
+    json_writer_end_object(&json);
+
+    return json_writer_finish(&json);
+}
+
+/**
+ * @brief Determine the range of the logs to send in the meter-data-history
+ *
+ * The short term log is sent from the beginning of the quarter-hour of its newest entry, the long term log completely.
+ *
+ * @param[out] range The range of both logs
+ * @param[in] until Only include the entries up to this timestamp, or 0 to include the newest entries
+ * @return
+ *   - ESP_OK on success
+ *   - ESP_ERR_INVALID_STATE if the logs are not available yet
+ *   - ESP_ERR_TIMEOUT if a log mutex couldn't be taken in time
+ */
+static esp_err_t get_meter_data_history_range(meter_data_history_range_t *range, time_t until) {
+    SemaphoreHandle_t short_term_log_mutex = logger_get_short_term_log_mutex_handle();
+    SemaphoreHandle_t long_term_log_mutex = logger_get_long_term_log_mutex_handle();
+    log_entry_short_term_p1_data_t newest_entry;
+    time_t quarter_hour_start;
+    struct tm *tm_ptr;
+    uint32_t index;
+
+    if (short_term_log_mutex == NULL || long_term_log_mutex == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (http_stats_take(short_term_log_mutex, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get short term log mutex within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
+        return ESP_ERR_TIMEOUT;
+    }
+    range->short_term_end_index = until != 0 ? logger_find_short_term_log_index(until + 1)
+                                             : logger_get_short_term_log_end_index();
+    range->short_term_index = range->short_term_end_index;
+    index = range->short_term_end_index - 1;
+    if (range->short_term_end_index != logger_get_short_term_log_first_index()
+        && logger_read_short_term_log_items(&index, &newest_entry, 1) == 1) {
+        // Start at the beginning of the quarter-hour (00, 15, 30 or 45 minutes) of the newest entry
+        quarter_hour_start = newest_entry.timestamp;
+        tm_ptr = localtime(&quarter_hour_start);
+        quarter_hour_start -= (tm_ptr->tm_min % 15) * 60 + tm_ptr->tm_sec;
+        range->short_term_index = logger_find_short_term_log_index(quarter_hour_start);
+    }
     xSemaphoreGive(short_term_log_mutex);
 
-    ESP_LOGD(TAG, "item_count = %d", item_count);
+    if (http_stats_take(long_term_log_mutex, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get long term log mutex within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
+        return ESP_ERR_TIMEOUT;
+    }
+    range->long_term_index = logger_get_long_term_log_first_index();
+    range->long_term_end_index = until != 0 ? logger_find_long_term_log_index(until + 1)
+                                            : logger_get_long_term_log_end_index();
+    xSemaphoreGive(long_term_log_mutex);
+
+    ESP_LOGD(TAG, "History range: short term %lu - %lu, long term %lu - %lu", range->short_term_index,
+             range->short_term_end_index, range->long_term_index, range->long_term_end_index);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Write the members of the meter-data-history object: the max demand of the last 13 months and the logs
+ *
+ * The logs are copied one batch at a time, the log mutexes are only held while copying a batch.
+ *
+ * @note The enclosing JSON object must be opened and closed by the caller
+ *
+ * @param[in] json The JSON writer, its error is set if a log mutex couldn't be taken in time
+ * @param[in] max_demand_year The max demand of the last 13 months
+ * @param[in] range The range of the logs to write, see get_meter_data_history_range()
+ * @param[in] batch Buffer for WEB_SERVER_HISTORY_BATCH_SIZE entries of either log
+ */
+static void write_meter_data_history(json_writer_t *json, const struct emucs_p1_max_demand_s *max_demand_year,
+                                     const meter_data_history_range_t *range, meter_data_history_batch_t *batch) {
+    SemaphoreHandle_t short_term_log_mutex = logger_get_short_term_log_mutex_handle();
+    SemaphoreHandle_t long_term_log_mutex = logger_get_long_term_log_mutex_handle();
+    uint32_t index;
+    size_t item_count;
+
+    // Add the max demand of the last 13 months
+    json_writer_begin_array(json, "maxDemandYear");
+    for (int i = 0; i < EMUCS_P1_MAX_DEMAND_YEAR_MONTHS; i++) {
+        if (max_demand_year[i].timestamp_appearance == 0) {
+            break;
+        }
+        json_writer_begin_object(json, NULL);
+        json_writer_add_int(json, "timestamp", max_demand_year[i].timestamp_appearance);
+        json_writer_add_fixed(json, "demand", max_demand_year[i].max_demand, EMUCS_P1_DECIMALS_POWER);
+        json_writer_end_object(json);
+    }
+    json_writer_end_array(json);
+
+    // Add the short term log data, one batch at a time
+    json_writer_begin_array(json, "shortTermHistory");
+    index = range->short_term_index;
+    while (index != range->short_term_end_index && json->out.err == ESP_OK) {
+        if (http_stats_take(short_term_log_mutex, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) != pdTRUE) {
+            ESP_LOGE(TAG, "Failed to get short term log mutex within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
+            json->out.err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        item_count = logger_read_short_term_log_items(&index, batch->short_term, MIN(WEB_SERVER_HISTORY_BATCH_SIZE, range->short_term_end_index - index));
+        xSemaphoreGive(short_term_log_mutex);
 
-    // Find the first entry that starts at the beginning of a quarter-hour, i.e. 00, 15, 30 or 45 minutes
-    // If no such entry is found, use the first entry available
-    uint16_t first_entry_index = 0;
-    for (size_t i = 0; i < item_count; i++) {
-        tm_ptr = localtime(&short_term_log_entry[i].timestamp);
-        if (tm_ptr->tm_min % 15 == 0 && tm_ptr->tm_sec == 0) {
-            first_entry_index = i;
+        if (item_count == 0) {
             break;
         }
+
+        for (size_t i = 0; i < item_count; i++) {
+            json_writer_begin_object(json, NULL);
+            json_writer_add_int(json, "timestamp", batch->short_term[i].timestamp);
+            json_writer_add_fixed(json, "avgDemand", batch->short_term[i].current_avg_demand, EMUCS_P1_DECIMALS_POWER);
+            json_writer_add_fixed(json, "powerUsage", batch->short_term[i].current_power_usage, EMUCS_P1_DECIMALS_POWER);
+            json_writer_end_object(json);
+        }
     }
-    ESP_LOGD(TAG, "first_entry_index = %d", first_entry_index);
+    json_writer_end_array(json);
+
+    // Add the long term log data, one batch at a time
+    json_writer_begin_array(json, "longTermHistory");
+    index = range->long_term_index;
+    while (index != range->long_term_end_index && json->out.err == ESP_OK) {
+        if (http_stats_take(long_term_log_mutex, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) != pdTRUE) {
+            ESP_LOGE(TAG, "Failed to get long term log mutex within %d ms", WEB_SERVER_MAX_TIMEOUT_MS);
+            json->out.err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        item_count = logger_read_long_term_log_items(&index, batch->long_term, MIN(WEB_SERVER_HISTORY_BATCH_SIZE, range->long_term_end_index - index));
+        xSemaphoreGive(long_term_log_mutex);
+
+        if (item_count == 0) {
+            break;
+        }
 
-    // Add the short term log data to the root JSON object (json_obj)
-    tmp_array = cJSON_CreateArray();
-    for (size_t i = first_entry_index; i < item_count; i++) {
-        tmp_obj = cJSON_CreateObject();
-        cJSON_AddNumberToObject(tmp_obj, "timestamp", (double) short_term_log_entry[i].timestamp);
-        cJSON_AddNumberToObject(tmp_obj, "avgDemand", short_term_log_entry[i].current_avg_demand);
-        cJSON_AddNumberToObject(tmp_obj, "powerUsage", short_term_log_entry[i].current_power_usage);
-        cJSON_AddItemToArray(tmp_array, tmp_obj);
+        for (size_t i = 0; i < item_count; i++) {
+            json_writer_begin_object(json, NULL);
+            json_writer_add_int(json, "timestamp", batch->long_term[i].timestamp);
+            json_writer_add_int(json, "electricityDeliveredTariff1", batch->long_term[i].electricity_delivered_tariff1);
+            json_writer_add_int(json, "electricityDeliveredTariff2", batch->long_term[i].electricity_delivered_tariff2);
+            json_writer_add_int(json, "electricityReturnedTariff1", batch->long_term[i].electricity_returned_tariff1);
+            json_writer_add_int(json, "electricityReturnedTariff2", batch->long_term[i].electricity_returned_tariff2);
+            json_writer_end_object(json);
+        }
     }
-    cJSON_AddItemToObject(json_obj, "shortTermHistory", tmp_array);
+    json_writer_end_array(json);
+}
 
-    free(short_term_log_entry);
+/**
+ * @brief Handler for the /api/batch endpoint
+ *
+ * Returns several resources in one response, so a page load needs a single request. The 'include' query parameter
+ * selects the resources, as a comma separated list of: version, system-info, meter-data and meter-data-history.
+ * Without it, all of them are returned. The 'fields' query parameter selects the meter data fields, as for
+ * /api/meter-data.
+ *
+ * The telegram and the predicted peak are copied once, and the history is cut off at the timestamp of that telegram,
+ * so all parts of the response describe the same telegram, whose sequence number is returned as telegramSequence.
+ * Before the first telegram, the history is empty.
+ *
+ * The range of the history is fixed under the log mutexes, but the entries are copied in batches while streaming, as
+ * for /api/meter-data-history, so the mutexes are never held while sending. Logged entries never change and entries
+ * logged later are outside the range, so the history matches a single atomic read, with one relaxation: the oldest
+ * entries of the range that the logs overwrite while the response is streamed are left out.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+static esp_err_t batch_get_handler(httpd_req_t *req) {
+    json_writer_t json;
+    char query[WEB_SERVER_MAX_QUERY_LEN];
+    char list[WEB_SERVER_MAX_QUERY_LEN];
+    uint32_t parts = BATCH_PARTS_ALL;
+    uint64_t field_mask = METER_DATA_FIELDS_BASIC;
+    meter_data_t *data = NULL;
+    meter_data_history_batch_t *batch = NULL;
+    meter_data_history_range_t range;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "include", list, sizeof(list)) == ESP_OK) {
+            if (parse_batch_parts(list, &parts) != ESP_OK || parts == 0) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid include");
+            }
+        }
+        if (httpd_query_key_value(query, "fields", list, sizeof(list)) == ESP_OK) {
+            if (meter_data_parse_field_mask(list, &field_mask) != ESP_OK || field_mask == 0) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid fields");
+            }
+        }
+    }
 
-    // Copy the long term log to a local buffer, sorted on entry timestamp
-    long_term_log_entry = malloc(LOGGER_LONG_TERM_LOG_BUF_SIZE * sizeof(log_entry_short_term_p1_data_t));
-    if (long_term_log_entry == NULL) {
-        // TODO: return 500 error instead?
-        ESP_LOGE(TAG, "Failed to allocate memory for log_entry");
-        vTaskDelete(NULL);
-        assert(0); // Should never get here
+    // Copy the telegram and the predicted peak once, every part of the response is based on this copy
+    if (parts & (BATCH_PART_BIT(BATCH_PART_METER_DATA) | BATCH_PART_BIT(BATCH_PART_METER_DATA_HISTORY))) {
+        data = request_arena_alloc(sizeof(*data));
+        if (data == NULL) {
+            return http_500_handler(req, "Out of memory");
+        }
+        if (meter_data_copy(data, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) != ESP_OK) {
+            return http_500_handler(req, "Meter data not available");
+        }
     }
 
-    xSemaphoreTake(long_term_log_mutex, portMAX_DELAY);
-    item_count = logger_get_long_term_log_items(long_term_log_entry, LOGGER_LONG_TERM_LOG_BUF_SIZE);
-    xSemaphoreGive(long_term_log_mutex);
+    // Fix the range of the logs, up to the copied telegram
+    if (parts & BATCH_PART_BIT(BATCH_PART_METER_DATA_HISTORY)) {
+        batch = request_arena_alloc(sizeof(*batch));
+        if (batch == NULL) {
+            return http_500_handler(req, "Out of memory");
+        }
+        if (data->p1.msg_timestamp == 0) {
+            // No telegram yet, a timestamp of 0 would select the newest entries instead
+            memset(&range, 0, sizeof(range));
+        } else if (get_meter_data_history_range(&range, data->p1.msg_timestamp) != ESP_OK) {
+            return http_500_handler(req, "Meter data history not available");
+        }
+    }
+
+    if (httpd_resp_set_hdr(req, "Cache-Control", "no-store") != ESP_OK
+        || begin_json_response(req, &json, true, NULL) != ESP_OK) {
+        return ESP_FAIL;
+    }
 
-    // Add the long term log data to the root JSON object (json_obj)
-    tmp_array = cJSON_CreateArray();
-    for (size_t i = 0; i < item_count; i++) {
-        tmp_obj = cJSON_CreateObject();
-        cJSON_AddNumberToObject(tmp_obj, "timestamp", (double) long_term_log_entry[i].timestamp);
-        cJSON_AddNumberToObject(tmp_obj, "electricityDeliveredTariff1", long_term_log_entry[i].electricity_delivered_tariff1);
-        cJSON_AddNumberToObject(tmp_obj, "electricityDeliveredTariff2", long_term_log_entry[i].electricity_delivered_tariff2);
-        cJSON_AddNumberToObject(tmp_obj, "electricityReturnedTariff1", long_term_log_entry[i].electricity_returned_tariff1);
-        cJSON_AddNumberToObject(tmp_obj, "electricityReturnedTariff2", long_term_log_entry[i].electricity_returned_tariff2);
-        cJSON_AddItemToArray(tmp_array, tmp_obj);
+    json_writer_begin_object(&json, NULL);
+    if (data != NULL) {
+        json_writer_add_int(&json, "telegramSequence", data->telegram_sequence);
     }
+    if (parts & BATCH_PART_BIT(BATCH_PART_VERSION)) {
+        json_writer_begin_object(&json, "version");
+        write_api_version(&json);
+        json_writer_end_object(&json);
+    }
+    if (parts & BATCH_PART_BIT(BATCH_PART_SYSTEM_INFO)) {
+        json_writer_begin_object(&json, "systemInfo");
+        write_system_info(&json);
+        json_writer_end_object(&json);
+    }
+    if (parts & BATCH_PART_BIT(BATCH_PART_METER_DATA)) {
+        json_writer_begin_object(&json, "meterData");
+        meter_data_write_json_fields(&json, data, field_mask);
+        json_writer_end_object(&json);
+    }
+    if (parts & BATCH_PART_BIT(BATCH_PART_METER_DATA_HISTORY)) {
+        json_writer_begin_object(&json, "meterDataHistory");
+        write_meter_data_history(&json, data->p1.max_demand_year, &range, batch);
+        json_writer_end_object(&json);
+    }
+    json_writer_end_object(&json);
 
-    cJSON_AddItemToObject(json_obj, "longTermHistory", tmp_array);
+    return json_writer_finish(&json);
+}
 
-    free(long_term_log_entry);
+/**
+ * @brief Parse a comma separated list of batch part names into a mask
+ *
+ * @param[in] list The list of part names, e.g. "version,meter-data"
+ * @param[out] parts The mask with a bit set for every part in the list (see BATCH_PART_BIT)
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the list contains an unknown part name
+ */
+static esp_err_t parse_batch_parts(const char *list, uint32_t *parts) {
+    const char *name = list;
+    const char *end;
+    size_t len;
+    batch_part_t part;
+
+    *parts = 0;
+    while (*name != '\0') {
+        end = strchr(name, ',');
+        len = end != NULL ? (size_t)(end - name) : strlen(name);
+
+        // Find the part with this name, empty names are ignored
+        if (len > 0) {
+            for (part = 0; part < BATCH_PART_COUNT; part++) {
+                if (strncmp(batch_part_names[part], name, len) == 0 && batch_part_names[part][len] == '\0') {
+                    break;
+                }
+            }
+            if (part == BATCH_PART_COUNT) {
+                ESP_LOGD(TAG, "Unknown batch part: %.*s", len, name);
+                return ESP_ERR_NOT_FOUND;
+            }
+            *parts |= BATCH_PART_BIT(part);
+        }
 
-    // Send the JSON object
-    err = send_json_response(req, json_obj, 200);
+        name += len;
+        if (*name == ',') {
+            name++;
+        }
+    }
 
-    // Free resources
-    cJSON_Delete(json_obj);
+    return ESP_OK;
+}
 
-    return err;
-}
\ No newline at end of file
+/**
+ * @brief Handler for incremental and downsampled queries on the meter-data-history
+ *
+ * Returns the points of the logs starting at 'cursor' (a token returned by an earlier query) or at the timestamp
+ * 'since'. The width of a point is given by 'resolution' (seconds) or derived from the target number of 'points';
+ * 'limit' caps the number of points. The response contains the cursor at which the next query continues, so a client
+ * that keeps polling with that cursor only receives the points it doesn't have yet. See history.c for the details.
+ *
+ * @param[in] req The request handle
+ * @param[in] query The query string of the request
+ * @return ESP_OK on success
+ */
+static esp_err_t meter_data_history_query_handler(httpd_req_t *req, const char *query) {
+    history_query_t history_query = {
+            .log = HISTORY_LOG_SHORT_TERM,
+            .index = 0,
+            .limit = HISTORY_MAX_LIMIT,
+            .resolution = 0
+    };
+    json_writer_t json;
+    uint32_t since = 0;
+    uint32_t points = 0;
+    uint32_t next_index;
+    char cursor[HISTORY_CURSOR_MAX_LEN];
+    esp_err_t err;
+
+    if (get_query_uint(query, "limit", &history_query.limit) == ESP_ERR_INVALID_ARG
+        || history_query.limit == 0 || history_query.limit > HISTORY_MAX_LIMIT) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid limit");
+    }
+
+    // Continue an earlier query, or start a new one
+    err = httpd_query_key_value(query, "cursor", cursor, sizeof(cursor));
+    if (err == ESP_OK) {
+        if (history_parse_cursor(cursor, &history_query) != ESP_OK) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid cursor");
+        }
+    }
+    else if (err == ESP_ERR_HTTPD_RESULT_TRUNC) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid cursor");
+    }
+    else {
+        if (get_query_uint(query, "resolution", &history_query.resolution) == ESP_ERR_INVALID_ARG
+            || history_query.resolution > HISTORY_MAX_RESOLUTION_S) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid resolution");
+        }
+        if (get_query_uint(query, "points", &points) == ESP_ERR_INVALID_ARG || points > HISTORY_MAX_LIMIT) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid points");
+        }
+        if (get_query_uint(query, "since", &since) == ESP_ERR_INVALID_ARG) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid since");
+        }
+        if (history_prepare_query(&history_query, since, points) != ESP_OK) {
+            return http_500_handler(req, "Failed to get log mutex");
+        }
+    }
+
+    if (httpd_resp_set_hdr(req, "Cache-Control", HTTP_CACHE_CONTROL_REVALIDATE) != ESP_OK
+        || begin_json_response(req, &json, true, NULL) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    json_writer_begin_object(&json, NULL);
+    json_writer_add_string(&json, "log", history_query.log == HISTORY_LOG_LONG_TERM ? "longTerm" : "shortTerm");
+    json_writer_add_int(&json, "resolution", history_query.resolution);
+    json_writer_begin_array(&json, "points");
+    if (history_write_points(&json, &history_query, &next_index) != ESP_OK) {
+        json.out.err = ESP_FAIL;
+        return json_writer_finish(&json);
+    }
+    json_writer_end_array(&json);
+
+    // The cursor is an opaque token for the client
+    history_format_cursor(&history_query, next_index, cursor, sizeof(cursor));
+    json_writer_add_string(&json, "next", cursor);
+    json_writer_end_object(&json);
+
+    return json_writer_finish(&json);
+}
@@ -0,0 +1,380 @@
+/**
+ * @file ws_telemetry.c
+ * @brief WebSocket channel sending the meter data as binary frames
+ *
+ * When a client connects, it first receives the schema descriptor as a text message (see telemetry_frame.h).
+ * After that, a binary frame is sent every time a new telegram or prediction is available.
+ *
+ * A frame is encoded once and the same buffer is queued for all clients. The frames are sent from the httpd task, where
+ * a send to a client that doesn't read blocks every other request until the send timeout. So a frame is only queued
+ * when the socket of the client can take it and the previous frame is sent, otherwise it is dropped for that client.
+ * A client that can't take WS_TELEMETRY_MAX_STALLED_FRAMES frames in a row is closed.
+ *
+ * When all client slots are in use, a new client is refused with 503 Service Unavailable before the handshake.
+ */
+
+#include <string.h>
+#include <sys/select.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "emucs_p1.h"
+#include "predict_peak.h"
+#include "meter_data.h"
+#include "shared_buffer.h"
+#include "telemetry_frame.h"
+#include "web_server.h"
+#include "ws_telemetry.h"
+
+typedef struct ws_telemetry_client_s ws_telemetry_client_t;
+
+typedef struct {
+    ws_telemetry_client_t *client;  // Client the frame is queued for, NULL if the slot is free
+    uint32_t generation;            // Generation of the client when the frame was queued
+    shared_buffer_t *frame;         // The queued frame
+} ws_telemetry_send_slot_t;
+
+struct ws_telemetry_client_s {
+    bool in_use;                    // Slot is used by a connected client
+    int fd;                         // Socket of the client
+    uint32_t generation;            // Incremented every time the slot is reused
+    uint32_t frames_sent;           // Number of frames sent
+    uint32_t frames_dropped;        // Number of frames dropped because the client couldn't take them
+    uint32_t stalled_count;         // Number of frames dropped in a row because the socket couldn't take them
+    ws_telemetry_send_slot_t send_slots[WS_TELEMETRY_MAX_QUEUED_FRAMES];
+};
+
+static const char *TAG = "ws_telemetry";                            // Tag used for logging
+static httpd_handle_t server_handle;                                // The httpd server the clients are connected to
+static SemaphoreHandle_t clients_mutex;                             // Mutex protecting the clients array
+static ws_telemetry_client_t clients[WS_TELEMETRY_MAX_CLIENTS];     // Connected clients
+
+// Function prototypes
+_Noreturn static void ws_telemetry_task(void *pvParameters);
+static void queue_frame(ws_telemetry_client_t *client, shared_buffer_t *frame, httpd_ws_type_t type);
+static void frame_sent(esp_err_t err, int socket, void *arg);
+static bool is_writable(int fd);
+static esp_err_t send_descriptor(httpd_req_t *req);
+static void client_session_closed(void *ctx);
+
+
+/**
+ * @brief Initialize the WebSocket channel and start the WebSocket telemetry task
+ *
+ * @param[in] server The httpd server the WebSocket endpoint is registered on
+ * @return ESP_OK on success
+ */
+esp_err_t ws_telemetry_init(httpd_handle_t server) {
+    server_handle = server;
+
+    if (telemetry_frame_init() != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    clients_mutex = xSemaphoreCreateMutex();
+    if (clients_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create clients mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(ws_telemetry_task, "ws_telemetry_task", WS_TELEMETRY_TASK_STACK_SIZE, NULL, WS_TELEMETRY_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create WebSocket telemetry task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Called by httpd before the WebSocket handshake, refuses the client if all client slots are in use
+ *
+ * Clients are only registered and removed in the httpd task, so a slot is still free when the handshake completes.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK to continue with the handshake, ESP_FAIL if the client is refused
+ */
+esp_err_t ws_telemetry_pre_handshake(httpd_req_t *req) {
+    bool full = true;
+
+    xSemaphoreTake(clients_mutex, portMAX_DELAY);
+    for (size_t i = 0; i < WS_TELEMETRY_MAX_CLIENTS; i++) {
+        if (!clients[i].in_use) {
+            full = false;
+            break;
+        }
+    }
+    xSemaphoreGive(clients_mutex);
+
+    if (full) {
+        ESP_LOGW(TAG, "Max number of WebSocket clients reached");
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", WS_TELEMETRY_RETRY_AFTER_S);
+        httpd_resp_sendstr(req, "Max number of WebSocket clients reached");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler for the WebSocket endpoint
+ *
+ * Called once after the handshake (method HTTP_GET) and for every message received from the client.
+ * After the handshake, the client is registered and the schema descriptor is sent.
+ * A client can request the schema descriptor again by sending WS_TELEMETRY_SCHEMA_REQUEST, other messages are ignored.
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+esp_err_t ws_telemetry_handler(httpd_req_t *req) {
+    uint8_t payload[WS_TELEMETRY_MAX_RX_FRAME_LEN];
+    httpd_ws_frame_t ws_frame = {0};
+    ws_telemetry_client_t *client = NULL;
+
+    if (req->method == HTTP_GET) {
+        xSemaphoreTake(clients_mutex, portMAX_DELAY);
+
+        // Find a free slot
+        for (size_t i = 0; i < WS_TELEMETRY_MAX_CLIENTS; i++) {
+            if (!clients[i].in_use) {
+                client = &clients[i];
+                break;
+            }
+        }
+        if (client == NULL) {
+            xSemaphoreGive(clients_mutex);
+            ESP_LOGW(TAG, "Max number of WebSocket clients reached");
+            return ESP_FAIL;
+        }
+
+        // Register the client, it is removed when the session is closed
+        client->in_use = true;
+        client->fd = httpd_req_to_sockfd(req);
+        client->generation++;
+        client->frames_sent = 0;
+        client->frames_dropped = 0;
+        client->stalled_count = 0;
+        req->sess_ctx = client;
+        req->free_ctx = client_session_closed;
+
+        xSemaphoreGive(clients_mutex);
+
+        ESP_LOGI(TAG, "WebSocket client connected (socket %d)", client->fd);
+
+        return send_descriptor(req);
+    }
+
+    // Get the length of the message
+    if (httpd_ws_recv_frame(req, &ws_frame, 0) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (ws_frame.len > sizeof(payload)) {
+        ESP_LOGW(TAG, "Message from WebSocket client too long (%d bytes)", ws_frame.len);
+        return ESP_FAIL;
+    }
+
+    // Receive the message
+    ws_frame.payload = payload;
+    if (ws_frame.len > 0 && httpd_ws_recv_frame(req, &ws_frame, ws_frame.len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    if (ws_frame.type == HTTPD_WS_TYPE_TEXT
+        && ws_frame.len == sizeof(WS_TELEMETRY_SCHEMA_REQUEST) - 1
+        && memcmp(payload, WS_TELEMETRY_SCHEMA_REQUEST, ws_frame.len) == 0) {
+        return send_descriptor(req);
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief WebSocket telemetry task
+ *
+ * Waits for new telegrams and predictions, encodes them and queues the frame for all clients.
+ *
+ * @param pvParameters
+ */
+_Noreturn static void ws_telemetry_task(void *pvParameters) {
+    EventGroupHandle_t event_group = emucs_p1_get_event_group_handle();
+    shared_buffer_t *frame;
+    meter_data_t data;
+
+    for (;;) {
+        xEventGroupWaitBits(event_group,
+                            EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_WS_BIT | PREDICT_PEAK_EVENT_AVAILABLE_WS_BIT,
+                            pdTRUE, pdFALSE, portMAX_DELAY);
+
+        if (meter_data_copy(&data, pdMS_TO_TICKS(WEB_SERVER_MAX_TIMEOUT_MS)) != ESP_OK) {
+            continue;
+        }
+
+        frame = telemetry_frame_encode_shared(&data);
+        if (frame == NULL) {
+            continue;
+        }
+
+        xSemaphoreTake(clients_mutex, portMAX_DELAY);
+        for (size_t i = 0; i < WS_TELEMETRY_MAX_CLIENTS; i++) {
+            if (clients[i].in_use) {
+                queue_frame(&clients[i], frame, HTTPD_WS_TYPE_BINARY);
+            }
+        }
+        xSemaphoreGive(clients_mutex);
+
+        // The queued sends hold their own references
+        shared_buffer_release(frame);
+    }
+}
+
+/**
+ * @brief Queue a frame for sending to a client
+ *
+ * The frame is dropped if the previous frame of the client isn't sent yet or its socket can't take more data, so the
+ * send in the httpd task doesn't block.
+ *
+ * @note The clients mutex must be taken before calling this function
+ *
+ * @param[in] client The client
+ * @param[in] frame The frame, the queued send acquires its own reference
+ * @param[in] type The WebSocket message type
+ */
+static void queue_frame(ws_telemetry_client_t *client, shared_buffer_t *frame, httpd_ws_type_t type) {
+    ws_telemetry_send_slot_t *slot = NULL;
+    httpd_ws_frame_t ws_frame = {
+            .final = true,
+            .fragmented = false,
+            .type = type,
+            .payload = (uint8_t *)frame->data,
+            .len = frame->len
+    };
+
+    // Find a free send slot
+    for (size_t i = 0; i < WS_TELEMETRY_MAX_QUEUED_FRAMES; i++) {
+        if (client->send_slots[i].client == NULL) {
+            slot = &client->send_slots[i];
+            break;
+        }
+    }
+    if (slot == NULL || !is_writable(client->fd)) {
+        client->frames_dropped++;
+        if (slot != NULL && ++client->stalled_count == WS_TELEMETRY_MAX_STALLED_FRAMES) {
+            ESP_LOGI(TAG, "WebSocket client stalled (socket %d), closing", client->fd);
+            httpd_sess_trigger_close(server_handle, client->fd);
+        }
+        return;
+    }
+    client->stalled_count = 0;
+
+    slot->client = client;
+    slot->generation = client->generation;
+    slot->frame = shared_buffer_acquire(frame);
+
+    // The frame is sent from the httpd task, the buffer stays valid until frame_sent() releases it
+    if (httpd_ws_send_data_async(server_handle, client->fd, &ws_frame, frame_sent, slot) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to queue frame for WebSocket client (socket %d)", client->fd);
+        shared_buffer_release(slot->frame);
+        slot->frame = NULL;
+        slot->client = NULL;
+        client->frames_dropped++;
+        return;
+    }
+}
+
+/**
+ * @brief Called by httpd when a queued frame is sent
+ *
+ * @param[in] err The result of sending the frame
+ * @param[in] socket The socket the frame was sent to
+ * @param[in] arg The send slot of the frame
+ */
+static void frame_sent(esp_err_t err, int socket, void *arg) {
+    ws_telemetry_send_slot_t *slot = (ws_telemetry_send_slot_t *)arg;
+    ws_telemetry_client_t *client;
+
+    xSemaphoreTake(clients_mutex, portMAX_DELAY);
+
+    client = slot->client;
+    shared_buffer_release(slot->frame);
+    slot->frame = NULL;
+    slot->client = NULL;
+
+    // Skip the accounting if the client disconnected and the slot was reused in the meantime
+    if (client != NULL && client->generation == slot->generation) {
+        if (err == ESP_OK) {
+            client->frames_sent++;
+        } else if (client->in_use) {
+            ESP_LOGI(TAG, "Failed to send to WebSocket client (socket %d), closing", socket);
+            httpd_sess_trigger_close(server_handle, socket);
+        }
+    }
+
+    xSemaphoreGive(clients_mutex);
+}
+
+/**
+ * @brief Check if a socket can take more data without blocking
+ *
+ * @param[in] fd The socket
+ * @return True if the socket is writable
+ */
+static bool is_writable(int fd) {
+    struct timeval timeout = {0};
+    fd_set write_fds;
+
+    FD_ZERO(&write_fds);
+    FD_SET(fd, &write_fds);
+
+    return select(fd + 1, NULL, &write_fds, NULL, &timeout) > 0;
+}
+
+/**
+ * @brief Send the schema descriptor to a client
+ *
+ * @param[in] req The request handle
+ * @return ESP_OK on success
+ */
+static esp_err_t send_descriptor(httpd_req_t *req) {
+    shared_buffer_t *descriptor = telemetry_frame_get_descriptor();
+    esp_err_t ret;
+
+    if (descriptor == NULL) {
+        return ESP_FAIL;
+    }
+
+    httpd_ws_frame_t ws_frame = {
+            .final = true,
+            .fragmented = false,
+            .type = HTTPD_WS_TYPE_TEXT,
+            .payload = (uint8_t *)descriptor->data,
+            .len = descriptor->len
+    };
+    ret = httpd_ws_send_frame(req, &ws_frame);
+
+    shared_buffer_release(descriptor);
+
+    return ret;
+}
+
+/**
+ * @brief Called by httpd when the session of a client is closed
+ *
+ * Frames that are still queued for the client are released by frame_sent().
+ *
+ * @param[in] ctx The client
+ */
+static void client_session_closed(void *ctx) {
+    ws_telemetry_client_t *client = (ws_telemetry_client_t *)ctx;
+
+    xSemaphoreTake(clients_mutex, portMAX_DELAY);
+
+    ESP_LOGI(TAG, "WebSocket client disconnected (socket %d, %lu frames sent, %lu dropped)",
+             client->fd, client->frames_sent, client->frames_dropped);
+
+    client->in_use = false;
+    client->fd = -1;
+
+    xSemaphoreGive(clients_mutex);
+}
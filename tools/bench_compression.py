@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+"""Compare the size and transfer time of the history responses with and without gzip compression.
+
+The device logs the CPU time spent compressing each response at debug level ("gzip_writer: Compressed ...").
+To compare compression levels, build the firmware with different values of GZIP_WRITER_LEVEL
+(main/include/gzip_writer.h) and run this script against each build.
+
+Usage: bench_compression.py <device address> [--runs <n>]
+"""
+
+import argparse
+import http.client
+import time
+
+PATHS = [
+    "/api/meter-data-history",
+    "/api/meter-data-history?since=0",
+    "/api/meter-data-history?since=0&points=96",
+]
+
+
+def fetch(host, path, encoding):
+    connection = http.client.HTTPConnection(host, timeout=30)
+    headers = {"Accept-Encoding": encoding} if encoding else {}
+    start = time.monotonic()
+    connection.request("GET", path, headers=headers)
+    response = connection.getresponse()
+    body = response.read()
+    elapsed = time.monotonic() - start
+    connection.close()
+    if response.status != 200:
+        raise RuntimeError("%s returned %d" % (path, response.status))
+    return len(body), elapsed, response.getheader("Content-Encoding", "identity")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the response compression of the history endpoint")
+    parser.add_argument("host", help="address of the device, e.g. kwartiwi.local")
+    parser.add_argument("--runs", type=int, default=5, help="number of requests per measurement")
+    args = parser.parse_args()
+
+    print("%-45s %-9s %10s %10s" % ("path", "encoding", "bytes", "ms"))
+    for path in PATHS:
+        for encoding in (None, "gzip"):
+            results = [fetch(args.host, path, encoding) for _ in range(args.runs)]
+            size = results[-1][0]
+            elapsed = sum(result[1] for result in results) / len(results)
+            print("%-45s %-9s %10d %10.1f" % (path, results[-1][2], size, elapsed * 1000))
+
+
+if __name__ == "__main__":
+    main()
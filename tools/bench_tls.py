@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Measure the TLS handshake latency of the HTTPS listener, with and without session resumption.
+
+Three cases are measured:
+  - full: a new connection without a session, the device does the complete ECDHE/ECDSA handshake
+  - resumed: a new connection that presents the session ticket of an earlier connection
+  - keep-alive: a request on a connection that is already open, as a polling client does
+
+The certificate is self-signed, so it isn't verified unless --cafile is given (e.g. certs/servercert.pem).
+
+Usage: bench_tls.py <device address> [--port <port>] [--runs <n>] [--path <path>] [--cafile <file>]
+"""
+
+import argparse
+import socket
+import ssl
+import statistics
+import time
+
+
+def make_context(cafile):
+    context = ssl.create_default_context(cafile=cafile)
+    if cafile is None:
+        context.check_hostname = False
+        context.verify_mode = ssl.CERT_NONE
+    return context
+
+
+def request(tls, host, path):
+    """Send a keep-alive GET request and read the response, returns the status code."""
+    tls.sendall(("GET %s HTTP/1.1\r\nHost: %s\r\n\r\n" % (path, host)).encode())
+    data = b""
+    while b"\r\n\r\n" not in data:
+        chunk = tls.recv(4096)
+        if not chunk:
+            raise RuntimeError("Connection closed")
+        data += chunk
+    header, body = data.split(b"\r\n\r\n", 1)
+    lines = header.decode("latin-1").split("\r\n")
+    headers = {name.strip().lower(): value.strip() for name, value in (line.split(":", 1) for line in lines[1:])}
+    if "content-length" in headers:
+        remaining = int(headers["content-length"]) - len(body)
+        while remaining > 0:
+            chunk = tls.recv(min(remaining, 4096))
+            if not chunk:
+                raise RuntimeError("Connection closed")
+            remaining -= len(chunk)
+    elif headers.get("transfer-encoding") == "chunked":
+        while not body.endswith(b"0\r\n\r\n"):
+            chunk = tls.recv(4096)
+            if not chunk:
+                raise RuntimeError("Connection closed")
+            body += chunk
+    return int(lines[0].split()[1])
+
+
+def connect(host, port, context, path, session=None):
+    """Open a connection and do one request, returns (handshake time, session, session reused, connection)."""
+    sock = socket.create_connection((host, port), timeout=30)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    start = time.monotonic()
+    tls = context.wrap_socket(sock, server_hostname=host, session=session)
+    handshake = time.monotonic() - start
+    # With TLS 1.3 the ticket arrives after the handshake, so the session is only complete after a response
+    request(tls, host, path)
+    return handshake, tls.session, tls.session_reused, tls
+
+
+def summary(name, times, note=""):
+    print("%-12s %8.1f %8.1f %8.1f  %s" % (name, min(times) * 1000, statistics.median(times) * 1000,
+                                           max(times) * 1000, note))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the TLS handshakes of the HTTPS listener")
+    parser.add_argument("host", help="address of the device, e.g. kwartiwi.local")
+    parser.add_argument("--port", type=int, default=443, help="port of the HTTPS listener")
+    parser.add_argument("--runs", type=int, default=10, help="number of connections per measurement")
+    parser.add_argument("--path", default="/api/version", help="path requested on every connection")
+    parser.add_argument("--cafile", help="certificate to verify the device with")
+    args = parser.parse_args()
+    context = make_context(args.cafile)
+
+    full = []
+    for _ in range(args.runs):
+        handshake, session, _, tls = connect(args.host, args.port, context, args.path)
+        tls.close()
+        full.append(handshake)
+
+    resumed = []
+    reused = 0
+    for _ in range(args.runs):
+        handshake, session, session_reused, tls = connect(args.host, args.port, context, args.path, session)
+        tls.close()
+        resumed.append(handshake)
+        reused += session_reused
+
+    keep_alive = []
+    _, _, _, tls = connect(args.host, args.port, context, args.path)
+    for _ in range(args.runs):
+        start = time.monotonic()
+        request(tls, args.host, args.path)
+        keep_alive.append(time.monotonic() - start)
+    version = tls.version()
+    cipher = tls.cipher()[0]
+    tls.close()
+
+    print("%s, %s" % (version, cipher))
+    print("%-12s %8s %8s %8s" % ("", "min ms", "med ms", "max ms"))
+    summary("full", full, "handshake")
+    summary("resumed", resumed, "handshake, %d/%d sessions reused" % (reused, args.runs))
+    summary("keep-alive", keep_alive, "request on an open connection")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Generate the self-signed ECDSA P-256 certificate and key of the HTTPS listener.
+
+The files are written to <output dir>/servercert.pem and <output dir>/prvtkey.pem and embedded in the firmware when
+CONFIG_WEB_SERVER_HTTPS is enabled. Existing files are never overwritten, so clients only need to trust the certificate
+once. Delete them to generate a new pair.
+
+P-256 keeps the TLS handshake on the device a lot faster than an RSA key of comparable strength.
+
+Usage: gen_https_cert.py <output dir> [--hostname <name>]... [--days <n>]
+"""
+
+import argparse
+import datetime
+import ipaddress
+import os
+import sys
+
+from cryptography import x509
+from cryptography.hazmat.primitives import hashes, serialization
+from cryptography.hazmat.primitives.asymmetric import ec
+from cryptography.x509.oid import NameOID
+
+CERT_FILE = "servercert.pem"
+KEY_FILE = "prvtkey.pem"
+
+
+def subject_alt_name(hostnames):
+    names = []
+    for hostname in hostnames:
+        try:
+            names.append(x509.IPAddress(ipaddress.ip_address(hostname)))
+        except ValueError:
+            names.append(x509.DNSName(hostname))
+    return x509.SubjectAlternativeName(names)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the certificate of the HTTPS listener")
+    parser.add_argument("output", help="directory to write the certificate and key to")
+    parser.add_argument("--hostname", action="append", help="name or address of the device, can be repeated "
+                                                            "(default: kwartiwi.local)")
+    parser.add_argument("--days", type=int, default=3650, help="validity of the certificate")
+    args = parser.parse_args()
+    hostnames = args.hostname or ["kwartiwi.local"]
+
+    cert_path = os.path.join(args.output, CERT_FILE)
+    key_path = os.path.join(args.output, KEY_FILE)
+    if os.path.exists(cert_path) and os.path.exists(key_path):
+        print("%s and %s already exist" % (cert_path, key_path))
+        return 0
+
+    key = ec.generate_private_key(ec.SECP256R1())
+    name = x509.Name([x509.NameAttribute(NameOID.COMMON_NAME, hostnames[0])])
+    now = datetime.datetime.now(datetime.timezone.utc)
+    cert = (x509.CertificateBuilder()
+            .subject_name(name)
+            .issuer_name(name)
+            .public_key(key.public_key())
+            .serial_number(x509.random_serial_number())
+            .not_valid_before(now - datetime.timedelta(days=1))
+            .not_valid_after(now + datetime.timedelta(days=args.days))
+            .add_extension(subject_alt_name(hostnames), critical=False)
+            .add_extension(x509.BasicConstraints(ca=False, path_length=None), critical=True)
+            .sign(key, hashes.SHA256()))
+
+    os.makedirs(args.output, exist_ok=True)
+    with open(key_path, "wb") as f:
+        f.write(key.private_bytes(serialization.Encoding.PEM, serialization.PrivateFormat.PKCS8,
+                                  serialization.NoEncryption()))
+    with open(cert_path, "wb") as f:
+        f.write(cert.public_bytes(serialization.Encoding.PEM))
+    print("Generated %s and %s for %s" % (cert_path, key_path, ", ".join(hostnames)))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+"""Load test the web server with concurrent polling clients, like dashboards that keep a connection open.
+
+Every client opens a keep-alive connection and requests the path at a fixed interval. When the device closes the
+connection (because the session pool is full or the session was idle), the client reconnects, which is counted. At the
+end the connection counters of the device (/api/system/connections) are printed.
+
+With --long-polls, that many extra clients keep a long-poll request (/api/meter-data?after=<seq>) parked on the
+device while the polling clients fill the session pool. A parked request must never be closed or answered with
+another client's response, so every long-poll response is checked to be the meter data of a newer telegram (or 204
+No Content on timeout), and connections closed while a request was parked are counted.
+
+Usage: load_test.py <device address> [--port <port>] [--clients <n>] [--duration <s>] [--interval <s>] [--path <path>]
+                    [--long-polls <n>]
+"""
+
+import argparse
+import http.client
+import json
+import statistics
+import threading
+import time
+
+
+class Client(threading.Thread):
+    def __init__(self, host, port, path, interval, stop):
+        super().__init__(daemon=True)
+        self.host = host
+        self.port = port
+        self.path = path
+        self.interval = interval
+        self.stop = stop
+        self.latencies = []
+        self.errors = 0
+        self.connects = 0
+
+    def run(self):
+        conn = None
+        while not self.stop.is_set():
+            if conn is None:
+                conn = http.client.HTTPConnection(self.host, self.port, timeout=10)
+                self.connects += 1
+            start = time.monotonic()
+            try:
+                conn.request("GET", self.path)
+                response = conn.getresponse()
+                response.read()
+                if response.status != 200:
+                    self.errors += 1
+                else:
+                    self.latencies.append(time.monotonic() - start)
+                if response.will_close:
+                    conn.close()
+                    conn = None
+            except (OSError, http.client.HTTPException):
+                self.errors += 1
+                conn.close()
+                conn = None
+            self.stop.wait(self.interval)
+        if conn is not None:
+            conn.close()
+
+
+class LongPollClient(threading.Thread):
+    def __init__(self, host, port, timeout, stop):
+        super().__init__(daemon=True)
+        self.host = host
+        self.port = port
+        self.timeout = timeout
+        self.stop = stop
+        self.answers = 0
+        self.timeouts = 0
+        self.closed = 0
+        self.wrong = 0
+
+    def run(self):
+        conn = None
+        after = 0
+        while not self.stop.is_set():
+            if conn is None:
+                conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout + 10)
+            try:
+                conn.request("GET", "/api/meter-data?after=%d&timeout=%d" % (after, self.timeout))
+                response = conn.getresponse()
+                body = response.read()
+            except (OSError, http.client.HTTPException):
+                # Closed by the device while the request was parked
+                self.closed += 1
+                conn.close()
+                conn = None
+                continue
+            if response.status == 204:
+                self.timeouts += 1
+            elif response.status == 200:
+                try:
+                    sequence = json.loads(body)["telegramSequence"]
+                except (ValueError, KeyError):
+                    sequence = None
+                if sequence is None or (after != 0 and sequence <= after):
+                    self.wrong += 1
+                else:
+                    self.answers += 1
+                    after = sequence
+            else:
+                self.wrong += 1
+            if response.will_close:
+                conn.close()
+                conn = None
+        if conn is not None:
+            conn.close()
+
+
+def percentile(values, p):
+    return sorted(values)[min(len(values) - 1, int(len(values) * p))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Load test the web server with concurrent polling clients")
+    parser.add_argument("host", help="address of the device, e.g. kwartiwi.local")
+    parser.add_argument("--port", type=int, default=80, help="port of the web server")
+    parser.add_argument("--clients", type=int, default=12, help="number of concurrent clients")
+    parser.add_argument("--duration", type=float, default=60, help="duration of the test in seconds")
+    parser.add_argument("--interval", type=float, default=1, help="time between the requests of a client in seconds")
+    parser.add_argument("--path", default="/api/meter-data", help="path requested by the clients")
+    parser.add_argument("--long-polls", type=int, default=0, help="number of clients that keep a long-poll parked")
+    parser.add_argument("--long-poll-timeout", type=int, default=30, help="timeout of the long-poll requests in s")
+    args = parser.parse_args()
+
+    stop = threading.Event()
+    long_polls = [LongPollClient(args.host, args.port, args.long_poll_timeout, stop) for _ in range(args.long_polls)]
+    for client in long_polls:
+        client.start()
+    # Let the long-polls park before the pool fills up
+    time.sleep(1 if long_polls else 0)
+    clients = [Client(args.host, args.port, args.path, args.interval, stop) for _ in range(args.clients)]
+    for client in clients:
+        client.start()
+    time.sleep(args.duration)
+    stop.set()
+    for client in clients:
+        client.join()
+
+    latencies = [latency for client in clients for latency in client.latencies]
+    print("%d clients, %d requests, %d errors, %d connects" % (
+        args.clients, len(latencies), sum(client.errors for client in clients),
+        sum(client.connects for client in clients)))
+    if latencies:
+        print("latency ms: median %.1f, p95 %.1f, max %.1f" % (
+            statistics.median(latencies) * 1000, percentile(latencies, 0.95) * 1000, max(latencies) * 1000))
+    if long_polls:
+        print("%d long-polls: %d answered, %d timed out, %d closed while parked, %d wrong responses" % (
+            len(long_polls), sum(client.answers for client in long_polls), sum(client.timeouts for client in long_polls),
+            sum(client.closed for client in long_polls), sum(client.wrong for client in long_polls)))
+
+    conn = http.client.HTTPConnection(args.host, args.port, timeout=10)
+    conn.request("GET", "/api/system/connections")
+    print("device: %s" % json.dumps(json.loads(conn.getresponse().read())))
+    conn.close()
+
+
+if __name__ == "__main__":
+    main()
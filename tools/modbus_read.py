@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Read the meter registers from the Modbus TCP server and print the decoded values.
+
+The register map is described in main/include/modbus_tcp.h. All registers are read with one request (input registers,
+or holding registers with --holding), repeated at an interval when --interval is given. The round-trip time of every
+request is printed, and whether the telegram sequence advanced.
+
+Usage: modbus_read.py <device address> [--port <port>] [--unit <id>] [--holding] [--interval <s>] [--count <n>]
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+REGISTER_COUNT = 54
+
+# (address, type, unit, name), see main/include/modbus_tcp.h
+REGISTERS = [
+    (0, "uint32", "", "telegramSequence"),
+    (2, "uint32", "s", "timestamp"),
+    (4, "float32", "A", "currentL1"),
+    (6, "float32", "A", "currentL2"),
+    (8, "float32", "A", "currentL3"),
+    (10, "float32", "V", "voltageL1"),
+    (12, "float32", "V", "voltageL2"),
+    (14, "float32", "V", "voltageL3"),
+    (16, "float32", "kW", "currentPowerUsage"),
+    (18, "float32", "kW", "currentPowerReturn"),
+    (20, "float32", "kW", "currentPowerUsageL1"),
+    (22, "float32", "kW", "currentPowerUsageL2"),
+    (24, "float32", "kW", "currentPowerUsageL3"),
+    (26, "float32", "kW", "currentPowerReturnL1"),
+    (28, "float32", "kW", "currentPowerReturnL2"),
+    (30, "float32", "kW", "currentPowerReturnL3"),
+    (32, "float32", "kW", "currentAvgDemand"),
+    (34, "float32", "kW", "predictedPeak"),
+    (36, "uint32", "s", "predictedPeakTime"),
+    (38, "float32", "kW", "maxDemandMonth"),
+    (40, "float32", "kWh", "electricityDeliveredTariff1"),
+    (42, "float32", "kWh", "electricityDeliveredTariff2"),
+    (44, "float32", "kWh", "electricityReturnedTariff1"),
+    (46, "float32", "kWh", "electricityReturnedTariff2"),
+    (48, "uint16", "", "tariffIndicator"),
+    (49, "uint16", "", "breakerState"),
+    (50, "float32", "kW", "limiterThreshold"),
+    (52, "float32", "A", "fuseSupervisionThreshold"),
+]
+FORMATS = {"uint16": ">H", "uint32": ">I", "float32": ">f"}
+
+
+def recv_exact(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("connection closed by the device")
+        data += chunk
+    return data
+
+
+def read_registers(sock, transaction, unit, function, address, count):
+    sock.sendall(struct.pack(">HHHBBHH", transaction, 0, 6, unit, function, address, count))
+    header = recv_exact(sock, 7)
+    response_transaction, protocol, length, _ = struct.unpack(">HHHB", header)
+    pdu = recv_exact(sock, length - 1)
+    if response_transaction != transaction or protocol != 0:
+        raise ValueError("unexpected response header")
+    if pdu[0] & 0x80:
+        raise ValueError("exception %d" % pdu[1])
+    return pdu[2:2 + pdu[1]]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read the meter registers from the Modbus TCP server")
+    parser.add_argument("host", help="address of the device")
+    parser.add_argument("--port", type=int, default=502, help="port (CONFIG_MODBUS_TCP_PORT)")
+    parser.add_argument("--unit", type=int, default=1, help="unit identifier (ignored by the device)")
+    parser.add_argument("--holding", action="store_true", help="read holding registers instead of input registers")
+    parser.add_argument("--interval", type=float, default=0, help="poll interval in seconds, 0 reads once")
+    parser.add_argument("--count", type=int, default=0, help="number of polls, 0 polls until Ctrl+C")
+    args = parser.parse_args()
+
+    function = 0x03 if args.holding else 0x04
+    sock = socket.create_connection((args.host, args.port), timeout=5)
+    last_sequence = None
+    transaction = 0
+    try:
+        while True:
+            transaction = (transaction + 1) & 0xFFFF
+            start = time.monotonic()
+            data = read_registers(sock, transaction, args.unit, function, 0, REGISTER_COUNT)
+            elapsed = (time.monotonic() - start) * 1000
+            values = {name: struct.unpack_from(FORMATS[kind], data, address * 2)[0]
+                      for address, kind, _, name in REGISTERS}
+            if args.interval > 0:
+                sequence = values["telegramSequence"]
+                print("%.1f ms  sequence %d%s  current %.2f/%.2f/%.2f A  usage %.3f kW  predicted peak %.3f kW" % (
+                    elapsed, sequence, " (new)" if sequence != last_sequence else "", values["currentL1"],
+                    values["currentL2"], values["currentL3"], values["currentPowerUsage"], values["predictedPeak"]))
+                last_sequence = sequence
+            else:
+                for address, kind, unit, name in REGISTERS:
+                    value = values[name]
+                    text = "%.3f" % value if kind == "float32" else "%d" % value
+                    print("%3d  %-28s %12s %s" % (address, name, text, unit))
+                print("%.1f ms" % elapsed)
+            args.count -= 1
+            if args.interval <= 0 or args.count == 0:
+                break
+            time.sleep(args.interval)
+    except KeyboardInterrupt:
+        pass
+    sock.close()
+
+
+if __name__ == "__main__":
+    main()
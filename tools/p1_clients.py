@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""Connect a number of clients to the P1 passthrough server and check the telegrams they receive.
+
+Every client reads the stream and splits it into telegrams ('/' up to the '!XXXX' CRC line). The CRC of every telegram
+is checked (CRC16/ARC, like the meter), so partial or interleaved telegrams are reported. With --slow a client only
+reads every few seconds, to see the server skip telegrams for it without delaying the others. At the end the counters
+of every client and of the device (/api/system/p1-passthrough) are printed.
+
+Usage: p1_clients.py <device address> [--port <port>] [--clients <n>] [--slow <n>] [--duration <s>] [--print]
+"""
+
+import argparse
+import json
+import socket
+import threading
+import time
+import urllib.request
+
+
+def crc16(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+class Client(threading.Thread):
+    def __init__(self, host, port, slow, stop, print_telegrams):
+        super().__init__(daemon=True)
+        self.host = host
+        self.port = port
+        self.slow = slow
+        self.stop = stop
+        self.print_telegrams = print_telegrams
+        self.telegrams = 0
+        self.crc_errors = 0
+        self.error = None
+
+    def run(self):
+        buf = b""
+        try:
+            sock = socket.create_connection((self.host, self.port), timeout=15)
+            if self.slow:
+                # Keep the receive window small so the device notices the slow reader
+                sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1024)
+            while not self.stop.is_set():
+                if self.slow:
+                    time.sleep(5)
+                data = sock.recv(256 if self.slow else 4096)
+                if not data:
+                    self.error = "closed by the device"
+                    return
+                buf += data
+                while True:
+                    start = buf.find(b"/")
+                    end = buf.find(b"\r\n", buf.find(b"!", max(start, 0)))
+                    if start < 0 or end < 0:
+                        break
+                    telegram = buf[start:end + 2]
+                    buf = buf[end + 2:]
+                    self.check(telegram)
+            sock.close()
+        except OSError as e:
+            self.error = str(e)
+
+    def check(self, telegram):
+        self.telegrams += 1
+        body, _, crc = telegram.rpartition(b"!")
+        try:
+            valid = crc16(body + b"!") == int(crc.strip(), 16)
+        except ValueError:
+            valid = False
+        if not valid:
+            self.crc_errors += 1
+        if self.print_telegrams:
+            print(telegram.decode("ascii", errors="replace"))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Connect clients to the P1 passthrough server")
+    parser.add_argument("host", help="address of the device")
+    parser.add_argument("--port", type=int, default=8088, help="port (CONFIG_P1_PASSTHROUGH_PORT)")
+    parser.add_argument("--clients", type=int, default=8, help="number of clients")
+    parser.add_argument("--slow", type=int, default=0, help="number of the clients that read slowly")
+    parser.add_argument("--duration", type=float, default=30, help="test duration in seconds")
+    parser.add_argument("--print", action="store_true", help="print the telegrams of the first client")
+    args = parser.parse_args()
+
+    stop = threading.Event()
+    clients = [Client(args.host, args.port, i < args.slow, stop, args.print and i == 0) for i in range(args.clients)]
+    for client in clients:
+        client.start()
+    time.sleep(args.duration)
+    stop.set()
+
+    for i, client in enumerate(clients):
+        print("client %2d%s: %d telegrams, %d CRC errors%s" % (i, " (slow)" if client.slow else "", client.telegrams,
+                                                             client.crc_errors,
+                                                             ", " + client.error if client.error else ""))
+
+    try:
+        with urllib.request.urlopen("http://%s/api/system/p1-passthrough" % args.host, timeout=10) as response:
+            print(json.dumps(json.load(response), indent=2))
+    except OSError as e:
+        print("Failed to get the device statistics: %s" % e)
+
+
+if __name__ == "__main__":
+    main()
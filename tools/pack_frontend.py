@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Pack the frontend into an asset bundle for the www partition.
+
+The bundle is memory-mapped by the firmware (see main/asset_bundle.c), so its layout must match
+main/include/asset_bundle.h. All integers are little endian.
+
+    header      magic "KWAB", u16 version, u16 entry count, u16 hash table size (a power of two, at
+                least 2), u16 reserved, u32 bundle size
+    hash table  u16 entry index per slot (0xFFFF if empty), open addressing with linear probing on the FNV-1a
+                hash of the path
+    entries     u32 path hash, u32 path offset, u32 data offset, u32 data size, u32 data CRC32,
+                u32 gzip offset, u32 gzip size, u32 gzip CRC32 (gzip size is 0 if there is no gzip variant)
+    strings     zero terminated paths, e.g. "/index.html"
+    data        file contents and their gzip variants, 4 byte aligned
+
+Text files are gzip compressed; the compressed variant is only kept if it is noticeably smaller.
+
+Usage: pack_frontend.py <frontend dir> <output file> [--max-size <bytes>]
+"""
+
+import argparse
+import gzip
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = b"KWAB"
+VERSION = 1
+HEADER_FORMAT = "<4sHHHHI"
+ENTRY_FORMAT = "<8I"
+EMPTY_SLOT = 0xFFFF
+DATA_ALIGNMENT = 4
+COMPRESSIBLE_EXTENSIONS = {".html", ".css", ".js", ".svg", ".json", ".csv", ".txt", ".ico"}
+MIN_COMPRESSION_GAIN = 0.9      # Keep the gzip variant only if it is at most 90% of the original size
+
+
+def fnv1a(data):
+    h = 0x811C9DC5
+    for b in data:
+        h = ((h ^ b) * 0x01000193) & 0xFFFFFFFF
+    return h
+
+
+def collect_files(root):
+    files = []
+    for dir_path, dir_names, file_names in os.walk(root):
+        dir_names.sort()
+        for name in sorted(file_names):
+            # Precompressed files are generated here, stale ones in the source tree are ignored
+            if name.endswith(".gz") or name.startswith("."):
+                continue
+            full_path = os.path.join(dir_path, name)
+            url_path = "/" + os.path.relpath(full_path, root).replace(os.sep, "/")
+            with open(full_path, "rb") as f:
+                files.append((url_path, f.read()))
+    return files
+
+
+def compress(path, data):
+    if os.path.splitext(path)[1].lower() not in COMPRESSIBLE_EXTENSIONS:
+        return None
+    compressed = gzip.compress(data, compresslevel=9, mtime=0)
+    if len(compressed) > len(data) * MIN_COMPRESSION_GAIN:
+        return None
+    return compressed
+
+
+def align(value):
+    return (value + DATA_ALIGNMENT - 1) & ~(DATA_ALIGNMENT - 1)
+
+
+def pack(files):
+    if len(files) >= EMPTY_SLOT:
+        raise ValueError("too many files")
+
+    # At least two slots, so the entries that follow the table are 4 byte aligned
+    table_size = 2
+    while table_size < len(files) * 2:
+        table_size *= 2
+
+    header_size = struct.calcsize(HEADER_FORMAT)
+    entry_size = struct.calcsize(ENTRY_FORMAT)
+    strings_offset = header_size + table_size * 2 + len(files) * entry_size
+
+    strings = bytearray()
+    path_offsets = []
+    for path, _ in files:
+        path_offsets.append(strings_offset + len(strings))
+        strings += path.encode("utf-8") + b"\0"
+
+    data = bytearray()
+    data_offset = align(strings_offset + len(strings))
+    entries = []
+    table = [EMPTY_SLOT] * table_size
+    for index, (path, content) in enumerate(files):
+        path_hash = fnv1a(path.encode("utf-8"))
+        slot = path_hash & (table_size - 1)
+        while table[slot] != EMPTY_SLOT:
+            slot = (slot + 1) & (table_size - 1)
+        table[slot] = index
+
+        blobs = []
+        for blob in (content, compress(path, content)):
+            if blob is None:
+                blobs += [0, 0, 0]
+                continue
+            offset = data_offset + len(data)
+            data += blob
+            data += b"\0" * (align(len(data)) - len(data))
+            blobs += [offset, len(blob), zlib.crc32(blob)]
+
+        entries.append(struct.pack(ENTRY_FORMAT, path_hash, path_offsets[index], *blobs))
+
+    size = data_offset + len(data)
+    bundle = bytearray(struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(files), table_size, 0, size))
+    bundle += struct.pack("<%dH" % table_size, *table)
+    bundle += b"".join(entries)
+    bundle += strings
+    bundle += b"\0" * (data_offset - len(bundle))
+    bundle += data
+    return bundle
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack the frontend into an asset bundle")
+    parser.add_argument("root", help="frontend directory")
+    parser.add_argument("output", help="bundle file to write")
+    parser.add_argument("--max-size", type=lambda s: int(s, 0), help="size of the partition")
+    args = parser.parse_args()
+
+    files = collect_files(args.root)
+    bundle = pack(files)
+    if args.max_size is not None and len(bundle) > args.max_size:
+        sys.exit("Bundle is %d bytes, which does not fit in %d bytes" % (len(bundle), args.max_size))
+
+    with open(args.output, "wb") as f:
+        f.write(bundle)
+    print("Packed %d files into %s (%d bytes)" % (len(files), args.output, len(bundle)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Check the long term log ring of main/logger.c on the host, also after it wrapped around.
+
+main/logger.c is compiled with gcc against minimal FreeRTOS and ESP-IDF stubs (written to a temporary directory), and
+fed with a telegram every minute for more quarter-hours than the ring holds. After every telegram the completed
+entries (first index up to the end index) must be sorted by timestamp, must not include the quarter-hour in progress
+and logger_find_long_term_log_index() must agree with a linear search.
+
+Usage: test_logger_ring.py [--cc <compiler>] [--quarters <n>]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+MAIN_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "main")
+
+STUBS = {
+    "freertos/FreeRTOS.h": """
+#pragma once
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define vTaskDelete(task) ((void)(task))
+""",
+    "freertos/semphr.h": """
+#pragma once
+typedef void *SemaphoreHandle_t;
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) { return (SemaphoreHandle_t)1; }
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks) { return pdTRUE; }
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) { return pdTRUE; }
+""",
+    "freertos/event_groups.h": """
+#pragma once
+typedef void *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+#define BIT0 1
+static inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear,
+                                              BaseType_t all, TickType_t ticks) { return bits; }
+""",
+    "esp_system.h": "#pragma once\n",
+    "esp_log.h": """
+#pragma once
+#define ESP_LOGD(tag, ...) ((void)(tag))
+#define ESP_LOGE(tag, ...) ((void)(tag))
+""",
+    "emucs_p1.h": """
+#pragma once
+#include <time.h>
+#include "freertos/semphr.h"
+#define EMUCS_P1_TELEGRAM_INTERVAL_MS 1000
+#define EMUCS_P1_EVENT_TELEGRAM_AVAILABLE_BIT BIT0
+typedef struct {
+    time_t msg_timestamp;
+    float current_avg_demand;
+    float current_power_usage;
+    float electricity_delivered_tariff1;
+    float electricity_delivered_tariff2;
+    float electricity_returned_tariff1;
+    float electricity_returned_tariff2;
+} emucs_p1_data_t;
+static inline EventGroupHandle_t emucs_p1_get_event_group_handle(void) { return NULL; }
+static inline SemaphoreHandle_t emucs_p1_get_telegram_mutex_handle(void) { return NULL; }
+static inline emucs_p1_data_t *emucs_p1_get_telegram(void) { return NULL; }
+""",
+}
+
+DRIVER = """
+#include <stdio.h>
+#include <stdlib.h>
+#include "logger.c"
+
+static int check(time_t now) {
+    log_entry_long_term_p1_data_t items[LOGGER_LONG_TERM_LOG_BUF_SIZE];
+    uint32_t first = logger_get_long_term_log_first_index();
+    uint32_t end = logger_get_long_term_log_end_index();
+    uint32_t index = first;
+    size_t count;
+
+    if (end - first > LOGGER_LONG_TERM_LOG_BUF_SIZE - 1) {
+        printf("%lld: %u entries, the ring holds at most %d completed entries\\n", (long long)now, end - first,
+               LOGGER_LONG_TERM_LOG_BUF_SIZE - 1);
+        return 1;
+    }
+
+    count = logger_read_long_term_log_items(&index, items, LOGGER_LONG_TERM_LOG_BUF_SIZE);
+    if (count != end - first || index != end) {
+        printf("%lld: read %zu entries up to %u, expected %u up to %u\\n", (long long)now, count, index, end - first,
+               end);
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (items[i].timestamp / 900 >= now / 900) {
+            printf("%lld: entry %zu is the quarter-hour in progress\\n", (long long)now, i);
+            return 1;
+        }
+        if (i > 0 && items[i].timestamp <= items[i - 1].timestamp) {
+            printf("%lld: entry %zu isn't sorted by timestamp\\n", (long long)now, i);
+            return 1;
+        }
+    }
+
+    // The legacy copy of the whole log must return the same entries
+    if (logger_get_long_term_log_items(items, LOGGER_LONG_TERM_LOG_BUF_SIZE) != count) {
+        printf("%lld: logger_get_long_term_log_items returned a different number of entries\\n", (long long)now);
+        return 1;
+    }
+    for (size_t i = 1; i < count; i++) {
+        if (items[i].timestamp <= items[i - 1].timestamp || items[i].timestamp / 900 >= now / 900) {
+            printf("%lld: logger_get_long_term_log_items entry %zu is out of order\\n", (long long)now, i);
+            return 1;
+        }
+    }
+
+    // Search for every quarter-hour boundary around the log
+    for (uint32_t i = 0; i < count; i++) {
+        time_t timestamp = items[i].timestamp;
+        if (logger_find_long_term_log_index(timestamp) != first + i
+            || logger_find_long_term_log_index(timestamp + 1) != first + i + 1) {
+            printf("%lld: binary search for %lld doesn't find entry %u\\n", (long long)now, (long long)timestamp, i);
+            return 1;
+        }
+    }
+    if (logger_find_long_term_log_index(now) != end) {
+        printf("%lld: binary search for the quarter-hour in progress doesn't return the end index\\n", (long long)now);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int quarters = atoi(argv[1]);
+    time_t start = 1760000400;  // A quarter-hour boundary
+
+    for (time_t now = start; now < start + quarters * 900; now += 60) {
+        emucs_p1_data_t data = {.msg_timestamp = now, .electricity_delivered_tariff1 = (float)(now - start) / 1e5f};
+        log_long_term_p1_date(&data);
+        if (check(now) != 0) {
+            return 1;
+        }
+    }
+    printf("%u completed quarter-hours logged, %u kept\\n", logger_get_long_term_log_end_index(),
+           logger_get_long_term_log_end_index() - logger_get_long_term_log_first_index());
+    return 0;
+}
+"""
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check the long term log ring of the logger on the host")
+    parser.add_argument("--cc", default=os.environ.get("CC", "gcc"), help="host C compiler")
+    parser.add_argument("--quarters", type=int, default=3 * 48, help="number of quarter-hours to log")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, content in STUBS.items():
+            os.makedirs(os.path.join(tmp, os.path.dirname(name)), exist_ok=True)
+            with open(os.path.join(tmp, name), "w") as f:
+                f.write(content)
+        driver = os.path.join(tmp, "driver.c")
+        with open(driver, "w") as f:
+            f.write(DRIVER)
+        binary = os.path.join(tmp, "driver")
+        subprocess.run([args.cc, "-std=gnu17", "-Wall", "-Wno-unused-function", "-I", tmp, "-I", MAIN_DIR, "-I",
+                        os.path.join(MAIN_DIR, "include"), driver, "-o", binary], check=True)
+        result = subprocess.run([binary, str(args.quarters)])
+
+    print("OK" if result.returncode == 0 else "FAILED")
+    sys.exit(result.returncode)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Receive the telegrams the device sends to the UDP multicast group and report lost datagrams.
+
+The datagram format is described in main/include/udp_multicast.h. Raw telegrams are printed as received, telemetry
+frames are decoded (schema version 1, see main/include/telemetry_frame.h). On exit (Ctrl+C) the number of received and
+lost datagrams is printed.
+
+Usage: udp_listen.py [--group <address>] [--port <port>] [--interface <address>] [--quiet]
+"""
+
+import argparse
+import socket
+import struct
+
+HEADER = struct.Struct("<BBHII")
+FRAME_V1 = struct.Struct("<BBHIIq4fHBx3f3f3f3f3ffq")
+TYPE_RAW_TELEGRAM = 1
+TYPE_TELEMETRY_FRAME = 2
+
+
+def describe_frame(payload):
+    if len(payload) < FRAME_V1.size or payload[0] != 1:
+        return "unsupported frame (%d bytes)" % len(payload)
+    values = FRAME_V1.unpack_from(payload)
+    timestamp, usage, ret = values[5], values[13], values[14]
+    current = values[24:27]
+    return "timestamp %d, usage %.3f kW, return %.3f kW, current %.2f/%.2f/%.2f A" % ((timestamp, usage, ret) + current)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Receive the telegrams sent to the UDP multicast group")
+    parser.add_argument("--group", default="239.255.80.1", help="multicast group (CONFIG_UDP_MULTICAST_GROUP)")
+    parser.add_argument("--port", type=int, default=5810, help="port (CONFIG_UDP_MULTICAST_PORT)")
+    parser.add_argument("--interface", default="0.0.0.0", help="address of the interface to join the group on")
+    parser.add_argument("--quiet", action="store_true", help="only report lost datagrams")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", args.port))
+    membership = socket.inet_aton(args.group) + socket.inet_aton(args.interface)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+
+    received = 0
+    lost = 0
+    last_sequence = None
+    try:
+        while True:
+            data, sender = sock.recvfrom(65535)
+            if len(data) < HEADER.size:
+                print("%s: datagram too short (%d bytes)" % (sender[0], len(data)))
+                continue
+            version, payload_type, size, sequence, telegram_sequence = HEADER.unpack_from(data)
+            payload = data[HEADER.size:HEADER.size + size]
+            received += 1
+            if last_sequence is not None and sequence != (last_sequence + 1) & 0xFFFFFFFF:
+                gap = (sequence - last_sequence - 1) & 0xFFFFFFFF
+                lost += gap
+                print("%s: %d datagrams lost before %d" % (sender[0], gap, sequence))
+            last_sequence = sequence
+            if args.quiet:
+                continue
+            if payload_type == TYPE_RAW_TELEGRAM:
+                print("%s: #%d telegram %d (%d bytes)" % (sender[0], sequence, telegram_sequence, size))
+                print(payload.decode("ascii", errors="replace"))
+            elif payload_type == TYPE_TELEMETRY_FRAME:
+                print("%s: #%d telegram %d: %s" % (sender[0], sequence, telegram_sequence, describe_frame(payload)))
+            else:
+                print("%s: #%d unknown payload type %d (version %d)" % (sender[0], sequence, payload_type, version))
+    except KeyboardInterrupt:
+        pass
+    print("%d datagrams received, %d lost" % (received, lost))
+
+
+if __name__ == "__main__":
+    main()